@@ -34,11 +34,14 @@ enum class AST_Node_Type {
 	New,
 	Null,
 	Import,
+	String_Interp,
+	Struct_Decl,
 };
 
 struct AST_Node {
 	AST_Node_Type type;
 	Source_Info src_info;
+	bool temp = false; // value can't outlive the expression that reads it, see mark_temporaries
 
 	AST_Node(AST_Node_Type _type, Source_Info _src_info) :
 		type(_type), src_info(_src_info) {}
@@ -58,6 +61,17 @@ struct AST_String_Literal : public AST_Node {
 		AST_Node(AST_Node_Type::String_Literal, _src_info), str(_str) {}
 };
 
+// "text {expr} text", split by the parser. "{expr:2}" formats a number with 2 decimals.
+// parts are the text around the expressions, so there's always one more part than exprs
+struct AST_String_Interp : public AST_Node {
+	std::vector<std::string> parts;
+	std::vector<std::unique_ptr<AST_Node>> exprs;
+	std::vector<int> precisions; // per expr, -1 for the shortest exact form
+
+	AST_String_Interp(Source_Info _src_info) :
+		AST_Node(AST_Node_Type::String_Interp, _src_info) {}
+};
+
 struct AST_Unary_Op : public AST_Node {
 	std::unique_ptr<AST_Node> expr;
 	Unary_Op op;
@@ -182,6 +196,15 @@ struct AST_Class_Decl : public AST_Node {
 		AST_Node(AST_Node_Type::Class_Decl, _src_info), name(_name), parent(_parent) {}
 };
 
+// fields are Var_Decls
+struct AST_Struct_Decl : public AST_Node {
+	std::string name;
+	std::vector<std::unique_ptr<AST_Node>> fields;
+
+	AST_Struct_Decl(Source_Info _src_info, const std::string& _name) :
+		AST_Node(AST_Node_Type::Struct_Decl, _src_info), name(_name) {}
+};
+
 struct AST_Implied : public AST_Node {
 	AST_Implied(Source_Info _src_info, AST_Node_Type _type) :
 		AST_Node(_type, _src_info) {}
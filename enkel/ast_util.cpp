@@ -18,6 +18,24 @@ void print_ast(AST_Node* node, int depth) {
 		std::cout << "AST_String_Literal: \"" << sub->str << "\"\n";
 		break;
 	}
+	case AST_Node_Type::String_Interp: {
+		AST_String_Interp* sub = (AST_String_Interp*) node;
+		std::cout << "AST_String_Interp: " << sub->exprs.size() << " exprs\n";
+
+		for (auto& expr : sub->exprs) {
+			print_ast(expr.get(), depth + 1);
+		}
+		break;
+	}
+	case AST_Node_Type::Struct_Decl: {
+		AST_Struct_Decl* sub = (AST_Struct_Decl*) node;
+		std::cout << "AST_Struct_Decl: " << sub->name << "\n";
+
+		for (auto& field : sub->fields) {
+			print_ast(field.get(), depth + 1);
+		}
+		break;
+	}
 	case AST_Node_Type::Unary_Op: {
 		AST_Unary_Op* sub = (AST_Unary_Op*) node;
 		std::cout << "AST_Unary_Op\n";
@@ -141,3 +159,114 @@ void print_ast(AST_Node* node, int depth) {
 		assert(false);
 	}
 }
+
+// kinds that create a new string or array every time they're evaluated
+static bool creates_object(const AST_Node* node) {
+	switch (node->type) {
+	case AST_Node_Type::String_Literal:
+	case AST_Node_Type::String_Interp:
+	case AST_Node_Type::Array_Init:
+	case AST_Node_Type::Subscript:
+		return true;
+	case AST_Node_Type::Bin_Op:
+		return ((const AST_Bin_Op*) node)->op == Bin_Op::Add;
+	default:
+		return false;
+	}
+}
+
+static void mark_temp(std::unique_ptr<AST_Node>& node) {
+	if (node != nullptr && creates_object(node.get()))
+		node->temp = true;
+}
+
+static void mark_children(std::vector<std::unique_ptr<AST_Node>>& nodes) {
+	for (auto& node : nodes)
+		mark_temporaries(node.get());
+}
+
+void mark_temporaries(AST_Node* node) {
+	if (node == nullptr)
+		return;
+
+	switch (node->type) {
+	case AST_Node_Type::String_Interp: {
+		AST_String_Interp* sub = (AST_String_Interp*) node;
+		for (auto& expr : sub->exprs)
+			mark_temp(expr);
+		mark_children(sub->exprs);
+		break;
+	}
+	case AST_Node_Type::Struct_Decl: mark_children(((AST_Struct_Decl*) node)->fields); break;
+	case AST_Node_Type::Unary_Op: mark_temporaries(((AST_Unary_Op*) node)->expr.get()); break;
+	case AST_Node_Type::Bin_Op: {
+		AST_Bin_Op* sub = (AST_Bin_Op*) node;
+		switch (sub->op) {
+		// these only read their operands and produce a new value
+		case Bin_Op::Add:
+		case Bin_Op::Sub:
+		case Bin_Op::Mul:
+		case Bin_Op::Div:
+		case Bin_Op::Equals:
+		case Bin_Op::Not_Equals:
+		case Bin_Op::Greater_Than:
+		case Bin_Op::Greater_Than_Equals:
+		case Bin_Op::Less_Than:
+		case Bin_Op::Less_Than_Equals:
+			mark_temp(sub->left);
+			mark_temp(sub->right);
+			break;
+		default:
+			break;
+		}
+		mark_temporaries(sub->left.get());
+		mark_temporaries(sub->right.get());
+		break;
+	}
+	case AST_Node_Type::Block: mark_children(((AST_Block*) node)->statements); break;
+	case AST_Node_Type::Var_Decl: mark_temporaries(((AST_Var_Decl*) node)->init.get()); break;
+	case AST_Node_Type::Multi_Var_Decl: mark_children(((AST_Multi_Var_Decl*) node)->decls); break;
+	case AST_Node_Type::Func_Decl: mark_temporaries(((AST_Func_Decl*) node)->body.get()); break;
+	case AST_Node_Type::Return: mark_temporaries(((AST_Return*) node)->expr.get()); break;
+	case AST_Node_Type::Func_Call: {
+		AST_Func_Call* sub = (AST_Func_Call*) node;
+		mark_temporaries(sub->expr.get());
+		mark_children(sub->args);
+		break;
+	}
+	case AST_Node_Type::If: {
+		AST_If* sub = (AST_If*) node;
+		mark_temporaries(sub->condition.get());
+		mark_temporaries(sub->if_body.get());
+		mark_temporaries(sub->else_body.get());
+		break;
+	}
+	case AST_Node_Type::While: {
+		AST_While* sub = (AST_While*) node;
+		mark_temporaries(sub->condition.get());
+		mark_temporaries(sub->body.get());
+		break;
+	}
+	case AST_Node_Type::For: {
+		// the body only sees the elements
+		AST_For* sub = (AST_For*) node;
+		mark_temp(sub->expr);
+		mark_temporaries(sub->expr.get());
+		mark_temporaries(sub->body.get());
+		break;
+	}
+	case AST_Node_Type::Array_Init: mark_children(((AST_Array_Init*) node)->items); break;
+	case AST_Node_Type::Subscript: {
+		// an element or a new one-character string, never the subscripted value itself
+		AST_Subscript* sub = (AST_Subscript*) node;
+		mark_temp(sub->expr);
+		mark_temporaries(sub->expr.get());
+		mark_temporaries(sub->subscript.get());
+		break;
+	}
+	case AST_Node_Type::Class_Decl: mark_children(((AST_Class_Decl*) node)->members); break;
+	case AST_Node_Type::New: mark_children(((AST_New*) node)->args); break;
+	default:
+		break;
+	}
+}
@@ -3,3 +3,10 @@
 #include "ast.h"
 
 void print_ast(AST_Node* node, int depth = 0);
+
+// Escape analysis. Flags the strings and arrays an expression creates only for its
+// parent to read: operands of arithmetic and comparisons, {exprs} of interpolated
+// strings, subscripted values and for-in sequences. Nothing can refer to those once
+// the parent is done, so the interpreter puts them on a scratch stack instead of the heap.
+// Args of externs that borrow them are the same, but the callee is only known at runtime.
+void mark_temporaries(AST_Node* node);
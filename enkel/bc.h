@@ -1,23 +1,41 @@
 #pragma once
 
 #include "extern_func.h"
+#include "source_info.h"
 
 #include <vector>
+#include <string>
+#include <stdint.h>
 
+// operands follow the opcode, in the order of the suffixes. [a, b] -> [c] is the
+// effect on the op stack, top on the right. with BC_WIDE in front, U8 operands are
+// u16 and U16 operands are u32, U32 stays the same. see encode_bc_inst
 enum {
 	BC_EXIT = 0,
-	BC_ALLOC_FRAME_U8,
+	BC_ALLOC_FRAME_U16_U32,	// slots, slots plus the deepest the op stack gets. patched in after the body
 	BC_PUSH_VAR_U8,
 	BC_PUSH_U8,
-	BC_PUSH_F32,
+	BC_PUSH_CONST_U16,		// number from num_consts
 	BC_PUSH_TRUE,
 	BC_PUSH_FALSE,
 	BC_PUSH_NULL,
 	BC_PUSH_FUNC_REF_U32,
+	BC_PUSH_STR_U16,		// literal from str_consts, the same string every time
+	BC_PUSH_THIS,
+	BC_PUSH_GLOBAL_U16,
+	BC_PUSH_MEMBER_U16,		// field of this, by name
 	BC_POP_VAR_U8,
+	BC_POP_GLOBAL_U16,
+	BC_POP_MEMBER_U16,
 	BC_POP_DISPOSE,
-	BC_CALL,				// pops func ref value from stack
-	BC_CALL_EXTERN_U16,		// doesn't pop
+	BC_DECL_GLOBAL_U16,
+	BC_DECL_CONST_GLOBAL_U16,
+	BC_DUP,
+	BC_DUP2,				// [a, b] -> [a, b, a, b]
+	BC_CALL_U8,				// [func, args...] -> [result]
+	BC_CALL_EXTERN_U16_U8,	// [args...] -> [result], import index
+	BC_CALL_METHOD_U16_U8,	// [obj, args...] -> [result], by name
+	BC_NEW_U16_U8,			// [args...] -> [instance], class by name
 	BC_RET,
 	BC_ADD,
 	BC_SUB,
@@ -29,21 +47,116 @@ enum {
 	BC_LESS_THAN_EQUALS,
 	BC_EQUALS,
 	BC_NOT_EQUALS,
+	BC_AND,					// both sides are always evaluated, like in the interpreter
+	BC_OR,
+	BC_NEGATE,
+	BC_POSITIVE,
+	BC_NOT,
+	BC_IS_U16,				// [val] -> [bool], class by name
+	BC_GET_FIELD_U16,		// [obj] -> [val]
+	BC_SET_FIELD_U16,		// [obj, val] -> [obj], a struct comes back modified and has to be stored
+	BC_CHECK_NOT_STRUCT,	// [obj] -> [], where a modified struct can't be stored
+	BC_GET_INDEX,			// [arr, index] -> [val]
+	BC_SET_INDEX,			// [arr, index, val] -> []
+	BC_ARRAY_U16,			// [items...] -> [arr]
+	BC_STRING_INTERP_U16,	// [values...] -> [str]
+	BC_FOR_NEXT_U8_U8_U8_U32, // iterable slot, index slot, item slot, exit: jumps to exit when done
+	BC_CLASS_DECL_U16,		// [field values...] -> []
+	BC_STRUCT_DECL_U16,		// [field defaults...] -> []
 	BC_JUMP_U32,
 	BC_JUMP_IF_TRUE_U32,
 	BC_JUMP_IF_FALSE_U32,
+
+	// register forms, operands are frame slots and nothing touches the op stack.
+	// the compiler uses them for arithmetic on locals, see BC_Compiler::compile_reg_op
+	BC_MOVE_U8_U8,			// dst, src
+	BC_LOAD_CONST_U8_U16,	// dst, index in num_consts
+	BC_ADD_U8_U8_U8,		// dst, a, b
+	BC_SUB_U8_U8_U8,
+	BC_MUL_U8_U8_U8,
+	BC_DIV_U8_U8_U8,
+	BC_GREATER_THAN_U8_U8_U8,
+	BC_LESS_THAN_U8_U8_U8,
+	BC_GREATER_THAN_EQUALS_U8_U8_U8,
+	BC_LESS_THAN_EQUALS_U8_U8_U8,
+	BC_EQUALS_U8_U8_U8,
+	BC_NOT_EQUALS_U8_U8_U8,
+	BC_JUMP_IF_TRUE_U8_U32,	// slot, dest
+	BC_JUMP_IF_FALSE_U8_U32,
+
+	// superinstructions, for the sequences that came up most in BC_Profile runs
+	BC_INC_VAR_U8,			// slot, for x++ and x += 1 as statements
+	BC_DEC_VAR_U8,
+	BC_INC_GLOBAL_U16,
+	BC_DEC_GLOBAL_U16,
+	BC_ADD_VAR_VAR_U8_U8,	// slot a, slot b: [] -> [a + b]
+	BC_CALL_FUNC_U32_U8,	// func index: [args...] -> [result], PUSH_FUNC_REF and CALL
+	BC_JUMP_IF_NOT_LESS_THAN_U8_U8_U32, // slot a, slot b, dest: the comparison and JUMP_IF_FALSE_U8_U32
+	BC_JUMP_IF_NOT_LESS_THAN_EQUALS_U8_U8_U32,
+	BC_JUMP_IF_NOT_GREATER_THAN_U8_U8_U32,
+	BC_JUMP_IF_NOT_GREATER_THAN_EQUALS_U8_U8_U32,
+	BC_SET_VAR_U8,			// slot: [val] -> [val], POP_VAR and PUSH_VAR from the peephole optimizer
+
+	BC_WIDE,				// prefix, for slots past 255, indices past 65535 and numbers up to 65535
+
+	BC_NUM_OPCODES, // not an opcode
 };
 
 struct AST_Func_Decl;
+struct AST_Class_Decl;
+struct AST_Struct_Decl;
 
 struct BC_Func {
 	uint32_t entry;
+	uint32_t num_args;
 	std::string name;
 	AST_Func_Decl* node; // only used during compilation
+	bool is_method = false; // called with the caller's this
+	bool is_global = false; // declared by name when the program runs
+};
+
+struct BC_Class {
+	std::string name;
+	std::string parent;
+	std::vector<std::string> fields; // CLASS_DECL pops their values
+	std::vector<uint32_t> methods; // func indices
+	const AST_Class_Decl* node = nullptr; // for snapshots, loaded programs have none
+};
+
+struct BC_Struct {
+	std::string name;
+	std::vector<std::string> fields; // STRUCT_DECL pops their defaults
+	const AST_Struct_Decl* node = nullptr; // like in BC_Class
+};
+
+// "text {expr:2} text", the values are on the stack
+struct BC_String_Interp {
+	std::vector<std::string> parts;
+	std::vector<int> precisions;
+};
+
+// an extern func the program calls, by name
+struct BC_Import {
+	std::string name;
+	uint32_t extern_index = (uint32_t) -1; // in the host's externs, see link_bc_program
+};
+
+// the statement the code from pos on came from, up to the next one
+struct BC_Line {
+	uint32_t pos;
+	Source_Info src_info;
 };
 
 struct BC_Program {
 	std::vector<uint8_t> code;
 	std::vector<BC_Func> func_table;
-	// TODO: store string table
+	std::vector<std::string> strings; // names
+	std::vector<float> num_consts; // for PUSH_CONST and LOAD_CONST, each one once
+	std::vector<std::string> str_consts; // literals for PUSH_STR, each one once
+	std::vector<std::string> globals; // looked up by name the first time they're used
+	std::vector<BC_Class> classes;
+	std::vector<BC_Struct> structs;
+	std::vector<BC_String_Interp> interps;
+	std::vector<BC_Import> imports; // each extern CALL_EXTERN_U16_U8 calls, once
+	std::vector<BC_Line> lines; // sorted by pos, for errors
 };
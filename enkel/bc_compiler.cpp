@@ -1,335 +1,1490 @@
 #include "bc_compiler.h"
+#include "bc_optimizer.h"
+#include "bc_util.h"
 #include "ast.h"
 
 #include <iostream>
 #include <algorithm>
+#include <assert.h>
+#include <string.h>
+#include <math.h>
+
+const int MAX_HOISTED_CONSTANTS = 16;
+// slots are u16 with BC_WIDE, and ALLOC_FRAME_U16_U32 has to hold the count
+const int MAX_SLOTS = UINT16_MAX;
+
+static uint32_t f32_bits(float num) {
+	uint32_t bits;
+	memcpy(&bits, &num, sizeof(bits));
+	return bits;
+}
+
+static uint8_t bin_op_to_opcode(Bin_Op op) {
+	switch (op) {
+	case Bin_Op::Add:
+	case Bin_Op::Add_Assign:
+		return BC_ADD;
+	case Bin_Op::Sub:
+	case Bin_Op::Sub_Assign:
+		return BC_SUB;
+	case Bin_Op::Mul:
+	case Bin_Op::Mul_Assign:
+		return BC_MUL;
+	case Bin_Op::Div:
+	case Bin_Op::Div_Assign:
+		return BC_DIV;
+	case Bin_Op::Equals: return BC_EQUALS;
+	case Bin_Op::Not_Equals: return BC_NOT_EQUALS;
+	case Bin_Op::Greater_Than: return BC_GREATER_THAN;
+	case Bin_Op::Less_Than: return BC_LESS_THAN;
+	case Bin_Op::Greater_Than_Equals: return BC_GREATER_THAN_EQUALS;
+	case Bin_Op::Less_Than_Equals: return BC_LESS_THAN_EQUALS;
+	case Bin_Op::And: return BC_AND;
+	case Bin_Op::Or: return BC_OR;
+	default: break;
+	}
+
+	return BC_EXIT;
+}
+
+static uint8_t bin_op_to_reg_opcode(Bin_Op op) {
+	switch (op) {
+	case Bin_Op::Add:
+	case Bin_Op::Add_Assign:
+		return BC_ADD_U8_U8_U8;
+	case Bin_Op::Sub:
+	case Bin_Op::Sub_Assign:
+		return BC_SUB_U8_U8_U8;
+	case Bin_Op::Mul:
+	case Bin_Op::Mul_Assign:
+		return BC_MUL_U8_U8_U8;
+	case Bin_Op::Div:
+	case Bin_Op::Div_Assign:
+		return BC_DIV_U8_U8_U8;
+	case Bin_Op::Equals: return BC_EQUALS_U8_U8_U8;
+	case Bin_Op::Not_Equals: return BC_NOT_EQUALS_U8_U8_U8;
+	case Bin_Op::Greater_Than: return BC_GREATER_THAN_U8_U8_U8;
+	case Bin_Op::Less_Than: return BC_LESS_THAN_U8_U8_U8;
+	case Bin_Op::Greater_Than_Equals: return BC_GREATER_THAN_EQUALS_U8_U8_U8;
+	case Bin_Op::Less_Than_Equals: return BC_LESS_THAN_EQUALS_U8_U8_U8;
+	default: break;
+	}
+
+	return BC_EXIT;
+}
+
+// JUMP_IF_FALSE_U8_U32 on the result of a register op, for the orderings
+static uint8_t bin_op_to_cond_jump_opcode(Bin_Op op) {
+	switch (op) {
+	case Bin_Op::Less_Than: return BC_JUMP_IF_NOT_LESS_THAN_U8_U8_U32;
+	case Bin_Op::Less_Than_Equals: return BC_JUMP_IF_NOT_LESS_THAN_EQUALS_U8_U8_U32;
+	case Bin_Op::Greater_Than: return BC_JUMP_IF_NOT_GREATER_THAN_U8_U8_U32;
+	case Bin_Op::Greater_Than_Equals: return BC_JUMP_IF_NOT_GREATER_THAN_EQUALS_U8_U8_U32;
+	default: break;
+	}
+
+	return BC_EXIT;
+}
+
+static bool is_num_literal(const AST_Node* node, float num) {
+	return node->type == AST_Node_Type::Literal && ((const AST_Literal*) node)->val.type == Value_Type::Num &&
+		((const AST_Literal*) node)->val.as.num == num;
+}
 
 BC_Program BC_Compiler::compile(AST_Node* node) {
 	program = {};
+	global_funcs.clear();
+	string_indices.clear();
+	num_const_indices.clear();
+	str_const_indices.clear();
+	global_indices.clear();
+	import_indices.clear();
+	classes.clear();
+	method_classes.clear();
+
+	// the extern list may have grown since the last compile
+	extern_indices.clear();
+	for (uint32_t i = 0; i < extern_funcs.size(); i++)
+		extern_indices[extern_funcs[i].name] = i;
+
+	if (node->type != AST_Node_Type::Block) {
+		error("Expected a program", node);
+	}
+
+	// global functions can be called before they're declared
+	collect_global_funcs(node);
 
 	BC_Frame global_frame;
-	compile_node(node, global_frame);
+	global_frame.is_global = true;
 
-	output_u8(BC_EXIT);
+	uint32_t alloc_pos = begin_alloc_frame();
+	compile_statement(node, global_frame);
+	patch_alloc_frame(alloc_pos, global_frame);
 
-	// generate functions
-	for (int i = 0; i < program.func_table.size(); i++) {
-		BC_Func& func = program.func_table[i];
+	emit(BC_EXIT);
 
-		func.entry = program.code.size();
+	// methods and nested functions get added while compiling
+	for (uint32_t i = 0; i < program.func_table.size(); i++)
+		compile_func(i);
 
-		uint32_t num_vars_backpatch;
-		output_u8(BC_ALLOC_FRAME_U8);
-		num_vars_backpatch = program.code.size();
-		output_u8((uint8_t) -1);
+	if (optimize)
+		optimize_bc_program(program);
 
-		BC_Frame func_frame;
+	return std::move(program);
+}
+
+// blocks share their parent's scope, so functions inside top-level blocks are global too
+void BC_Compiler::collect_global_funcs(AST_Node* node) {
+	for (auto& statement : ((AST_Block*) node)->statements) {
+		switch (statement->type) {
+		case AST_Node_Type::Block:
+			collect_global_funcs(statement.get());
+			break;
+		case AST_Node_Type::Func_Decl: {
+			AST_Func_Decl* func = (AST_Func_Decl*) statement.get();
+			if (global_funcs.count(func->name) || find_extern(func->name) >= 0) {
+				error("Conflicting function name: " + func->name, func);
+			}
+
+			add_func(func, true, false);
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
+
+uint32_t BC_Compiler::add_func(AST_Func_Decl* node, bool is_global, bool is_method) {
+	BC_Func func;
+	func.entry = (uint32_t) -1;
+	func.num_args = (uint32_t) node->args.size();
+	func.name = node->name;
+	func.node = node;
+	func.is_method = is_method;
+	func.is_global = is_global;
+
+	uint32_t index = program.func_table.size();
+	program.func_table.push_back(func);
+
+	if (is_global)
+		global_funcs[node->name] = index;
+	return index;
+}
+
+void BC_Compiler::compile_func(uint32_t func_index) {
+	// func_table can grow while compiling, don't keep references into it
+	AST_Func_Decl* node = program.func_table[func_index].node;
+	program.func_table[func_index].entry = program.code.size();
+
+	uint32_t alloc_pos = begin_alloc_frame();
+
+	BC_Frame frame;
+	auto class_it = method_classes.find(func_index);
+	if (class_it != method_classes.end())
+		frame.class_name = class_it->second;
+
+	if (node->args.size() > MAX_SLOTS) {
+		error("Too many arguments", node);
+	}
+
+	for (const auto& arg : node->args) {
+		frame.locals.push_back({arg.name, (uint16_t) frame.next_slot, false});
+		frame.next_slot++;
+	}
+	frame.num_slots = frame.next_slot;
+
+	// the caller leaves the args where the first slots are, nothing to copy
+	compile_statement(node->body.get(), frame);
+
+	emit(BC_PUSH_NULL);
+	emit(BC_RET);
+	patch_alloc_frame(alloc_pos, frame);
+}
+
+// statements leave the op stack as they found it
+void BC_Compiler::compile_statement(AST_Node* node, BC_Frame& frame) {
+	if (node->type != AST_Node_Type::Block)
+		mark_line(node);
+
+	switch (node->type) {
+	case AST_Node_Type::Block:
+		for (auto& statement : ((AST_Block*) node)->statements)
+			compile_statement(statement.get(), frame);
+		return;
+	case AST_Node_Type::Var_Decl:
+		compile_var_decl((AST_Var_Decl*) node, frame);
+		return;
+	case AST_Node_Type::Multi_Var_Decl:
+		for (auto& decl : ((AST_Multi_Var_Decl*) node)->decls)
+			compile_var_decl((AST_Var_Decl*) decl.get(), frame);
+		return;
+	case AST_Node_Type::Func_Decl: {
+		AST_Func_Decl* sub = (AST_Func_Decl*) node;
+
+		// declared by run(), see collect_global_funcs
+		if (frame.is_global && frame.depth == 0)
+			return;
+
+		// nested functions are locals holding a function ref. the body is compiled
+		// later, and like in the interpreter it can't see the enclosing locals
+		uint32_t func_index = add_func(sub, false, !sub->is_global);
+		emit(BC_PUSH_FUNC_REF_U32, func_index);
+		emit(BC_POP_VAR_U8, declare_local(sub->name, true, frame, node));
+		return;
+	}
+	case AST_Node_Type::Class_Decl:
+		compile_class_decl((AST_Class_Decl*) node, frame);
+		return;
+	case AST_Node_Type::Struct_Decl:
+		compile_struct_decl((AST_Struct_Decl*) node, frame);
+		return;
+	case AST_Node_Type::If:
+		compile_if((AST_If*) node, frame);
+		return;
+	case AST_Node_Type::While:
+		compile_while((AST_While*) node, frame);
+		return;
+	case AST_Node_Type::For:
+		compile_for((AST_For*) node, frame);
+		return;
+	case AST_Node_Type::Return: {
+		AST_Return* sub = (AST_Return*) node;
 
-		// pop args in reverse order
-		for (int j = 0; j < func.node->args.size(); j++) {
-			const Definition& arg_def = func.node->args[j];
+		if (sub->expr != nullptr) {
+			compile_expr(sub->expr.get(), frame);
+		} else {
+			emit(BC_PUSH_NULL);
+		}
 
-			int var_index = func_frame.vars.size();
-			func_frame.vars.push_back(arg_def.name);
+		// returning from the top level ends the program
+		if (frame.is_global) {
+			emit(BC_POP_DISPOSE);
+			emit(BC_EXIT);
+			return;
+		}
 
-			output_u8(BC_POP_VAR_U8);
-			output_u8(func.node->args.size() - 1 - j);
+		emit(BC_RET);
+		return;
+	}
+	case AST_Node_Type::Break: {
+		if (frame.loops.empty()) {
+			error("break outside of a loop", node);
 		}
 
-		compile_node(func.node->body.get(), func_frame);
-		
-		// backpatch number of local vars
-		write_u8_at(func_frame.vars.size(), num_vars_backpatch);
+		uint32_t patch_addr;
+		emit_jump(BC_JUMP_U32, patch_addr);
+		frame.loops.back().break_patches.push_back(patch_addr);
+		return;
+	}
+	case AST_Node_Type::Continue:
+		if (frame.loops.empty()) {
+			error("continue outside of a loop", node);
+		}
 
-		output_u8(BC_PUSH_NULL);
-		output_u8(BC_RET);
+		emit(BC_JUMP_U32, frame.loops.back().continue_addr);
+		return;
+	case AST_Node_Type::Unary_Op: {
+		AST_Unary_Op* sub = (AST_Unary_Op*) node;
+		if (sub->op == Unary_Op::Increment || sub->op == Unary_Op::Decrement) {
+			Bin_Op op = sub->op == Unary_Op::Increment ? Bin_Op::Add : Bin_Op::Sub;
+			compile_update(get_lvalue(sub->expr.get(), frame), op, nullptr, false, frame, node);
+			return;
+		}
+		break;
+	}
+	case AST_Node_Type::Bin_Op: {
+		AST_Bin_Op* sub = (AST_Bin_Op*) node;
+		switch (sub->op) {
+		case Bin_Op::Assign:
+		case Bin_Op::Add_Assign:
+		case Bin_Op::Sub_Assign:
+		case Bin_Op::Mul_Assign:
+		case Bin_Op::Div_Assign:
+			compile_update(get_lvalue(sub->left.get(), frame), sub->op, sub->right.get(), false, frame, node);
+			return;
+		case Bin_Op::Dot:
+			compile_dot(sub, frame, false);
+			return;
+		default:
+			break;
+		}
+		break;
+	}
+	case AST_Node_Type::Import:
+		error("Unhandled node type", node);
+		return;
+	default:
+		break;
 	}
 
-	return program;
+	compile_expr(node, frame);
+	emit(BC_POP_DISPOSE);
 }
 
-void BC_Compiler::compile_node(AST_Node* node, BC_Frame& frame) {
+// pushes exactly one value
+void BC_Compiler::compile_expr(AST_Node* node, BC_Frame& frame) {
 	switch (node->type) {
 	case AST_Node_Type::Literal: {
 		AST_Literal* sub = (AST_Literal*) node;
 		switch (sub->val.type) {
-		case Value_Type::Num: {
-			float num = sub->val.as.num;
-			if (floorf(num) == num && num > 0 && num < 256) {
-				output_u8(BC_PUSH_U8);
-				output_u8((uint8_t) num);
-				break;
-			}
-
-			output_u8(BC_PUSH_F32);
-			output_f32(num);
-			break;
-		}
+		case Value_Type::Num:
+			compile_num(sub->val.as.num);
+			return;
 		case Value_Type::Bool:
-			output_u8(sub->val.as._bool ? BC_PUSH_TRUE : BC_PUSH_FALSE);
-			break;
+			emit(sub->val.as._bool ? BC_PUSH_TRUE : BC_PUSH_FALSE);
+			return;
 		default:
-			error("unhandled value type");
+			break;
 		}
 
+		error("Unhandled value type", node);
+		return;
+	}
+	case AST_Node_Type::String_Literal:
+		emit(BC_PUSH_STR_U16, add_str_const(((AST_String_Literal*) node)->str));
+		return;
+	case AST_Node_Type::String_Interp:
+		compile_string_interp((AST_String_Interp*) node, frame);
+		return;
+	case AST_Node_Type::Unary_Op: {
+		AST_Unary_Op* sub = (AST_Unary_Op*) node;
+
+		switch (sub->op) {
+		case Unary_Op::Increment:
+		case Unary_Op::Decrement: {
+			Bin_Op op = sub->op == Unary_Op::Increment ? Bin_Op::Add : Bin_Op::Sub;
+			compile_update(get_lvalue(sub->expr.get(), frame), op, nullptr, true, frame, node);
+			return;
+		}
+		case Unary_Op::Not:
+			compile_expr(sub->expr.get(), frame);
+			emit(BC_NOT);
+			return;
+		case Unary_Op::Positive:
+			compile_expr(sub->expr.get(), frame);
+			emit(BC_POSITIVE);
+			return;
+		case Unary_Op::Negate:
+			compile_expr(sub->expr.get(), frame);
+			emit(BC_NEGATE);
+			return;
+		}
+
+		error("Unhandled unary operator", node);
 		return;
 	}
 	case AST_Node_Type::Bin_Op: {
 		AST_Bin_Op* sub = (AST_Bin_Op*) node;
 
-		if (sub->op == Bin_Op::Assign) {
-			compile_node(sub->right.get(), frame);
-
-			if (sub->left->type != AST_Node_Type::Var) {
-				error("not implemented yet, sorry.");
+		switch (sub->op) {
+		case Bin_Op::Assign:
+		case Bin_Op::Add_Assign:
+		case Bin_Op::Sub_Assign:
+		case Bin_Op::Mul_Assign:
+		case Bin_Op::Div_Assign:
+			compile_update(get_lvalue(sub->left.get(), frame), sub->op, sub->right.get(), true, frame, node);
+			return;
+		case Bin_Op::Dot:
+			compile_dot(sub, frame, true);
+			return;
+		case Bin_Op::Is:
+			if (sub->right->type != AST_Node_Type::Var) {
+				error("Expected type name", node);
 			}
 
-			int var_index = find_var_index(((AST_Var*) sub->left.get())->name, frame);
-
-			output_u8(BC_POP_VAR_U8);
-			output_u8(var_index);
+			compile_expr(sub->left.get(), frame);
+			emit(BC_IS_U16, add_string(((AST_Var*) sub->right.get())->name));
 			return;
+		default:
+			break;
 		}
 
-		if (sub->op == Bin_Op::Add_Assign) {
-			if (sub->left->type != AST_Node_Type::Var) {
-				error("not implemented yet, sorry.");
-			}
-			int var_index = find_var_index(((AST_Var*) sub->left.get())->name, frame);
+		uint8_t opcode = bin_op_to_opcode(sub->op);
+		if (opcode == BC_EXIT) {
+			error("Unhandled binary operator", node);
+		}
 
-			output_u8(BC_PUSH_VAR_U8);
-			output_u8(var_index);
+		// a + b on two locals, as in return a + b or f(a + b)
+		if (superinstructions && sub->op == Bin_Op::Add && sub->left->type == AST_Node_Type::Var && sub->right->type == AST_Node_Type::Var) {
+			Name left = resolve(((AST_Var*) sub->left.get())->name, frame);
+			Name right = resolve(((AST_Var*) sub->right.get())->name, frame);
+			if (left.kind == Name_Kind::Local && right.kind == Name_Kind::Local) {
+				emit(BC_ADD_VAR_VAR_U8_U8, left.index, right.index);
+				return;
+			}
+		}
 
-			compile_node(sub->right.get(), frame);
+		// and/or don't short circuit, same as the interpreter
+		compile_expr(sub->left.get(), frame);
+		compile_expr(sub->right.get(), frame);
+		emit(opcode);
+		return;
+	}
+	case AST_Node_Type::Var:
+		push_name(resolve(((AST_Var*) node)->name, frame));
+		return;
+	case AST_Node_Type::Func_Call:
+		compile_call((AST_Func_Call*) node, frame);
+		return;
+	case AST_Node_Type::Array_Init: {
+		AST_Array_Init* sub = (AST_Array_Init*) node;
+		for (auto& item : sub->items)
+			compile_expr(item.get(), frame);
 
-			// TODO: maybe add separate instructions for these ops
-			output_u8(BC_ADD);
-			output_u8(BC_POP_VAR_U8);
-			output_u8(var_index);
-			return;
+		emit(BC_ARRAY_U16, sub->items.size());
+		return;
+	}
+	case AST_Node_Type::Subscript: {
+		AST_Subscript* sub = (AST_Subscript*) node;
+		compile_expr(sub->expr.get(), frame);
+		compile_expr(sub->subscript.get(), frame);
+		emit(BC_GET_INDEX);
+		return;
+	}
+	case AST_Node_Type::New: {
+		AST_New* sub = (AST_New*) node;
+		if (sub->args.size() > MAX_SLOTS) {
+			error("Too many arguments", node);
 		}
-		
-		compile_node(sub->left.get(), frame);
-		compile_node(sub->right.get(), frame);
-
-		auto bin_op_to_opcode = [this](Bin_Op op) {
-			switch (op) {
-			case Bin_Op::Add: return BC_ADD;
-			case Bin_Op::Sub: return BC_SUB;
-			case Bin_Op::Mul: return BC_MUL;
-			case Bin_Op::Div: return BC_DIV;
-			case Bin_Op::Equals: return BC_EQUALS;
-			case Bin_Op::Not_Equals: return BC_NOT_EQUALS;
-			case Bin_Op::Greater_Than: return BC_GREATER_THAN;
-			case Bin_Op::Less_Than: return BC_LESS_THAN;
-			case Bin_Op::Greater_Than_Equals: return BC_GREATER_THAN_EQUALS;
-			case Bin_Op::Less_Than_Equals: return BC_LESS_THAN_EQUALS;
-			}
 
-			error("unhandled binary op type");
-		};
+		for (auto& arg : sub->args)
+			compile_expr(arg.get(), frame);
 
-		output_u8(bin_op_to_opcode(sub->op));
+		emit(BC_NEW_U16_U8, add_string(sub->name), sub->args.size());
 		return;
 	}
-	case AST_Node_Type::Block: {
-		AST_Block* sub = (AST_Block*) node;
+	case AST_Node_Type::This:
+		emit(BC_PUSH_THIS);
+		return;
+	case AST_Node_Type::Null:
+		emit(BC_PUSH_NULL);
+		return;
+	default:
+		break;
+	}
+
+	error("Unhandled node type", node);
+}
 
-		uint32_t num_vars_backpatch;
-		if (sub->is_global_scope) {
-			output_u8(BC_ALLOC_FRAME_U8);
-			num_vars_backpatch = program.code.size();
-			output_u8((uint8_t) -1);
+// a.b, a.b(), a.b[i], a.b++
+void BC_Compiler::compile_dot(AST_Bin_Op* node, BC_Frame& frame, bool keep_value) {
+	AST_Node* right = node->right.get();
+
+	switch (right->type) {
+	case AST_Node_Type::Var:
+		compile_expr(node->left.get(), frame);
+		emit(BC_GET_FIELD_U16, add_string(((AST_Var*) right)->name));
+		break;
+	case AST_Node_Type::Func_Call: {
+		AST_Func_Call* call = (AST_Func_Call*) right;
+		if (call->expr->type != AST_Node_Type::Var) {
+			error("Expected a method name", node);
+		}
+		if (call->args.size() > MAX_SLOTS) {
+			error("Too many arguments", node);
+		}
+
+		compile_expr(node->left.get(), frame);
+		for (auto& arg : call->args)
+			compile_expr(arg.get(), frame);
+
+		emit(BC_CALL_METHOD_U16_U8, add_string(((AST_Var*) call->expr.get())->name), call->args.size());
+		break;
+	}
+	case AST_Node_Type::Subscript: {
+		AST_Subscript* sub = (AST_Subscript*) right;
+		if (sub->expr->type != AST_Node_Type::Var) {
+			error("Expected a field name", node);
 		}
 
-		for (auto& statement : sub->statements) {
-			compile_node(statement.get(), frame);
+		compile_expr(node->left.get(), frame);
+		emit(BC_GET_FIELD_U16, add_string(((AST_Var*) sub->expr.get())->name));
+		compile_expr(sub->subscript.get(), frame);
+		emit(BC_GET_INDEX);
+		break;
+	}
+	case AST_Node_Type::Unary_Op: {
+		AST_Unary_Op* postfix = (AST_Unary_Op*) right;
+		if (postfix->op != Unary_Op::Increment && postfix->op != Unary_Op::Decrement) {
+			error("Expected a field name", node);
+		}
+
+		Bin_Op op = postfix->op == Unary_Op::Increment ? Bin_Op::Add : Bin_Op::Sub;
+		compile_update(get_lvalue(node, frame), op, nullptr, keep_value, frame, node);
+		return;
+	}
+	default:
+		error("Expected a field or method name", node);
+		return;
+	}
+
+	if (!keep_value)
+		emit(BC_POP_DISPOSE);
+}
+
+void BC_Compiler::compile_call(AST_Func_Call* node, BC_Frame& frame) {
+	if (node->args.size() > MAX_SLOTS) {
+		error("Too many arguments", node);
+	}
+
+	if (node->expr->type == AST_Node_Type::Var) {
+		Name name = resolve(((AST_Var*) node->expr.get())->name, frame);
 
-			if (statement->type == AST_Node_Type::Func_Call) {
-				output_u8(BC_POP_DISPOSE);
+		if (name.kind == Name_Kind::Extern) {
+			if ((int) node->args.size() < extern_funcs[name.index].min_args) {
+				error("Too few arguments", node);
 			}
+
+			for (auto& arg : node->args)
+				compile_expr(arg.get(), frame);
+
+			emit(BC_CALL_EXTERN_U16_U8, add_import(name.index), node->args.size());
+			return;
 		}
 
-		if (sub->is_global_scope) {
-			write_u8_at(frame.vars.size(), num_vars_backpatch);
+		// the count is checked when loading, a wrong one has to be an error once the call runs
+		if (superinstructions && name.kind == Name_Kind::Func && node->args.size() == program.func_table[name.index].num_args) {
+			for (auto& arg : node->args)
+				compile_expr(arg.get(), frame);
+
+			emit(BC_CALL_FUNC_U32_U8, name.index, node->args.size());
+			return;
 		}
 
+		// members are called with this, same as in the interpreter
+		push_name(name);
+	} else {
+		compile_expr(node->expr.get(), frame);
+	}
+
+	for (auto& arg : node->args)
+		compile_expr(arg.get(), frame);
+
+	emit(BC_CALL_U8, node->args.size());
+}
+
+void BC_Compiler::compile_if(AST_If* node, BC_Frame& frame) {
+	uint32_t else_patch;
+	compile_cond_jump(node->condition.get(), else_patch, frame);
+
+	size_t num_locals;
+	int next_slot;
+	begin_scope(frame, num_locals, next_slot);
+	compile_statement(node->if_body.get(), frame);
+	end_scope(frame, num_locals, next_slot);
+
+	if (node->else_body == nullptr) {
+		patch_jump(else_patch);
 		return;
 	}
-	case AST_Node_Type::Func_Decl: {
-		// function bodies are generated at the end, so just store the ref here
-		
-		AST_Func_Decl* sub = (AST_Func_Decl*) node;
 
-		BC_Func func = {0};
-		func.entry = (uint32_t) -1;
-		func.name = sub->name;
-		func.node = sub;
+	uint32_t end_patch;
+	emit_jump(BC_JUMP_U32, end_patch);
+	patch_jump(else_patch);
+
+	begin_scope(frame, num_locals, next_slot);
+	compile_statement(node->else_body.get(), frame);
+	end_scope(frame, num_locals, next_slot);
+
+	patch_jump(end_patch);
+}
+
+void BC_Compiler::compile_while(AST_While* node, BC_Frame& frame) {
+	size_t num_constants = frame.constants.size();
+	int const_slot = frame.next_slot;
+	hoist_constants(node, frame);
+
+	uint32_t loop_addr = program.code.size();
+
+	uint32_t exit_patch;
+	compile_cond_jump(node->condition.get(), exit_patch, frame);
+
+	frame.loops.push_back({loop_addr});
+
+	size_t num_locals;
+	int next_slot;
+	begin_scope(frame, num_locals, next_slot);
+	compile_statement(node->body.get(), frame);
+	end_scope(frame, num_locals, next_slot);
+
+	emit(BC_JUMP_U32, loop_addr);
+
+	patch_jump(exit_patch);
+	for (uint32_t patch_addr : frame.loops.back().break_patches)
+		patch_jump(patch_addr);
+	frame.loops.pop_back();
+
+	frame.constants.resize(num_constants);
+	frame.next_slot = const_slot;
+}
+
+// the iterable and the index live in hidden locals, FOR_NEXT pushes the next item
+void BC_Compiler::compile_for(AST_For* node, BC_Frame& frame) {
+	size_t num_locals;
+	int next_slot;
+	begin_scope(frame, num_locals, next_slot);
+
+	size_t num_constants = frame.constants.size();
+	hoist_constants(node->body.get(), frame);
+
+	compile_expr(node->expr.get(), frame);
+	uint16_t iterable_slot = alloc_temp(frame, node);
+	uint16_t index_slot = alloc_temp(frame, node);
+	frame.locals.push_back({node->var_name, (uint16_t) frame.next_slot, false});
+	uint16_t var_slot = alloc_temp(frame, node);
+
+	emit(BC_POP_VAR_U8, iterable_slot);
+	emit(BC_PUSH_U8, 0);
+	emit(BC_POP_VAR_U8, index_slot);
+
+	uint32_t loop_addr = program.code.size();
+	emit(BC_FOR_NEXT_U8_U8_U8_U32, iterable_slot, index_slot, var_slot, (uint32_t) -1);
+	uint32_t exit_patch = program.code.size() - 4;
+
+	frame.loops.push_back({loop_addr});
+	compile_statement(node->body.get(), frame);
 
-		uint16_t func_index = program.func_table.size();
-		program.func_table.push_back(func);
+	emit(BC_JUMP_U32, loop_addr);
 
+	patch_jump(exit_patch);
+	for (uint32_t patch_addr : frame.loops.back().break_patches)
+		patch_jump(patch_addr);
+	frame.loops.pop_back();
+
+	frame.constants.resize(num_constants);
+	end_scope(frame, num_locals, next_slot);
+}
+
+void BC_Compiler::compile_var_decl(AST_Var_Decl* node, BC_Frame& frame) {
+	bool is_local = !frame.is_global || frame.depth > 0;
+
+	// the local isn't visible to its own initializer, so its slot is only reserved
+	if (is_local && is_reg_op(node->init.get())) {
+		uint16_t slot = alloc_temp(frame, node);
+		compile_reg_op((AST_Bin_Op*) node->init.get(), slot, frame);
+		declare_local(node->name, node->is_const, frame, node, slot);
 		return;
 	}
-	case AST_Node_Type::Var_Decl: {
-		AST_Var_Decl* sub = (AST_Var_Decl*) node;
 
-		int index = frame.vars.size();
-		frame.vars.push_back(sub->name);
+	if (node->init != nullptr) {
+		compile_expr(node->init.get(), frame);
+	} else {
+		emit(BC_PUSH_NULL);
+	}
 
-		if (sub->init != nullptr) {
-			compile_node(sub->init.get(), frame);
-			
-			output_u8(BC_POP_VAR_U8);
-			output_u8(index);
-			return;
-		}
-		
+	if (!is_local) {
+		emit(node->is_const ? BC_DECL_CONST_GLOBAL_U16 : BC_DECL_GLOBAL_U16, add_global(node->name));
 		return;
 	}
-	case AST_Node_Type::Var: {
-		AST_Var* sub = (AST_Var*) node;
 
-		for (int i = 0; i < program.func_table.size(); i++) {
-			const BC_Func& func = program.func_table[i];
+	emit(BC_POP_VAR_U8, declare_local(node->name, node->is_const, frame, node));
+}
 
-			if (func.name == sub->name) {
-				output_u8(BC_PUSH_FUNC_REF_U32);
-				output_u32(i);
-				return;
+// field values are evaluated here, methods become functions that are called with this
+void BC_Compiler::compile_class_decl(AST_Class_Decl* node, BC_Frame& frame) {
+	BC_Class bc_class;
+	bc_class.name = node->name;
+	bc_class.parent = node->parent;
+	bc_class.node = node;
+
+	Class_Info info;
+	info.parent = node->parent;
+
+	for (auto& member : node->members) {
+		if (member->type == AST_Node_Type::Var_Decl) {
+			AST_Var_Decl* field = (AST_Var_Decl*) member.get();
+
+			if (field->init != nullptr) {
+				compile_expr(field->init.get(), frame);
+			} else {
+				emit(BC_PUSH_NULL);
 			}
+
+			bc_class.fields.push_back(field->name);
+			info.members.push_back(field->name);
+		} else if (member->type == AST_Node_Type::Func_Decl) {
+			AST_Func_Decl* method = (AST_Func_Decl*) member.get();
+
+			uint32_t func_index = add_func(method, false, true);
+			method_classes[func_index] = node->name;
+
+			bc_class.methods.push_back(func_index);
+			info.members.push_back(method->name);
+		} else {
+			error("Unexpected class member", member.get());
 		}
+	}
+
+	classes[node->name] = std::move(info);
 
-		int index = find_var_index(sub->name, frame);
+	// before the emit, which looks up how many fields it pops
+	program.classes.push_back(std::move(bc_class));
+	emit(BC_CLASS_DECL_U16, (uint32_t) program.classes.size() - 1);
+}
 
-		output_u8(BC_PUSH_VAR_U8);
-		output_u8(index);
+void BC_Compiler::compile_struct_decl(AST_Struct_Decl* node, BC_Frame& frame) {
+	if (node->fields.size() > MAX_STRUCT_FIELDS) {
+		error("Structs can have at most " + std::to_string(MAX_STRUCT_FIELDS) + " fields", node);
+	}
+
+	BC_Struct bc_struct;
+	bc_struct.name = node->name;
+	bc_struct.node = node;
+
+	for (auto& member : node->fields) {
+		AST_Var_Decl* field = (AST_Var_Decl*) member.get();
+		if (std::find(bc_struct.fields.begin(), bc_struct.fields.end(), field->name) != bc_struct.fields.end()) {
+			error("Duplicate field name: " + field->name, field);
+		}
+
+		if (field->init != nullptr) {
+			compile_expr(field->init.get(), frame);
+		} else {
+			emit(BC_PUSH_U8, 0);
+		}
+
+		bc_struct.fields.push_back(field->name);
+	}
+
+	program.structs.push_back(std::move(bc_struct));
+	emit(BC_STRUCT_DECL_U16, (uint32_t) program.structs.size() - 1);
+}
+
+void BC_Compiler::compile_string_interp(AST_String_Interp* node, BC_Frame& frame) {
+	for (auto& expr : node->exprs)
+		compile_expr(expr.get(), frame);
+
+	program.interps.push_back({node->parts, node->precisions});
+	emit(BC_STRING_INTERP_U16, (uint32_t) program.interps.size() - 1);
+}
+
+void BC_Compiler::compile_num(float num) {
+	// wide past 255
+	if (floorf(num) == num && num >= 0 && num <= UINT16_MAX && !signbit(num)) {
+		emit(BC_PUSH_U8, (uint32_t) num);
 		return;
 	}
-	case AST_Node_Type::If: {
-		AST_If* sub = (AST_If*) node;
 
-		if (sub->else_body != nullptr) {
-			error("not implemented yet");
+	emit(BC_PUSH_CONST_U16, add_num_const(num));
+}
+
+void BC_Compiler::compile_cond_jump(AST_Node* condition, uint32_t& patch_addr, BC_Frame& frame) {
+	if (!is_reg_op(condition)) {
+		compile_expr(condition, frame);
+		emit_jump(BC_JUMP_IF_FALSE_U32, patch_addr);
+		return;
+	}
+
+	AST_Bin_Op* sub = (AST_Bin_Op*) condition;
+	uint8_t opcode = bin_op_to_cond_jump_opcode(sub->op);
+	if (superinstructions && opcode != BC_EXIT) {
+		int next_slot = frame.next_slot;
+		uint16_t a = compile_to_slot(sub->left.get(), !may_assign(sub->right.get()), frame);
+		uint16_t b = compile_to_slot(sub->right.get(), true, frame);
+		frame.next_slot = next_slot;
+
+		emit(opcode, a, b, (uint32_t) -1);
+		patch_addr = program.code.size() - 4;
+		return;
+	}
+
+	uint16_t temp = alloc_temp(frame, condition);
+	compile_reg_op(sub, temp, frame);
+	frame.next_slot--;
+
+	emit(BC_JUMP_IF_FALSE_U8_U32, temp, (uint32_t) -1);
+	patch_addr = program.code.size() - 4;
+}
+
+bool BC_Compiler::is_reg_op(const AST_Node* node) const {
+	return register_ops && node != nullptr && node->type == AST_Node_Type::Bin_Op &&
+		((const AST_Bin_Op*) node)->op != Bin_Op::Add_Assign && // compound assignments are expressions too
+		((const AST_Bin_Op*) node)->op != Bin_Op::Sub_Assign &&
+		((const AST_Bin_Op*) node)->op != Bin_Op::Mul_Assign &&
+		((const AST_Bin_Op*) node)->op != Bin_Op::Div_Assign &&
+		bin_op_to_reg_opcode(((const AST_Bin_Op*) node)->op) != BC_EXIT;
+}
+
+// whether evaluating node could change a local. a local operand on the left is
+// only read when the op runs, so it has to be copied first if the right side can
+bool BC_Compiler::may_assign(const AST_Node* node) const {
+	switch (node->type) {
+	case AST_Node_Type::Literal:
+	case AST_Node_Type::String_Literal:
+	case AST_Node_Type::Var:
+	case AST_Node_Type::This:
+	case AST_Node_Type::Null:
+		return false;
+	case AST_Node_Type::Unary_Op: {
+		const AST_Unary_Op* sub = (const AST_Unary_Op*) node;
+		if (sub->op == Unary_Op::Increment || sub->op == Unary_Op::Decrement)
+			return true;
+		return may_assign(sub->expr.get());
+	}
+	case AST_Node_Type::Bin_Op: {
+		const AST_Bin_Op* sub = (const AST_Bin_Op*) node;
+		if (sub->op != Bin_Op::Dot && !is_reg_op(node) && sub->op != Bin_Op::And && sub->op != Bin_Op::Or)
+			return true;
+		return may_assign(sub->left.get()) || may_assign(sub->right.get());
+	}
+	case AST_Node_Type::Func_Call: {
+		// the callee can't see the caller's locals
+		const AST_Func_Call* sub = (const AST_Func_Call*) node;
+		if (may_assign(sub->expr.get()))
+			return true;
+		for (const auto& arg : sub->args) {
+			if (may_assign(arg.get()))
+				return true;
 		}
+		return false;
+	}
+	case AST_Node_Type::Subscript: {
+		const AST_Subscript* sub = (const AST_Subscript*) node;
+		return may_assign(sub->expr.get()) || may_assign(sub->subscript.get());
+	}
+	default:
+		return true;
+	}
+}
+
+void BC_Compiler::compile_reg_op(AST_Bin_Op* node, uint16_t dst, BC_Frame& frame) {
+	int next_slot = frame.next_slot;
+
+	uint16_t a = compile_to_slot(node->left.get(), !may_assign(node->right.get()), frame);
+	uint16_t b = compile_to_slot(node->right.get(), true, frame);
+
+	emit(bin_op_to_reg_opcode(node->op), dst, a, b);
+
+	frame.next_slot = next_slot;
+}
 
-		compile_node(sub->condition.get(), frame);
-		output_u8(BC_JUMP_IF_FALSE_U32);
-		uint32_t skip_patch_addr = program.code.size();
-		output_u32((uint32_t) -1);
+uint16_t BC_Compiler::compile_to_slot(AST_Node* node, bool borrow, BC_Frame& frame) {
+	Name name{Name_Kind::Global};
+	if (node->type == AST_Node_Type::Var)
+		name = resolve(((AST_Var*) node)->name, frame);
+
+	if (borrow && name.kind == Name_Kind::Local)
+		return (uint16_t) name.index;
+
+	bool is_num = node->type == AST_Node_Type::Literal && ((AST_Literal*) node)->val.type == Value_Type::Num;
+	if (is_num && find_constant(((AST_Literal*) node)->val.as.num, frame) >= 0)
+		return (uint16_t) find_constant(((AST_Literal*) node)->val.as.num, frame);
+
+	uint16_t temp = alloc_temp(frame, node);
+
+	if (name.kind == Name_Kind::Local) {
+		emit(BC_MOVE_U8_U8, temp, name.index);
+	} else if (is_reg_op(node)) {
+		compile_reg_op((AST_Bin_Op*) node, temp, frame);
+	} else if (is_num) {
+		emit(BC_LOAD_CONST_U8_U16, temp, add_num_const(((AST_Literal*) node)->val.as.num));
+	} else {
+		compile_expr(node, frame);
+		emit(BC_POP_VAR_U8, temp);
+	}
 
-		compile_node(sub->if_body.get(), frame);
+	return temp;
+}
 
-		// backpatch skip label addr
-		write_u32_at(program.code.size(), skip_patch_addr);
+// walks the statements like compile_statement does, nested functions and classes
+// get compiled separately
+void BC_Compiler::hoist_constants(AST_Node* node, BC_Frame& frame) {
+	if (node == nullptr || !register_ops)
 		return;
+
+	switch (node->type) {
+	case AST_Node_Type::Block:
+		for (auto& statement : ((AST_Block*) node)->statements)
+			hoist_constants(statement.get(), frame);
+		break;
+	case AST_Node_Type::Var_Decl:
+		hoist_operands(((AST_Var_Decl*) node)->init.get(), frame);
+		break;
+	case AST_Node_Type::Multi_Var_Decl:
+		for (auto& decl : ((AST_Multi_Var_Decl*) node)->decls)
+			hoist_constants(decl.get(), frame);
+		break;
+	case AST_Node_Type::If: {
+		AST_If* sub = (AST_If*) node;
+		hoist_operands(sub->condition.get(), frame);
+		hoist_constants(sub->if_body.get(), frame);
+		hoist_constants(sub->else_body.get(), frame);
+		break;
 	}
 	case AST_Node_Type::While: {
 		AST_While* sub = (AST_While*) node;
+		hoist_operands(sub->condition.get(), frame);
+		hoist_constants(sub->body.get(), frame);
+		break;
+	}
+	case AST_Node_Type::For:
+		hoist_constants(((AST_For*) node)->body.get(), frame);
+		break;
+	case AST_Node_Type::Bin_Op: {
+		AST_Bin_Op* sub = (AST_Bin_Op*) node;
+		if (sub->left->type != AST_Node_Type::Var)
+			break;
 
-		// loop:
-		uint32_t loop_addr = program.code.size();
+		if (sub->op == Bin_Op::Assign) {
+			hoist_operands(sub->right.get(), frame);
+		} else if (bin_op_to_reg_opcode(sub->op) != BC_EXIT) {
+			// x += 2, x += 1 is an INC
+			if (superinstructions && (sub->op == Bin_Op::Add_Assign || sub->op == Bin_Op::Sub_Assign) && is_num_literal(sub->right.get(), 1))
+				break;
+			if (sub->right->type == AST_Node_Type::Literal && ((AST_Literal*) sub->right.get())->val.type == Value_Type::Num)
+				hoist_constant(((AST_Literal*) sub->right.get())->val.as.num, frame);
+			else
+				hoist_operands(sub->right.get(), frame);
+		}
+		break;
+	}
+	default:
+		break;
+	}
+}
 
-		compile_node(sub->condition.get(), frame);
-		output_u8(BC_JUMP_IF_FALSE_U32);
-		uint32_t loop_patch_addr = program.code.size();
-		output_u32((uint32_t) -1);
+// the number operands of a register op
+void BC_Compiler::hoist_operands(AST_Node* node, BC_Frame& frame) {
+	if (!is_reg_op(node))
+		return;
 
-		// body
-		compile_node(sub->body.get(), frame);
-		output_u8(BC_JUMP_U32);
-		output_u32(loop_addr);
+	AST_Bin_Op* sub = (AST_Bin_Op*) node;
+	for (AST_Node* operand : {sub->left.get(), sub->right.get()}) {
+		if (operand->type == AST_Node_Type::Literal && ((AST_Literal*) operand)->val.type == Value_Type::Num)
+			hoist_constant(((AST_Literal*) operand)->val.as.num, frame);
+		else
+			hoist_operands(operand, frame);
+	}
+}
 
-		// exit:
-		uint32_t exit_addr = program.code.size();
-		write_u32_at(exit_addr, loop_patch_addr);
+void BC_Compiler::hoist_constant(float num, BC_Frame& frame) {
+	// each one costs a slot in every call
+	if (find_constant(num, frame) >= 0 || frame.constants.size() >= (size_t) MAX_HOISTED_CONSTANTS)
 		return;
+
+	uint16_t slot = alloc_temp(frame, nullptr);
+	emit(BC_LOAD_CONST_U8_U16, slot, add_num_const(num));
+	frame.constants.push_back({num, slot});
+}
+
+int BC_Compiler::find_constant(float num, const BC_Frame& frame) const {
+	for (const auto& constant : frame.constants) {
+		if (memcmp(&constant.first, &num, sizeof(float)) == 0)
+			return constant.second;
 	}
-	case AST_Node_Type::Func_Call: {
-		AST_Func_Call* sub = (AST_Func_Call*) node;
+	return -1;
+}
 
-		if (sub->expr->type == AST_Node_Type::Var) {
-			AST_Var* var = (AST_Var*) sub->expr.get();
+BC_Compiler::LValue BC_Compiler::get_lvalue(AST_Node* target, BC_Frame& frame) {
+	LValue lv;
 
-			int extern_func_index = -1;
-			for (int i = 0; i < extern_funcs.size(); i++) {
-				if (extern_funcs[i].name == var->name) {
-					extern_func_index = i;
-					break;
-				}
-			}
+	switch (target->type) {
+	case AST_Node_Type::Var: {
+		lv.kind = LValue::Var;
+		lv.name = resolve(((AST_Var*) target)->name, frame);
 
-			if (extern_func_index != -1) {
-				// emit external func call
+		bool assignable = lv.name.kind == Name_Kind::Member || lv.name.kind == Name_Kind::Global ||
+			(lv.name.kind == Name_Kind::Local && !lv.name.is_const);
+		if (!assignable) {
+			error("Expression is not modifiable", target);
+		}
+		return lv;
+	}
+	case AST_Node_Type::Subscript: {
+		AST_Subscript* sub = (AST_Subscript*) target;
+		lv.kind = LValue::Index;
+		lv.container = sub->expr.get();
+		lv.index = sub->subscript.get();
+		return lv;
+	}
+	case AST_Node_Type::Bin_Op: {
+		AST_Bin_Op* sub = (AST_Bin_Op*) target;
+		if (sub->op != Bin_Op::Dot)
+			break;
 
-				const Extern_Func& func = extern_funcs[extern_func_index];
-				
-				// push args to stack in order
-				for (int i = 0; i < sub->args.size(); i++) {
-					compile_node(sub->args[i].get(), frame);
-				}
+		// p.x++ parses as p.(x++)
+		AST_Node* right = sub->right.get();
+		if (right->type == AST_Node_Type::Unary_Op)
+			right = ((AST_Unary_Op*) right)->expr.get();
 
-				output_u8(BC_CALL_EXTERN_U16);
-				output_u16((uint16_t) extern_func_index);
-				return;
-			}
+		if (right->type == AST_Node_Type::Var) {
+			lv.kind = LValue::Field;
+			lv.container = sub->left.get();
+			lv.field = ((AST_Var*) right)->name;
+			return lv;
+		}
+
+		// a.b[i]
+		if (right->type == AST_Node_Type::Subscript && ((AST_Subscript*) right)->expr->type == AST_Node_Type::Var) {
+			AST_Subscript* subscript = (AST_Subscript*) right;
+			lv.kind = LValue::Index;
+			lv.container = sub->left.get();
+			lv.field = ((AST_Var*) subscript->expr.get())->name;
+			lv.index = subscript->subscript.get();
+			return lv;
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	error("Expression is not modifiable", target);
+	return lv;
+}
+
+void BC_Compiler::compile_update(const LValue& lv, Bin_Op op, AST_Node* value, bool keep_value, BC_Frame& frame, const AST_Node* node) {
+	bool is_assign = op == Bin_Op::Assign;
+	bool is_step = value == nullptr; // ++/--, keeps the old value
+
+	auto compile_value = [&]() {
+		if (is_step) {
+			emit(BC_PUSH_U8, 1);
+		} else {
+			compile_expr(value, frame);
+		}
+
+		if (!is_assign)
+			emit(bin_op_to_opcode(op));
+	};
+
+	// x++, x--, x += 1 and x -= 1 on a local or a global
+	bool is_inc = op == Bin_Op::Add || op == Bin_Op::Add_Assign;
+	bool is_dec = op == Bin_Op::Sub || op == Bin_Op::Sub_Assign;
+	if (superinstructions && lv.kind == LValue::Var && !keep_value && (is_inc || is_dec) && (is_step || is_num_literal(value, 1))) {
+		if (lv.name.kind == Name_Kind::Local) {
+			emit(is_inc ? BC_INC_VAR_U8 : BC_DEC_VAR_U8, lv.name.index);
+			return;
+		}
+		if (lv.name.kind == Name_Kind::Global) {
+			emit(is_inc ? BC_INC_GLOBAL_U16 : BC_DEC_GLOBAL_U16, lv.name.index);
+			return;
+		}
+	}
+
+	// x = a + b, x += a on a local
+	bool is_local = lv.kind == LValue::Var && lv.name.kind == Name_Kind::Local;
+	if (register_ops && is_local && !keep_value && !is_step && (!is_assign || is_reg_op(value))) {
+		uint16_t slot = (uint16_t) lv.name.index;
+
+		if (is_assign) {
+			compile_reg_op((AST_Bin_Op*) value, slot, frame);
+			return;
 		}
 
-		// push args to stack in order
-		for (int i = 0; i < sub->args.size(); i++) {
-			compile_node(sub->args[i].get(), frame);
+		// the old value is read before the value is evaluated
+		if (!may_assign(value)) {
+			int next_slot = frame.next_slot;
+			uint16_t operand = compile_to_slot(value, true, frame);
+
+			emit(bin_op_to_reg_opcode(op), slot, slot, operand);
+			frame.next_slot = next_slot;
+			return;
 		}
+	}
 
-		// push func ref expression
-		compile_node(sub->expr.get(), frame);
+	if (lv.kind == LValue::Var) {
+		if (keep_value && is_step)
+			push_name(lv.name);
+		if (!is_assign)
+			push_name(lv.name);
 
-		// pop and call
-		output_u8(BC_CALL);
+		compile_value();
+		pop_name(lv.name);
+
+		if (keep_value && !is_step)
+			push_name(lv.name);
 		return;
 	}
-	case AST_Node_Type::Return: {
-		AST_Return* sub = (AST_Return*) node;
 
-		if (sub->expr != nullptr) {
-			compile_node(sub->expr.get(), frame);
+	// fields and items have their container under the value, so the value
+	// of the expression waits in a temp until it's stored
+	open_lvalue(lv, frame);
+	if (!is_assign)
+		load_lvalue(lv);
+
+	int temp = -1;
+	if (keep_value && is_step) {
+		temp = alloc_temp(frame, node);
+		emit(BC_DUP);
+		emit(BC_POP_VAR_U8, temp);
+	}
+
+	compile_value();
+
+	if (keep_value && !is_step) {
+		temp = alloc_temp(frame, node);
+		emit(BC_DUP);
+		emit(BC_POP_VAR_U8, temp);
+	}
+
+	store_lvalue(lv, frame);
+
+	if (keep_value) {
+		emit(BC_PUSH_VAR_U8, temp);
+		frame.next_slot--;
+	}
+}
+
+void BC_Compiler::open_lvalue(const LValue& lv, BC_Frame& frame) {
+	switch (lv.kind) {
+	case LValue::Var:
+		break;
+	case LValue::Field:
+		open_container(lv.container, frame);
+		break;
+	case LValue::Index:
+		// arrays are shared, so they never need to be stored back
+		compile_expr(lv.container, frame);
+		if (!lv.field.empty()) {
+			emit(BC_GET_FIELD_U16, add_string(lv.field));
+		}
+		compile_expr(lv.index, frame);
+		break;
+	}
+}
+
+void BC_Compiler::load_lvalue(const LValue& lv) {
+	switch (lv.kind) {
+	case LValue::Var:
+		push_name(lv.name);
+		break;
+	case LValue::Field:
+		emit(BC_DUP);
+		emit(BC_GET_FIELD_U16, add_string(lv.field));
+		break;
+	case LValue::Index:
+		emit(BC_DUP2);
+		emit(BC_GET_INDEX);
+		break;
+	}
+}
+
+void BC_Compiler::store_lvalue(const LValue& lv, BC_Frame& frame) {
+	switch (lv.kind) {
+	case LValue::Var:
+		pop_name(lv.name);
+		break;
+	case LValue::Field:
+		emit(BC_SET_FIELD_U16, add_string(lv.field));
+		close_container(lv.container, frame);
+		break;
+	case LValue::Index:
+		emit(BC_SET_INDEX);
+		break;
+	}
+}
+
+// x, a.x or a[i], leaves what's needed to store it back under its value
+void BC_Compiler::open_container(AST_Node* container, BC_Frame& frame) {
+	if (container->type == AST_Node_Type::Var) {
+		push_name(resolve(((AST_Var*) container)->name, frame));
+		return;
+	}
+
+	if (container->type == AST_Node_Type::Bin_Op && ((AST_Bin_Op*) container)->op == Bin_Op::Dot &&
+		((AST_Bin_Op*) container)->right->type == AST_Node_Type::Var) {
+		AST_Bin_Op* sub = (AST_Bin_Op*) container;
+		compile_expr(sub->left.get(), frame);
+		emit(BC_DUP);
+		emit(BC_GET_FIELD_U16, add_string(((AST_Var*) sub->right.get())->name));
+		return;
+	}
+
+	if (container->type == AST_Node_Type::Subscript) {
+		AST_Subscript* sub = (AST_Subscript*) container;
+		compile_expr(sub->expr.get(), frame);
+		compile_expr(sub->subscript.get(), frame);
+		emit(BC_DUP2);
+		emit(BC_GET_INDEX);
+		return;
+	}
+
+	compile_expr(container, frame);
+}
+
+void BC_Compiler::close_container(AST_Node* container, BC_Frame& frame) {
+	if (container->type == AST_Node_Type::Var) {
+		Name name = resolve(((AST_Var*) container)->name, frame);
+		if (name.kind == Name_Kind::Member || name.kind == Name_Kind::Global ||
+			(name.kind == Name_Kind::Local && !name.is_const)) {
+			pop_name(name);
 		} else {
-			output_u8(BC_PUSH_NULL);
+			emit(BC_CHECK_NOT_STRUCT);
 		}
+		return;
+	}
 
-		output_u8(BC_RET);
+	if (container->type == AST_Node_Type::Bin_Op && ((AST_Bin_Op*) container)->op == Bin_Op::Dot &&
+		((AST_Bin_Op*) container)->right->type == AST_Node_Type::Var) {
+		AST_Bin_Op* sub = (AST_Bin_Op*) container;
+		emit(BC_SET_FIELD_U16, add_string(((AST_Var*) sub->right.get())->name));
+		// holds a struct, so it's an instance and not a struct itself
+		emit(BC_POP_DISPOSE);
 		return;
 	}
+
+	if (container->type == AST_Node_Type::Subscript) {
+		emit(BC_SET_INDEX);
+		return;
+	}
+
+	// this, calls, ...
+	emit(BC_CHECK_NOT_STRUCT);
+}
+
+void BC_Compiler::push_name(const Name& name) {
+	switch (name.kind) {
+	case Name_Kind::Local:
+		emit(BC_PUSH_VAR_U8, name.index);
+		break;
+	case Name_Kind::Member:
+		emit(BC_PUSH_MEMBER_U16, name.index);
+		break;
+	case Name_Kind::Global:
+		emit(BC_PUSH_GLOBAL_U16, name.index);
+		break;
+	case Name_Kind::Func:
+		emit(BC_PUSH_FUNC_REF_U32, name.index);
+		break;
+	case Name_Kind::Extern:
+		// as a value, found in the builtins by name
+		emit(BC_PUSH_GLOBAL_U16, add_global(extern_funcs[name.index].name));
+		break;
+	}
+}
+
+void BC_Compiler::pop_name(const Name& name) {
+	switch (name.kind) {
+	case Name_Kind::Local:
+		emit(BC_POP_VAR_U8, name.index);
+		break;
+	case Name_Kind::Member:
+		emit(BC_POP_MEMBER_U16, name.index);
+		break;
+	case Name_Kind::Global:
+		emit(BC_POP_GLOBAL_U16, name.index);
+		break;
 	default:
-		error("unhandled node type");
+		error("Expression is not modifiable");
+	}
+}
+
+// same order as the interpreter's scopes: locals, this, globals, global functions, builtins
+BC_Compiler::Name BC_Compiler::resolve(const std::string& name, BC_Frame& frame) {
+	for (auto it = frame.locals.rbegin(); it != frame.locals.rend(); ++it) {
+		if (it->name == name)
+			return {Name_Kind::Local, it->slot, it->is_const};
 	}
 
-	error("yeah");
+	if (!frame.class_name.empty() && is_member(frame.class_name, name))
+		return {Name_Kind::Member, (int) add_string(name)};
+
+	auto func_it = global_funcs.find(name);
+	if (func_it != global_funcs.end())
+		return {Name_Kind::Func, (int) func_it->second};
+
+	int extern_index = find_extern(name);
+	if (extern_index >= 0)
+		return {Name_Kind::Extern, extern_index};
+
+	return {Name_Kind::Global, (int) add_global(name)};
 }
 
-void BC_Compiler::output_u8(uint8_t byte) {
-	program.code.push_back(byte);
+// instances also get their parents' members, and a method may be running on a subclass
+bool BC_Compiler::is_member(const std::string& class_name, const std::string& name) const {
+	auto has_member = [&](const std::string& cur) {
+		auto it = classes.find(cur);
+		return it != classes.end() && std::find(it->second.members.begin(), it->second.members.end(), name) != it->second.members.end();
+	};
+
+	for (const auto& it : classes) {
+		// is it class_name, a parent of it or a subclass of it
+		bool related = false;
+		for (std::string cur = it.first; !cur.empty() && !related;) {
+			related = cur == class_name;
+			auto cur_it = classes.find(cur);
+			cur = cur_it != classes.end() ? cur_it->second.parent : "";
+		}
+		for (std::string cur = class_name; !cur.empty() && !related;) {
+			related = cur == it.first;
+			auto cur_it = classes.find(cur);
+			cur = cur_it != classes.end() ? cur_it->second.parent : "";
+		}
+
+		if (related && has_member(it.first))
+			return true;
+	}
+
+	return false;
 }
 
-void BC_Compiler::output_u16(uint16_t word) {
-	program.code.push_back(word & 0xFF);
-	program.code.push_back(word >> 8);
+int BC_Compiler::find_extern(const std::string& name) const {
+	auto it = extern_indices.find(name);
+	return it != extern_indices.end() ? (int) it->second : -1;
 }
 
-void BC_Compiler::output_u32(uint32_t word) {
-	program.code.push_back(word & 0xFF);
-	program.code.push_back(word >> 8 & 0xFF);
-	program.code.push_back(word >> 16 & 0xFF);
-	program.code.push_back(word >> 24 & 0xFF);
+// already linked against extern_funcs
+uint32_t BC_Compiler::add_import(uint32_t extern_index) {
+	auto it = import_indices.find(extern_index);
+	if (it != import_indices.end())
+		return it->second;
+
+	uint32_t index = (uint32_t) program.imports.size();
+	program.imports.push_back({extern_funcs[extern_index].name, extern_index});
+	import_indices[extern_index] = index;
+	return index;
 }
 
-void BC_Compiler::output_f32(float num) {
-	uint32_t bin;
-	memcpy(&bin, &num, 4);
-	output_u32(bin);
+uint32_t BC_Compiler::add_string(const std::string& str) {
+	auto it = string_indices.find(str);
+	if (it != string_indices.end())
+		return it->second;
+
+	uint32_t index = (uint32_t) program.strings.size();
+	program.strings.push_back(str);
+	string_indices[str] = index;
+	return index;
 }
 
-void BC_Compiler::write_u8_at(uint8_t word, uint32_t pos) {
-	program.code[pos] = word;
+// by bits, so -0 and 0 stay apart
+uint32_t BC_Compiler::add_num_const(float num) {
+	auto it = num_const_indices.find(f32_bits(num));
+	if (it != num_const_indices.end())
+		return it->second;
+
+	uint32_t index = (uint32_t) program.num_consts.size();
+	program.num_consts.push_back(num);
+	num_const_indices[f32_bits(num)] = index;
+	return index;
+}
+
+uint32_t BC_Compiler::add_str_const(const std::string& str) {
+	auto it = str_const_indices.find(str);
+	if (it != str_const_indices.end())
+		return it->second;
+
+	uint32_t index = (uint32_t) program.str_consts.size();
+	program.str_consts.push_back(str);
+	str_const_indices[str] = index;
+	return index;
+}
+
+uint32_t BC_Compiler::add_global(const std::string& name) {
+	auto it = global_indices.find(name);
+	if (it != global_indices.end())
+		return it->second;
+
+	uint32_t index = (uint32_t) program.globals.size();
+	program.globals.push_back(name);
+	global_indices[name] = index;
+	return index;
+}
+
+// locals can't shadow anything that's visible from where they're declared
+uint16_t BC_Compiler::declare_local(const std::string& name, bool is_const, BC_Frame& frame, const AST_Node* node, int slot) {
+	for (const auto& local : frame.locals) {
+		if (local.name == name) {
+			error("Conflicting variable name: " + name, node);
+		}
+	}
+
+	if (global_funcs.count(name) || find_extern(name) >= 0 ||
+		(!frame.class_name.empty() && is_member(frame.class_name, name))) {
+		error("Conflicting variable name: " + name, node);
+	}
+
+	if (slot < 0)
+		slot = alloc_temp(frame, node);
+
+	frame.locals.push_back({name, (uint16_t) slot, is_const});
+	return (uint16_t) slot;
+}
+
+uint16_t BC_Compiler::alloc_temp(BC_Frame& frame, const AST_Node* node) {
+	if (frame.next_slot >= MAX_SLOTS) {
+		error("Too many local variables", node);
+	}
+
+	int slot = frame.next_slot++;
+	frame.num_slots = std::max(frame.num_slots, frame.next_slot);
+	return (uint16_t) slot;
+}
+
+// slots of locals that went out of scope get reused
+void BC_Compiler::begin_scope(BC_Frame& frame, size_t& num_locals, int& next_slot) {
+	num_locals = frame.locals.size();
+	next_slot = frame.next_slot;
+	frame.depth++;
+}
+
+void BC_Compiler::end_scope(BC_Frame& frame, size_t num_locals, int next_slot) {
+	frame.locals.resize(num_locals);
+	frame.next_slot = next_slot;
+	frame.depth--;
+}
+
+void BC_Compiler::emit_jump(uint8_t op, uint32_t& patch_addr) {
+	emit(op, (uint32_t) -1);
+	patch_addr = program.code.size() - 4;
+}
+
+// to the current position
+void BC_Compiler::patch_jump(uint32_t patch_addr) {
+	write_u32_at(program.code.size(), patch_addr);
+}
+
+void BC_Compiler::emit(uint8_t op, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+	BC_Inst inst;
+	inst.op = op;
+	inst.operands[0] = a;
+	inst.operands[1] = b;
+	inst.operands[2] = c;
+	inst.operands[3] = d;
+	encode_bc_inst(inst, program.code);
+
+	int pops, pushes;
+	get_bc_stack_effect(inst, program, pops, pushes);
+	stack_depth += pushes - pops;
+	assert(stack_depth >= 0);
+	max_stack_depth = std::max(max_stack_depth, stack_depth);
+}
+
+void BC_Compiler::mark_line(const AST_Node* node) {
+	uint32_t pos = program.code.size();
+	if (!program.lines.empty()) {
+		BC_Line& last = program.lines.back();
+		if (last.src_info.line == node->src_info.line && last.src_info.file_index == node->src_info.file_index)
+			return;
+
+		// the last statement didn't emit anything
+		if (last.pos == pos) {
+			last.src_info = node->src_info;
+			return;
+		}
+	}
+
+	program.lines.push_back({pos, node->src_info});
+}
+
+uint32_t BC_Compiler::begin_alloc_frame() {
+	stack_depth = 0;
+	max_stack_depth = 0;
+
+	uint32_t alloc_pos = program.code.size();
+	emit(BC_ALLOC_FRAME_U16_U32, 0, 0);
+	return alloc_pos;
+}
+
+void BC_Compiler::patch_alloc_frame(uint32_t alloc_pos, const BC_Frame& frame) {
+	write_u16_at(frame.num_slots, alloc_pos + 1);
+	write_u32_at(frame.num_slots + max_stack_depth, alloc_pos + 3);
+}
+
+void BC_Compiler::write_u16_at(uint16_t word, uint32_t pos) {
+	program.code[pos] = word & 0xFF;
+	program.code[pos + 1] = word >> 8;
 }
 
 void BC_Compiler::write_u32_at(uint32_t word, uint32_t pos) {
@@ -339,18 +1494,13 @@ void BC_Compiler::write_u32_at(uint32_t word, uint32_t pos) {
 	program.code[pos + 3] = word >> 24 & 0xFF;
 }
 
-void BC_Compiler::error(const std::string& msg) const {
+void BC_Compiler::error(const std::string& msg, const AST_Node* node) const {
+	if (error_callback != nullptr) {
+		error_callback(msg, node != nullptr ? &node->src_info : nullptr);
+		return;
+	}
+
 	std::cout << "Bytecode compiler error: " << msg << "\n";
 	assert(false);
 	exit(1);
 }
-
-int BC_Compiler::find_var_index(const std::string& name, BC_Frame& frame) {
-	auto result = std::find(frame.vars.begin(), frame.vars.end(), name);
-
-	if (result == frame.vars.end()) {
-		error("variable not found in current frame");
-	}
-
-	return result - frame.vars.begin();
-}
@@ -4,33 +4,177 @@
 #include "bc.h"
 #include "extern_func.h"
 
+#include <functional>
+#include <unordered_map>
+
+// Compiles a parsed program for BC_VM. Locals live in numbered frame slots;
+// globals, class members and fields are still found by name at runtime, like
+// in the interpreter. Global functions are bound when compiling, externs are
+// imported by name and linked to extern_funcs, see link_bc_program.
 class BC_Compiler {
 public:
+	using Error_Callback_Func = std::function<void(const std::string& msg, const Source_Info* info)>;
+
 	BC_Compiler(const std::vector<Extern_Func>& _extern_funcs)
 		: extern_funcs(_extern_funcs) {}
 
 	BC_Program compile(AST_Node* node);
+	void set_error_callback(Error_Callback_Func _func) { error_callback = _func; }
+	// runs optimize_bc_program on the result, on by default
+	void set_optimize(bool _optimize) { optimize = _optimize; }
+	// register forms for arithmetic on locals, see compile_reg_op. on by default,
+	// off leaves everything on the op stack
+	void set_register_ops(bool _register_ops) { register_ops = _register_ops; }
+	// fused ops like INC_VAR_U8, ADD_VAR_VAR_U8_U8, CALL_FUNC_U32_U8 and the compare
+	// and branch jumps, on by default. off gives the sequences they replace
+	void set_superinstructions(bool _superinstructions) { superinstructions = _superinstructions; }
 
 private:
-	BC_Program program;
-	const std::vector<Extern_Func>& extern_funcs;
-	//std::vector<AST_Node*> func_decls_backlog;
+	struct Local {
+		std::string name;
+		uint16_t slot;
+		bool is_const;
+	};
+
+	struct Loop {
+		uint32_t continue_addr;
+		std::vector<uint32_t> break_patches;
+	};
 
 	struct BC_Frame {
-		std::vector<std::string> vars;
+		std::vector<Local> locals; // the visible ones, innermost last
+		int next_slot = 0;
+		int num_slots = 0;
+		int depth = 0; // nested ifs and loops, blocks share their parent's scope
+		bool is_global = false; // top level of the program
+		std::string class_name; // for methods
+		std::vector<Loop> loops;
+		std::vector<std::pair<float, uint16_t>> constants; // slots holding numbers, see hoist_constants
+	};
+
+	enum class Name_Kind {
+		Local,
+		Member, // of this
+		Global, // or anything else that isn't known when compiling
+		Func,
+		Extern,
+	};
+
+	struct Name {
+		Name_Kind kind;
+		int index = 0; // slot, string, global, func or extern index
+		bool is_const = false;
+	};
+
+	// what an assignment or ++ writes to
+	struct LValue {
+		enum Kind { Var, Field, Index } kind;
+		Name name; // Var
+		AST_Node* container = nullptr; // Field: the struct or instance. Index: the array
+		std::string field; // Field, or Index of container.field
+		AST_Node* index = nullptr; // Index
+	};
+
+	struct Class_Info {
+		std::string parent;
+		std::vector<std::string> members;
 	};
 
-	void compile_node(AST_Node* node, BC_Frame& frame);
+	void collect_global_funcs(AST_Node* node);
+	uint32_t add_func(AST_Func_Decl* node, bool is_global, bool is_method);
+	void compile_func(uint32_t func_index);
+
+	void compile_statement(AST_Node* node, BC_Frame& frame);
+	void compile_expr(AST_Node* node, BC_Frame& frame);
+	void compile_dot(AST_Bin_Op* node, BC_Frame& frame, bool keep_value);
+	void compile_call(AST_Func_Call* node, BC_Frame& frame);
+	void compile_if(AST_If* node, BC_Frame& frame);
+	void compile_while(AST_While* node, BC_Frame& frame);
+	void compile_for(AST_For* node, BC_Frame& frame);
+	void compile_var_decl(AST_Var_Decl* node, BC_Frame& frame);
+	void compile_class_decl(AST_Class_Decl* node, BC_Frame& frame);
+	void compile_struct_decl(AST_Struct_Decl* node, BC_Frame& frame);
+	void compile_string_interp(AST_String_Interp* node, BC_Frame& frame);
+	void compile_num(float num);
+	void compile_cond_jump(AST_Node* condition, uint32_t& patch_addr, BC_Frame& frame); // jumps if false
+
+	// register forms: arithmetic that ends up in a local is done on slots directly,
+	// operands that aren't locals get temps
+	bool is_reg_op(const AST_Node* node) const;
+	bool may_assign(const AST_Node* node) const;
+	void compile_reg_op(AST_Bin_Op* node, uint16_t dst, BC_Frame& frame);
+	// borrow allows returning the slot of a local instead of a copy
+	uint16_t compile_to_slot(AST_Node* node, bool borrow, BC_Frame& frame);
+	// loads the numbers a loop uses as register operands once, before it starts
+	void hoist_constants(AST_Node* node, BC_Frame& frame);
+	void hoist_operands(AST_Node* node, BC_Frame& frame);
+	void hoist_constant(float num, BC_Frame& frame);
+	int find_constant(float num, const BC_Frame& frame) const;
+
+	// assignments, compound assignments and ++/--
+	// op is Assign, Add_Assign.. or Add/Sub for ++/--. keep_value leaves the value of
+	// the expression: the new value, or the old one for ++/--
+	LValue get_lvalue(AST_Node* target, BC_Frame& frame);
+	void compile_update(const LValue& lv, Bin_Op op, AST_Node* value, bool keep_value, BC_Frame& frame, const AST_Node* node);
+	void open_lvalue(const LValue& lv, BC_Frame& frame);
+	void load_lvalue(const LValue& lv);
+	void store_lvalue(const LValue& lv, BC_Frame& frame);
+	// a struct that got a field assigned has to be stored back where it came from
+	void open_container(AST_Node* container, BC_Frame& frame);
+	void close_container(AST_Node* container, BC_Frame& frame);
+	void push_name(const Name& name);
+	void pop_name(const Name& name);
+
+	Name resolve(const std::string& name, BC_Frame& frame);
+	bool is_member(const std::string& class_name, const std::string& name) const;
+	int find_extern(const std::string& name) const;
+	uint32_t add_import(uint32_t extern_index);
+	uint32_t add_string(const std::string& str);
+	uint32_t add_num_const(float num);
+	uint32_t add_str_const(const std::string& str);
+	uint32_t add_global(const std::string& name);
+	// slot is allocated if it's -1
+	uint16_t declare_local(const std::string& name, bool is_const, BC_Frame& frame, const AST_Node* node, int slot = -1);
+	uint16_t alloc_temp(BC_Frame& frame, const AST_Node* node);
+	void begin_scope(BC_Frame& frame, size_t& num_locals, int& next_slot);
+	void end_scope(BC_Frame& frame, size_t num_locals, int next_slot);
+	// starts a new entry in the line map if node is on another line
+	void mark_line(const AST_Node* node);
+	void emit_jump(uint8_t op, uint32_t& patch_addr);
+	// ALLOC_FRAME_U16_U32 at the start of a function, patched once its slots and
+	// op stack depth are known
+	uint32_t begin_alloc_frame();
+	void patch_alloc_frame(uint32_t alloc_pos, const BC_Frame& frame);
+	void patch_jump(uint32_t patch_addr);
+
+	// operands past the ones op has are ignored. with BC_WIDE if one of them needs it
+	void emit(uint8_t op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0, uint32_t d = 0);
 
 	// little endian
-	void output_u8(uint8_t byte);
-	void output_u16(uint16_t word);
-	void output_u32(uint32_t word);
-	void output_f32(float num);
+	void write_u16_at(uint16_t word, uint32_t pos);
+	void write_u32_at(uint32_t word, uint32_t pos);
+
+	void error(const std::string& msg = "", const AST_Node* node = nullptr) const;
+
+	BC_Program program;
+	const std::vector<Extern_Func>& extern_funcs;
+	Error_Callback_Func error_callback;
+	bool optimize = true;
+	bool register_ops = true;
+	bool superinstructions = true;
 
-	void write_u8_at(uint8_t word, uint32_t pos = -1);
-	void write_u32_at(uint32_t word, uint32_t pos = -1);
+	// of the function being compiled, tracked by emit. every jump happens at the same
+	// depth as its target, there's no ternary or short-circuiting
+	int stack_depth = 0;
+	int max_stack_depth = 0;
 
-	void error(const std::string& msg = "") const;
-	int find_var_index(const std::string& name, BC_Frame& frame);
+	std::unordered_map<std::string, uint32_t> global_funcs;
+	std::unordered_map<std::string, uint32_t> string_indices;
+	std::unordered_map<uint32_t, uint32_t> num_const_indices; // by bits
+	std::unordered_map<std::string, uint32_t> str_const_indices;
+	std::unordered_map<std::string, uint32_t> global_indices;
+	std::unordered_map<std::string, uint32_t> extern_indices; // last one of a name, like the builtin scope
+	std::unordered_map<uint32_t, uint32_t> import_indices; // extern index -> import
+	std::unordered_map<std::string, Class_Info> classes;
+	std::unordered_map<uint32_t, std::string> method_classes; // func index -> class
 };
@@ -0,0 +1,219 @@
+#include "bc_file.h"
+#include "image_io.h"
+#include "value.h"
+
+#include <string.h>
+#include <stdio.h>
+
+// Layout, everything little endian:
+//   header: magic, version, number of opcodes
+//   source file names
+//   code, as it is in memory
+//   function table, strings, number and string constants, globals, classes, structs,
+//   string interps, imports
+//   line map
+// The code is one block that gets copied out of the mapping as is, none of it
+// is decoded. AST nodes aren't saved, they're null in a loaded program. Imports
+// are only names, they're bound to the host's externs by link_bc_program.
+
+static const char BC_FILE_MAGIC[4] = {'E', 'N', 'K', 'B'};
+static const uint32_t BC_FILE_VERSION = 3;
+
+static void write_strs(Image_Writer& out, const std::vector<std::string>& strs) {
+	out.u32((uint32_t) strs.size());
+	for (const auto& str : strs)
+		out.str(str);
+}
+
+static void read_strs(Image_Reader& in, std::vector<std::string>& strs) {
+	uint32_t count = in.u32();
+	for (uint32_t i = 0; i < count && in.ok; i++)
+		strs.push_back(in.str());
+}
+
+bool save_bc_program(const std::string& path, const BC_Program& program, const std::vector<std::string>& source_files) {
+	Image_Writer out;
+	out.data.insert(out.data.end(), BC_FILE_MAGIC, BC_FILE_MAGIC + 4);
+	out.u32(BC_FILE_VERSION);
+	out.u32(BC_NUM_OPCODES);
+
+	write_strs(out, source_files);
+
+	out.u32((uint32_t) program.code.size());
+	out.bytes(program.code.data(), program.code.size());
+
+	out.u32((uint32_t) program.func_table.size());
+	for (const auto& func : program.func_table) {
+		out.u32(func.entry);
+		out.u32(func.num_args);
+		out.str(func.name);
+		out.u8(func.is_method);
+		out.u8(func.is_global);
+	}
+
+	write_strs(out, program.strings);
+	out.u32((uint32_t) program.num_consts.size());
+	for (float num : program.num_consts)
+		out.f32(num);
+	write_strs(out, program.str_consts);
+	write_strs(out, program.globals);
+
+	out.u32((uint32_t) program.classes.size());
+	for (const auto& bc_class : program.classes) {
+		out.str(bc_class.name);
+		out.str(bc_class.parent);
+		write_strs(out, bc_class.fields);
+		out.u32((uint32_t) bc_class.methods.size());
+		for (uint32_t method : bc_class.methods)
+			out.u32(method);
+	}
+
+	out.u32((uint32_t) program.structs.size());
+	for (const auto& bc_struct : program.structs) {
+		out.str(bc_struct.name);
+		write_strs(out, bc_struct.fields);
+	}
+
+	out.u32((uint32_t) program.interps.size());
+	for (const auto& interp : program.interps) {
+		write_strs(out, interp.parts);
+		for (int precision : interp.precisions)
+			out.u32((uint32_t) precision);
+	}
+
+	out.u32((uint32_t) program.imports.size());
+	for (const auto& import : program.imports)
+		out.str(import.name);
+
+	out.u32((uint32_t) program.lines.size());
+	for (const auto& line : program.lines) {
+		out.u32(line.pos);
+		out.u32((uint32_t) line.src_info.line);
+		out.u16((uint16_t) line.src_info.file_index);
+	}
+
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file)
+		return false;
+
+	bool written = fwrite(out.data.data(), out.data.size(), 1, file) == 1;
+	fclose(file);
+	return written;
+}
+
+bool load_bc_program(const std::string& path, BC_Program& program, std::vector<std::string>* source_files) {
+	Mapped_File file(path);
+	if (file.data == nullptr || file.size < 12 || memcmp(file.data, BC_FILE_MAGIC, 4) != 0)
+		return false;
+
+	Image_Reader in;
+	in.pos = file.data + 4;
+	in.end = file.data + file.size;
+
+	// the opcodes are numbered by their order in the enum
+	if (in.u32() != BC_FILE_VERSION || in.u32() != BC_NUM_OPCODES)
+		return false;
+
+	std::vector<std::string> files;
+	read_strs(in, files);
+
+	BC_Program loaded;
+
+	uint32_t code_size = in.u32();
+	const uint8_t* code = in.bytes(code_size);
+	if (code == nullptr)
+		return false;
+	loaded.code.assign(code, code + code_size);
+
+	uint32_t num_funcs = in.u32();
+	for (uint32_t i = 0; i < num_funcs && in.ok; i++) {
+		BC_Func func;
+		func.entry = in.u32();
+		func.num_args = in.u32();
+		func.name = in.str();
+		func.node = nullptr;
+		func.is_method = in.u8() != 0;
+		func.is_global = in.u8() != 0;
+
+		if (func.entry >= code_size)
+			return false;
+		loaded.func_table.push_back(std::move(func));
+	}
+
+	read_strs(in, loaded.strings);
+	uint32_t num_consts = in.u32();
+	for (uint32_t i = 0; i < num_consts && in.ok; i++)
+		loaded.num_consts.push_back(in.f32());
+	read_strs(in, loaded.str_consts);
+	read_strs(in, loaded.globals);
+
+	uint32_t num_classes = in.u32();
+	for (uint32_t i = 0; i < num_classes && in.ok; i++) {
+		BC_Class bc_class;
+		bc_class.name = in.str();
+		bc_class.parent = in.str();
+		read_strs(in, bc_class.fields);
+
+		uint32_t num_methods = in.u32();
+		for (uint32_t j = 0; j < num_methods && in.ok; j++) {
+			uint32_t method = in.u32();
+			if (method >= loaded.func_table.size())
+				return false;
+			bc_class.methods.push_back(method);
+		}
+
+		loaded.classes.push_back(std::move(bc_class));
+	}
+
+	uint32_t num_structs = in.u32();
+	for (uint32_t i = 0; i < num_structs && in.ok; i++) {
+		BC_Struct bc_struct;
+		bc_struct.name = in.str();
+		read_strs(in, bc_struct.fields);
+		if (bc_struct.fields.size() > MAX_STRUCT_FIELDS)
+			return false;
+
+		loaded.structs.push_back(std::move(bc_struct));
+	}
+
+	uint32_t num_interps = in.u32();
+	for (uint32_t i = 0; i < num_interps && in.ok; i++) {
+		BC_String_Interp interp;
+		read_strs(in, interp.parts);
+		if (interp.parts.empty())
+			return false;
+
+		for (size_t j = 0; j + 1 < interp.parts.size() && in.ok; j++)
+			interp.precisions.push_back((int) in.u32());
+
+		loaded.interps.push_back(std::move(interp));
+	}
+
+	uint32_t num_imports = in.u32();
+	for (uint32_t i = 0; i < num_imports && in.ok; i++) {
+		BC_Import import;
+		import.name = in.str();
+		loaded.imports.push_back(std::move(import));
+	}
+
+	uint32_t num_lines = in.u32();
+	for (uint32_t i = 0; i < num_lines && in.ok; i++) {
+		BC_Line line;
+		line.pos = in.u32();
+		line.src_info.line = (int) in.u32();
+		line.src_info.file_index = (short) in.u16();
+
+		// errors look lines up by pos
+		if (!loaded.lines.empty() && line.pos <= loaded.lines.back().pos)
+			return false;
+		loaded.lines.push_back(line);
+	}
+
+	if (!in.ok)
+		return false;
+
+	program = std::move(loaded);
+	if (source_files != nullptr)
+		*source_files = std::move(files);
+	return true;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "bc.h"
+
+// compiled programs on disk, so scripts can start without lexing, parsing and compiling.
+// externs are imported by name, a file runs on any host that registers them.
+// source_files is stored as is, for hosts that name files by Source_Info::file_index
+bool save_bc_program(const std::string& path, const BC_Program& program, const std::vector<std::string>& source_files = {});
+// false if the file is missing, isn't a compiled program or is from another version.
+// only the tables are checked. the program has to be linked with link_bc_program and
+// pass verify_bc_program before it runs
+bool load_bc_program(const std::string& path, BC_Program& program, std::vector<std::string>* source_files = nullptr);
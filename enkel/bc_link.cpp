@@ -0,0 +1,22 @@
+#include "bc_link.h"
+
+#include <unordered_map>
+
+bool link_bc_program(BC_Program& program, const std::vector<Extern_Func>& extern_funcs, std::string& error) {
+	// the last one registered under a name wins, like in the builtin scope
+	std::unordered_map<std::string, uint32_t> extern_indices;
+	for (uint32_t i = 0; i < extern_funcs.size(); i++)
+		extern_indices[extern_funcs[i].name] = i;
+
+	for (auto& import : program.imports) {
+		auto it = extern_indices.find(import.name);
+		if (it == extern_indices.end()) {
+			error = "Missing external func: " + import.name;
+			return false;
+		}
+
+		import.extern_index = it->second;
+	}
+
+	return true;
+}
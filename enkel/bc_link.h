@@ -0,0 +1,9 @@
+#pragma once
+
+#include "bc.h"
+
+// Binds the program's imports to the host's extern funcs by name, so a compiled
+// program doesn't depend on the order the host registered them in. BC_Compiler
+// links what it compiles against its own externs, a loaded program has to be
+// linked before it's verified. returns false and sets error if one is missing
+bool link_bc_program(BC_Program& program, const std::vector<Extern_Func>& extern_funcs, std::string& error);
@@ -0,0 +1,436 @@
+#include "bc_optimizer.h"
+#include "bc_util.h"
+
+#include <assert.h>
+#include <string.h>
+#include <math.h>
+#include <unordered_map>
+
+namespace {
+
+const int NO_TARGET = -1;
+
+struct Inst {
+	BC_Inst bc; // the code address of jumps isn't kept up to date, target is
+	int target = NO_TARGET; // instruction index a jump goes to
+	bool removed = false;
+	uint8_t op() const { return bc.op; }
+};
+
+struct Optimizer {
+	std::vector<Inst> insts;
+	std::vector<int> func_entries; // instruction index of each function
+	std::vector<int> line_starts; // instruction index of each entry in the line map
+	std::vector<int> num_jumps_to; // how many jumps and entries land on each instruction
+	std::vector<float> num_consts; // with the folded ones, encode drops the unused ones
+	std::unordered_map<uint32_t, uint32_t> num_const_indices; // by bits
+	bool changed = false;
+
+	void decode(const BC_Program& program);
+	void encode(BC_Program& program) const;
+	void count_targets();
+
+	// index of the next instruction that's still there, or insts.size()
+	int next(int i) const;
+	int resolve(int target) const;
+	// whether control only gets to i from the instruction before it
+	bool is_straight(int i) const { return i < (int) insts.size() && num_jumps_to[i] == 0; }
+	void remove(int i);
+	void replace(int i, const Inst& inst);
+
+	Inst make_num(float num);
+	bool get_num(const Inst& inst, float& num) const;
+	bool fold_bin_op(uint8_t op, float a, float b, Inst& result);
+
+	void thread_jumps();
+	void remove_unreachable();
+	void combine();
+};
+
+}
+
+// jumps have the code address as their last operand, it's never wide
+static bool has_target(uint8_t op) {
+	switch (op) {
+	case BC_JUMP_U32:
+	case BC_JUMP_IF_TRUE_U32:
+	case BC_JUMP_IF_FALSE_U32:
+	case BC_JUMP_IF_TRUE_U8_U32:
+	case BC_JUMP_IF_FALSE_U8_U32:
+	case BC_JUMP_IF_NOT_LESS_THAN_U8_U8_U32:
+	case BC_JUMP_IF_NOT_LESS_THAN_EQUALS_U8_U8_U32:
+	case BC_JUMP_IF_NOT_GREATER_THAN_U8_U8_U32:
+	case BC_JUMP_IF_NOT_GREATER_THAN_EQUALS_U8_U8_U32:
+	case BC_FOR_NEXT_U8_U8_U8_U32:
+		return true;
+	}
+	return false;
+}
+
+static bool is_terminator(uint8_t op) {
+	return op == BC_JUMP_U32 || op == BC_RET || op == BC_EXIT;
+}
+
+// pushes that can't fail and don't change anything
+static bool is_pure_push(uint8_t op) {
+	switch (op) {
+	case BC_PUSH_VAR_U8:
+	case BC_PUSH_U8:
+	case BC_PUSH_CONST_U16:
+	case BC_PUSH_TRUE:
+	case BC_PUSH_FALSE:
+	case BC_PUSH_NULL:
+	case BC_PUSH_FUNC_REF_U32:
+	case BC_PUSH_STR_U16:
+	case BC_DUP:
+		return true;
+	}
+	return false;
+}
+
+static Inst make_inst(uint8_t op, uint32_t operand = 0) {
+	Inst inst;
+	inst.bc.op = op;
+	inst.bc.operands[0] = operand;
+	return inst;
+}
+
+static uint32_t f32_bits(float num) {
+	uint32_t bits;
+	memcpy(&bits, &num, sizeof(bits));
+	return bits;
+}
+
+static bool get_bool(const Inst& inst, bool& b) {
+	if (inst.op() != BC_PUSH_TRUE && inst.op() != BC_PUSH_FALSE)
+		return false;
+
+	b = inst.op() == BC_PUSH_TRUE;
+	return true;
+}
+
+// same encoding the compiler picks
+Inst Optimizer::make_num(float num) {
+	if (floorf(num) == num && num >= 0 && num <= UINT16_MAX && !signbit(num))
+		return make_inst(BC_PUSH_U8, (uint32_t) num);
+
+	auto it = num_const_indices.find(f32_bits(num));
+	if (it != num_const_indices.end())
+		return make_inst(BC_PUSH_CONST_U16, it->second);
+
+	uint32_t index = (uint32_t) num_consts.size();
+	num_consts.push_back(num);
+	num_const_indices[f32_bits(num)] = index;
+	return make_inst(BC_PUSH_CONST_U16, index);
+}
+
+bool Optimizer::get_num(const Inst& inst, float& num) const {
+	if (inst.op() == BC_PUSH_U8) {
+		num = (float) inst.bc.operands[0];
+		return true;
+	}
+	if (inst.op() == BC_PUSH_CONST_U16) {
+		num = num_consts[inst.bc.operands[0]];
+		return true;
+	}
+	return false;
+}
+
+// a op b, the same way the VM does it on numbers
+bool Optimizer::fold_bin_op(uint8_t op, float a, float b, Inst& result) {
+	switch (op) {
+	case BC_ADD: result = make_num(a + b); return true;
+	case BC_SUB: result = make_num(a - b); return true;
+	case BC_MUL: result = make_num(a * b); return true;
+	case BC_DIV: result = make_num(a / b); return true;
+	}
+
+	bool b_result;
+	switch (op) {
+	case BC_GREATER_THAN: b_result = a > b; break;
+	case BC_LESS_THAN: b_result = a < b; break;
+	case BC_GREATER_THAN_EQUALS: b_result = a >= b; break;
+	case BC_LESS_THAN_EQUALS: b_result = a <= b; break;
+	case BC_EQUALS: b_result = a == b; break;
+	case BC_NOT_EQUALS: b_result = a != b; break;
+	default: return false;
+	}
+
+	result = make_inst(b_result ? BC_PUSH_TRUE : BC_PUSH_FALSE);
+	return true;
+}
+
+void Optimizer::decode(const BC_Program& program) {
+	std::vector<int> index_at(program.code.size() + 1, NO_TARGET);
+
+	uint32_t pos = 0;
+	while (pos < program.code.size()) {
+		Inst inst;
+		int len = decode_bc_inst(&program.code[pos], inst.bc);
+		assert(pos + len <= program.code.size());
+
+		index_at[pos] = (int) insts.size();
+		insts.push_back(inst);
+		pos += len;
+	}
+
+	for (auto& inst : insts) {
+		if (!has_target(inst.op()))
+			continue;
+
+		uint32_t addr = inst.bc.operands[get_bc_num_operands(inst.op()) - 1];
+		assert(addr < index_at.size() && index_at[addr] != NO_TARGET);
+		inst.target = index_at[addr];
+	}
+
+	for (const auto& func : program.func_table)
+		func_entries.push_back(index_at[func.entry]);
+
+	for (const auto& line : program.lines)
+		line_starts.push_back(line.pos < program.code.size() ? index_at[line.pos] : (int) insts.size());
+
+	num_consts = program.num_consts;
+	for (uint32_t i = 0; i < num_consts.size(); i++)
+		num_const_indices[f32_bits(num_consts[i])] = i;
+}
+
+void Optimizer::encode(BC_Program& program) const {
+	// only the numbers that are still used, in the order they first come up
+	const uint32_t UNUSED = (uint32_t) -1;
+	std::vector<uint32_t> new_const_index(num_consts.size(), UNUSED);
+	program.num_consts.clear();
+
+	// removed instructions continue at the next one. the width of an instruction
+	// doesn't depend on its target, so targets are filled in after
+	std::vector<uint32_t> new_pos(insts.size() + 1);
+	std::vector<uint8_t> code;
+	code.reserve(program.code.size());
+	for (size_t i = 0; i < insts.size(); i++) {
+		new_pos[i] = (uint32_t) code.size();
+		if (insts[i].removed)
+			continue;
+
+		BC_Inst bc = insts[i].bc;
+		int const_operand = bc.op == BC_PUSH_CONST_U16 ? 0 : bc.op == BC_LOAD_CONST_U8_U16 ? 1 : -1;
+		if (const_operand >= 0) {
+			uint32_t& index = new_const_index[bc.operands[const_operand]];
+			if (index == UNUSED) {
+				index = (uint32_t) program.num_consts.size();
+				program.num_consts.push_back(num_consts[bc.operands[const_operand]]);
+			}
+			bc.operands[const_operand] = index;
+		}
+		encode_bc_inst(bc, code);
+	}
+	new_pos[insts.size()] = (uint32_t) code.size();
+
+	for (size_t i = 0; i < insts.size(); i++) {
+		const Inst& inst = insts[i];
+		if (inst.removed || !has_target(inst.op()))
+			continue;
+
+		uint32_t addr = new_pos[inst.target];
+		uint32_t end = new_pos[next(i)];
+		memcpy(&code[end - sizeof(addr)], &addr, sizeof(addr));
+	}
+
+	program.code = std::move(code);
+	for (size_t i = 0; i < func_entries.size(); i++)
+		program.func_table[i].entry = new_pos[func_entries[i]];
+
+	// statements that lost all their code end up at the same pos as the next one
+	std::vector<BC_Line> lines;
+	for (size_t i = 0; i < line_starts.size(); i++) {
+		BC_Line line = program.lines[i];
+		line.pos = new_pos[line_starts[i]];
+		if (!lines.empty() && lines.back().pos == line.pos)
+			lines.back() = line;
+		else
+			lines.push_back(line);
+	}
+	program.lines = std::move(lines);
+}
+
+void Optimizer::count_targets() {
+	num_jumps_to.assign(insts.size() + 1, 0);
+	num_jumps_to[0]++;
+	for (const auto& inst : insts) {
+		if (!inst.removed && inst.target != NO_TARGET)
+			num_jumps_to[resolve(inst.target)]++;
+	}
+	for (int entry : func_entries)
+		num_jumps_to[resolve(entry)]++;
+}
+
+int Optimizer::next(int i) const {
+	i++;
+	while (i < (int) insts.size() && insts[i].removed)
+		i++;
+	return i;
+}
+
+int Optimizer::resolve(int target) const {
+	while (target < (int) insts.size() && insts[target].removed)
+		target++;
+	return target;
+}
+
+void Optimizer::remove(int i) {
+	insts[i].removed = true;
+	changed = true;
+}
+
+void Optimizer::replace(int i, const Inst& inst) {
+	insts[i] = inst;
+	changed = true;
+}
+
+// jumps to unconditional jumps go straight to the end of the chain,
+// and jumps to the next instruction are dropped
+void Optimizer::thread_jumps() {
+	for (int i = 0; i < (int) insts.size(); i++) {
+		Inst& inst = insts[i];
+		if (inst.removed || inst.target == NO_TARGET)
+			continue;
+
+		int target = resolve(inst.target);
+		for (int hops = 0; hops < 16 && target < (int) insts.size() && insts[target].op() == BC_JUMP_U32; hops++)
+			target = resolve(insts[target].target);
+
+		if (target != inst.target) {
+			inst.target = target;
+			changed = true;
+		}
+
+		if (inst.op() == BC_JUMP_U32 && target == next(i))
+			remove(i);
+	}
+}
+
+// what follows a jump, ret or exit only runs if something jumps there
+void Optimizer::remove_unreachable() {
+	count_targets();
+
+	bool reachable = true;
+	for (int i = 0; i < (int) insts.size(); i++) {
+		if (insts[i].removed)
+			continue;
+
+		if (num_jumps_to[i] > 0)
+			reachable = true;
+
+		if (!reachable) {
+			remove(i);
+			continue;
+		}
+
+		if (is_terminator(insts[i].op()))
+			reachable = false;
+	}
+}
+
+void Optimizer::combine() {
+	count_targets();
+
+	for (int i = 0; i < (int) insts.size(); i++) {
+		if (insts[i].removed)
+			continue;
+
+		Inst& a = insts[i];
+		int j = next(i);
+		if (!is_straight(j))
+			continue;
+		Inst& b = insts[j];
+
+		// push x, pop_dispose
+		if (is_pure_push(a.op()) && b.op() == BC_POP_DISPOSE) {
+			remove(i);
+			remove(j);
+			continue;
+		}
+
+		// pop_var n, push_var n
+		if (a.op() == BC_POP_VAR_U8 && b.op() == BC_PUSH_VAR_U8 && a.bc.operands[0] == b.bc.operands[0]) {
+			replace(i, make_inst(BC_SET_VAR_U8, a.bc.operands[0]));
+			remove(j);
+			continue;
+		}
+
+		// set_var n, pop_dispose
+		if (a.op() == BC_SET_VAR_U8 && b.op() == BC_POP_DISPOSE) {
+			a.bc.op = BC_POP_VAR_U8;
+			remove(j);
+			continue;
+		}
+
+		float num;
+		bool boolean;
+		if (get_num(a, num)) {
+			if (b.op() == BC_NEGATE || b.op() == BC_POSITIVE) {
+				replace(i, make_num(b.op() == BC_NEGATE ? -num : num));
+				remove(j);
+				continue;
+			}
+
+			// push a, push b, op
+			float rhs;
+			int k = next(j);
+			Inst folded;
+			if (get_num(b, rhs) && is_straight(k) && fold_bin_op(insts[k].op(), num, rhs, folded)) {
+				replace(i, folded);
+				remove(j);
+				remove(k);
+				continue;
+			}
+		} else if (get_bool(a, boolean)) {
+			if (b.op() == BC_NOT) {
+				replace(i, make_inst(boolean ? BC_PUSH_FALSE : BC_PUSH_TRUE));
+				remove(j);
+				continue;
+			}
+
+			// while (true), if (false)
+			if (b.op() == BC_JUMP_IF_TRUE_U32 || b.op() == BC_JUMP_IF_FALSE_U32) {
+				if (boolean == (b.op() == BC_JUMP_IF_TRUE_U32)) {
+					int target = b.target;
+					replace(i, make_inst(BC_JUMP_U32));
+					insts[i].target = target;
+				} else {
+					remove(i);
+				}
+				remove(j);
+				continue;
+			}
+		}
+
+		// jump_if_false over a jump: jump_if_true to where that went
+		bool is_cond = a.op() == BC_JUMP_IF_TRUE_U32 || a.op() == BC_JUMP_IF_FALSE_U32 ||
+			a.op() == BC_JUMP_IF_TRUE_U8_U32 || a.op() == BC_JUMP_IF_FALSE_U8_U32;
+		if (is_cond && b.op() == BC_JUMP_U32 && resolve(a.target) == next(j)) {
+			switch (a.op()) {
+			case BC_JUMP_IF_TRUE_U32: a.bc.op = BC_JUMP_IF_FALSE_U32; break;
+			case BC_JUMP_IF_FALSE_U32: a.bc.op = BC_JUMP_IF_TRUE_U32; break;
+			case BC_JUMP_IF_TRUE_U8_U32: a.bc.op = BC_JUMP_IF_FALSE_U8_U32; break;
+			case BC_JUMP_IF_FALSE_U8_U32: a.bc.op = BC_JUMP_IF_TRUE_U8_U32; break;
+			}
+			a.target = b.target;
+			remove(j);
+			continue;
+		}
+	}
+}
+
+void optimize_bc_program(BC_Program& program) {
+	Optimizer opt;
+	opt.decode(program);
+
+	// each pass can make room for the others
+	do {
+		opt.changed = false;
+		opt.thread_jumps();
+		opt.remove_unreachable();
+		opt.combine();
+	} while (opt.changed);
+
+	opt.encode(program);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "bc.h"
+
+// Peephole passes over compiled code: drops pushes that get popped right away,
+// folds arithmetic on constants, threads jumps to jumps, removes unreachable code
+// and fuses a few pairs. Jump targets and function entries are re-linked after.
+// Runs at the end of BC_Compiler::compile unless turned off there.
+void optimize_bc_program(BC_Program& program);
@@ -1,96 +1,414 @@
 #include "bc_util.h"
+#include "bc_vm.h"
 
 #include <stdint.h>
+#include <string.h>
 #include <string_view>
 #include <assert.h>
 #include <iostream>
+#include <algorithm>
 
 static std::string_view opcode_to_str(uint8_t opc) {
 	switch (opc) {
-	case BC_ADD: return "add";
 	case BC_EXIT: return "exit";
-	case BC_SUB: return "sub";
-	case BC_MUL: return "mul";
-	case BC_DIV: return "div";
-	case BC_POP_DISPOSE: return "pop_dispose";
-	case BC_RET: return "ret";
-	case BC_ALLOC_FRAME_U8: return "alloc";
+	case BC_ALLOC_FRAME_U16_U32: return "alloc";
 	case BC_PUSH_VAR_U8: return "push_var";
 	case BC_PUSH_U8: return "push_u8";
-	case BC_PUSH_F32: return "push_f32";
-	case BC_POP_VAR_U8: return "pop_var";
-	case BC_CALL: return "call";
-	case BC_CALL_EXTERN_U16: return "call_extern";
+	case BC_PUSH_CONST_U16: return "push_const";
 	case BC_PUSH_TRUE: return "push_true";
 	case BC_PUSH_FALSE: return "push_false";
 	case BC_PUSH_NULL: return "push_null";
 	case BC_PUSH_FUNC_REF_U32: return "push_func_ref";
-	case BC_JUMP_U32: return "jump";
-	case BC_JUMP_IF_TRUE_U32: return "jump_if_true";
-	case BC_JUMP_IF_FALSE_U32: return "jump_if_false";
-	case BC_EQUALS: return "equals";
-	case BC_NOT_EQUALS: return "not_equals";
+	case BC_PUSH_STR_U16: return "push_str";
+	case BC_PUSH_THIS: return "push_this";
+	case BC_PUSH_GLOBAL_U16: return "push_global";
+	case BC_PUSH_MEMBER_U16: return "push_member";
+	case BC_POP_VAR_U8: return "pop_var";
+	case BC_POP_GLOBAL_U16: return "pop_global";
+	case BC_POP_MEMBER_U16: return "pop_member";
+	case BC_POP_DISPOSE: return "pop_dispose";
+	case BC_DECL_GLOBAL_U16: return "decl_global";
+	case BC_DECL_CONST_GLOBAL_U16: return "decl_const_global";
+	case BC_DUP: return "dup";
+	case BC_DUP2: return "dup2";
+	case BC_CALL_U8: return "call";
+	case BC_CALL_EXTERN_U16_U8: return "call_extern";
+	case BC_CALL_METHOD_U16_U8: return "call_method";
+	case BC_NEW_U16_U8: return "new";
+	case BC_RET: return "ret";
+	case BC_ADD: return "add";
+	case BC_SUB: return "sub";
+	case BC_MUL: return "mul";
+	case BC_DIV: return "div";
 	case BC_GREATER_THAN: return "greater_than";
 	case BC_LESS_THAN: return "less_than";
 	case BC_GREATER_THAN_EQUALS: return "greater_than_equals";
 	case BC_LESS_THAN_EQUALS: return "less_than_equals";
+	case BC_EQUALS: return "equals";
+	case BC_NOT_EQUALS: return "not_equals";
+	case BC_AND: return "and";
+	case BC_OR: return "or";
+	case BC_NEGATE: return "negate";
+	case BC_POSITIVE: return "positive";
+	case BC_NOT: return "not";
+	case BC_IS_U16: return "is";
+	case BC_GET_FIELD_U16: return "get_field";
+	case BC_SET_FIELD_U16: return "set_field";
+	case BC_CHECK_NOT_STRUCT: return "check_not_struct";
+	case BC_GET_INDEX: return "get_index";
+	case BC_SET_INDEX: return "set_index";
+	case BC_ARRAY_U16: return "array";
+	case BC_STRING_INTERP_U16: return "string_interp";
+	case BC_FOR_NEXT_U8_U8_U8_U32: return "for_next";
+	case BC_CLASS_DECL_U16: return "class_decl";
+	case BC_STRUCT_DECL_U16: return "struct_decl";
+	case BC_JUMP_U32: return "jump";
+	case BC_JUMP_IF_TRUE_U32: return "jump_if_true";
+	case BC_JUMP_IF_FALSE_U32: return "jump_if_false";
+	case BC_MOVE_U8_U8: return "move";
+	case BC_LOAD_CONST_U8_U16: return "load_const";
+	case BC_ADD_U8_U8_U8: return "add_r";
+	case BC_SUB_U8_U8_U8: return "sub_r";
+	case BC_MUL_U8_U8_U8: return "mul_r";
+	case BC_DIV_U8_U8_U8: return "div_r";
+	case BC_GREATER_THAN_U8_U8_U8: return "greater_than_r";
+	case BC_LESS_THAN_U8_U8_U8: return "less_than_r";
+	case BC_GREATER_THAN_EQUALS_U8_U8_U8: return "greater_than_equals_r";
+	case BC_LESS_THAN_EQUALS_U8_U8_U8: return "less_than_equals_r";
+	case BC_EQUALS_U8_U8_U8: return "equals_r";
+	case BC_NOT_EQUALS_U8_U8_U8: return "not_equals_r";
+	case BC_JUMP_IF_TRUE_U8_U32: return "jump_if_true_r";
+	case BC_JUMP_IF_FALSE_U8_U32: return "jump_if_false_r";
+	case BC_INC_VAR_U8: return "inc_var";
+	case BC_DEC_VAR_U8: return "dec_var";
+	case BC_INC_GLOBAL_U16: return "inc_global";
+	case BC_DEC_GLOBAL_U16: return "dec_global";
+	case BC_ADD_VAR_VAR_U8_U8: return "add_var_var";
+	case BC_CALL_FUNC_U32_U8: return "call_func";
+	case BC_JUMP_IF_NOT_LESS_THAN_U8_U8_U32: return "jump_if_not_less_than";
+	case BC_JUMP_IF_NOT_LESS_THAN_EQUALS_U8_U8_U32: return "jump_if_not_less_than_equals";
+	case BC_JUMP_IF_NOT_GREATER_THAN_U8_U8_U32: return "jump_if_not_greater_than";
+	case BC_JUMP_IF_NOT_GREATER_THAN_EQUALS_U8_U8_U32: return "jump_if_not_greater_than_equals";
+	case BC_SET_VAR_U8: return "set_var";
+	case BC_WIDE: return "wide";
 	}
 	assert(false);
+	return "?";
 }
 
-static int get_inst_len(uint8_t opc) {
+// a char per operand, in order: 1 for u8, 2 for u16, 4 for u32 and f for f32
+static const char* get_operand_types(uint8_t opc) {
 	switch (opc) {
 	case BC_EXIT:
+	case BC_PUSH_TRUE:
+	case BC_PUSH_FALSE:
+	case BC_PUSH_NULL:
+	case BC_PUSH_THIS:
+	case BC_POP_DISPOSE:
+	case BC_DUP:
+	case BC_DUP2:
+	case BC_RET:
 	case BC_ADD:
 	case BC_SUB:
 	case BC_MUL:
 	case BC_DIV:
-	case BC_POP_DISPOSE:
-	case BC_RET:
-	case BC_PUSH_TRUE:
-	case BC_PUSH_FALSE:
-	case BC_PUSH_NULL:
-	case BC_EQUALS:
-	case BC_NOT_EQUALS:
 	case BC_GREATER_THAN:
 	case BC_LESS_THAN:
 	case BC_GREATER_THAN_EQUALS:
 	case BC_LESS_THAN_EQUALS:
-	case BC_CALL:
-		return 1;
-	case BC_ALLOC_FRAME_U8:
+	case BC_EQUALS:
+	case BC_NOT_EQUALS:
+	case BC_AND:
+	case BC_OR:
+	case BC_NEGATE:
+	case BC_POSITIVE:
+	case BC_NOT:
+	case BC_CHECK_NOT_STRUCT:
+	case BC_GET_INDEX:
+	case BC_SET_INDEX:
+	case BC_WIDE:
+		return "";
 	case BC_PUSH_VAR_U8:
 	case BC_PUSH_U8:
 	case BC_POP_VAR_U8:
-		return 2;
-	case BC_CALL_EXTERN_U16:
-		return 3;
-	case BC_PUSH_F32:
+	case BC_CALL_U8:
+	case BC_INC_VAR_U8:
+	case BC_DEC_VAR_U8:
+	case BC_SET_VAR_U8:
+		return "1";
+	case BC_PUSH_CONST_U16:
+	case BC_PUSH_STR_U16:
+	case BC_PUSH_GLOBAL_U16:
+	case BC_PUSH_MEMBER_U16:
+	case BC_POP_GLOBAL_U16:
+	case BC_POP_MEMBER_U16:
+	case BC_DECL_GLOBAL_U16:
+	case BC_DECL_CONST_GLOBAL_U16:
+	case BC_IS_U16:
+	case BC_GET_FIELD_U16:
+	case BC_SET_FIELD_U16:
+	case BC_ARRAY_U16:
+	case BC_STRING_INTERP_U16:
+	case BC_CLASS_DECL_U16:
+	case BC_STRUCT_DECL_U16:
+	case BC_INC_GLOBAL_U16:
+	case BC_DEC_GLOBAL_U16:
+		return "2";
+	case BC_PUSH_FUNC_REF_U32:
 	case BC_JUMP_U32:
 	case BC_JUMP_IF_TRUE_U32:
 	case BC_JUMP_IF_FALSE_U32:
-	case BC_PUSH_FUNC_REF_U32:
-		return 5;
+		return "4";
+	case BC_MOVE_U8_U8:
+	case BC_ADD_VAR_VAR_U8_U8:
+		return "11";
+	case BC_LOAD_CONST_U8_U16:
+		return "12";
+	case BC_ALLOC_FRAME_U16_U32:
+		return "24";
+	case BC_CALL_EXTERN_U16_U8:
+	case BC_CALL_METHOD_U16_U8:
+	case BC_NEW_U16_U8:
+		return "21";
+	case BC_JUMP_IF_TRUE_U8_U32:
+	case BC_JUMP_IF_FALSE_U8_U32:
+		return "14";
+	case BC_CALL_FUNC_U32_U8:
+		return "41";
+	case BC_ADD_U8_U8_U8:
+	case BC_SUB_U8_U8_U8:
+	case BC_MUL_U8_U8_U8:
+	case BC_DIV_U8_U8_U8:
+	case BC_GREATER_THAN_U8_U8_U8:
+	case BC_LESS_THAN_U8_U8_U8:
+	case BC_GREATER_THAN_EQUALS_U8_U8_U8:
+	case BC_LESS_THAN_EQUALS_U8_U8_U8:
+	case BC_EQUALS_U8_U8_U8:
+	case BC_NOT_EQUALS_U8_U8_U8:
+		return "111";
+	case BC_JUMP_IF_NOT_LESS_THAN_U8_U8_U32:
+	case BC_JUMP_IF_NOT_LESS_THAN_EQUALS_U8_U8_U32:
+	case BC_JUMP_IF_NOT_GREATER_THAN_U8_U8_U32:
+	case BC_JUMP_IF_NOT_GREATER_THAN_EQUALS_U8_U8_U32:
+		return "114";
+	case BC_FOR_NEXT_U8_U8_U8_U32:
+		return "1114";
 	}
 
 	assert(false);
+	return "";
+}
+
+static int get_operand_size(char type, bool wide) {
+	switch (type) {
+	case '1': return wide ? 2 : 1;
+	case '2': return wide ? 4 : 2;
+	default: return 4;
+	}
+}
+
+int get_bc_num_operands(uint8_t opcode) {
+	return (int) strlen(get_operand_types(opcode));
+}
+
+int get_bc_inst_len(const uint8_t* inst) {
+	bool wide = inst[0] == BC_WIDE;
+	const char* types = get_operand_types(inst[wide ? 1 : 0]);
+
+	int len = wide ? 2 : 1;
+	for (const char* type = types; *type != '\0'; type++)
+		len += get_operand_size(*type, wide);
+	return len;
+}
+
+int decode_bc_inst(const uint8_t* code, BC_Inst& inst) {
+	const uint8_t* start = code;
+	bool wide = *code == BC_WIDE;
+	if (wide)
+		code++;
+
+	inst = BC_Inst{};
+	inst.op = *code++;
+
+	const char* types = get_operand_types(inst.op);
+	for (int i = 0; types[i] != '\0'; i++) {
+		int size = get_operand_size(types[i], wide);
+		for (int j = 0; j < size; j++)
+			inst.operands[i] |= (uint32_t) code[j] << (j * 8);
+		code += size;
+	}
+
+	return (int) (code - start);
+}
+
+void encode_bc_inst(const BC_Inst& inst, std::vector<uint8_t>& code) {
+	const char* types = get_operand_types(inst.op);
+
+	bool wide = false;
+	for (int i = 0; types[i] != '\0'; i++) {
+		if ((types[i] == '1' && inst.operands[i] > UINT8_MAX) || (types[i] == '2' && inst.operands[i] > UINT16_MAX))
+			wide = true;
+	}
+
+	if (wide)
+		code.push_back(BC_WIDE);
+	code.push_back(inst.op);
+
+	for (int i = 0; types[i] != '\0'; i++) {
+		int size = get_operand_size(types[i], wide);
+		assert(size == 4 || inst.operands[i] >> (size * 8) == 0);
+		for (int j = 0; j < size; j++)
+			code.push_back(inst.operands[i] >> (j * 8) & 0xFF);
+	}
+}
+
+void get_bc_stack_effect(const BC_Inst& inst, const BC_Program& program, int& pops, int& pushes) {
+	const uint32_t* operands = inst.operands;
+	pops = 0;
+	pushes = 0;
+
+	switch (inst.op) {
+	case BC_PUSH_VAR_U8:
+	case BC_PUSH_U8:
+	case BC_PUSH_CONST_U16:
+	case BC_PUSH_TRUE:
+	case BC_PUSH_FALSE:
+	case BC_PUSH_NULL:
+	case BC_PUSH_FUNC_REF_U32:
+	case BC_PUSH_STR_U16:
+	case BC_PUSH_THIS:
+	case BC_PUSH_GLOBAL_U16:
+	case BC_PUSH_MEMBER_U16:
+	case BC_ADD_VAR_VAR_U8_U8:
+		pushes = 1;
+		break;
+	case BC_POP_VAR_U8:
+	case BC_POP_GLOBAL_U16:
+	case BC_POP_MEMBER_U16:
+	case BC_POP_DISPOSE:
+	case BC_DECL_GLOBAL_U16:
+	case BC_DECL_CONST_GLOBAL_U16:
+	case BC_RET:
+	case BC_CHECK_NOT_STRUCT:
+	case BC_JUMP_IF_TRUE_U32:
+	case BC_JUMP_IF_FALSE_U32:
+		pops = 1;
+		break;
+	case BC_NEGATE:
+	case BC_POSITIVE:
+	case BC_NOT:
+	case BC_IS_U16:
+	case BC_GET_FIELD_U16:
+	case BC_SET_VAR_U8:
+		pops = 1;
+		pushes = 1;
+		break;
+	case BC_DUP:
+		pops = 1;
+		pushes = 2;
+		break;
+	case BC_DUP2:
+		pops = 2;
+		pushes = 4;
+		break;
+	case BC_ADD:
+	case BC_SUB:
+	case BC_MUL:
+	case BC_DIV:
+	case BC_GREATER_THAN:
+	case BC_LESS_THAN:
+	case BC_GREATER_THAN_EQUALS:
+	case BC_LESS_THAN_EQUALS:
+	case BC_EQUALS:
+	case BC_NOT_EQUALS:
+	case BC_AND:
+	case BC_OR:
+	case BC_SET_FIELD_U16:
+	case BC_GET_INDEX:
+		pops = 2;
+		pushes = 1;
+		break;
+	case BC_SET_INDEX:
+		pops = 3;
+		break;
+	case BC_CALL_U8:
+		pops = operands[0] + 1;
+		pushes = 1;
+		break;
+	case BC_CALL_METHOD_U16_U8:
+		pops = operands[1] + 1;
+		pushes = 1;
+		break;
+	case BC_CALL_EXTERN_U16_U8:
+	case BC_NEW_U16_U8:
+	case BC_CALL_FUNC_U32_U8:
+		pops = operands[1];
+		pushes = 1;
+		break;
+	case BC_ARRAY_U16:
+		pops = operands[0];
+		pushes = 1;
+		break;
+	case BC_STRING_INTERP_U16:
+		pops = (int) program.interps[operands[0]].parts.size() - 1;
+		pushes = 1;
+		break;
+	case BC_CLASS_DECL_U16:
+		pops = (int) program.classes[operands[0]].fields.size();
+		break;
+	case BC_STRUCT_DECL_U16:
+		pops = (int) program.structs[operands[0]].fields.size();
+		break;
+	default:
+		// jumps, register forms and the ones on slots or globals
+		break;
+	}
 }
 
 void print_bc_program(const BC_Program& program) {
 	uint32_t pos = 0;
 
 	while (pos < program.code.size()) {
-		uint8_t opc = program.code[pos];
-		
+		BC_Inst inst;
+		int inst_len = decode_bc_inst(&program.code[pos], inst);
+
 		printf("%4d", pos);
-		std::cout << ":    " << opcode_to_str(opc) << " ";
+		std::cout << ":    " << (program.code[pos] == BC_WIDE ? "wide " : "") << opcode_to_str(inst.op) << " ";
+
+		for (int i = 0; i < get_bc_num_operands(inst.op); i++)
+			std::cout << inst.operands[i] << " ";
 
-		int inst_len = get_inst_len(opc);
-		for (int i = 1; i < inst_len; i++)
-			std::cout << (int) program.code[pos + i] << " ";
+		// the constant, if there's one
+		if (inst.op == BC_PUSH_CONST_U16)
+			std::cout << "(" << program.num_consts[inst.operands[0]] << ")";
+		else if (inst.op == BC_LOAD_CONST_U8_U16)
+			std::cout << "(" << program.num_consts[inst.operands[1]] << ")";
+		else if (inst.op == BC_PUSH_STR_U16)
+			std::cout << "(\"" << program.str_consts[inst.operands[0]] << "\")";
+		else if (inst.op == BC_CALL_EXTERN_U16_U8)
+			std::cout << "(" << program.imports[inst.operands[0]].name << ")";
 
 		std::cout << "\n";
 
 		pos += inst_len;
 	}
 }
+
+void print_bc_profile(const BC_Profile& profile, size_t max_lines) {
+	printf("%llu instructions\n", (unsigned long long) profile.dispatches);
+
+	for (int n = 1; n <= BC_Profile::MAX_N; n++) {
+		std::vector<std::pair<uint32_t, uint64_t>> sorted(profile.ngrams[n - 1].begin(), profile.ngrams[n - 1].end());
+		std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+		if (sorted.size() > max_lines)
+			sorted.resize(max_lines);
+
+		std::cout << "\n";
+		for (const auto& [seq, count] : sorted) {
+			printf("%12llu %5.1f%%   ", (unsigned long long) count, 100.0 * count / profile.dispatches);
+			for (int i = n - 1; i >= 0; i--)
+				std::cout << opcode_to_str((seq >> (i * 8)) & 0xFF) << (i > 0 ? ", " : "");
+			std::cout << "\n";
+		}
+	}
+}
@@ -2,4 +2,24 @@
 
 #include "bc.h"
 
+struct BC_Profile;
+
+// an instruction with its operands read out
+struct BC_Inst {
+	uint8_t op = BC_EXIT;
+	uint32_t operands[4] = {};
+};
+
 void print_bc_program(const BC_Program& program);
+// opcode and operands, in bytes, with the WIDE prefix if inst starts with one
+int get_bc_inst_len(const uint8_t* inst);
+int get_bc_num_operands(uint8_t opcode);
+// returns the length, like get_bc_inst_len
+int decode_bc_inst(const uint8_t* code, BC_Inst& inst);
+// the short form if every operand fits in it, WIDE otherwise
+void encode_bc_inst(const BC_Inst& inst, std::vector<uint8_t>& code);
+// how many values inst takes off the op stack and how many it leaves. program has the
+// classes, structs and string interps it refers to
+void get_bc_stack_effect(const BC_Inst& inst, const BC_Program& program, int& pops, int& pushes);
+// the most common sequences of each length, max_lines per length
+void print_bc_profile(const BC_Profile& profile, size_t max_lines = 20);
@@ -0,0 +1,297 @@
+#include "bc_verifier.h"
+#include "bc_util.h"
+
+namespace {
+
+const int NOT_VISITED = -1;
+
+// a function, or the top level at 0
+struct Entry {
+	uint32_t pos;
+	uint32_t num_args;
+};
+
+struct Verifier {
+	const BC_Program& program;
+	const std::vector<Extern_Func>& extern_funcs;
+	std::string error;
+
+	std::vector<bool> is_inst; // an instruction starts there
+	std::vector<int> depth_at; // op stack depth before each instruction, once reached
+	std::vector<int> owner; // the entry each instruction was reached from
+
+	Verifier(const BC_Program& _program, const std::vector<Extern_Func>& _extern_funcs)
+		: program(_program), extern_funcs(_extern_funcs) {}
+
+	bool decode_all();
+	bool verify_entry(int entry_index, const Entry& entry);
+	bool check_operands(const BC_Inst& inst, uint32_t num_slots);
+	bool fail(const std::string& msg, uint32_t pos);
+};
+
+}
+
+// how many of the operands, from the first one, are frame slots
+static int get_num_slot_operands(uint8_t op) {
+	switch (op) {
+	case BC_PUSH_VAR_U8:
+	case BC_POP_VAR_U8:
+	case BC_SET_VAR_U8:
+	case BC_INC_VAR_U8:
+	case BC_DEC_VAR_U8:
+	case BC_LOAD_CONST_U8_U16:
+	case BC_JUMP_IF_TRUE_U8_U32:
+	case BC_JUMP_IF_FALSE_U8_U32:
+		return 1;
+	case BC_MOVE_U8_U8:
+	case BC_ADD_VAR_VAR_U8_U8:
+	case BC_JUMP_IF_NOT_LESS_THAN_U8_U8_U32:
+	case BC_JUMP_IF_NOT_LESS_THAN_EQUALS_U8_U8_U32:
+	case BC_JUMP_IF_NOT_GREATER_THAN_U8_U8_U32:
+	case BC_JUMP_IF_NOT_GREATER_THAN_EQUALS_U8_U8_U32:
+		return 2;
+	case BC_ADD_U8_U8_U8:
+	case BC_SUB_U8_U8_U8:
+	case BC_MUL_U8_U8_U8:
+	case BC_DIV_U8_U8_U8:
+	case BC_GREATER_THAN_U8_U8_U8:
+	case BC_LESS_THAN_U8_U8_U8:
+	case BC_GREATER_THAN_EQUALS_U8_U8_U8:
+	case BC_LESS_THAN_EQUALS_U8_U8_U8:
+	case BC_EQUALS_U8_U8_U8:
+	case BC_NOT_EQUALS_U8_U8_U8:
+	case BC_FOR_NEXT_U8_U8_U8_U32:
+		return 3;
+	default:
+		return 0;
+	}
+}
+
+// the jump target is the last operand
+static bool is_jump(uint8_t op) {
+	switch (op) {
+	case BC_JUMP_U32:
+	case BC_JUMP_IF_TRUE_U32:
+	case BC_JUMP_IF_FALSE_U32:
+	case BC_JUMP_IF_TRUE_U8_U32:
+	case BC_JUMP_IF_FALSE_U8_U32:
+	case BC_FOR_NEXT_U8_U8_U8_U32:
+	case BC_JUMP_IF_NOT_LESS_THAN_U8_U8_U32:
+	case BC_JUMP_IF_NOT_LESS_THAN_EQUALS_U8_U8_U32:
+	case BC_JUMP_IF_NOT_GREATER_THAN_U8_U8_U32:
+	case BC_JUMP_IF_NOT_GREATER_THAN_EQUALS_U8_U8_U32:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool Verifier::fail(const std::string& msg, uint32_t pos) {
+	error = msg + " at " + std::to_string(pos);
+	return false;
+}
+
+bool Verifier::decode_all() {
+	const std::vector<uint8_t>& code = program.code;
+	is_inst.assign(code.size(), false);
+
+	uint32_t pos = 0;
+	while (pos < code.size()) {
+		// the decoder trusts the opcode, and the operands have to be there
+		bool wide = code[pos] == BC_WIDE;
+		if (wide && pos + 1 == code.size())
+			return fail("Truncated instruction", pos);
+
+		uint8_t op = code[pos + (wide ? 1 : 0)];
+		if (op >= BC_NUM_OPCODES || op == BC_WIDE)
+			return fail("Invalid opcode " + std::to_string(op), pos);
+
+		uint32_t len = get_bc_inst_len(&code[pos]);
+		if (len > code.size() - pos)
+			return fail("Truncated instruction", pos);
+
+		is_inst[pos] = true;
+		pos += len;
+	}
+
+	return true;
+}
+
+bool Verifier::check_operands(const BC_Inst& inst, uint32_t num_slots) {
+	const uint32_t* operands = inst.operands;
+
+	for (int i = 0; i < get_num_slot_operands(inst.op); i++) {
+		if (operands[i] >= num_slots)
+			return false;
+	}
+
+	switch (inst.op) {
+	case BC_PUSH_CONST_U16:
+		return operands[0] < program.num_consts.size();
+	case BC_LOAD_CONST_U8_U16:
+		return operands[1] < program.num_consts.size();
+	case BC_PUSH_STR_U16:
+		return operands[0] < program.str_consts.size();
+	case BC_PUSH_MEMBER_U16:
+	case BC_POP_MEMBER_U16:
+	case BC_IS_U16:
+	case BC_GET_FIELD_U16:
+	case BC_SET_FIELD_U16:
+	case BC_CALL_METHOD_U16_U8:
+	case BC_NEW_U16_U8:
+		return operands[0] < program.strings.size();
+	case BC_PUSH_GLOBAL_U16:
+	case BC_POP_GLOBAL_U16:
+	case BC_DECL_GLOBAL_U16:
+	case BC_DECL_CONST_GLOBAL_U16:
+	case BC_INC_GLOBAL_U16:
+	case BC_DEC_GLOBAL_U16:
+		return operands[0] < program.globals.size();
+	case BC_PUSH_FUNC_REF_U32:
+		return operands[0] < program.func_table.size();
+	case BC_CALL_FUNC_U32_U8:
+		return operands[0] < program.func_table.size() && operands[1] == program.func_table[operands[0]].num_args;
+	case BC_CALL_EXTERN_U16_U8:
+		// imports are checked to be linked first
+		return operands[0] < program.imports.size() && (int) operands[1] >= extern_funcs[program.imports[operands[0]].extern_index].min_args;
+	case BC_CLASS_DECL_U16:
+		return operands[0] < program.classes.size();
+	case BC_STRUCT_DECL_U16:
+		return operands[0] < program.structs.size();
+	case BC_STRING_INTERP_U16:
+		return operands[0] < program.interps.size();
+	case BC_FOR_NEXT_U8_U8_U8_U32:
+		// the item is written while the iterable and index are still in use
+		return operands[0] != operands[1] && operands[0] != operands[2] && operands[1] != operands[2];
+	default:
+		return true;
+	}
+}
+
+// follows every path from the entry, with the op stack depth along each
+bool Verifier::verify_entry(int entry_index, const Entry& entry) {
+	const std::vector<uint8_t>& code = program.code;
+	if (entry.pos >= code.size() || !is_inst[entry.pos])
+		return fail("Entry isn't an instruction", entry.pos);
+
+	BC_Inst alloc;
+	decode_bc_inst(&code[entry.pos], alloc);
+	if (alloc.op != BC_ALLOC_FRAME_U16_U32)
+		return fail("Entry doesn't allocate a frame", entry.pos);
+
+	uint32_t num_slots = alloc.operands[0];
+	if (entry.num_args > num_slots || alloc.operands[1] < num_slots)
+		return fail("Frame is too small", entry.pos);
+	int max_depth = (int) (alloc.operands[1] - num_slots);
+
+	std::vector<std::pair<uint32_t, int>> work;
+	auto reach = [&](uint32_t pos, int depth) {
+		if (pos >= code.size() || !is_inst[pos])
+			return fail("Jump doesn't land on an instruction", pos);
+
+		if (depth_at[pos] == NOT_VISITED) {
+			depth_at[pos] = depth;
+			owner[pos] = entry_index;
+			work.push_back({pos, depth});
+		} else if (owner[pos] != entry_index) {
+			return fail("Code is shared between functions", pos);
+		} else if (depth_at[pos] != depth) {
+			return fail("Op stack depth differs between paths", pos);
+		}
+
+		return true;
+	};
+
+	if (!reach(entry.pos, 0))
+		return false;
+
+	while (!work.empty()) {
+		uint32_t pos = work.back().first;
+		int depth = work.back().second;
+		work.pop_back();
+
+		BC_Inst inst;
+		uint32_t next = pos + decode_bc_inst(&code[pos], inst);
+
+		if (inst.op == BC_ALLOC_FRAME_U16_U32 && pos != entry.pos)
+			return fail("Frame allocated inside a function", pos);
+
+		if (!check_operands(inst, num_slots))
+			return fail("Operand out of range", pos);
+
+		int pops, pushes;
+		get_bc_stack_effect(inst, program, pops, pushes);
+		if (pops > depth)
+			return fail("Op stack underflow", pos);
+
+		depth += pushes - pops;
+		if (depth > max_depth)
+			return fail("Op stack goes past the frame", pos);
+
+		if (is_jump(inst.op) && !reach(inst.operands[get_bc_num_operands(inst.op) - 1], depth))
+			return false;
+
+		switch (inst.op) {
+		case BC_EXIT:
+			// leaves the VM without returning from the frames in between
+			if (entry_index != 0)
+				return fail("Exit inside a function", pos);
+			break;
+		case BC_RET:
+		case BC_JUMP_U32:
+			break;
+		default:
+			if (next == code.size())
+				return fail("Code runs past the end", pos);
+			if (!reach(next, depth))
+				return false;
+			break;
+		}
+	}
+
+	return true;
+}
+
+bool verify_bc_program(const BC_Program& program, const std::vector<Extern_Func>& extern_funcs, std::string& error) {
+	Verifier verifier(program, extern_funcs);
+	if (program.code.empty()) {
+		error = "No code";
+		return false;
+	}
+
+	if (!verifier.decode_all()) {
+		error = verifier.error;
+		return false;
+	}
+
+	std::vector<Entry> entries = {{0, 0}};
+	for (const auto& func : program.func_table)
+		entries.push_back({func.entry, func.num_args});
+
+	for (const auto& import : program.imports) {
+		if (import.extern_index >= extern_funcs.size() || extern_funcs[import.extern_index].name != import.name) {
+			error = "Import " + import.name + " isn't linked";
+			return false;
+		}
+	}
+
+	for (const auto& bc_class : program.classes) {
+		for (uint32_t method : bc_class.methods) {
+			if (method >= program.func_table.size()) {
+				error = "Method of " + bc_class.name + " doesn't exist";
+				return false;
+			}
+		}
+	}
+
+	verifier.depth_at.assign(program.code.size(), NOT_VISITED);
+	verifier.owner.assign(program.code.size(), NOT_VISITED);
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (!verifier.verify_entry((int) i, entries[i])) {
+			error = verifier.error;
+			return false;
+		}
+	}
+
+	return true;
+}
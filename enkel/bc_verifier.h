@@ -0,0 +1,14 @@
+#pragma once
+
+#include "bc.h"
+
+// Checks the structure BC_VM relies on while running a program: that the code decodes,
+// jumps land on instructions, the op stack has the same depth wherever control meets
+// and stays within what ALLOC_FRAME_U16_U32 reserved, slots are within the frame, the
+// slots of FOR_NEXT_U8_U8_U8_U32 are distinct, and table, function and import indices
+// exist. Imports have to be linked to extern_funcs. Calls with a fixed target have to
+// pass the right number of args. Types aren't tracked, the VM still checks the values
+// it operates on. Programs from BC_Compiler always pass, ones loaded from a file should
+// be linked and verified against the host's externs before they run. returns false
+// and sets error if not
+bool verify_bc_program(const BC_Program& program, const std::vector<Extern_Func>& extern_funcs, std::string& error);
@@ -1,181 +1,1421 @@
 #include "bc_vm.h"
+#include "interpreter.h"
+#include "bc_util.h"
 
 #include <assert.h>
 #include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
 
-void BC_VM::run(const BC_Program* program, const std::vector<Extern_Func>& extern_funcs) {
-	BC_VM::program = program;
+static Value make_func_ref(uint32_t func_index) {
+	Value val{};
+	val.type = Value_Type::BC_Func_Ref;
+	val.as.i = func_index;
+	return val;
+}
+
+// whether storing b over a changes anything
+static bool is_same_value(const Value& a, const Value& b) {
+	if (a.type != b.type)
+		return false;
+
+	switch (a.type) {
+	case Value_Type::Null: return true;
+	case Value_Type::Num: return a.as.num == b.as.num;
+	case Value_Type::Bool: return a.as._bool == b.as._bool;
+	case Value_Type::GC_Obj: return a.as.ptr == b.as.ptr;
+	case Value_Type::Struct: return a.struct_id == b.struct_id && memcmp(a.as.fields, b.as.fields, sizeof(a.as.fields)) == 0;
+	default: return a.as.i == b.as.i;
+	}
+}
+
+static bool is_instance(const Value& val) {
+	return val.type == Value_Type::GC_Obj && ((GC_Obj*) val.as.ptr)->type == GC_Obj_Type::Instance;
+}
+
+static Bin_Op opcode_to_bin_op(uint8_t op) {
+	switch (op) {
+	case BC_ADD:
+	case BC_ADD_U8_U8_U8:
+	case BC_INC_VAR_U8:
+	case BC_INC_GLOBAL_U16:
+	case BC_ADD_VAR_VAR_U8_U8: return Bin_Op::Add;
+	case BC_SUB:
+	case BC_SUB_U8_U8_U8:
+	case BC_DEC_VAR_U8:
+	case BC_DEC_GLOBAL_U16: return Bin_Op::Sub;
+	case BC_MUL:
+	case BC_MUL_U8_U8_U8: return Bin_Op::Mul;
+	case BC_DIV:
+	case BC_DIV_U8_U8_U8: return Bin_Op::Div;
+	case BC_GREATER_THAN:
+	case BC_GREATER_THAN_U8_U8_U8:
+	case BC_JUMP_IF_NOT_GREATER_THAN_U8_U8_U32: return Bin_Op::Greater_Than;
+	case BC_LESS_THAN:
+	case BC_LESS_THAN_U8_U8_U8:
+	case BC_JUMP_IF_NOT_LESS_THAN_U8_U8_U32: return Bin_Op::Less_Than;
+	case BC_GREATER_THAN_EQUALS:
+	case BC_GREATER_THAN_EQUALS_U8_U8_U8:
+	case BC_JUMP_IF_NOT_GREATER_THAN_EQUALS_U8_U8_U32: return Bin_Op::Greater_Than_Equals;
+	case BC_LESS_THAN_EQUALS:
+	case BC_LESS_THAN_EQUALS_U8_U8_U8:
+	case BC_JUMP_IF_NOT_LESS_THAN_EQUALS_U8_U8_U32: return Bin_Op::Less_Than_Equals;
+	case BC_EQUALS:
+	case BC_EQUALS_U8_U8_U8: return Bin_Op::Equals;
+	case BC_NOT_EQUALS:
+	case BC_NOT_EQUALS_U8_U8_U8: return Bin_Op::Not_Equals;
+	case BC_AND: return Bin_Op::And;
+	case BC_OR: return Bin_Op::Or;
+	}
+	return Bin_Op::Not_A_Bin_Op;
+}
+
+BC_VM::BC_VM(Interpreter& _interp) : interp(_interp) {
+	assert(interp.bc_vm == nullptr);
+	interp.bc_vm = this;
+	alloc_stack();
+}
+
+BC_VM::BC_VM(const BC_VM& parent) :
+	interp(parent.interp), program(parent.program), is_worker(true),
+	str_consts(parent.str_consts), run_id(parent.run_id), global_defs(parent.global_defs), globals_ctx(parent.globals_ctx) {
+	alloc_stack();
+}
+
+BC_VM::~BC_VM() {
+	if (!is_worker && interp.bc_vm == this)
+		interp.bc_vm = nullptr;
+	// anything the script kept still has them, they just aren't roots anymore
+	Context* ctx = interp.ctx;
+	if (!is_worker && ctx->bc_str_consts_run == run_id) {
+		for (const Value& val : ctx->bc_str_consts)
+			((GC_Obj*) val.as.ptr)->pin_count--;
+		ctx->bc_str_consts.clear();
+		ctx->bc_str_consts_run = 0;
+	}
+
+	free(stack);
+	free(frames);
+}
+
+// zeroed memory is null values, and the OS hands it out a page at a time
+void BC_VM::alloc_stack() {
+	stack = (Value*) calloc(STACK_SIZE, sizeof(Value));
+	frames = (BC_Frame*) calloc(MAX_FRAMES, sizeof(BC_Frame));
+	if (stack == nullptr || frames == nullptr) {
+		error("Out of memory");
+	}
+
+	stack_end = stack + STACK_SIZE;
+	sp = stack;
+	frames_end = frames + MAX_FRAMES;
+	fp = frames;
+}
+
+void BC_VM::push_frame(uint32_t num_args, uint32_t return_pos, GC_Obj_Instance* this_obj, bool constructing) {
+	if (fp + 1 == frames_end) {
+		error("Stack overflow");
+	}
+
+	*++fp = {return_pos, (uint32_t) (sp - num_args - stack), this_obj, constructing};
+}
+
+void BC_VM::check_stack(size_t count) {
+	if ((size_t) (stack_end - sp) < count) {
+		error("Stack overflow");
+	}
+}
+
+// each context gets its own, so no context holds objects from another one's heap
+void BC_VM::bind_str_consts() {
+	Context* ctx = interp.ctx;
+	if (ctx->bc_str_consts_run != run_id) {
+		// anything the script kept still has the old ones, they just aren't roots anymore
+		for (const Value& val : ctx->bc_str_consts)
+			((GC_Obj*) val.as.ptr)->pin_count--;
+		ctx->bc_str_consts.clear();
+
+		ctx->bc_str_consts.reserve(program->str_consts.size());
+		for (const std::string& str : program->str_consts) {
+			Value val = interp.create_string(str);
+			((GC_Obj*) val.as.ptr)->pin_count++;
+			ctx->bc_str_consts.push_back(val);
+		}
+		ctx->bc_str_consts_run = run_id;
+	}
+
+	str_consts = ctx->bc_str_consts.data();
+}
+
+void BC_VM::run(const BC_Program* _program) {
+	program = _program;
+	global_defs.assign(program->globals.size(), nullptr);
+	globals_ctx = interp.ctx;
+	run_id = ++interp.num_bc_runs;
+	bind_str_consts();
+
+	// global functions are shared by all contexts, like in the interpreter
+	for (uint32_t i = 0; i < program->func_table.size(); i++) {
+		const BC_Func& func = program->func_table[i];
+		if (!func.is_global)
+			continue;
+
+		Definition* existing = interp.program_scope.find_def(func.name);
+		if (existing != nullptr) {
+			// already declared when the program ran in another context
+			if (existing->value.type == Value_Type::BC_Func_Ref && existing->value.as.i == (int32_t) i)
+				continue;
+
+			error("Conflicting function name: " + func.name);
+		}
+
+		interp.program_scope.set_def(func.name, make_func_ref(i), DEF_FUNC);
+	}
 
+	uint32_t prev_pos = pos;
+	BC_Frame* prev_fp = fp;
+	Value* prev_sp = sp;
+
+	push_frame(0, RETURN_TO_HOST, nullptr, false);
 	pos = 0;
+	execute();
+
+	// the top level has no RET
+	fp = prev_fp;
+	sp = prev_sp;
+	pos = prev_pos;
+}
 
-	while (pos < program->code.size()) {
-		uint8_t op = eat_u8();
+Value BC_VM::call(uint32_t func_index, const Value* args, size_t count, GC_Obj_Instance* obj) {
+	assert(program != nullptr && func_index < program->func_table.size());
+	const BC_Func& func = program->func_table[func_index];
+	if (count != func.num_args) {
+		error("Incorrect number of arguments");
+	}
 
-		switch (op) {
-		case BC_EXIT:
-			return;
-		case BC_ALLOC_FRAME_U8: {
-			uint32_t num_vars = eat_u8();
-			frame_stack.push_back({(uint32_t)var_stack.size(), num_vars});
-			for (int i = 0; i < num_vars; i++)
-				var_stack.push_back({});
-			break;
+	uint32_t prev_pos = pos;
+	if (!is_worker)
+		bind_str_consts();
+
+	check_stack(count);
+	for (size_t i = 0; i < count; i++)
+		*sp++ = args[i];
+
+	push_frame(func.num_args, RETURN_TO_HOST, func.is_method ? obj : nullptr, false);
+	pos = func.entry;
+	execute();
+
+	Value result = *--sp;
+
+	pos = prev_pos;
+	return result;
+}
+
+void BC_VM::call_batch(uint32_t func_index, const std::vector<const Value*>& columns, size_t count, Value* results, GC_Obj_Instance* obj) {
+	assert(program != nullptr && func_index < program->func_table.size());
+	const BC_Func& func = program->func_table[func_index];
+	if (columns.size() != func.num_args) {
+		error("Incorrect number of arguments");
+	}
+
+	uint32_t prev_pos = pos;
+	if (!is_worker)
+		bind_str_consts();
+	check_stack(func.num_args);
+
+	for (size_t i = 0; i < count; i++) {
+		for (size_t j = 0; j < columns.size(); j++)
+			*sp++ = columns[j][i];
+
+		push_frame(func.num_args, RETURN_TO_HOST, func.is_method ? obj : nullptr, false);
+		pos = func.entry;
+		execute();
+
+		results[i] = *--sp;
+	}
+
+	pos = prev_pos;
+}
+
+// every opcode, in the order of the enum in bc.h
+#define BC_OPCODE_LIST(X) \
+	X(BC_EXIT) X(BC_ALLOC_FRAME_U16_U32) X(BC_PUSH_VAR_U8) X(BC_PUSH_U8) X(BC_PUSH_CONST_U16) \
+	X(BC_PUSH_TRUE) X(BC_PUSH_FALSE) X(BC_PUSH_NULL) X(BC_PUSH_FUNC_REF_U32) X(BC_PUSH_STR_U16) \
+	X(BC_PUSH_THIS) X(BC_PUSH_GLOBAL_U16) X(BC_PUSH_MEMBER_U16) X(BC_POP_VAR_U8) X(BC_POP_GLOBAL_U16) \
+	X(BC_POP_MEMBER_U16) X(BC_POP_DISPOSE) X(BC_DECL_GLOBAL_U16) X(BC_DECL_CONST_GLOBAL_U16) X(BC_DUP) \
+	X(BC_DUP2) X(BC_CALL_U8) X(BC_CALL_EXTERN_U16_U8) X(BC_CALL_METHOD_U16_U8) X(BC_NEW_U16_U8) \
+	X(BC_RET) X(BC_ADD) X(BC_SUB) X(BC_MUL) X(BC_DIV) \
+	X(BC_GREATER_THAN) X(BC_LESS_THAN) X(BC_GREATER_THAN_EQUALS) X(BC_LESS_THAN_EQUALS) X(BC_EQUALS) \
+	X(BC_NOT_EQUALS) X(BC_AND) X(BC_OR) X(BC_NEGATE) X(BC_POSITIVE) \
+	X(BC_NOT) X(BC_IS_U16) X(BC_GET_FIELD_U16) X(BC_SET_FIELD_U16) X(BC_CHECK_NOT_STRUCT) \
+	X(BC_GET_INDEX) X(BC_SET_INDEX) X(BC_ARRAY_U16) X(BC_STRING_INTERP_U16) X(BC_FOR_NEXT_U8_U8_U8_U32) \
+	X(BC_CLASS_DECL_U16) X(BC_STRUCT_DECL_U16) X(BC_JUMP_U32) X(BC_JUMP_IF_TRUE_U32) X(BC_JUMP_IF_FALSE_U32) \
+	X(BC_MOVE_U8_U8) X(BC_LOAD_CONST_U8_U16) X(BC_ADD_U8_U8_U8) X(BC_SUB_U8_U8_U8) X(BC_MUL_U8_U8_U8) \
+	X(BC_DIV_U8_U8_U8) X(BC_GREATER_THAN_U8_U8_U8) X(BC_LESS_THAN_U8_U8_U8) X(BC_GREATER_THAN_EQUALS_U8_U8_U8) X(BC_LESS_THAN_EQUALS_U8_U8_U8) \
+	X(BC_EQUALS_U8_U8_U8) X(BC_NOT_EQUALS_U8_U8_U8) X(BC_JUMP_IF_TRUE_U8_U32) X(BC_JUMP_IF_FALSE_U8_U32) \
+	X(BC_INC_VAR_U8) X(BC_DEC_VAR_U8) X(BC_INC_GLOBAL_U16) X(BC_DEC_GLOBAL_U16) X(BC_ADD_VAR_VAR_U8_U8) \
+	X(BC_CALL_FUNC_U32_U8) X(BC_JUMP_IF_NOT_LESS_THAN_U8_U8_U32) X(BC_JUMP_IF_NOT_LESS_THAN_EQUALS_U8_U8_U32) \
+	X(BC_JUMP_IF_NOT_GREATER_THAN_U8_U8_U32) X(BC_JUMP_IF_NOT_GREATER_THAN_EQUALS_U8_U8_U32) X(BC_SET_VAR_U8) \
+	X(BC_WIDE)
+
+#define BC_OPCODE_VALUE(opcode) opcode,
+static constexpr uint8_t opcode_list[] = {BC_OPCODE_LIST(BC_OPCODE_VALUE)};
+
+static constexpr bool is_opcode_list_complete() {
+	for (size_t i = 0; i < sizeof(opcode_list); i++) {
+		if (opcode_list[i] != i)
+			return false;
+	}
+	return sizeof(opcode_list) == BC_NUM_OPCODES;
+}
+static_assert(is_opcode_list_complete(), "BC_OPCODE_LIST has to match the opcodes in bc.h");
+
+// operands are unaligned and little endian, like the platforms this runs on
+static inline uint8_t read_u8(const uint8_t*& ip) {
+	return *ip++;
+}
+
+static inline uint16_t read_u16(const uint8_t*& ip) {
+	uint16_t word;
+	memcpy(&word, ip, sizeof(word));
+	ip += sizeof(word);
+	return word;
+}
+
+static inline uint32_t read_u32(const uint8_t*& ip) {
+	uint32_t word;
+	memcpy(&word, ip, sizeof(word));
+	ip += sizeof(word);
+	return word;
+}
+
+
+// computed goto where the compiler has it, a switch everywhere else. either way
+// there's no bounds check, every function ends with RET and the top level with EXIT.
+// define BC_NO_THREADED_DISPATCH to compare
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(BC_NO_THREADED_DISPATCH)
+#define BC_THREADED_DISPATCH
+#endif
+
+#ifdef BC_THREADED_DISPATCH
+#define VM_CASE(opcode) label_##opcode:
+#define VM_NEXT() goto *table[op = *ip++]
+#else
+#define VM_CASE(opcode) case opcode:
+#define VM_NEXT() continue
+#endif
+
+// each handler reads its operands into opnd0..3 and then has a second label, where
+// BC_WIDE goes once it has read the wide operands
+#define VM_WIDE(opcode) wide_##opcode:
+#define BC_WIDE_CASE(opcode) case opcode: goto wide_##opcode;
+
+// anything that can call a function or an extern needs pos, and the var stack
+// may have moved once it returns. so does anything that can fail, for the line
+// in the error
+#define VM_SAVE_POS() pos = (uint32_t) (ip - code)
+#define VM_LOAD_POS() ip = code + pos; vars = stack + fp->base
+
+#define VM_BIN_OP(opcode, result) \
+	VM_CASE(opcode) VM_WIDE(opcode) { \
+		Value rval = sp[-1]; \
+		sp--; \
+		Value& lval = sp[-1]; \
+		if (lval.type == Value_Type::Num && rval.type == Value_Type::Num) { \
+			float a = lval.as.num; \
+			float b = rval.as.num; \
+			lval = result; \
+		} else { \
+			VM_SAVE_POS(); \
+			lval = interp.apply_bin_op(opcode_to_bin_op(opcode), lval, rval, nullptr); \
+		} \
+		VM_NEXT(); \
+	}
+
+#define VM_REG_OP(opcode, result) \
+	VM_CASE(opcode) \
+		opnd0 = ip[0]; \
+		opnd1 = ip[1]; \
+		opnd2 = ip[2]; \
+		ip += 3; \
+	VM_WIDE(opcode) { \
+		Value& dst = vars[opnd0]; \
+		const Value& lval = vars[opnd1]; \
+		const Value& rval = vars[opnd2]; \
+		if (lval.type == Value_Type::Num && rval.type == Value_Type::Num) { \
+			float a = lval.as.num; \
+			float b = rval.as.num; \
+			dst = result; \
+		} else { \
+			VM_SAVE_POS(); \
+			dst = interp.apply_bin_op(opcode_to_bin_op(opcode), lval, rval, nullptr); \
+		} \
+		VM_NEXT(); \
+	}
+
+#define VM_COND_JUMP(opcode, result) \
+	VM_CASE(opcode) \
+		opnd0 = ip[0]; \
+		opnd1 = ip[1]; \
+		ip += 2; \
+		opnd2 = read_u32(ip); \
+	VM_WIDE(opcode) { \
+		const Value& lval = vars[opnd0]; \
+		const Value& rval = vars[opnd1]; \
+		bool cond; \
+		if (lval.type == Value_Type::Num && rval.type == Value_Type::Num) { \
+			float a = lval.as.num; \
+			float b = rval.as.num; \
+			cond = result; \
+		} else { \
+			VM_SAVE_POS(); \
+			cond = interp.apply_bin_op(opcode_to_bin_op(opcode), lval, rval, nullptr).as._bool; \
+		} \
+		if (!cond) \
+			ip = code + opnd2; \
+		VM_NEXT(); \
+	}
+
+void BC_VM::execute() {
+	const uint8_t* code = program->code.data();
+	const uint8_t* ip = code + pos;
+	Value* vars = stack + fp->base;
+	uint8_t op;
+	uint32_t opnd0, opnd1, opnd2, opnd3;
+
+#ifdef BC_THREADED_DISPATCH
+#define BC_OPCODE_LABEL(opcode) &&label_##opcode,
+#define BC_PROFILE_LABEL(opcode) &&label_profile,
+	static const void* const dispatch_table[] = {BC_OPCODE_LIST(BC_OPCODE_LABEL)};
+	// every opcode goes through record_op first
+	static const void* const profile_table[] = {BC_OPCODE_LIST(BC_PROFILE_LABEL)};
+	const void* const* table = profile != nullptr ? profile_table : dispatch_table;
+	VM_NEXT();
+
+label_profile:
+	record_op(op);
+	goto *dispatch_table[op];
+#else
+	while (true) {
+	op = *ip++;
+	if (profile != nullptr)
+		record_op(op);
+
+	switch (op) {
+#endif
+
+	VM_CASE(BC_EXIT) VM_WIDE(BC_EXIT)
+		return;
+	VM_CASE(BC_ALLOC_FRAME_U16_U32)
+		opnd0 = read_u16(ip);
+		opnd1 = read_u32(ip);
+	VM_WIDE(BC_ALLOC_FRAME_U16_U32) {
+		// the args are already in the first slots, the rest start out null
+		vars = stack + fp->base;
+		if (opnd1 > (uint32_t) (stack_end - vars)) {
+			VM_SAVE_POS();
+			error("Stack overflow");
 		}
-		case BC_PUSH_U8:
-			op_stack.push_back(Value::from_num(eat_u8()));
-			break;
-		case BC_PUSH_F32:
-			op_stack.push_back(Value::from_num(eat_f32()));
-			break;
-		case BC_PUSH_TRUE:
-			op_stack.push_back(Value::from_bool(true));
-			break;
-		case BC_PUSH_FALSE:
-			op_stack.push_back(Value::from_bool(false));
-			break;
-		case BC_PUSH_NULL:
-			op_stack.push_back(Value::null_value());
-			break;
-		case BC_PUSH_VAR_U8: {
-			int var_index = eat_u8();
-			const BC_Frame& cur_frame = frame_stack.back();
 
-			op_stack.push_back(var_stack[cur_frame.start + var_index]);
-			break;
+		Value* locals_end = vars + opnd0;
+		for (; sp < locals_end; sp++)
+			*sp = Value::null_value();
+		VM_NEXT();
+	}
+	VM_CASE(BC_PUSH_VAR_U8)
+		opnd0 = read_u8(ip);
+	VM_WIDE(BC_PUSH_VAR_U8)
+		*sp++ = vars[opnd0];
+		VM_NEXT();
+	VM_CASE(BC_PUSH_U8)
+		opnd0 = read_u8(ip);
+	VM_WIDE(BC_PUSH_U8)
+		*sp++ = Value::from_num(opnd0);
+		VM_NEXT();
+	VM_CASE(BC_PUSH_CONST_U16)
+		opnd0 = read_u16(ip);
+	VM_WIDE(BC_PUSH_CONST_U16)
+		*sp++ = Value::from_num(program->num_consts[opnd0]);
+		VM_NEXT();
+	VM_CASE(BC_PUSH_TRUE) VM_WIDE(BC_PUSH_TRUE)
+		*sp++ = Value::from_bool(true);
+		VM_NEXT();
+	VM_CASE(BC_PUSH_FALSE) VM_WIDE(BC_PUSH_FALSE)
+		*sp++ = Value::from_bool(false);
+		VM_NEXT();
+	VM_CASE(BC_PUSH_NULL) VM_WIDE(BC_PUSH_NULL)
+		*sp++ = Value::null_value();
+		VM_NEXT();
+	VM_CASE(BC_PUSH_FUNC_REF_U32)
+		opnd0 = read_u32(ip);
+	VM_WIDE(BC_PUSH_FUNC_REF_U32)
+		*sp++ = make_func_ref(opnd0);
+		VM_NEXT();
+	VM_CASE(BC_PUSH_STR_U16)
+		opnd0 = read_u16(ip);
+	VM_WIDE(BC_PUSH_STR_U16)
+		*sp++ = str_consts[opnd0];
+		VM_NEXT();
+	VM_CASE(BC_PUSH_THIS) VM_WIDE(BC_PUSH_THIS) {
+		GC_Obj_Instance* this_obj = fp->this_obj;
+		if (this_obj == nullptr) {
+			VM_SAVE_POS();
+			error("Not in a class");
 		}
-		case BC_PUSH_FUNC_REF_U32: {
-			uint32_t func_index = eat_u32();
 
-			Value val{};
-			val.type = Value_Type::BC_Func_Ref;
-			val.as.i = func_index;
+		*sp++ = Value::from_gc_obj(this_obj);
+		VM_NEXT();
+	}
+	VM_CASE(BC_PUSH_GLOBAL_U16)
+		opnd0 = read_u16(ip);
+	VM_WIDE(BC_PUSH_GLOBAL_U16)
+		VM_SAVE_POS();
+		*sp++ = find_global(opnd0)->value;
+		VM_NEXT();
+	VM_CASE(BC_PUSH_MEMBER_U16)
+		opnd0 = read_u16(ip);
+	VM_WIDE(BC_PUSH_MEMBER_U16)
+		VM_SAVE_POS();
+		*sp++ = find_member(opnd0)->value;
+		VM_NEXT();
+	VM_CASE(BC_POP_VAR_U8)
+		opnd0 = read_u8(ip);
+	VM_WIDE(BC_POP_VAR_U8)
+		vars[opnd0] = sp[-1];
+		sp--;
+		VM_NEXT();
+	VM_CASE(BC_SET_VAR_U8)
+		opnd0 = read_u8(ip);
+	VM_WIDE(BC_SET_VAR_U8)
+		vars[opnd0] = sp[-1];
+		VM_NEXT();
+	VM_CASE(BC_POP_GLOBAL_U16)
+		opnd0 = read_u16(ip);
+	VM_WIDE(BC_POP_GLOBAL_U16)
+		VM_SAVE_POS();
+		store(find_global(opnd0), sp[-1]);
+		sp--;
+		VM_NEXT();
+	VM_CASE(BC_POP_MEMBER_U16)
+		opnd0 = read_u16(ip);
+	VM_WIDE(BC_POP_MEMBER_U16)
+		VM_SAVE_POS();
+		store(find_member(opnd0), sp[-1]);
+		sp--;
+		VM_NEXT();
+	VM_CASE(BC_POP_DISPOSE) VM_WIDE(BC_POP_DISPOSE)
+		sp--;
+		VM_NEXT();
+	VM_CASE(BC_DECL_GLOBAL_U16)
+	VM_CASE(BC_DECL_CONST_GLOBAL_U16)
+		opnd0 = read_u16(ip);
+	VM_WIDE(BC_DECL_GLOBAL_U16)
+	VM_WIDE(BC_DECL_CONST_GLOBAL_U16)
+		VM_SAVE_POS();
+		declare_global(opnd0, op == BC_DECL_CONST_GLOBAL_U16);
+		VM_NEXT();
+	VM_CASE(BC_DUP) VM_WIDE(BC_DUP)
+		sp[0] = sp[-1];
+		sp++;
+		VM_NEXT();
+	VM_CASE(BC_DUP2) VM_WIDE(BC_DUP2) {
+		sp[0] = sp[-2];
+		sp[1] = sp[-1];
+		sp += 2;
+		VM_NEXT();
+	}
+	VM_CASE(BC_CALL_U8)
+		opnd0 = read_u8(ip);
+	VM_WIDE(BC_CALL_U8) {
+		// the args move down over func, to where the callee's slots start
+		Value* args = sp - opnd0;
+		Value func = args[-1];
+		memmove(args - 1, args, opnd0 * sizeof(Value));
+		sp--;
 
-			op_stack.push_back(val);
-			break;
+		VM_SAVE_POS();
+		call_value(func, opnd0, fp->this_obj, false);
+		VM_LOAD_POS();
+		VM_NEXT();
+	}
+	VM_CASE(BC_CALL_EXTERN_U16_U8)
+		opnd0 = read_u16(ip);
+		opnd1 = read_u8(ip);
+	VM_WIDE(BC_CALL_EXTERN_U16_U8)
+		VM_SAVE_POS();
+		call_extern(program->imports[opnd0].extern_index, opnd1);
+		VM_LOAD_POS();
+		VM_NEXT();
+	VM_CASE(BC_CALL_METHOD_U16_U8)
+		opnd0 = read_u16(ip);
+		opnd1 = read_u8(ip);
+	VM_WIDE(BC_CALL_METHOD_U16_U8)
+		VM_SAVE_POS();
+		call_method(opnd0, opnd1);
+		VM_LOAD_POS();
+		VM_NEXT();
+	VM_CASE(BC_NEW_U16_U8)
+		opnd0 = read_u16(ip);
+		opnd1 = read_u8(ip);
+	VM_WIDE(BC_NEW_U16_U8)
+		VM_SAVE_POS();
+		construct(interp.create_instance(program->strings[opnd0], nullptr), opnd1);
+		VM_LOAD_POS();
+		VM_NEXT();
+	VM_CASE(BC_RET) VM_WIDE(BC_RET) {
+		// the result goes where the callee's slots started
+		Value* base = stack + fp->base;
+		*base = fp->constructing ? Value::from_gc_obj(fp->this_obj) : sp[-1];
+		sp = base + 1;
+
+		pos = fp->return_pos;
+		fp--;
+
+		if (pos == RETURN_TO_HOST)
+			return;
+
+		VM_LOAD_POS();
+		VM_NEXT();
+	}
+	VM_BIN_OP(BC_ADD, Value::from_num(a + b))
+	VM_BIN_OP(BC_SUB, Value::from_num(a - b))
+	VM_BIN_OP(BC_MUL, Value::from_num(a * b))
+	VM_BIN_OP(BC_DIV, Value::from_num(a / b))
+	VM_BIN_OP(BC_GREATER_THAN, Value::from_bool(a > b))
+	VM_BIN_OP(BC_LESS_THAN, Value::from_bool(a < b))
+	VM_BIN_OP(BC_GREATER_THAN_EQUALS, Value::from_bool(a >= b))
+	VM_BIN_OP(BC_LESS_THAN_EQUALS, Value::from_bool(a <= b))
+	VM_BIN_OP(BC_EQUALS, Value::from_bool(a == b))
+	VM_BIN_OP(BC_NOT_EQUALS, Value::from_bool(a != b))
+	VM_CASE(BC_AND) VM_WIDE(BC_AND)
+	VM_CASE(BC_OR) VM_WIDE(BC_OR) {
+		// only bools, apply_bin_op reports anything else
+		Value rval = sp[-1];
+		sp--;
+		VM_SAVE_POS();
+		sp[-1] = interp.apply_bin_op(opcode_to_bin_op(op), sp[-1], rval, nullptr);
+		VM_NEXT();
+	}
+	VM_CASE(BC_NEGATE) VM_WIDE(BC_NEGATE)
+	VM_CASE(BC_POSITIVE) VM_WIDE(BC_POSITIVE) {
+		Value& val = sp[-1];
+		VM_SAVE_POS();
+		float num = interp.expect_value(val, Value_Type::Num, nullptr).as.num;
+		val = Value::from_num(op == BC_NEGATE ? -num : num);
+		VM_NEXT();
+	}
+	VM_CASE(BC_NOT) VM_WIDE(BC_NOT) {
+		Value& val = sp[-1];
+		VM_SAVE_POS();
+		bool b = interp.expect_value(val, Value_Type::Bool, nullptr).as._bool;
+		val = Value::from_bool(!b);
+		VM_NEXT();
+	}
+	VM_CASE(BC_IS_U16)
+		opnd0 = read_u16(ip);
+	VM_WIDE(BC_IS_U16) {
+		const std::string& class_name = program->strings[opnd0];
+		Value& val = sp[-1];
+		val = Value::from_bool(is_instance(val) && ((GC_Obj_Instance*) val.as.ptr)->class_name == class_name);
+		VM_NEXT();
+	}
+	VM_CASE(BC_GET_FIELD_U16)
+		opnd0 = read_u16(ip);
+	VM_WIDE(BC_GET_FIELD_U16)
+		VM_SAVE_POS();
+		get_field(opnd0);
+		VM_NEXT();
+	VM_CASE(BC_SET_FIELD_U16)
+		opnd0 = read_u16(ip);
+	VM_WIDE(BC_SET_FIELD_U16)
+		VM_SAVE_POS();
+		set_field(opnd0);
+		VM_NEXT();
+	VM_CASE(BC_CHECK_NOT_STRUCT) VM_WIDE(BC_CHECK_NOT_STRUCT)
+		if (sp[-1].type == Value_Type::Struct) {
+			VM_SAVE_POS();
+			error("Expression is not modifiable");
 		}
-		case BC_POP_DISPOSE:
-			op_stack.pop_back();
-			break;
-		case BC_POP_VAR_U8: {
-			int var_index = eat_u8();
-			const BC_Frame& cur_frame = frame_stack.back();
+		sp--;
+		VM_NEXT();
+	VM_CASE(BC_GET_INDEX) VM_WIDE(BC_GET_INDEX)
+		VM_SAVE_POS();
+		get_index();
+		VM_NEXT();
+	VM_CASE(BC_SET_INDEX) VM_WIDE(BC_SET_INDEX)
+		VM_SAVE_POS();
+		set_index();
+		VM_NEXT();
+	VM_CASE(BC_ARRAY_U16)
+		opnd0 = read_u16(ip);
+	VM_WIDE(BC_ARRAY_U16)
+		VM_SAVE_POS();
+		make_array(opnd0);
+		VM_NEXT();
+	VM_CASE(BC_STRING_INTERP_U16)
+		opnd0 = read_u16(ip);
+	VM_WIDE(BC_STRING_INTERP_U16)
+		VM_SAVE_POS();
+		make_string(opnd0);
+		VM_NEXT();
+	VM_CASE(BC_FOR_NEXT_U8_U8_U8_U32)
+		opnd0 = ip[0];
+		opnd1 = ip[1];
+		opnd2 = ip[2];
+		ip += 3;
+		opnd3 = read_u32(ip);
+	VM_WIDE(BC_FOR_NEXT_U8_U8_U8_U32) {
+		const Value& iterable = vars[opnd0];
+		Value& index_val = vars[opnd1];
+		Value& item = vars[opnd2];
 
-			var_stack[cur_frame.start + var_index] = op_stack.back();
-			op_stack.pop_back();
-			break;
+		// the slot is an ordinary local, a loaded program may have put anything there
+		if (index_val.type != Value_Type::Num || !(index_val.as.num >= 0 && index_val.as.num < INT_MAX)) {
+			VM_SAVE_POS();
+			error("Expected a number index");
 		}
-		case BC_CALL: {
-			Value func_val = op_stack.back();
-			op_stack.pop_back();
+		int index = (int) index_val.as.num;
 
-			if (func_val.type != Value_Type::BC_Func_Ref) {
-				assert(false);
+		if (iterable.type == Value_Type::Num) {
+			if (index >= (int) iterable.as.num) {
+				ip = code + opnd3;
+				VM_NEXT();
 			}
 
-			const BC_Func& func = program->func_table[func_val.as.i];
+			item = Value::from_num(index);
+		} else if (iterable.type == Value_Type::GC_Obj && ((GC_Obj*) iterable.as.ptr)->type == GC_Obj_Type::Array) {
+			// the array may change size while looping
+			GC_Obj_Array* arr = (GC_Obj_Array*) iterable.as.ptr;
+			if (index >= arr->arr.size()) {
+				ip = code + opnd3;
+				VM_NEXT();
+			}
 
-			call_stack.push_back(pos);
-			pos = func.entry;
-			break;
+			item = arr->arr[index];
+		} else {
+			VM_SAVE_POS();
+			error("Object is not iterable");
+		}
+
+		index_val.as.num = index + 1;
+		VM_NEXT();
+	}
+	VM_CASE(BC_CLASS_DECL_U16)
+		opnd0 = read_u16(ip);
+	VM_WIDE(BC_CLASS_DECL_U16)
+		VM_SAVE_POS();
+		declare_class(opnd0);
+		VM_NEXT();
+	VM_CASE(BC_STRUCT_DECL_U16)
+		opnd0 = read_u16(ip);
+	VM_WIDE(BC_STRUCT_DECL_U16)
+		VM_SAVE_POS();
+		declare_struct(opnd0);
+		VM_NEXT();
+	VM_CASE(BC_JUMP_U32)
+		opnd0 = read_u32(ip);
+	VM_WIDE(BC_JUMP_U32)
+		ip = code + opnd0;
+		VM_NEXT();
+	VM_CASE(BC_JUMP_IF_TRUE_U32)
+	VM_CASE(BC_JUMP_IF_FALSE_U32)
+		opnd0 = read_u32(ip);
+	VM_WIDE(BC_JUMP_IF_TRUE_U32)
+	VM_WIDE(BC_JUMP_IF_FALSE_U32) {
+		if (sp[-1].type != Value_Type::Bool) {
+			VM_SAVE_POS();
+			error("Expected bool");
+		}
+
+		bool b = sp[-1].as._bool;
+		sp--;
+
+		if ((op != BC_JUMP_IF_TRUE_U32) != b)
+			ip = code + opnd0;
+		VM_NEXT();
+	}
+	VM_CASE(BC_MOVE_U8_U8)
+		opnd0 = ip[0];
+		opnd1 = ip[1];
+		ip += 2;
+	VM_WIDE(BC_MOVE_U8_U8)
+		vars[opnd0] = vars[opnd1];
+		VM_NEXT();
+	VM_CASE(BC_LOAD_CONST_U8_U16)
+		opnd0 = read_u8(ip);
+		opnd1 = read_u16(ip);
+	VM_WIDE(BC_LOAD_CONST_U8_U16)
+		vars[opnd0] = Value::from_num(program->num_consts[opnd1]);
+		VM_NEXT();
+	VM_REG_OP(BC_ADD_U8_U8_U8, Value::from_num(a + b))
+	VM_REG_OP(BC_SUB_U8_U8_U8, Value::from_num(a - b))
+	VM_REG_OP(BC_MUL_U8_U8_U8, Value::from_num(a * b))
+	VM_REG_OP(BC_DIV_U8_U8_U8, Value::from_num(a / b))
+	VM_REG_OP(BC_GREATER_THAN_U8_U8_U8, Value::from_bool(a > b))
+	VM_REG_OP(BC_LESS_THAN_U8_U8_U8, Value::from_bool(a < b))
+	VM_REG_OP(BC_GREATER_THAN_EQUALS_U8_U8_U8, Value::from_bool(a >= b))
+	VM_REG_OP(BC_LESS_THAN_EQUALS_U8_U8_U8, Value::from_bool(a <= b))
+	VM_REG_OP(BC_EQUALS_U8_U8_U8, Value::from_bool(a == b))
+	VM_REG_OP(BC_NOT_EQUALS_U8_U8_U8, Value::from_bool(a != b))
+	VM_CASE(BC_JUMP_IF_TRUE_U8_U32)
+	VM_CASE(BC_JUMP_IF_FALSE_U8_U32)
+		opnd0 = read_u8(ip);
+		opnd1 = read_u32(ip);
+	VM_WIDE(BC_JUMP_IF_TRUE_U8_U32)
+	VM_WIDE(BC_JUMP_IF_FALSE_U8_U32) {
+		const Value& val = vars[opnd0];
+		if (val.type != Value_Type::Bool) {
+			VM_SAVE_POS();
+			error("Expected bool");
+		}
+
+		if ((op != BC_JUMP_IF_TRUE_U8_U32) != val.as._bool)
+			ip = code + opnd1;
+		VM_NEXT();
+	}
+	VM_CASE(BC_INC_VAR_U8)
+	VM_CASE(BC_DEC_VAR_U8)
+		opnd0 = read_u8(ip);
+	VM_WIDE(BC_INC_VAR_U8)
+	VM_WIDE(BC_DEC_VAR_U8) {
+		Value& val = vars[opnd0];
+		if (val.type == Value_Type::Num) {
+			val.as.num += op == BC_INC_VAR_U8 ? 1 : -1;
+		} else {
+			VM_SAVE_POS();
+			val = interp.apply_bin_op(opcode_to_bin_op(op), val, Value::from_num(1), nullptr);
+		}
+		VM_NEXT();
+	}
+	VM_CASE(BC_INC_GLOBAL_U16)
+	VM_CASE(BC_DEC_GLOBAL_U16)
+		opnd0 = read_u16(ip);
+	VM_WIDE(BC_INC_GLOBAL_U16)
+	VM_WIDE(BC_DEC_GLOBAL_U16) {
+		VM_SAVE_POS();
+		Definition* def = find_global(opnd0);
+		Value val = def->value;
+		if (val.type == Value_Type::Num)
+			val.as.num += op == BC_INC_GLOBAL_U16 ? 1 : -1;
+		else
+			val = interp.apply_bin_op(opcode_to_bin_op(op), val, Value::from_num(1), nullptr);
+		store(def, val);
+		VM_NEXT();
+	}
+	VM_CASE(BC_ADD_VAR_VAR_U8_U8)
+		opnd0 = ip[0];
+		opnd1 = ip[1];
+		ip += 2;
+	VM_WIDE(BC_ADD_VAR_VAR_U8_U8) {
+		const Value& lval = vars[opnd0];
+		const Value& rval = vars[opnd1];
+		if (lval.type == Value_Type::Num && rval.type == Value_Type::Num) {
+			*sp++ = Value::from_num(lval.as.num + rval.as.num);
+		} else {
+			VM_SAVE_POS();
+			*sp++ = interp.apply_bin_op(Bin_Op::Add, lval, rval, nullptr);
+		}
+		VM_NEXT();
+	}
+	VM_CASE(BC_CALL_FUNC_U32_U8)
+		opnd0 = read_u32(ip);
+		opnd1 = read_u8(ip);
+	VM_WIDE(BC_CALL_FUNC_U32_U8) {
+		// verified to take opnd1 args
+		const BC_Func& func = program->func_table[opnd0];
+		VM_SAVE_POS();
+		push_frame(opnd1, pos, func.is_method ? fp->this_obj : nullptr, false);
+		ip = code + func.entry;
+		VM_NEXT();
+	}
+	VM_COND_JUMP(BC_JUMP_IF_NOT_LESS_THAN_U8_U8_U32, a < b)
+	VM_COND_JUMP(BC_JUMP_IF_NOT_LESS_THAN_EQUALS_U8_U8_U32, a <= b)
+	VM_COND_JUMP(BC_JUMP_IF_NOT_GREATER_THAN_U8_U8_U32, a > b)
+	VM_COND_JUMP(BC_JUMP_IF_NOT_GREATER_THAN_EQUALS_U8_U8_U32, a >= b)
+	VM_CASE(BC_WIDE) {
+		// rare, so the operands go through the generic decoder
+		BC_Inst inst;
+		ip += decode_bc_inst(ip - 1, inst) - 1;
+		op = inst.op;
+		opnd0 = inst.operands[0];
+		opnd1 = inst.operands[1];
+		opnd2 = inst.operands[2];
+		opnd3 = inst.operands[3];
+
+		switch (op) {
+		BC_OPCODE_LIST(BC_WIDE_CASE)
+		}
+	}
+	VM_WIDE(BC_WIDE)
+		error("Invalid opcode " + std::to_string(op));
+		return;
+
+#ifndef BC_THREADED_DISPATCH
+	default:
+		error("Invalid opcode " + std::to_string(op));
+		return;
+	}
+	}
+#endif
+}
+
+void BC_VM::record_op(uint8_t op) {
+	profile->dispatches++;
+
+	profile_history = (profile_history << 8) | op;
+	if (profile_len < BC_Profile::MAX_N)
+		profile_len++;
+
+	for (int n = 1; n <= profile_len; n++) {
+		uint32_t mask = n == 4 ? 0xFFFFFFFF : (1u << (n * 8)) - 1;
+		profile->ngrams[n - 1][profile_history & mask]++;
+	}
+}
+
+void BC_VM::declare_global(uint32_t index, bool is_const) {
+	const std::string& name = program->globals[index];
+	Scope& global_scope = interp.ctx->global_scope;
+
+	if (global_scope.find_def(name) != nullptr) {
+		error("Conflicting variable name: " + name);
+	}
+
+	interp.promote(sp[-1]);
+	global_scope.set_def(name, sp[-1], is_const ? DEF_CONST : 0);
+	sp--;
+}
+
+// [obj] -> [val]
+void BC_VM::get_field(uint32_t name_index) {
+	const std::string& name = program->strings[name_index];
+	Value& obj = sp[-1];
+
+	if (obj.type == Value_Type::Struct) {
+		const Struct_Decl& decl = interp.struct_decls[obj.struct_id];
+		auto it = std::find(decl.fields.begin(), decl.fields.end(), name);
+		if (it == decl.fields.end()) {
+			error("No field " + name + " in struct " + decl.name);
+		}
+
+		obj = Value::from_num(obj.as.fields[it - decl.fields.begin()]);
+		return;
+	}
+
+	GC_Obj* gc_obj = (GC_Obj*) interp.expect_value(obj, Value_Type::GC_Obj, nullptr).as.ptr;
+	switch (gc_obj->type) {
+	case GC_Obj_Type::Instance: {
+		Definition* def = ((GC_Obj_Instance*) gc_obj)->scope.find_def(name, false);
+		if (def == nullptr) {
+			error("No such variable/function: " + name);
+		}
+
+		obj = def->value;
+		return;
+	}
+	case GC_Obj_Type::Array:
+		if (name != "length") {
+			error("Expected class instance");
+		}
+		obj = Value::from_num(((GC_Obj_Array*) gc_obj)->arr.size());
+		return;
+	case GC_Obj_Type::String:
+		if (name != "length") {
+			error("Expected class instance");
+		}
+		obj = Value::from_num(((GC_Obj_String*) gc_obj)->str.size());
+		return;
+	case GC_Obj_Type::Pool: {
+		GC_Obj_Pool* pool = (GC_Obj_Pool*) gc_obj;
+		if (name == "size") {
+			obj = Value::from_num(pool->instances.size());
+		} else if (name == "available") {
+			obj = Value::from_num(pool->free_list.size());
+		} else {
+			error("Pools only have acquire(), release(), size and available");
+		}
+		return;
+	}
+	default:
+		error("Expected class instance");
+	}
+}
+
+// [obj, val] -> [obj]
+void BC_VM::set_field(uint32_t name_index) {
+	const std::string& name = program->strings[name_index];
+	Value val = sp[-1];
+	sp--;
+	Value& obj = sp[-1];
+
+	if (obj.type == Value_Type::Struct) {
+		const Struct_Decl& decl = interp.struct_decls[obj.struct_id];
+		auto it = std::find(decl.fields.begin(), decl.fields.end(), name);
+		if (it == decl.fields.end()) {
+			error("No field " + name + " in struct " + decl.name);
+		}
+		if (val.type != Value_Type::Num) {
+			error("Struct fields can only hold numbers");
+		}
+
+		obj.as.fields[it - decl.fields.begin()] = val.as.num;
+		return;
+	}
+
+	interp.expect_value(obj, Value_Type::GC_Obj, nullptr);
+	if (!is_instance(obj)) {
+		error("Expression is not modifiable");
+	}
+
+	Definition* def = ((GC_Obj_Instance*) obj.as.ptr)->scope.find_def(name, false);
+	if (def == nullptr) {
+		error("No such variable/function: " + name);
+	}
+
+	store(def, val);
+}
+
+// [arr, index] -> [val]
+void BC_VM::get_index() {
+	Value index_val = sp[-1];
+	sp--;
+	Value& target = sp[-1];
+
+	if (target.type != Value_Type::GC_Obj) {
+		error("Expected gc obj");
+	}
+	if (index_val.type != Value_Type::Num) {
+		error("Expected a number index");
+	}
+	// NaN or past int can't be in bounds, and casting it would be undefined
+	if (!(index_val.as.num > INT_MIN && index_val.as.num < INT_MAX)) {
+		error("Out of bounds");
+	}
+
+	GC_Obj* gc_obj = (GC_Obj*) target.as.ptr;
+	int index = (int) index_val.as.num;
+
+	if (gc_obj->type == GC_Obj_Type::Array) {
+		GC_Obj_Array* arr = (GC_Obj_Array*) gc_obj;
+		if (index < 0 || index >= arr->arr.size()) {
+			error("Out of bounds");
+		}
+
+		target = arr->arr[index];
+	} else if (gc_obj->type == GC_Obj_Type::String) {
+		GC_Obj_String* str = (GC_Obj_String*) gc_obj;
+		if (index < 0 || index >= str->str.size()) {
+			error("Out of bounds");
+		}
+
+		target = interp.create_string(std::string(1, str->str[index]));
+	} else {
+		error("Expression is not subscriptable (expected array, string, etc..)");
+	}
+}
+
+// [arr, index, val] -> []
+void BC_VM::set_index() {
+	const Value& target = sp[-3];
+	const Value& index_val = sp[-2];
+	const Value& val = sp[-1];
+
+	if (target.type != Value_Type::GC_Obj) {
+		error("Expected gc obj");
+	}
+	if (index_val.type != Value_Type::Num) {
+		error("Expected a number index");
+	}
+	// NaN or past int can't be in bounds, and casting it would be undefined
+	if (!(index_val.as.num > INT_MIN && index_val.as.num < INT_MAX)) {
+		error("Out of bounds");
+	}
+
+	GC_Obj* gc_obj = (GC_Obj*) target.as.ptr;
+	int index = (int) index_val.as.num;
+
+	if (gc_obj->type == GC_Obj_Type::Array) {
+		GC_Obj_Array* arr = (GC_Obj_Array*) gc_obj;
+		if (index < 0 || index >= arr->arr.size()) {
+			error("Out of bounds");
+		}
+
+		if (interp.in_parallel && !interp.can_store_in_parallel(arr, index)) {
+			error("Only the current item can be modified inside parallel_for");
 		}
-		case BC_CALL_EXTERN_U16: {
-			uint16_t extern_id = eat_u16();
 
-			const Extern_Func& func = extern_funcs[extern_id];
-			std::vector<Value> args;
+		if (!arr->young)
+			interp.promote(val);
+		arr->arr[index] = val;
+	} else if (gc_obj->type == GC_Obj_Type::String) {
+		error("Expression is not modifiable");
+	} else {
+		error("Expression is not subscriptable (expected array, string, etc..)");
+	}
+
+	sp -= 3;
+}
+
+void BC_VM::make_array(uint32_t count) {
+	GC_Obj_Array* arr = new GC_Obj_Array();
+	interp.add_to_heap(arr);
+	arr->arr.assign(sp - count, sp);
+
+	sp -= count;
+	*sp++ = Value::from_gc_obj(arr);
+}
+
+void BC_VM::make_string(uint32_t interp_index) {
+	const BC_String_Interp& interp_str = program->interps[interp_index];
+	size_t count = interp_str.parts.size() - 1;
+	const Value* values = sp - count;
 
-			// TODO: optional args
-			for (int i = 0; i < func.min_args; i++) {
-				args.push_back(op_stack.back());
-				op_stack.pop_back();
+	size_t length = 0;
+	for (const auto& part : interp_str.parts)
+		length += part.size();
+	for (size_t i = 0; i < count; i++)
+		length += interp.interp_value_length(values[i], interp_str.precisions[i]);
+
+	std::string str;
+	str.reserve(length);
+	for (size_t i = 0; i < count; i++) {
+		str += interp_str.parts[i];
+		interp.append_interp_value(str, values[i], interp_str.precisions[i]);
+	}
+	str += interp_str.parts.back();
+
+	sp -= count;
+	*sp++ = interp.create_string(std::move(str));
+}
+
+void BC_VM::declare_class(uint32_t class_index) {
+	const BC_Class& bc_class = program->classes[class_index];
+	size_t count = bc_class.fields.size();
+	const Value* values = sp - count;
+
+	if (interp.in_parallel) {
+		error("Classes can't be declared inside parallel_for");
+	}
+
+	// already declared when the program ran in another context, this one keeps
+	// its own field values
+	auto existing = interp.class_decls.find(bc_class.name);
+	if (existing != interp.class_decls.end() && existing->second.program == program && existing->second.index == class_index) {
+		Scope& fields = interp.get_class_fields(bc_class.name);
+		for (size_t i = 0; i < count; i++) {
+			interp.promote(values[i]);
+			fields.set_def(bc_class.fields[i], values[i]);
+		}
+		sp -= count;
+		return;
+	}
+
+	if (existing != interp.class_decls.end()) {
+		error("Redefinition of class \"" + bc_class.name + "\"");
+	}
+
+	Class_Decl& decl = interp.class_decls[bc_class.name];
+	decl.name = bc_class.name;
+	decl.parent = bc_class.parent;
+	decl.node = bc_class.node;
+	decl.program = program;
+	decl.index = class_index;
+
+	for (size_t i = 0; i < count; i++) {
+		if (decl.scope.find_def(bc_class.fields[i], false) != nullptr) {
+			error("Conflicting variable name: " + bc_class.fields[i]);
+		}
+
+		// defaults are copied into every instance
+		interp.promote(values[i]);
+		decl.scope.set_def(bc_class.fields[i], values[i]);
+	}
+
+	for (uint32_t func_index : bc_class.methods) {
+		const std::string& name = program->func_table[func_index].name;
+		if (decl.scope.find_def(name, false) != nullptr) {
+			error("Conflicting function name: " + name);
+		}
+
+		decl.scope.set_def(name, make_func_ref(func_index), DEF_FUNC);
+	}
+
+	sp -= count;
+}
+
+void BC_VM::declare_struct(uint32_t struct_index) {
+	const BC_Struct& bc_struct = program->structs[struct_index];
+	size_t count = bc_struct.fields.size();
+	const Value* values = sp - count;
+
+	if (interp.in_parallel) {
+		error("Structs can't be declared inside parallel_for");
+	}
+
+	Definition* existing = interp.program_scope.find_def(bc_struct.name);
+	if (existing != nullptr) {
+		// already declared when the program ran in another context
+		if (existing->value.type == Value_Type::Struct_Type) {
+			const Struct_Decl& decl = interp.struct_decls[existing->value.as.i];
+			if (decl.program == program && decl.index == struct_index) {
+				sp -= count;
+				return;
 			}
+		}
+
+		error("Conflicting struct name: " + bc_struct.name);
+	}
 
-			std::reverse(args.begin(), args.end());
+	Struct_Decl decl;
+	decl.name = bc_struct.name;
+	decl.node = bc_struct.node;
+	decl.program = program;
+	decl.index = struct_index;
+	decl.fields = bc_struct.fields;
+	for (size_t i = 0; i < count; i++)
+		decl.defaults[i] = interp.expect_value(values[i], Value_Type::Num, nullptr).as.num;
 
-			Value ret = func.callback(args, this);
-			op_stack.push_back(ret);
-			break;
+	Value val;
+	val.type = Value_Type::Struct_Type;
+	val.as.i = (int32_t) interp.struct_decls.size();
+
+	interp.struct_decls.push_back(decl);
+	interp.program_scope.set_def(bc_struct.name, val, DEF_FUNC);
+
+	sp -= count;
+}
+
+void BC_VM::call_value(const Value& func, uint32_t num_args, GC_Obj_Instance* this_obj, bool constructing) {
+	switch (func.type) {
+	case Value_Type::BC_Func_Ref: {
+		const BC_Func& bc_func = program->func_table[func.as.i];
+		if (num_args != bc_func.num_args) {
+			error("Incorrect number of arguments");
 		}
-		case BC_RET: {
-			pos = call_stack.back();
-			call_stack.pop_back();
-			const BC_Frame& cur_frame = frame_stack.back();
-			for (int i = 0; i < cur_frame.num_vars; i++)
-				var_stack.pop_back();
-			frame_stack.pop_back();
+
+		push_frame(num_args, pos, bc_func.is_method ? this_obj : nullptr, constructing);
+		pos = bc_func.entry;
+		return;
+	}
+	case Value_Type::Extern_Func:
+		// CALL_EXTERN is verified to have enough
+		if (num_args < interp.external_funcs[func.as.i].min_args) {
+			error("Too few arguments");
+		}
+
+		call_extern(func.as.i, num_args);
+		if (constructing)
+			sp[-1] = Value::from_gc_obj(this_obj);
+		return;
+	case Value_Type::Struct_Type: {
+		std::vector<Value> args(sp - num_args, sp);
+		sp -= num_args;
+		*sp++ = interp.construct_struct(func, args, nullptr);
+		return;
+	}
+	default:
+		break;
+	}
+
+	error("No such function");
+}
+
+void BC_VM::call_extern(uint32_t extern_index, uint32_t num_args) {
+	const Extern_Func& func = interp.external_funcs[extern_index];
+
+	// the callback may call back into the VM, so the args get their own vector
+	std::vector<Value> args(sp - num_args, sp);
+	sp -= num_args;
+
+	// workers of a parallel section leave it pointing at the parallel_for call
+	if (!interp.in_parallel)
+		interp.extern_func_node = nullptr;
+
+	*sp++ = func.callback(args, (void*) &interp);
+}
+
+// obj.name(args...), obj is under the args
+void BC_VM::call_method(uint32_t name_index, uint32_t num_args) {
+	const std::string& name = program->strings[name_index];
+	Value* args = sp - num_args;
+	Value obj = args[-1];
+
+	if (obj.type == Value_Type::Struct) {
+		error("Structs only have fields");
+	}
+
+	GC_Obj* gc_obj = (GC_Obj*) interp.expect_value(obj, Value_Type::GC_Obj, nullptr).as.ptr;
+	memmove(args - 1, args, num_args * sizeof(Value));
+	sp--;
+
+	switch (gc_obj->type) {
+	case GC_Obj_Type::Instance: {
+		GC_Obj_Instance* instance = (GC_Obj_Instance*) gc_obj;
+		Definition* def = instance->scope.find_def(name, false);
+		if (def == nullptr) {
+			error("No such variable/function: " + name);
+		}
+
+		call_value(def->value, num_args, instance, false);
+		return;
+	}
+	case GC_Obj_Type::Array: {
+		GC_Obj_Array* arr = (GC_Obj_Array*) gc_obj;
+
+		if (name != "push" && name != "pop" && name != "remove_at")
 			break;
+
+		if (interp.in_parallel) {
+			error("Arrays can't be resized inside parallel_for");
 		}
-		case BC_ADD:
-		case BC_SUB:
-		case BC_MUL:
-		case BC_DIV:
-		case BC_GREATER_THAN:
-		case BC_LESS_THAN:
-		case BC_GREATER_THAN_EQUALS:
-		case BC_LESS_THAN_EQUALS:
-		{
-			float b = op_stack.back().as.num;
-			op_stack.pop_back();
-			float a = op_stack.back().as.num;
-			op_stack.pop_back();
-
-			Value result;
-			switch (op) {
-			case BC_ADD: result = Value::from_num(a + b); break;
-			case BC_SUB: result = Value::from_num(a - b); break;
-			case BC_MUL: result = Value::from_num(a * b); break;
-			case BC_DIV: result = Value::from_num(a / b); break;
-			case BC_GREATER_THAN: result = Value::from_bool(a > b); break;
-			case BC_LESS_THAN: result = Value::from_bool(a < b); break;
-			case BC_GREATER_THAN_EQUALS: result = Value::from_bool(a >= b); break;
-			case BC_LESS_THAN_EQUALS: result = Value::from_bool(a <= b); break;
+
+		if (num_args != (name == "pop" ? 0 : 1)) {
+			error("Incorrect number of args");
+		}
+
+		if (name == "push") {
+			if (!arr->young)
+				interp.promote(sp[-1]);
+			arr->arr.push_back(sp[-1]);
+			sp[-1] = Value::null_value();
+			return;
+		}
+
+		if (name == "pop") {
+			if (arr->arr.empty()) {
+				error("Out of bounds");
 			}
 
-			op_stack.push_back(result);
-			break;
+			*sp++ = arr->arr.back();
+			arr->arr.pop_back();
+			return;
 		}
-		case BC_JUMP_U32:
-			pos = eat_u32();
-			break;
-		case BC_JUMP_IF_TRUE_U32:
-		case BC_JUMP_IF_FALSE_U32: {
-			uint32_t dest = eat_u32();
-			bool b = op_stack.back().as._bool;
-			op_stack.pop_back();
-
-			if ((op != BC_JUMP_IF_TRUE_U32) != b)
-				pos = dest;
-			break;
+
+		int index = (int) interp.expect_value(sp[-1], Value_Type::Num, nullptr).as.num;
+		if (index < 0 || index >= arr->arr.size()) {
+			error("Index is out of bounds");
+		}
+
+		sp[-1] = arr->arr[index];
+		arr->arr.erase(arr->arr.begin() + index);
+		return;
+	}
+	case GC_Obj_Type::Pool: {
+		GC_Obj_Pool* pool = (GC_Obj_Pool*) gc_obj;
+
+		if (interp.in_parallel) {
+			error("Pools can't be used inside parallel_for");
 		}
-		default:
-			assert(false);
+
+		if (name == "acquire") {
+			construct(interp.acquire_from_pool(pool, nullptr), num_args);
+			return;
+		}
+
+		if (name == "release") {
+			if (num_args != 1) {
+				error("Incorrect number of args");
+			}
+
+			interp.release_to_pool(pool, sp[-1], nullptr);
+			sp[-1] = Value::null_value();
+			return;
 		}
+
+		error("Pools only have acquire(), release(), size and available");
+		return;
 	}
+	default:
+		break;
+	}
+
+	error("Expected class instance");
 }
 
-uint8_t BC_VM::eat_u8() {
-	return program->code[pos++];
+// calls init with the args on the stack, if the class has one, and leaves the instance
+void BC_VM::construct(GC_Obj_Instance* instance, uint32_t num_args) {
+	Definition* constructor = instance->scope.find_def("init", false);
+	if (constructor != nullptr) {
+		call_value(constructor->value, num_args, instance, true);
+		return;
+	}
+
+	if (num_args != 0) {
+		error("Default constructor takes no args");
+	}
+
+	*sp++ = Value::from_gc_obj(instance);
 }
 
-uint16_t BC_VM::eat_u16() {
-	uint16_t result = program->code[pos++];
-	result |= program->code[pos++] << 8;
-	return result;
+Definition* BC_VM::find_global(uint32_t index) {
+	if (globals_ctx != interp.ctx) {
+		global_defs.assign(program->globals.size(), nullptr);
+		globals_ctx = interp.ctx;
+	}
+
+	// definitions never move once they exist, so they can be kept
+	Definition*& def = global_defs[index];
+	if (def == nullptr) {
+		def = interp.ctx->global_scope.find_def(program->globals[index]);
+		if (def == nullptr) {
+			error("No such variable/function: " + program->globals[index]);
+		}
+	}
+
+	return def;
 }
 
-uint32_t BC_VM::eat_u32() {
-	uint32_t result = program->code[pos++];
-	result |= program->code[pos++] << 8;
-	result |= program->code[pos++] << 16;
-	result |= program->code[pos++] << 24;
-	return result;
+// a field of this, or a global for methods of classes that don't have it
+Definition* BC_VM::find_member(uint32_t name_index) {
+	const std::string& name = program->strings[name_index];
+	GC_Obj_Instance* this_obj = fp->this_obj;
+
+	Definition* def = this_obj != nullptr ? this_obj->scope.find_def(name, false) : nullptr;
+	if (def == nullptr)
+		def = interp.ctx->global_scope.find_def(name);
+
+	if (def == nullptr) {
+		error("No such variable/function: " + name);
+	}
+
+	return def;
 }
 
-float BC_VM::eat_f32() {
-	uint32_t bin = eat_u32();
+// same checks as assigning through a variable in the interpreter. storing the value
+// that's already there is allowed, that's how structs are written back after a field changed
+void BC_VM::store(Definition* def, const Value& val) {
+	bool read_only = (def->flags & (DEF_CONST | DEF_FUNC)) || (def->scope != nullptr && def->scope->read_only);
+	if (read_only) {
+		if (!is_same_value(def->value, val)) {
+			error(interp.in_parallel ? "Expression is not modifiable (globals are read-only inside parallel_for)" : "Expression is not modifiable");
+		}
+		return;
+	}
+
+	GC_Obj_Instance* owner = def->scope != nullptr ? def->scope->owner : nullptr;
+	if (interp.in_parallel && owner != nullptr && !interp.can_store_in_parallel(owner, -1)) {
+		error("Only the current item can be modified inside parallel_for");
+	}
+
+	bool escapes = def->scope != nullptr && def->scope->persistent && (owner == nullptr || !owner->young);
+	if (escapes)
+		interp.promote(val);
 
-	float num;
-	memcpy(&num, &bin, 4);
+	def->value = val;
+}
+
+const Source_Info* BC_VM::get_src_info() const {
+	if (program == nullptr || fp == frames)
+		return nullptr;
+
+	// pos is past the instruction that's running
+	auto it = std::upper_bound(program->lines.begin(), program->lines.end(), pos - 1,
+		[](uint32_t pos, const BC_Line& line) { return pos < line.pos; });
+	if (it == program->lines.begin())
+		return nullptr;
+	return &(it - 1)->src_info;
+}
 
-	return num;
+void BC_VM::error(const std::string& msg) const {
+	interp.error_at(msg, get_src_info());
 }
@@ -6,27 +6,130 @@
 #include <vector>
 #include <stdint.h>
 #include <string>
+#include <unordered_map>
 
+class Interpreter;
+struct Context;
+struct Definition;
+struct GC_Obj_Instance;
+
+// a call. its slots start at base in the value stack, the args are the first ones
+// and the op stack is on top of them
 struct BC_Frame {
-	uint32_t start;
-	uint32_t num_vars;
+	uint32_t return_pos;
+	uint32_t base;
+	GC_Obj_Instance* this_obj;
+	bool constructing; // called by NEW or pool.acquire, returns this instead
 };
 
+// how often each sequence of opcodes ran, in execution order (across jumps and calls).
+// used to pick superinstructions, see print_bc_profile
+struct BC_Profile {
+	static constexpr int MAX_N = 4;
+
+	uint64_t dispatches = 0;
+	// ngrams[n - 1] has the sequences of length n, a byte per opcode with the last one lowest
+	std::unordered_map<uint32_t, uint64_t> ngrams[MAX_N];
+};
+
+// Runs compiled programs on an interpreter. The heap, globals, classes, structs and
+// external funcs all belong to the interpreter, so builtins and natives work the same
+// on both. While a VM exists, the interpreter hands calls to compiled functions
+// (Func_Handles, call_function, parallel_for) to it.
 class BC_VM {
 public:
-	void run(const BC_Program* program, const std::vector<Extern_Func>& extern_funcs);
+	BC_VM(Interpreter& _interp);
+	// for a worker thread: same interpreter and program, its own stack.
+	// doesn't replace parent as the interpreter's VM
+	BC_VM(const BC_VM& parent);
+	BC_VM& operator=(const BC_VM&) = delete;
+	~BC_VM();
+
+	// declares the global functions and runs the top level. the program has
+	// to outlive the VM, since functions stay declared. it has to come from
+	// BC_Compiler or pass verify_bc_program, the code isn't checked while it runs
+	void run(const BC_Program* program);
 
-	uint8_t eat_u8();
-	uint16_t eat_u16();
-	uint32_t eat_u32();
-	float eat_f32();
+	// calls a function of the program from the host. obj is this for methods
+	Value call(uint32_t func_index, const Value* args, size_t count, GC_Obj_Instance* obj = nullptr);
+
+	// calls func_index count times, with columns[j][i] as argument j of call i, and stores
+	// the return value of call i in results[i]. obj is this for methods
+	void call_batch(uint32_t func_index, const std::vector<const Value*>& columns, size_t count, Value* results, GC_Obj_Instance* obj = nullptr);
+
+	const BC_Program* get_program() const { return program; }
+	// of the statement being run, nullptr if nothing is
+	const Source_Info* get_src_info() const;
+
+	// counts every instruction the VM runs from now on into profile, nullptr stops.
+	// workers don't inherit it
+	void set_profile(BC_Profile* _profile) { profile = _profile; profile_history = 0; profile_len = 0; }
 private:
+	// return address that hands control back to the host
+	static constexpr uint32_t RETURN_TO_HOST = (uint32_t) -1;
+	// in values and calls. the memory is only touched as far as it gets used
+	static constexpr size_t STACK_SIZE = 1 << 20;
+	static constexpr size_t MAX_FRAMES = 1 << 16;
+
+	void alloc_stack();
+	// the program's string literals in the current context's heap, made the first
+	// time this run uses the context
+	void bind_str_consts();
+	// args are the top num_args values
+	void push_frame(uint32_t num_args, uint32_t return_pos, GC_Obj_Instance* this_obj, bool constructing);
+	// makes sure count more values fit, for values that don't come from the program
+	void check_stack(size_t count);
+
+	void execute();
+	void record_op(uint8_t op);
+	void error(const std::string& msg) const;
+
+	// func is off the op stack, the args are on top. BC functions only push a frame and
+	// jump, the callee's ALLOC_FRAME makes room for its other locals
+	void call_value(const Value& func, uint32_t num_args, GC_Obj_Instance* this_obj, bool constructing);
+	void call_extern(uint32_t extern_index, uint32_t num_args);
+	void call_method(uint32_t name_index, uint32_t num_args);
+	void construct(GC_Obj_Instance* instance, uint32_t num_args);
+
+	// the less common instructions, operands are already read
+	void declare_global(uint32_t index, bool is_const);
+	void get_field(uint32_t name_index);
+	void set_field(uint32_t name_index);
+	void get_index();
+	void set_index();
+	void make_array(uint32_t count);
+	void make_string(uint32_t interp_index);
+	void declare_class(uint32_t class_index);
+	void declare_struct(uint32_t struct_index);
+
+	Definition* find_global(uint32_t index);
+	Definition* find_member(uint32_t name_index);
+	void store(Definition* def, const Value& val);
+
+	Interpreter& interp;
 	const BC_Program* program = nullptr;
+	bool is_worker = false;
+
+	uint32_t pos = 0; // only kept up to date across calls, execute() has its own instruction pointer
+
+	// allocated once, so nothing in them ever moves. frames[0] is a placeholder
+	// for the host, it has no this
+	Value* stack = nullptr;
+	Value* stack_end = nullptr;
+	Value* sp = nullptr; // one past the top
+	BC_Frame* frames = nullptr;
+	BC_Frame* frames_end = nullptr;
+	BC_Frame* fp = nullptr; // the current frame
+
+	// the current context's bc_str_consts. workers share the parent's
+	const Value* str_consts = nullptr;
+	uint32_t run_id = 0;
 
-	uint32_t pos;
+	BC_Profile* profile = nullptr;
+	uint32_t profile_history = 0; // the last opcodes that ran
+	int profile_len = 0;
 
-	std::vector<Value> op_stack;
-	std::vector<uint32_t> call_stack;
-	std::vector<BC_Frame> frame_stack;
-	std::vector<Value> var_stack;
+	// resolved on first use, per context
+	std::vector<Definition*> global_defs;
+	Context* globals_ctx = nullptr;
 };
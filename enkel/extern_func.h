@@ -6,8 +6,13 @@
 #include <string>
 #include <vector>
 
+// the func never keeps or returns its args, so temporary strings and arrays
+// passed to it can live on the interpreter's scratch stack (see mark_temporaries)
+const int EXTERN_BORROWS_ARGS = 1 << 0;
+
 struct Extern_Func {
 	std::string name;
 	int min_args = 0;
 	std::function<Value(const std::vector<Value>&, void* data_ptr)> callback;
+	int flags = 0;
 };
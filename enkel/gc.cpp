@@ -3,23 +3,43 @@
 #include <assert.h>
 #include <algorithm>
 
+GC_Heap::~GC_Heap() {
+	for (GC_Obj* obj : young_objects) {
+		if (obj->young)
+			delete obj;
+	}
+}
+
 void GC_Heap::add_obj(GC_Obj* obj) {
+	if (frame_active) {
+		obj->young = true;
+		young_objects.push_back(obj);
+		return;
+	}
+
 	objects.push_back(std::unique_ptr<GC_Obj>(obj));
 }
 
-void GC_Heap::garbage_collect(const Scope& scope) {
+void GC_Heap::garbage_collect(const std::vector<const Scope*>& root_scopes) {
 	for (auto& obj : objects) {
 		obj->reached = false;
 	}
 
 	// recursively mark
-	for (auto& def : scope.definitions) {
-		const Value& val = def.second.value;
-		if (val.type != Value_Type::GC_Obj)
-			continue;
+	for (auto& obj : objects) {
+		if (obj->pin_count > 0)
+			mark_obj_and_children(*obj);
+	}
+
+	for (const Scope* scope : root_scopes) {
+		for (auto& def : scope->definitions) {
+			const Value& val = def.second.value;
+			if (val.type != Value_Type::GC_Obj)
+				continue;
 
-		GC_Obj* obj = (GC_Obj*) val.as.ptr;
-		mark_obj_and_children(*obj);
+			GC_Obj* obj = (GC_Obj*) val.as.ptr;
+			mark_obj_and_children(*obj);
+		}
 	}
 
 	// free unreachable objects
@@ -28,45 +48,84 @@ void GC_Heap::garbage_collect(const Scope& scope) {
 	}), objects.end());
 }
 
-void GC_Heap::mark_obj_and_children(GC_Obj& obj) {
-	if (obj.reached)
-		return;
-
-	// mark this object
-	obj.reached = true;
+// calls func on every object obj references directly
+template <typename Func>
+static void for_each_child(GC_Obj& obj, Func&& func) {
+	auto visit_value = [&](const Value& value) {
+		if (value.type == Value_Type::GC_Obj)
+			func(*(GC_Obj*) value.as.ptr);
+	};
 
-	// recursively mark its children, if any
 	if (obj.type == GC_Obj_Type::Instance) {
 		GC_Obj_Instance* instance = (GC_Obj_Instance*) &obj;
 
-		for (auto& def : instance->scope.definitions) {
-			const Value& value = def.second.value;
-			if (value.type != Value_Type::GC_Obj)
-				continue;
+		for (auto& def : instance->scope.definitions)
+			visit_value(def.second.value);
 
-			GC_Obj* child = (GC_Obj*) value.as.ptr;
-			mark_obj_and_children(*child);
-		}
+		if (instance->pool != nullptr)
+			func(*instance->pool);
 	} else if (obj.type == GC_Obj_Type::Array) {
 		GC_Obj_Array* arr = (GC_Obj_Array*) &obj;
 
-		for (auto& value : arr->arr) {
-			if (value.type != Value_Type::GC_Obj)
-				continue;
+		for (auto& value : arr->arr)
+			visit_value(value);
+	} else if (obj.type == GC_Obj_Type::Pool) {
+		GC_Obj_Pool* pool = (GC_Obj_Pool*) &obj;
 
-			GC_Obj* child = (GC_Obj*) value.as.ptr;
-			mark_obj_and_children(*child);
-		}
+		for (GC_Obj_Instance* instance : pool->instances)
+			func(*instance);
+
+		for (auto& def : pool->defaults)
+			visit_value(def.second.value);
 	} else if (obj.type == GC_Obj_Type::Table) {
 		GC_Obj_Table* table = (GC_Obj_Table*) &obj;
 
-		for (auto& def : table->definitions) {
-			const Value& value = def.second.value;
-			if (value.type != Value_Type::GC_Obj)
-				continue;
+		for (auto& def : table->definitions)
+			visit_value(def.second.value);
+	}
+}
 
-			GC_Obj* child = (GC_Obj*) value.as.ptr;
-			mark_obj_and_children(*child);
-		}
+void GC_Heap::mark_obj_and_children(GC_Obj& obj) {
+	if (obj.reached)
+		return;
+
+	// mark this object
+	obj.reached = true;
+
+	// recursively mark its children, if any
+	for_each_child(obj, [this](GC_Obj& child) {
+		mark_obj_and_children(child);
+	});
+}
+
+void GC_Heap::begin_frame() {
+	frame_active = true;
+}
+
+void GC_Heap::end_frame() {
+	// pinned objects are roots, same as in garbage_collect
+	for (GC_Obj* obj : young_objects) {
+		if (obj->young && obj->pin_count > 0)
+			promote(obj);
 	}
+
+	for (GC_Obj* obj : young_objects) {
+		if (obj->young)
+			delete obj;
+	}
+
+	young_objects.clear();
+	frame_active = false;
+}
+
+void GC_Heap::promote(GC_Obj* obj) {
+	if (!obj->young)
+		return;
+
+	obj->young = false;
+	objects.push_back(std::unique_ptr<GC_Obj>(obj));
+
+	for_each_child(*obj, [this](GC_Obj& child) {
+		promote(&child);
+	});
 }
@@ -13,14 +13,19 @@ enum class GC_Obj_Type {
 	Array,
 	Table, // TODO: dictionary?
 	Instance,
+	Pool,
 };
 
 struct GC_Obj {
 	GC_Obj_Type type;
 	bool reached = false;
+	bool young = false; // allocated during the current frame, see GC_Heap::begin_frame
+	int pin_count = 0; // pinned objects are roots, see Func_Handle
+	uint32_t parallel_section = 0; // the parallel_for that created it, if any
 
 	GC_Obj(GC_Obj_Type _type) :
 		type(_type) {}
+	virtual ~GC_Obj() = default;
 };
 
 struct GC_Obj_String : public GC_Obj {
@@ -28,6 +33,8 @@ struct GC_Obj_String : public GC_Obj {
 
 	GC_Obj_String(const std::string& _str) :
 		GC_Obj(GC_Obj_Type::String), str(_str) {}
+	GC_Obj_String(std::string&& _str) :
+		GC_Obj(GC_Obj_Type::String), str(std::move(_str)) {}
 };
 
 struct GC_Obj_Array : public GC_Obj {
@@ -44,22 +51,62 @@ struct GC_Obj_Table : public GC_Obj {
 		GC_Obj(GC_Obj_Type::Table) {}
 };
 
+struct GC_Obj_Pool;
+
 struct GC_Obj_Instance : public GC_Obj {
 	std::string class_name;
 	Scope scope;
+	GC_Obj_Pool* pool = nullptr; // set for instances owned by a pool
+	bool released = false; // back in its pool, waiting for acquire
 	// TODO: dont copy function reference values
 
 	GC_Obj_Instance(const Scope& _scope) :
-		GC_Obj(GC_Obj_Type::Instance), scope(_scope) {}
+		GC_Obj(GC_Obj_Type::Instance), scope(_scope) {
+		scope.persistent = true;
+		scope.owner = this;
+	}
+};
+
+// Preallocated instances of one class, reused by acquire/release.
+// Keeps all of its instances alive, handed out or not.
+struct GC_Obj_Pool : public GC_Obj {
+	std::string class_name;
+	std::unordered_map<std::string, Definition> defaults; // fields of a fresh instance
+	std::vector<GC_Obj_Instance*> instances;
+	std::vector<GC_Obj_Instance*> free_list;
+
+	GC_Obj_Pool() :
+		GC_Obj(GC_Obj_Type::Pool) {}
 };
 
 class GC_Heap {
 public:
+	GC_Heap() = default;
+	~GC_Heap();
+	GC_Heap(const GC_Heap&) = delete;
+	GC_Heap& operator=(const GC_Heap&) = delete;
+
 	void add_obj(GC_Obj* obj);
-	void garbage_collect(const Scope& scope);
+	// frees everything that isn't pinned or reachable from one of the scopes
+	void garbage_collect(const std::vector<const Scope*>& root_scopes);
+	const std::vector<std::unique_ptr<GC_Obj>>& get_objects() const { return objects; }
+
+	// Objects added between begin_frame and end_frame are young. They are kept
+	// out of the regular heap and freed all at once by end_frame, without a mark
+	// or sweep, unless they were promoted. The interpreter promotes a young object
+	// as soon as it's stored somewhere that outlives the frame (a global, an old
+	// object's field or element). The host must not hold on to young values
+	// past end_frame, e.g. what update() returned.
+	void begin_frame();
+	void end_frame();
+	bool in_frame() const { return frame_active; }
+	// makes a young object and everything young it references regular heap objects
+	void promote(GC_Obj* obj);
 
 private:
 	void mark_obj_and_children(GC_Obj& obj);
 
 	std::vector<std::unique_ptr<GC_Obj>> objects;
+	std::vector<GC_Obj*> young_objects; // promoted ones are owned by objects
+	bool frame_active = false;
 };
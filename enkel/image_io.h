@@ -0,0 +1,125 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// little endian reading and writing for the files the interpreter saves,
+// snapshots (snapshot.cpp) and compiled programs (bc_file.cpp)
+
+struct Image_Writer {
+	std::vector<uint8_t> data;
+
+	void u8(uint8_t x) { data.push_back(x); }
+	void u16(uint16_t x) { u8(x & 0xFF); u8(x >> 8); }
+	void u32(uint32_t x) { u16(x & 0xFFFF); u16(x >> 16); }
+	void f32(float x) {
+		uint32_t bin;
+		memcpy(&bin, &x, 4);
+		u32(bin);
+	}
+	void str(const std::string& s) {
+		u32((uint32_t) s.size());
+		data.insert(data.end(), s.begin(), s.end());
+	}
+	void bytes(const uint8_t* p, size_t n) { data.insert(data.end(), p, p + n); }
+};
+
+// reads past the end return zeros and clear ok
+struct Image_Reader {
+	const uint8_t* pos;
+	const uint8_t* end;
+	bool ok = true;
+
+	bool has(size_t n) {
+		if ((size_t) (end - pos) < n)
+			ok = false;
+		return ok;
+	}
+	uint8_t u8() { return has(1) ? *pos++ : 0; }
+	uint16_t u16() { uint16_t lo = u8(); return lo | (u8() << 8); }
+	uint32_t u32() { uint32_t lo = u16(); return lo | ((uint32_t) u16() << 16); }
+	float f32() {
+		uint32_t bin = u32();
+		float x;
+		memcpy(&x, &bin, 4);
+		return x;
+	}
+	std::string str() {
+		uint32_t size = u32();
+		if (!has(size))
+			return {};
+		std::string s((const char*) pos, size);
+		pos += size;
+		return s;
+	}
+	// points into the file, nullptr past the end
+	const uint8_t* bytes(size_t n) {
+		if (!has(n))
+			return nullptr;
+		const uint8_t* p = pos;
+		pos += n;
+		return p;
+	}
+};
+
+// read-only view of a whole file, mapped where the platform allows it
+class Mapped_File {
+public:
+	Mapped_File(const std::string& path) {
+#ifdef _WIN32
+		FILE* file = fopen(path.c_str(), "rb");
+		if (!file)
+			return;
+		fseek(file, 0, SEEK_END);
+		size = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		buffer.resize(size);
+		if (size > 0 && fread(buffer.data(), size, 1, file) != 1)
+			buffer.clear();
+		fclose(file);
+		data = buffer.data();
+		size = buffer.size();
+#else
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			void* mem = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mem != MAP_FAILED) {
+				data = (const uint8_t*) mem;
+				size = st.st_size;
+			}
+		}
+		close(fd);
+#endif
+	}
+
+	~Mapped_File() {
+#ifndef _WIN32
+		if (data != nullptr)
+			munmap((void*) data, size);
+#endif
+	}
+
+	Mapped_File(const Mapped_File&) = delete;
+	Mapped_File& operator=(const Mapped_File&) = delete;
+
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+
+private:
+#ifdef _WIN32
+	std::vector<uint8_t> buffer;
+#endif
+};
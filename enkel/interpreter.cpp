@@ -1,15 +1,26 @@
 #include "interpreter.h"
+#include "num_format.h"
+#include "bc_vm.h"
 
 #include <assert.h>
 #include <iostream>
 #include <algorithm>
 #include <cmath>
+#include <stdio.h>
+
+// the item the worker on this thread is running, see Interpreter::can_store_in_parallel
+struct Parallel_Item {
+	const GC_Obj* obj = nullptr;
+	size_t index = 0;
+};
+static thread_local Parallel_Item parallel_item;
 
 Interpreter::Interpreter() :
-	global_scope(nullptr, nullptr) {
+	builtin_scope(nullptr, nullptr), program_scope(&builtin_scope, nullptr), default_context(&program_scope) {
 
 	// typeof(value)
-	add_external_func({"typeof", 1, [this](const std::vector<Value>& args, void* data_ptr) -> Value {
+	add_external_func({"typeof", 1, [](const std::vector<Value>& args, void* data_ptr) -> Value {
+		Interpreter& interp = *(Interpreter*) data_ptr;
 		const Value& val = args[0];
 
 		std::string result;
@@ -24,9 +35,14 @@ Interpreter::Interpreter() :
 			result = "boolean";
 			break;
 		case Value_Type::Func_Ref:
+		case Value_Type::BC_Func_Ref:
 		case Value_Type::Extern_Func:
+		case Value_Type::Struct_Type:
 			result = "function";
 			break;
+		case Value_Type::Struct:
+			result = interp.struct_decls[val.struct_id].name;
+			break;
 		case Value_Type::GC_Obj: {
 			GC_Obj* gc_obj = (GC_Obj*) val.as.ptr;
 			switch (gc_obj->type) {
@@ -42,94 +58,186 @@ Interpreter::Interpreter() :
 				result = instance->class_name;
 				break;
 			}
+			case GC_Obj_Type::Pool:
+				result = "pool";
+				break;
 			}
 			break;
 		}
 		}
 
-		return create_string(result);
-	}});
+		return interp.create_string(result);
+	}, EXTERN_BORROWS_ARGS});
 
 	// _run_gc()  [temporary]
-	add_external_func({"_run_gc", 0, [this](const std::vector<Value>& args, void* data_ptr) -> Value {
+	add_external_func({"_run_gc", 0, [](const std::vector<Value>& args, void* data_ptr) -> Value {
+		Interpreter& interp = *(Interpreter*) data_ptr;
+		if (interp.in_parallel) {
+			interp.error("Can't run the GC inside parallel_for", interp.extern_func_node);
+		}
+
 		// TODO: run from current scope???
-		heap.garbage_collect(global_scope);
+		// class defaults are copied into new instances, so they're roots too
+		std::vector<const Scope*> roots = {&interp.get_global_scope()};
+		for (const auto& it : interp.class_decls) {
+			auto fields_it = interp.ctx->class_fields.find(it.first);
+			roots.push_back(fields_it != interp.ctx->class_fields.end() ? &fields_it->second : &it.second.scope);
+		}
+		interp.get_heap().garbage_collect(roots);
 		return {};
 	}});
 
-	// print(value)
-	add_external_func({"print", 1, [this](const std::vector<Value>& args, void* data_ptr) -> Value {
+	// parallel_for(array, func)
+	// calls func(item) or func(item, index) for every item, spread across cores.
+	// func may read globals but not assign them. it may only modify its own item,
+	// the slot at its index in arrays, and objects created inside parallel_for
+	add_external_func({"parallel_for", 2, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
-		std::cout << "print(): " << interp.get_string(args[0]) << "\n";
+		interp.run_parallel(args[0], args[1], nullptr);
 		return {};
-	}});
+	}, EXTERN_BORROWS_ARGS});
+
+	// parallel_map(array, func)
+	// same as parallel_for, but returns a new array with the results of func
+	add_external_func({"parallel_map", 2, [](const std::vector<Value>& args, void* data_ptr) -> Value {
+		Interpreter& interp = *(Interpreter*) data_ptr;
+
+		GC_Obj_Array* results = new GC_Obj_Array();
+		interp.add_to_heap(results);
+
+		interp.run_parallel(args[0], args[1], results);
+		return Value::from_gc_obj(results);
+	}, EXTERN_BORROWS_ARGS});
+
+	// create_pool(class_name, count)
+	// preallocates count instances of a class. pool.acquire(args...) hands one out,
+	// reset to the class defaults and constructed with args, and pool.release(obj)
+	// takes it back. the pool grows when it runs dry
+	add_external_func({"create_pool", 2, [](const std::vector<Value>& args, void* data_ptr) -> Value {
+		Interpreter& interp = *(Interpreter*) data_ptr;
+		const std::string& class_name = interp.get_string(interp.expect_value(args[0], Value_Type::GC_Obj, interp.extern_func_node));
+		int count = (int) interp.expect_value(args[1], Value_Type::Num, interp.extern_func_node).as.num;
+
+		if (interp.in_parallel) {
+			interp.error("Pools can't be created inside parallel_for", interp.extern_func_node);
+		}
+
+		GC_Obj_Pool* pool = new GC_Obj_Pool();
+		interp.add_to_heap(pool);
+		pool->class_name = class_name;
+
+		for (int i = 0; i < count; i++) {
+			GC_Obj_Instance* instance = interp.create_instance(class_name, interp.extern_func_node);
+			instance->pool = pool;
+			instance->released = true;
+			pool->instances.push_back(instance);
+			pool->free_list.push_back(instance);
+		}
+
+		// fresh instances hold the defaults, keep a copy for resetting
+		GC_Obj_Instance* sample = count > 0 ? pool->instances[0] : interp.create_instance(class_name, interp.extern_func_node);
+		pool->defaults = sample->scope.definitions;
+
+		return Value::from_gc_obj(pool);
+	}, EXTERN_BORROWS_ARGS});
+
+	// print(value, precision)
+	add_external_func({"print", 1, [](const std::vector<Value>& args, void* data_ptr) -> Value {
+		Interpreter& interp = *(Interpreter*) data_ptr;
+		int precision = interp.get_precision_arg(args, 1);
+		interp.write_log(Log_Level::Info, "print(): " + interp.get_string(args[0], precision));
+		return {};
+	}, EXTERN_BORROWS_ARGS});
+
+	// log(level, value, precision)
+	// level is "debug", "info", "warn" or "error"
+	add_external_func({"log", 2, [](const std::vector<Value>& args, void* data_ptr) -> Value {
+		Interpreter& interp = *(Interpreter*) data_ptr;
+		const Value& level_val = interp.expect_value(args[0], Value_Type::GC_Obj, interp.extern_func_node);
+		GC_Obj* level_obj = (GC_Obj*) level_val.as.ptr;
+		Log_Level level;
+		if (level_obj->type != GC_Obj_Type::String || !Log_Sink::parse_level(((GC_Obj_String*) level_obj)->str, level))
+			interp.error("log level has to be \"debug\", \"info\", \"warn\" or \"error\"", interp.extern_func_node);
+
+		int precision = interp.get_precision_arg(args, 2);
+		interp.write_log(level, std::string("[") + Log_Sink::get_level_name(level) + "] " + interp.get_string(args[1], precision));
+		return {};
+	}, EXTERN_BORROWS_ARGS});
+
+	// to_string(value, precision)
+	// numbers are as short as possible without losing anything, unless precision gives the decimals
+	add_external_func({"to_string", 1, [](const std::vector<Value>& args, void* data_ptr) -> Value {
+		Interpreter& interp = *(Interpreter*) data_ptr;
+		int precision = interp.get_precision_arg(args, 1);
+		return interp.create_string(interp.get_string(args[0], precision));
+	}, EXTERN_BORROWS_ARGS});
 
 	// min(value)
-	add_external_func({"min", 2, [this](const std::vector<Value>& args, void* data_ptr) -> Value {
+	add_external_func({"min", 2, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
-		float a = expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
-		float b = expect_value(args[1], Value_Type::Num, interp.extern_func_node).as.num;
+		float a = interp.expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
+		float b = interp.expect_value(args[1], Value_Type::Num, interp.extern_func_node).as.num;
 
 		return Value::from_num(std::min(a, b));
 	}});
 
 	// max(value)
-	add_external_func({"max", 2, [this](const std::vector<Value>& args, void* data_ptr) -> Value {
+	add_external_func({"max", 2, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
-		float a = expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
-		float b = expect_value(args[1], Value_Type::Num, interp.extern_func_node).as.num;
+		float a = interp.expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
+		float b = interp.expect_value(args[1], Value_Type::Num, interp.extern_func_node).as.num;
 
 		return Value::from_num(std::max(a, b));
 	}});
 
 	// abs(value)
-	add_external_func({"abs", 1, [this](const std::vector<Value>& args, void* data_ptr) -> Value {
+	add_external_func({"abs", 1, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
-		float x = expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
+		float x = interp.expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
 
 		return Value::from_num(std::abs(x));
 	}});
 
 	// floor(value)
-	add_external_func({"floor", 1, [this](const std::vector<Value>& args, void* data_ptr) -> Value {
+	add_external_func({"floor", 1, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
-		float x = expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
+		float x = interp.expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
 
 		return Value::from_num(std::floor(x));
 	}});
 
 	// ceil(value)
-	add_external_func({"ceil", 1, [this](const std::vector<Value>& args, void* data_ptr) -> Value {
+	add_external_func({"ceil", 1, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
-		float x = expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
+		float x = interp.expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
 
 		return Value::from_num(std::ceil(x));
 	}});
 
 	// lerp(a, b, ratio)
-	add_external_func({"lerp", 3, [this](const std::vector<Value>& args, void* data_ptr) -> Value {
+	add_external_func({"lerp", 3, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
-		float a = expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
-		float b = expect_value(args[1], Value_Type::Num, interp.extern_func_node).as.num;
-		float ratio = expect_value(args[2], Value_Type::Num, interp.extern_func_node).as.num;
+		float a = interp.expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
+		float b = interp.expect_value(args[1], Value_Type::Num, interp.extern_func_node).as.num;
+		float ratio = interp.expect_value(args[2], Value_Type::Num, interp.extern_func_node).as.num;
 
 		return Value::from_num(a + (b - a) * ratio);
 	}});
 
 	// clamp(value, min, max) or clamp(value, max)
-	add_external_func({"clamp", 2, [this](const std::vector<Value>& args, void* data_ptr) -> Value {
+	add_external_func({"clamp", 2, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
-		float value = expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
+		float value = interp.expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
 		float min_val = 0;
 		float max_val;
 
 		if (args.size() == 2) {
-			max_val = expect_value(args[1], Value_Type::Num, interp.extern_func_node).as.num;
+			max_val = interp.expect_value(args[1], Value_Type::Num, interp.extern_func_node).as.num;
 		} else if (args.size() == 3) {
-			min_val = expect_value(args[1], Value_Type::Num, interp.extern_func_node).as.num;
-			max_val = expect_value(args[2], Value_Type::Num, interp.extern_func_node).as.num;
+			min_val = interp.expect_value(args[1], Value_Type::Num, interp.extern_func_node).as.num;
+			max_val = interp.expect_value(args[2], Value_Type::Num, interp.extern_func_node).as.num;
 		} else {
-			error("Too many args!");
+			interp.error("Too many args!", interp.extern_func_node);
 		}
 
 		float result = std::min(std::max(value, min_val), max_val);
@@ -140,19 +248,19 @@ Interpreter::Interpreter() :
 	// min is inclusive, max is exclusive
 	// returns value wrapped around [min, max]
 	// example: wrap(-1, 0, 10) returns 9
-	add_external_func({"wrap", 2, [this](const std::vector<Value>& args, void* data_ptr) -> Value {
+	add_external_func({"wrap", 2, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
-		float value = expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
+		float value = interp.expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
 		float min_val = 0;
 		float max_val;
 
 		if (args.size() == 2) {
-			max_val = expect_value(args[1], Value_Type::Num, interp.extern_func_node).as.num;
+			max_val = interp.expect_value(args[1], Value_Type::Num, interp.extern_func_node).as.num;
 		} else if (args.size() == 3) {
-			min_val = expect_value(args[1], Value_Type::Num, interp.extern_func_node).as.num;
-			max_val = expect_value(args[2], Value_Type::Num, interp.extern_func_node).as.num;
+			min_val = interp.expect_value(args[1], Value_Type::Num, interp.extern_func_node).as.num;
+			max_val = interp.expect_value(args[2], Value_Type::Num, interp.extern_func_node).as.num;
 		} else {
-			error("Too many args!");
+			interp.error("Too many args!", interp.extern_func_node);
 		}
 
 		float range = max_val - min_val;
@@ -165,36 +273,167 @@ Interpreter::Interpreter() :
 	}});
 
 	// sqrt(value)
-	add_external_func({"sqrt", 1, [this](const std::vector<Value>& args, void* data_ptr) -> Value {
+	add_external_func({"sqrt", 1, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
-		float x = expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
+		float x = interp.expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
 		return Value::from_num(std::sqrt(x));
 	}});
 
 	// sin(value)
-	add_external_func({"sin", 1, [this](const std::vector<Value>& args, void* data_ptr) -> Value {
+	add_external_func({"sin", 1, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
-		float x = expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
+		float x = interp.expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
 		return Value::from_num(std::sin(x));
 	}});
 
 	// cos(value)
-	add_external_func({"cos", 1, [this](const std::vector<Value>& args, void* data_ptr) -> Value {
+	add_external_func({"cos", 1, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
-		float x = expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
+		float x = interp.expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
 		return Value::from_num(std::cos(x));
 	}});
 
 	// tan(value)
-	add_external_func({"tan", 1, [this](const std::vector<Value>& args, void* data_ptr) -> Value {
+	add_external_func({"tan", 1, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
-		float x = expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
+		float x = interp.expect_value(args[0], Value_Type::Num, interp.extern_func_node).as.num;
 		return Value::from_num(std::tan(x));
 	}});
 }
 
 Eval_Result Interpreter::eval(AST_Node* node) {
-	return eval_node(node, &global_scope, nullptr);
+	return eval_node(node, &ctx->global_scope, nullptr);
+}
+
+void Interpreter::reload(AST_Node* program) {
+	if (program->type != AST_Node_Type::Block) {
+		error("Expected a program", program);
+	}
+
+	Value func_val;
+	func_val.type = Value_Type::Func_Ref;
+
+	std::vector<std::string> changed_classes;
+
+	for (auto& statement : ((AST_Block*) program)->statements) {
+		switch (statement->type) {
+		case AST_Node_Type::Func_Decl: {
+			AST_Func_Decl* func = (AST_Func_Decl*) statement.get();
+			func_val.as.ptr = (void*) func;
+			program_scope.set_def(func->name, func_val, DEF_FUNC);
+			break;
+		}
+		case AST_Node_Type::Class_Decl: {
+			AST_Class_Decl* class_node = (AST_Class_Decl*) statement.get();
+
+			auto class_it = class_decls.find(class_node->name);
+			if (class_it == class_decls.end()) {
+				eval_node(class_node, &ctx->global_scope);
+				break;
+			}
+
+			Class_Decl& decl = class_it->second;
+			decl.node = class_node;
+			decl.parent = class_node->parent;
+
+			for (auto& member : class_node->members) {
+				if (member->type == AST_Node_Type::Func_Decl) {
+					AST_Func_Decl* method = (AST_Func_Decl*) member.get();
+					func_val.as.ptr = (void*) method;
+					decl.scope.set_def(method->name, func_val, DEF_FUNC);
+				} else if (member->type == AST_Node_Type::Var_Decl) {
+					// keep the values of existing members, declare new ones
+					if (decl.scope.find_def(((AST_Var_Decl*) member.get())->name, false) == nullptr)
+						eval_node(member.get(), &decl.scope);
+				}
+			}
+
+			changed_classes.push_back(decl.name);
+			break;
+		}
+		case AST_Node_Type::Struct_Decl:
+			// live values depend on the layout, so existing structs stay as they are
+			if (program_scope.find_def(((AST_Struct_Decl*) statement.get())->name) == nullptr)
+				eval_node(statement.get(), &ctx->global_scope);
+			break;
+		case AST_Node_Type::Var_Decl:
+			if (ctx->global_scope.find_def(((AST_Var_Decl*) statement.get())->name) == nullptr)
+				eval_node(statement.get(), &ctx->global_scope);
+			break;
+		case AST_Node_Type::Multi_Var_Decl:
+			for (auto& decl : ((AST_Multi_Var_Decl*) statement.get())->decls) {
+				if (ctx->global_scope.find_def(((AST_Var_Decl*) decl.get())->name) == nullptr)
+					eval_node(decl.get(), &ctx->global_scope);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (changed_classes.empty())
+		return;
+
+	// what an instance of each class would get from new, cached per class
+	std::unordered_map<std::string, std::unordered_map<std::string, Definition>> class_members;
+	auto get_members = [&](const std::string& class_name) -> const std::unordered_map<std::string, Definition>& {
+		auto it = class_members.find(class_name);
+		if (it != class_members.end())
+			return it->second;
+
+		auto& members = class_members[class_name];
+		std::string cur = class_name;
+		while (!cur.empty()) {
+			auto decl_it = class_decls.find(cur);
+			if (decl_it == class_decls.end())
+				break;
+
+			// subclasses override their parents
+			for (const auto& def : decl_it->second.scope.definitions)
+				members.insert(def);
+
+			cur = decl_it->second.parent;
+		}
+		return members;
+	};
+
+	auto inherits_changed = [&](const std::string& class_name) {
+		std::string cur = class_name;
+		while (!cur.empty()) {
+			if (std::find(changed_classes.begin(), changed_classes.end(), cur) != changed_classes.end())
+				return true;
+
+			auto decl_it = class_decls.find(cur);
+			if (decl_it == class_decls.end())
+				return false;
+			cur = decl_it->second.parent;
+		}
+		return false;
+	};
+
+	for (const auto& obj : ctx->heap.get_objects()) {
+		if (obj->type != GC_Obj_Type::Instance)
+			continue;
+
+		GC_Obj_Instance* instance = (GC_Obj_Instance*) obj.get();
+		if (!inherits_changed(instance->class_name))
+			continue;
+
+		for (const auto& it : get_members(instance->class_name)) {
+			const Definition& member = it.second;
+			Definition* existing = instance->scope.find_def(it.first, false);
+
+			if (existing == nullptr) {
+				instance->scope.set_def(it.first, member.value, member.flags);
+			} else if (member.flags & DEF_FUNC) {
+				existing->value = member.value;
+			}
+		}
+	}
+}
+
+std::unique_ptr<Context> Interpreter::create_context() {
+	return std::make_unique<Context>(&program_scope);
 }
 
 void Interpreter::add_external_func(const Extern_Func& func) {
@@ -206,15 +445,41 @@ void Interpreter::add_external_func(const Extern_Func& func) {
 	Value val;
 	val.type = Value_Type::Extern_Func;
 	val.as.i = id;
-	global_scope.set_def(func.name, val, DEF_FUNC);
+	builtin_scope.set_def(func.name, val, DEF_FUNC);
 }
 
-std::string Interpreter::get_string(const Value& val) const {
+bool Interpreter::find_extern_func(const std::string& name, Value& out) {
+	Definition* def = builtin_scope.find_def(name, false);
+	if (def == nullptr || def->value.type != Value_Type::Extern_Func)
+		return false;
+
+	out = def->value;
+	return true;
+}
+
+std::string Interpreter::get_string(const Value& val, int precision) const {
+	char buf[NUM_FORMAT_MAX];
+
 	switch (val.type) {
 	case Value_Type::Null: return "null";
-	case Value_Type::Num: return std::to_string(val.as.num);
+	case Value_Type::Num: return std::string(buf, format_num(buf, val.as.num, precision));
 	case Value_Type::Bool: return val.as._bool ? "true" : "false";
-	case Value_Type::Func_Ref: return "func_ref";
+	case Value_Type::Func_Ref:
+	case Value_Type::BC_Func_Ref: return "func_ref";
+	case Value_Type::Struct: {
+		const Struct_Decl& decl = struct_decls[val.struct_id];
+
+		std::string str = decl.name + "(";
+		for (size_t i = 0; i < decl.fields.size(); i++) {
+			str += decl.fields[i] + ": ";
+			str.append(buf, format_num(buf, val.as.fields[i], precision));
+			if (i != decl.fields.size() - 1)
+				str += ", ";
+		}
+		str += ")";
+		return str;
+	}
+	case Value_Type::Struct_Type: return struct_decls[val.as.i].name;
 	case Value_Type::GC_Obj: {
 		GC_Obj* obj = (GC_Obj*) val.as.ptr;
 
@@ -239,6 +504,7 @@ std::string Interpreter::get_string(const Value& val) const {
 			// TODO: print members
 			return instance->class_name;
 		}
+		case GC_Obj_Type::Pool: return "pool(" + ((GC_Obj_Pool*) obj)->class_name + ")";
 		}
 		error();
 	}
@@ -255,18 +521,31 @@ Value Interpreter::call_function(Value func_ref, const std::vector<Value>& args,
 			error("Too few arguments", node);
 		}
 
-		extern_func_node = node;
+		// workers of a parallel section leave it pointing at the parallel_for call
+		if (!in_parallel)
+			extern_func_node = node;
 		return func.callback(args, (void*) this);
 	}
 
+	if (func_ref.type == Value_Type::Struct_Type) {
+		return construct_struct(func_ref, args, node);
+	}
+
+	if (func_ref.type == Value_Type::BC_Func_Ref) {
+		if (bc_vm == nullptr) {
+			error("No such function", node);
+		}
+		return bc_vm->call(func_ref.as.i, args.data(), args.size(), obj);
+	}
+
 	AST_Func_Decl* func_decl = (AST_Func_Decl*) func_ref.as.ptr;
 	if (args.size() != func_decl->args.size()) {
 		error("Incorrect number of arguments", node);
 	}
 
-	Scope func_scope((obj != nullptr) ? &obj->scope : &global_scope, obj);
+	Scope func_scope((obj != nullptr) ? &obj->scope : &ctx->global_scope, obj);
 	if (func_decl->is_global) {
-		func_scope.parent = &global_scope;
+		func_scope.parent = &ctx->global_scope;
 		func_scope.this_obj = nullptr;
 	}
 
@@ -279,9 +558,520 @@ Value Interpreter::call_function(Value func_ref, const std::vector<Value>& args,
 	return call_result.value;
 }
 
+// Point(1, 2), missing fields get their defaults
+Value Interpreter::construct_struct(const Value& struct_type, const std::vector<Value>& args, const AST_Node* node) {
+	const Struct_Decl& decl = struct_decls[struct_type.as.i];
+	if (args.size() > decl.fields.size()) {
+		error("Too many arguments for struct " + decl.name, node);
+	}
+
+	Value val{};
+	val.type = Value_Type::Struct;
+	val.struct_id = struct_type.as.i;
+
+	for (size_t i = 0; i < decl.fields.size(); i++) {
+		if (i < args.size())
+			val.as.fields[i] = expect_value(args[i], Value_Type::Num, node).as.num;
+		else
+			val.as.fields[i] = decl.defaults[i];
+	}
+
+	return val;
+}
+
+// assigns to what an expression referred to, see Eval_Result::field
+void Interpreter::store(const Eval_Result& target, const Value& val, const AST_Node* node) {
+	if (in_parallel && target.container != nullptr && !can_store_in_parallel(target.container, target.index)) {
+		error("Only the current item can be modified inside parallel_for", node);
+	}
+
+	if (target.field < 0) {
+		if (target.escapes)
+			promote(val);
+		*target.ref = val;
+		return;
+	}
+
+	if (val.type != Value_Type::Num) {
+		error("Struct fields can only hold numbers", node);
+	}
+
+	target.ref->as.fields[target.field] = val.as.num;
+}
+
+// everything but numbers, which callers handle inline
+Value Interpreter::apply_bin_op(Bin_Op op, const Value& lval, const Value& rval, const AST_Node* node) {
+	if (op == Bin_Op::And || op == Bin_Op::Or) {
+		bool left = expect_value(lval, Value_Type::Bool, node).as._bool;
+		bool right = expect_value(rval, Value_Type::Bool, node).as._bool;
+
+		return Value::from_bool(op == Bin_Op::And ? (left && right) : (left || right));
+	}
+
+	// "x = " + x, anything added to a string is formatted like in print
+	auto is_string = [](const Value& val) {
+		return val.type == Value_Type::GC_Obj && ((GC_Obj*) val.as.ptr)->type == GC_Obj_Type::String;
+	};
+	if (op == Bin_Op::Add && (is_string(lval) || is_string(rval))) {
+		std::string str;
+		append_interp_value(str, lval);
+		append_interp_value(str, rval);
+		GC_Obj_String* obj = new GC_Obj_String(std::move(str));
+		add_to_heap(obj);
+		return Value::from_gc_obj(obj);
+	}
+
+	if (is_string(lval) && is_string(rval)) {
+		const std::string& lstr = ((GC_Obj_String*) lval.as.ptr)->str;
+		const std::string& rstr = ((GC_Obj_String*) rval.as.ptr)->str;
+
+		if (op == Bin_Op::Equals)
+			return Value::from_bool(lstr == rstr);
+		if (op == Bin_Op::Not_Equals)
+			return Value::from_bool(lstr != rstr);
+	}
+
+	if (lval.type == Value_Type::Struct && rval.type == Value_Type::Struct &&
+		(op == Bin_Op::Equals || op == Bin_Op::Not_Equals)) {
+		bool equal = lval.struct_id == rval.struct_id;
+		for (size_t i = 0; equal && i < struct_decls[lval.struct_id].fields.size(); i++)
+			equal = lval.as.fields[i] == rval.as.fields[i];
+
+		return Value::from_bool(equal == (op == Bin_Op::Equals));
+	}
+
+	if (lval.type == Value_Type::Null || rval.type == Value_Type::Null) {
+		if (op == Bin_Op::Equals)
+			return Value::from_bool(lval.type == rval.type);
+		if (op == Bin_Op::Not_Equals)
+			return Value::from_bool(lval.type != rval.type);
+	}
+
+	error("unhandled binary operator, sorry.", node);
+	return {};
+}
+
+// a new instance with the fields and methods of its class and parents, not constructed yet
+GC_Obj_Instance* Interpreter::create_instance(const std::string& class_name, const AST_Node* node) {
+	auto class_it = class_decls.find(class_name);
+	if (class_it == class_decls.end()) {
+		error("Class not found: " + class_name, node);
+	}
+
+	const Class_Decl& class_decl = class_it->second;
+
+	// TODO: this_obj???
+	GC_Obj_Instance* instance = new GC_Obj_Instance(Scope(&ctx->global_scope, nullptr));
+	add_to_heap(instance);
+
+	instance->class_name = class_name;
+	instance->scope.definitions = class_decl.scope.definitions;
+	auto own_fields = ctx->class_fields.find(class_name);
+	if (own_fields != ctx->class_fields.end()) {
+		for (const auto& it : own_fields->second.definitions)
+			instance->scope.definitions[it.first].value = it.second.value;
+	}
+	for (auto& it : instance->scope.definitions)
+		it.second.scope = &instance->scope;
+
+	std::string cur = class_decl.parent;
+	while (!cur.empty()) {
+		auto parent_it = class_decls.find(cur);
+		if (parent_it == class_decls.end()) {
+			error("Class not found: " + cur, node);
+		}
+
+		for (const auto& it : parent_it->second.scope.definitions) {
+			const std::string& def_name = it.first;
+			const Definition& def = it.second;
+
+			if (instance->scope.find_def(def_name, false) != nullptr) {
+				// TODO: proper error handling, cant overload a var with a func etc.
+				//error("duplicate variable name: " + def_name);
+				continue;
+			}
+
+			instance->scope.set_def(def_name, get_class_field(cur, def_name, def.value), def.flags);
+		}
+
+		cur = parent_it->second.parent;
+	}
+
+	return instance;
+}
+
+// fields of a class declared by another context, evaluated in this one
+Scope& Interpreter::get_class_fields(const std::string& class_name) {
+	auto it = ctx->class_fields.find(class_name);
+	if (it == ctx->class_fields.end()) {
+		it = ctx->class_fields.emplace(class_name, Scope(nullptr, nullptr)).first;
+		it->second.persistent = true;
+	}
+	return it->second;
+}
+
+// a default as the current context evaluated it, or the declaring context's
+const Value& Interpreter::get_class_field(const std::string& class_name, const std::string& name, const Value& declared) {
+	auto fields_it = ctx->class_fields.find(class_name);
+	if (fields_it == ctx->class_fields.end())
+		return declared;
+
+	Definition* def = fields_it->second.find_def(name, false);
+	return def != nullptr ? def->value : declared;
+}
+
+// calls init with the evaluated args, if the class has one
+void Interpreter::construct_instance(GC_Obj_Instance* instance, const std::vector<std::unique_ptr<AST_Node>>& args, Scope* scope, const AST_Node* node) {
+	Definition* constructor = instance->scope.find_def("init", false);
+	if (constructor != nullptr) {
+		// evaluate constructor args
+		std::vector<Value> arg_evals;
+		for (auto& arg : args) {
+			arg_evals.push_back(eval_node(arg.get(), scope, nullptr).value);
+		}
+
+		// call constructor
+		call_function(constructor->value, arg_evals, instance);
+	}
+
+	if (constructor == nullptr && !args.empty()) {
+		error("Default constructor takes no args", node);
+	}
+}
+
+// hands out an instance reset to the class defaults, the caller constructs it
+GC_Obj_Instance* Interpreter::acquire_from_pool(GC_Obj_Pool* pool, const AST_Node* node) {
+	GC_Obj_Instance* instance;
+	if (!pool->free_list.empty()) {
+		instance = pool->free_list.back();
+		pool->free_list.pop_back();
+
+		// only values are reset, the definitions themselves stay allocated
+		for (auto& it : instance->scope.definitions) {
+			auto def_it = pool->defaults.find(it.first);
+			if (def_it != pool->defaults.end())
+				it.second.value = def_it->second.value;
+		}
+	} else {
+		// pool ran dry, grow it
+		instance = create_instance(pool->class_name, node);
+		instance->pool = pool;
+		pool->instances.push_back(instance);
+		if (!pool->young)
+			promote(Value::from_gc_obj(instance));
+	}
+
+	instance->released = false;
+	return instance;
+}
+
+void Interpreter::release_to_pool(GC_Obj_Pool* pool, const Value& val, const AST_Node* node) {
+	GC_Obj_Instance* instance = (GC_Obj_Instance*) expect_value(val, Value_Type::GC_Obj, node).as.ptr;
+	if (instance->type != GC_Obj_Type::Instance || instance->pool != pool) {
+		error("Object doesn't belong to this pool", node);
+	}
+	if (instance->released) {
+		error("Object was already released", node);
+	}
+
+	instance->released = true;
+	pool->free_list.push_back(instance);
+}
+
+void Interpreter::add_to_heap(GC_Obj* obj) {
+	if (in_parallel) {
+		obj->parallel_section = parallel_section;
+		std::lock_guard<std::mutex> lock(parallel_heap_mutex);
+		ctx->heap.add_obj(obj);
+		return;
+	}
+
+	ctx->heap.add_obj(obj);
+}
+
+// write check for the frame heap: val is stored somewhere that outlives the frame
+void Interpreter::promote(const Value& val) {
+	if (val.type != Value_Type::GC_Obj || !((GC_Obj*) val.as.ptr)->young)
+		return;
+
+	if (in_parallel) {
+		std::lock_guard<std::mutex> lock(parallel_heap_mutex);
+		ctx->heap.promote((GC_Obj*) val.as.ptr);
+		return;
+	}
+
+	ctx->heap.promote((GC_Obj*) val.as.ptr);
+}
+
+void Interpreter::write_log(Log_Level level, const std::string& msg) {
+	if (log_sink != nullptr) {
+		log_sink->write(level, msg);
+		return;
+	}
+
+	std::cout << msg << "\n";
+}
+
+void Interpreter::run_parallel(const Value& arr_val, const Value& func, GC_Obj_Array* results) {
+	AST_Node* node = extern_func_node;
+
+	if (in_parallel) {
+		error("parallel_for can't be nested", node);
+	}
+
+	expect_value(arr_val, Value_Type::GC_Obj, node);
+	GC_Obj_Array* arr = (GC_Obj_Array*) arr_val.as.ptr;
+	if (arr->type != GC_Obj_Type::Array) {
+		error("Expected array", node);
+	}
+
+	bool is_bc_func = func.type == Value_Type::BC_Func_Ref && bc_vm != nullptr;
+	if (func.type != Value_Type::Func_Ref && func.type != Value_Type::Extern_Func && !is_bc_func) {
+		error("Expected function", node);
+	}
+
+	bool pass_index = false;
+	if (func.type == Value_Type::Func_Ref)
+		pass_index = ((AST_Func_Decl*) func.as.ptr)->args.size() == 2;
+	else if (is_bc_func)
+		pass_index = bc_vm->get_program()->func_table[func.as.i].num_args == 2;
+
+	if (thread_pool == nullptr) {
+		thread_pool = std::make_unique<Thread_Pool>(num_workers);
+	}
+
+	size_t count = arr->arr.size();
+	if (results != nullptr) {
+		results->arr.resize(count);
+	}
+
+	// globals become read-only, arrays can't be resized and stores are checked
+	// by can_store_in_parallel, so workers only ever write to their own items,
+	// locals and result slots. the heap is locked for new objects and the GC is
+	// off until everyone is done
+	in_parallel = true;
+	parallel_section++;
+	ctx->global_scope.read_only = true;
+
+	// the VM's stacks aren't shared, every participating thread gets its own
+	std::vector<std::unique_ptr<BC_VM>> workers(thread_pool->get_num_threads());
+
+	size_t chunk_size = std::max(count / (thread_pool->get_num_threads() * 8), (size_t) 1);
+	thread_pool->parallel_for(count, chunk_size, [&](int participant, size_t begin, size_t end) {
+		std::unique_ptr<BC_VM>& worker = workers[participant];
+		if (is_bc_func && worker == nullptr)
+			worker = std::make_unique<BC_VM>(*bc_vm);
+
+		// another interpreter's parallel_for may be running this one
+		Parallel_Item prev_item = parallel_item;
+
+		std::vector<Value> args;
+		for (size_t i = begin; i < end; i++) {
+			const Value& item = arr->arr[i];
+			parallel_item = {item.type == Value_Type::GC_Obj ? (const GC_Obj*) item.as.ptr : nullptr, i};
+
+			args.clear();
+			args.push_back(item);
+			if (pass_index)
+				args.push_back(Value::from_num(i));
+
+			Value result = worker != nullptr ? worker->call(func.as.i, args.data(), args.size()) : call_function(func, args, nullptr, node);
+			if (results != nullptr)
+				results->arr[i] = result;
+		}
+
+		parallel_item = prev_item;
+	});
+
+	ctx->global_scope.read_only = false;
+	in_parallel = false;
+}
+
+// anything else may be shared with another worker. objects created by any worker
+// are only reachable from the worker's own item or locals
+bool Interpreter::can_store_in_parallel(const GC_Obj* container, int index) const {
+	if (container == parallel_item.obj || container->parallel_section == parallel_section)
+		return true;
+
+	return container->type == GC_Obj_Type::Array && index == (int) parallel_item.index;
+}
+
+// forgets locals declared by a function body, so a reused scope can run it again
+static void forget_locals(Scope& scope, const std::vector<Definition*>& arg_defs) {
+	if (scope.definitions.size() == arg_defs.size())
+		return;
+
+	for (auto it = scope.definitions.begin(); it != scope.definitions.end();) {
+		if (std::find(arg_defs.begin(), arg_defs.end(), &it->second) == arg_defs.end())
+			it = scope.definitions.erase(it);
+		else
+			++it;
+	}
+}
+
+void Interpreter::call_function_batch(Value func_ref, const std::vector<const Value*>& columns, size_t count, Value* results, GC_Obj_Instance* obj) {
+	if (func_ref.type == Value_Type::Extern_Func) {
+		const Extern_Func& func = external_funcs[func_ref.as.i];
+		if (columns.size() < func.min_args) {
+			error("Too few arguments");
+		}
+
+		std::vector<Value> args(columns.size());
+		for (size_t i = 0; i < count; i++) {
+			for (size_t j = 0; j < columns.size(); j++)
+				args[j] = columns[j][i];
+
+			results[i] = func.callback(args, (void*) this);
+		}
+		return;
+	}
+
+	if (func_ref.type == Value_Type::BC_Func_Ref && bc_vm != nullptr) {
+		bc_vm->call_batch(func_ref.as.i, columns, count, results, obj);
+		return;
+	}
+
+	if (func_ref.type != Value_Type::Func_Ref) {
+		error("No such function");
+	}
+
+	AST_Func_Decl* func_decl = (AST_Func_Decl*) func_ref.as.ptr;
+	if (columns.size() != func_decl->args.size()) {
+		error("Incorrect number of arguments");
+	}
+
+	Scope func_scope((obj != nullptr) ? &obj->scope : &ctx->global_scope, obj);
+	if (func_decl->is_global) {
+		func_scope.parent = &ctx->global_scope;
+		func_scope.this_obj = nullptr;
+	}
+
+	// defs don't move once inserted, so the args can be overwritten in place
+	std::vector<Definition*> arg_defs;
+	for (const auto& arg : func_decl->args) {
+		func_scope.set_def(arg.name, {});
+		arg_defs.push_back(func_scope.find_def(arg.name, false));
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		for (size_t j = 0; j < arg_defs.size(); j++)
+			arg_defs[j]->value = columns[j][i];
+
+		results[i] = eval_node(func_decl->body.get(), &func_scope).value;
+
+		forget_locals(func_scope, arg_defs);
+	}
+}
+
+Func_Handle Interpreter::prepare_call(const std::string& name, int num_args, GC_Obj_Instance* obj) {
+	const Definition* def = (obj != nullptr) ? obj->scope.find_def(name) : ctx->global_scope.find_def(name);
+	if (def == nullptr)
+		return {};
+
+	return prepare_call(def->value, num_args, obj);
+}
+
+Func_Handle Interpreter::prepare_call(Value func_ref, int num_args, GC_Obj_Instance* obj) {
+	Func_Handle handle;
+
+	if (func_ref.type == Value_Type::Extern_Func) {
+		if (num_args < external_funcs[func_ref.as.i].min_args) {
+			error("Too few arguments");
+		}
+	} else if (func_ref.type == Value_Type::Func_Ref) {
+		AST_Func_Decl* func_decl = (AST_Func_Decl*) func_ref.as.ptr;
+		if (num_args != func_decl->args.size()) {
+			error("Incorrect number of arguments");
+		}
+
+		if (func_decl->is_global)
+			obj = nullptr;
+
+		handle.scope = std::make_unique<Scope>((obj != nullptr) ? &obj->scope : &ctx->global_scope, obj);
+		for (const auto& arg : func_decl->args) {
+			handle.scope->set_def(arg.name, {});
+			handle.arg_defs.push_back(handle.scope->find_def(arg.name, false));
+		}
+	} else if (func_ref.type == Value_Type::BC_Func_Ref && bc_vm != nullptr) {
+		const BC_Func& func = bc_vm->get_program()->func_table[func_ref.as.i];
+		if (num_args != func.num_args) {
+			error("Incorrect number of arguments");
+		}
+
+		if (!func.is_method)
+			obj = nullptr;
+	} else {
+		error("No such function");
+	}
+
+	handle.interp = this;
+	handle.ctx = ctx;
+	handle.func = func_ref;
+	handle.num_args = num_args;
+	handle.obj = obj;
+	if (obj != nullptr)
+		obj->pin_count++;
+
+	return handle;
+}
+
+Func_Handle& Func_Handle::operator=(Func_Handle&& other) noexcept {
+	if (this == &other)
+		return *this;
+
+	release();
+
+	interp = other.interp;
+	ctx = other.ctx;
+	func = other.func;
+	obj = other.obj;
+	num_args = other.num_args;
+	scope = std::move(other.scope);
+	arg_defs = std::move(other.arg_defs);
+	in_use = false;
+
+	other.interp = nullptr;
+	other.obj = nullptr;
+	return *this;
+}
+
+void Func_Handle::release() {
+	if (obj != nullptr)
+		obj->pin_count--;
+
+	interp = nullptr;
+	obj = nullptr;
+	scope.reset();
+	arg_defs.clear();
+}
+
+Value Func_Handle::call(const Value* args, size_t count) {
+	assert(is_valid() && count == num_args);
+
+	Context* prev_ctx = interp->ctx;
+	interp->ctx = ctx;
+
+	Value result;
+	// only the interpreter's own functions have a scope to reuse
+	if (func.type != Value_Type::Func_Ref || in_use) {
+		result = interp->call_function(func, std::vector<Value>(args, args + count), obj);
+	} else {
+		in_use = true;
+		for (size_t i = 0; i < count; i++)
+			arg_defs[i]->value = args[i];
+
+		result = interp->eval_node(((AST_Func_Decl*) func.as.ptr)->body.get(), scope.get()).value;
+		forget_locals(*scope, arg_defs);
+		in_use = false;
+	}
+
+	interp->ctx = prev_ctx;
+	return result;
+}
+
 Value Interpreter::create_string(const std::string& str) {
 	GC_Obj_String* obj = new GC_Obj_String(str);
-	heap.add_obj(obj);
+	add_to_heap(obj);
 
 	Value val;
 	val.type = Value_Type::GC_Obj;
@@ -289,6 +1079,57 @@ Value Interpreter::create_string(const std::string& str) {
 	return val;
 }
 
+GC_Obj_String* Interpreter::alloc_scratch_string() {
+	if (num_scratch_strings == scratch_strings.size())
+		scratch_strings.emplace_back(new GC_Obj_String(std::string()));
+
+	return scratch_strings[num_scratch_strings++].get();
+}
+
+GC_Obj_Array* Interpreter::alloc_scratch_array() {
+	if (num_scratch_arrays == scratch_arrays.size())
+		scratch_arrays.emplace_back(new GC_Obj_Array());
+
+	GC_Obj_Array* arr = scratch_arrays[num_scratch_arrays++].get();
+	arr->arr.clear();
+	return arr;
+}
+
+Value Interpreter::create_string(std::string&& str) {
+	GC_Obj_String* obj = new GC_Obj_String(std::move(str));
+	add_to_heap(obj);
+
+	return Value::from_gc_obj(obj);
+}
+
+// text of a value inside an interpolated string, same as get_string but
+// without a temporary string for strings and numbers
+void Interpreter::append_interp_value(std::string& out, const Value& val, int precision) const {
+	if (val.type == Value_Type::Num) {
+		char buf[NUM_FORMAT_MAX];
+		out.append(buf, format_num(buf, val.as.num, precision));
+		return;
+	}
+
+	if (val.type == Value_Type::GC_Obj && ((GC_Obj*) val.as.ptr)->type == GC_Obj_Type::String) {
+		out += ((GC_Obj_String*) val.as.ptr)->str;
+		return;
+	}
+
+	out += get_string(val, precision);
+}
+
+// only used to reserve, so numbers get a typical length instead of being formatted twice
+size_t Interpreter::interp_value_length(const Value& val, int precision) const {
+	if (val.type == Value_Type::Num)
+		return precision < 0 ? 8 : 8 + precision;
+
+	if (val.type == Value_Type::GC_Obj && ((GC_Obj*) val.as.ptr)->type == GC_Obj_Type::String)
+		return ((GC_Obj_String*) val.as.ptr)->str.size();
+
+	return get_string(val, precision).size();
+}
+
 // TODO: does this need to be here?
 const Value& Interpreter::expect_value(const Value& val, Value_Type expected_type, const AST_Node* node) const {
 	if (val.type != expected_type) {
@@ -298,6 +1139,17 @@ const Value& Interpreter::expect_value(const Value& val, Value_Type expected_typ
 	return val;
 }
 
+int Interpreter::get_precision_arg(const std::vector<Value>& args, size_t index) const {
+	if (args.size() <= index)
+		return -1;
+
+	float precision = expect_value(args[index], Value_Type::Num, extern_func_node).as.num;
+	if (precision > NUM_FORMAT_MAX_PRECISION)
+		error("Precision can be at most " + std::to_string(NUM_FORMAT_MAX_PRECISION) + " decimals", extern_func_node);
+
+	return precision < 0 ? -1 : (int) precision;
+}
+
 // a.b()
 // selected_obj is set for children evals calls when using dot operator
 Eval_Result Interpreter::eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance* selected_obj) {
@@ -310,8 +1162,57 @@ Eval_Result Interpreter::eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance
 	case AST_Node_Type::String_Literal: {
 		AST_String_Literal* sub = (AST_String_Literal*) node;
 
+		if (use_scratch(node)) {
+			GC_Obj_String* str = alloc_scratch_string();
+			str->str.assign(sub->str);
+			return {Value::from_gc_obj(str)};
+		}
+
 		return {create_string(sub->str)};
 	}
+	case AST_Node_Type::String_Interp: {
+		AST_String_Interp* sub = (AST_String_Interp*) node;
+
+		// evaluate everything first, so the result is allocated once at its final length
+		const size_t MAX_LOCAL_VALUES = 8;
+		Value local_values[MAX_LOCAL_VALUES];
+		std::vector<Value> more_values;
+		Value* values = local_values;
+		if (sub->exprs.size() > MAX_LOCAL_VALUES) {
+			more_values.resize(sub->exprs.size());
+			values = more_values.data();
+		}
+
+		size_t length = 0;
+		for (const auto& part : sub->parts)
+			length += part.size();
+
+		Scratch_Scope scratch(*this);
+		for (size_t i = 0; i < sub->exprs.size(); i++) {
+			values[i] = eval_node(sub->exprs[i].get(), scope).value;
+			length += interp_value_length(values[i], sub->precisions[i]);
+		}
+
+		bool temp = use_scratch(node);
+		std::string local_str;
+		std::string& str = temp ? scratch_buf : local_str;
+		str.clear();
+		str.reserve(length);
+		for (size_t i = 0; i < sub->exprs.size(); i++) {
+			str += sub->parts[i];
+			append_interp_value(str, values[i], sub->precisions[i]);
+		}
+		str += sub->parts.back();
+
+		scratch.release();
+		if (temp) {
+			GC_Obj_String* obj = alloc_scratch_string();
+			obj->str.swap(str);
+			return {Value::from_gc_obj(obj)};
+		}
+
+		return {create_string(std::move(str))};
+	}
 	case AST_Node_Type::Unary_Op: {
 		AST_Unary_Op* sub = (AST_Unary_Op*) node;
 
@@ -332,25 +1233,20 @@ Eval_Result Interpreter::eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance
 		}
 
 		if (expr_eval.ref == nullptr) {
-			error("Expression is not modifiable", node);
+			error(in_parallel ? "Expression is not modifiable (globals are read-only inside parallel_for)" : "Expression is not modifiable", node);
 		}
 
-		if (expr_eval.ref->type != Value_Type::Num) {
-			error("Expected number", node);
+		if (sub->op != Unary_Op::Increment && sub->op != Unary_Op::Decrement) {
+			error("", node);
 		}
 
+		// x++ is x += 1, like in BC_VM
 		Value old_value = expr_eval.value;
-
-		switch (sub->op) {
-		case Unary_Op::Increment:
-			*expr_eval.ref = Value::from_num(expr_eval.ref->as.num + 1);
-			break;
-		case Unary_Op::Decrement:
-			*expr_eval.ref = Value::from_num(expr_eval.ref->as.num - 1);
-			break;
-		default:
-			error("", node);
-		}
+		Bin_Op op = sub->op == Unary_Op::Increment ? Bin_Op::Add : Bin_Op::Sub;
+		if (old_value.type == Value_Type::Num)
+			store(expr_eval, Value::from_num(old_value.as.num + (op == Bin_Op::Add ? 1 : -1)), node);
+		else
+			store(expr_eval, apply_bin_op(op, old_value, Value::from_num(1), node), node);
 
 		return {old_value};
 	}
@@ -363,23 +1259,75 @@ Eval_Result Interpreter::eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance
 
 			Value rval = eval_node(sub->right.get(), scope).value;
 
-			Value* ref = eval_node(sub->left.get(), scope).ref;
-			if (ref == nullptr) {
-				error("Expression is not modifiable", node);
+			Eval_Result target = eval_node(sub->left.get(), scope);
+			if (target.ref == nullptr) {
+				error(in_parallel ? "Expression is not modifiable (globals are read-only inside parallel_for)" : "Expression is not modifiable", node);
 			}
 
-			*ref = rval;
+			store(target, rval, node);
 
 			Eval_Result result;
 			result.value = rval;
-			result.ref = ref;
+			result.ref = target.ref;
+			result.field = target.field;
+			result.escapes = target.escapes;
+			result.container = target.container;
+			result.index = target.index;
 			return result;
 		}
 
 		if (sub->op == Bin_Op::Dot) {
 			// dot operator needs to not immediately change scope,
 			// but store the scope and change when rightside function call happens
-			Value lval = expect_value(eval_node(sub->left.get(), scope).value, Value_Type::GC_Obj, node);
+			Eval_Result l_eval = eval_node(sub->left.get(), scope);
+
+			// struct.field
+			if (l_eval.value.type == Value_Type::Struct) {
+				// postfix ops end up on the right side: p.x++
+				AST_Unary_Op* postfix = nullptr;
+				AST_Node* field_node = sub->right.get();
+				if (field_node->type == AST_Node_Type::Unary_Op) {
+					postfix = (AST_Unary_Op*) field_node;
+					field_node = postfix->expr.get();
+				}
+
+				if (field_node->type != AST_Node_Type::Var) {
+					error("Structs only have fields", node);
+				}
+
+				const Struct_Decl& decl = struct_decls[l_eval.value.struct_id];
+				const std::string& name = ((AST_Var*) field_node)->name;
+
+				auto it = std::find(decl.fields.begin(), decl.fields.end(), name);
+				if (it == decl.fields.end()) {
+					error("No field " + name + " in struct " + decl.name, node);
+				}
+
+				Eval_Result result;
+				result.field = (int) (it - decl.fields.begin());
+				result.value = Value::from_num(l_eval.value.as.fields[result.field]);
+				result.ref = l_eval.ref;
+				result.container = l_eval.container;
+				result.index = l_eval.index;
+				if (result.ref == nullptr)
+					result.field = -1;
+
+				if (postfix != nullptr) {
+					if (postfix->op != Unary_Op::Increment && postfix->op != Unary_Op::Decrement) {
+						error("Structs only have fields", node);
+					}
+					if (result.ref == nullptr) {
+						error("Expression is not modifiable", node);
+					}
+
+					float delta = postfix->op == Unary_Op::Increment ? 1.0f : -1.0f;
+					store(result, Value::from_num(result.value.as.num + delta), node);
+					return {result.value};
+				}
+				return result;
+			}
+
+			Value lval = expect_value(l_eval.value, Value_Type::GC_Obj, node);
 
 			GC_Obj* gc_obj = (GC_Obj*) lval.as.ptr;
 
@@ -406,13 +1354,20 @@ Eval_Result Interpreter::eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance
 
 				AST_Var* var = (AST_Var*) fcall->expr.get();
 
+				if (in_parallel && (var->name == "push" || var->name == "pop" || var->name == "remove_at")) {
+					error("Arrays can't be resized inside parallel_for", node);
+				}
+
 				// array.push(val)
 				if (var->name == "push") {
 					if (fcall->args.size() != 1) {
 						error("Incorrect number of args", node);
 					}
 
-					arr->arr.push_back(eval_node(fcall->args[0].get(), scope).value);
+					Value val = eval_node(fcall->args[0].get(), scope).value;
+					if (!arr->young)
+						promote(val);
+					arr->arr.push_back(val);
 					return {};
 				}
 
@@ -447,6 +1402,47 @@ Eval_Result Interpreter::eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance
 				}
 			}
 
+			// pool.acquire(args...), pool.release(instance), pool.size, pool.available
+			if (gc_obj->type == GC_Obj_Type::Pool) {
+				GC_Obj_Pool* pool = (GC_Obj_Pool*) gc_obj;
+
+				if (sub->right->type == AST_Node_Type::Var) {
+					AST_Var* var = (AST_Var*) sub->right.get();
+					if (var->name == "size")
+						return {Value::from_num(pool->instances.size())};
+					if (var->name == "available")
+						return {Value::from_num(pool->free_list.size())};
+				}
+
+				if (sub->right->type != AST_Node_Type::Func_Call || ((AST_Func_Call*) sub->right.get())->expr->type != AST_Node_Type::Var) {
+					error("Pools only have acquire(), release(), size and available", node);
+				}
+
+				AST_Func_Call* fcall = (AST_Func_Call*) sub->right.get();
+				const std::string& method = ((AST_Var*) fcall->expr.get())->name;
+
+				if (in_parallel) {
+					error("Pools can't be used inside parallel_for", node);
+				}
+
+				if (method == "acquire") {
+					GC_Obj_Instance* instance = acquire_from_pool(pool, node);
+					construct_instance(instance, fcall->args, scope, node);
+					return {Value::from_gc_obj(instance)};
+				}
+
+				if (method == "release") {
+					if (fcall->args.size() != 1) {
+						error("Incorrect number of args", node);
+					}
+
+					release_to_pool(pool, eval_node(fcall->args[0].get(), scope).value, node);
+					return {};
+				}
+
+				error("Pools only have acquire(), release(), size and available", node);
+			}
+
 			// string.length
 			if (gc_obj->type == GC_Obj_Type::String && sub->right->type == AST_Node_Type::Var) {
 				GC_Obj_String* str = (GC_Obj_String*) gc_obj;
@@ -500,12 +1496,20 @@ Eval_Result Interpreter::eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance
 			return {Value::from_bool(inst->class_name == compare->name)};
 		}
 
+		// temporary operands are gone once the result exists
+		Scratch_Scope scratch(*this, sub->left->temp || sub->right->temp);
 		Eval_Result l_eval = eval_node(sub->left.get(), scope);
 		Eval_Result r_eval = eval_node(sub->right.get(), scope);
 
 		Value lval = l_eval.value;
 		Value rval = r_eval.value;
 
+		bool is_compound_assign = sub->op == Bin_Op::Add_Assign || sub->op == Bin_Op::Sub_Assign ||
+			sub->op == Bin_Op::Mul_Assign || sub->op == Bin_Op::Div_Assign;
+		if (is_compound_assign && l_eval.ref == nullptr) {
+			error(in_parallel ? "Expression is not modifiable (globals are read-only inside parallel_for)" : "Expression is not modifiable", node);
+		}
+
 		if (lval.type == Value_Type::Num && rval.type == Value_Type::Num) {
 			Value val;
 			switch (sub->op) {
@@ -541,19 +1545,19 @@ Eval_Result Interpreter::eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance
 				break;
 			case Bin_Op::Add_Assign:
 				val = Value::from_num(lval.as.num + rval.as.num);
-				*l_eval.ref = val;
+				store(l_eval, val, node);
 				break;
 			case Bin_Op::Sub_Assign:
 				val = Value::from_num(lval.as.num - rval.as.num);
-				*l_eval.ref = val;
+				store(l_eval, val, node);
 				break;
 			case Bin_Op::Mul_Assign:
 				val = Value::from_num(lval.as.num * rval.as.num);
-				*l_eval.ref = val;
+				store(l_eval, val, node);
 				break;
 			case Bin_Op::Div_Assign:
 				val = Value::from_num(lval.as.num / rval.as.num);
-				*l_eval.ref = val;
+				store(l_eval, val, node);
 				break;
 			default:
 				error("", node);
@@ -562,60 +1566,31 @@ Eval_Result Interpreter::eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance
 			return {val};
 		}
 
-		if (sub->op == Bin_Op::And || sub->op == Bin_Op::Or) {
-			bool left = expect_value(lval, Value_Type::Bool, node).as._bool;
-			bool right = expect_value(rval, Value_Type::Bool, node).as._bool;
-
-			bool result = sub->op == Bin_Op::And ?
-				(left && right) :
-				(left || right);
-
-			return {Value::from_bool(result)};
-		}
-
-		if (lval.type == Value_Type::GC_Obj && rval.type == Value_Type::GC_Obj) {
-			GC_Obj* lobj = (GC_Obj*) lval.as.ptr;
-			GC_Obj* robj = (GC_Obj*) rval.as.ptr;
-
-			if (lobj->type == GC_Obj_Type::String && robj->type == GC_Obj_Type::String) {
-				GC_Obj_String* lstr = (GC_Obj_String*) lval.as.ptr;
-				GC_Obj_String* rstr = (GC_Obj_String*) rval.as.ptr;
-
-				if (sub->op == Bin_Op::Add) {
-					GC_Obj_String* obj = new GC_Obj_String(lstr->str + rstr->str);
-					heap.add_obj(obj);
-
-					Eval_Result result;
-					result.value = Value::from_gc_obj(obj);
-					return result;
-				}
-
-				if (sub->op == Bin_Op::Equals) {
-					Eval_Result result;
-					result.value = Value::from_bool(lstr->str == rstr->str);
-					return result;
-				}
-
-				if (sub->op == Bin_Op::Not_Equals) {
-					Eval_Result result;
-					result.value = Value::from_bool(lstr->str != rstr->str);
-					return result;
-				}
-			}
+		if (is_compound_assign) {
+			Bin_Op op = sub->op == Bin_Op::Add_Assign ? Bin_Op::Add :
+				sub->op == Bin_Op::Sub_Assign ? Bin_Op::Sub :
+				sub->op == Bin_Op::Mul_Assign ? Bin_Op::Mul : Bin_Op::Div;
+			Value val = apply_bin_op(op, lval, rval, node);
+			store(l_eval, val, node);
+			return {val};
 		}
 
-		if (lval.type == Value_Type::Null || rval.type == Value_Type::Null) {
-			if (sub->op == Bin_Op::Equals) {
-				return {Value::from_bool(lval.type == rval.type)};
-			}
-
-			if (sub->op == Bin_Op::Not_Equals) {
-				return {Value::from_bool(lval.type != rval.type)};
-			}
+		// "x = " + x, anything added to a string is formatted like in print
+		auto is_string = [](const Value& val) {
+			return val.type == Value_Type::GC_Obj && ((GC_Obj*) val.as.ptr)->type == GC_Obj_Type::String;
+		};
+		if (sub->op == Bin_Op::Add && (is_string(lval) || is_string(rval)) && use_scratch(node)) {
+			// the operands may be released scratch strings, build the result first
+			scratch_buf.clear();
+			append_interp_value(scratch_buf, lval);
+			append_interp_value(scratch_buf, rval);
+			scratch.release();
+			GC_Obj_String* obj = alloc_scratch_string();
+			obj->str.swap(scratch_buf);
+			return {Value::from_gc_obj(obj)};
 		}
 
-		error("unhandled binary operator, sorry.", node);
-		return {};
+		return {apply_bin_op(sub->op, lval, rval, node)};
 	}
 	case AST_Node_Type::Block: {
 		AST_Block* sub = (AST_Block*) node;
@@ -638,6 +1613,8 @@ Eval_Result Interpreter::eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance
 			val = eval_node(sub->init.get(), scope).value;
 		}
 
+		if (scope->persistent)
+			promote(val);
 		scope->set_def(sub->name, val, sub->is_const ? DEF_CONST : 0);
 		break;
 	}
@@ -667,12 +1644,21 @@ Eval_Result Interpreter::eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance
 
 		Eval_Result ret;
 		ret.value = var->value;
-		ret.ref = (var->flags & (DEF_CONST | DEF_FUNC)) ? nullptr : &var->value;
+		bool read_only = (var->flags & (DEF_CONST | DEF_FUNC)) || (var->scope != nullptr && var->scope->read_only);
+		ret.ref = read_only ? nullptr : &var->value;
+		ret.escapes = var->scope != nullptr && var->scope->persistent && (var->scope->owner == nullptr || !var->scope->owner->young);
+		if (var->scope != nullptr)
+			ret.container = var->scope->owner;
 		return ret;
 	}
 	case AST_Node_Type::Func_Decl: {
 		AST_Func_Decl* sub = (AST_Func_Decl*) node;
-		if (scope->find_def(sub->name) != nullptr) {
+		Definition* existing = scope->find_def(sub->name);
+		if (existing != nullptr) {
+			// already declared when the program ran in another context
+			if (scope == &ctx->global_scope && existing->value.type == Value_Type::Func_Ref && existing->value.as.ptr == sub)
+				break;
+
 			error("Conflicting function name: " + sub->name, node);
 		}
 
@@ -680,7 +1666,9 @@ Eval_Result Interpreter::eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance
 		val.type = Value_Type::Func_Ref;
 		val.as.ptr = (void*) sub;
 
-		scope->set_def(sub->name, val, DEF_FUNC);
+		// global functions are shared by all contexts
+		Scope* target = scope == &ctx->global_scope ? &program_scope : scope;
+		target->set_def(sub->name, val, DEF_FUNC);
 		break;
 	}
 	case AST_Node_Type::Return: {
@@ -701,14 +1689,27 @@ Eval_Result Interpreter::eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance
 
 		// foo.bar(); foo is selected_obj
 		Value func_ref = eval_node(sub->expr.get(), scope, selected_obj).value;
-		if (func_ref.type != Value_Type::Func_Ref && func_ref.type != Value_Type::Extern_Func) {
+		if (func_ref.type != Value_Type::Func_Ref && func_ref.type != Value_Type::Extern_Func && func_ref.type != Value_Type::Struct_Type) {
 			error("No such function", node);
 		}
 
+		// args of externs that only borrow them can be temporaries. workers of a
+		// parallel section share borrowed_arg and the scratch stack, they leave both alone
+		bool borrows = func_ref.type == Value_Type::Extern_Func && (external_funcs[func_ref.as.i].flags & EXTERN_BORROWS_ARGS);
+		Scratch_Scope scratch(*this, borrows);
+
 		// evaluate caller argument expressions
 		std::vector<Value> arg_evals;
-		for (auto& arg : sub->args) {
-			arg_evals.push_back(eval_node(arg.get(), scope).value);
+		if (in_parallel) {
+			for (auto& arg : sub->args)
+				arg_evals.push_back(eval_node(arg.get(), scope).value);
+		} else {
+			const AST_Node* prev_borrowed = borrowed_arg;
+			for (auto& arg : sub->args) {
+				borrowed_arg = borrows ? arg.get() : nullptr;
+				arg_evals.push_back(eval_node(arg.get(), scope).value);
+			}
+			borrowed_arg = prev_borrowed;
 		}
 		
 		Value result = call_function(func_ref, arg_evals, selected_obj != nullptr ? selected_obj : scope->this_obj, node);
@@ -764,6 +1765,7 @@ Eval_Result Interpreter::eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance
 
 		Scope new_scope(scope, scope->this_obj);
 
+		Scratch_Scope scratch(*this, sub->expr->temp);
 		Value expr_val = eval_node(sub->expr.get(), scope).value;
 
 		if (expr_val.type == Value_Type::Num) {
@@ -817,8 +1819,13 @@ Eval_Result Interpreter::eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance
 	case AST_Node_Type::Array_Init: {
 		AST_Array_Init* sub = (AST_Array_Init*) node;
 
-		GC_Obj_Array* gc_obj = new GC_Obj_Array();
-		heap.add_obj(gc_obj);
+		GC_Obj_Array* gc_obj;
+		if (use_scratch(node)) {
+			gc_obj = alloc_scratch_array();
+		} else {
+			gc_obj = new GC_Obj_Array();
+			add_to_heap(gc_obj);
+		}
 
 		for (auto& item : sub->items) {
 			gc_obj->arr.push_back(eval_node(item.get(), scope).value);
@@ -833,6 +1840,7 @@ Eval_Result Interpreter::eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance
 	case AST_Node_Type::Subscript: {
 		AST_Subscript* sub = (AST_Subscript*) node;
 
+		Scratch_Scope scratch(*this, sub->expr->temp);
 		Value expr_val = eval_node(sub->expr.get(), scope).value;
 		if (expr_val.type != Value_Type::GC_Obj) {
 			error("Expected gc obj", node);
@@ -856,6 +1864,9 @@ Eval_Result Interpreter::eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance
 			Eval_Result result;
 			result.ref = &arr->arr[index];
 			result.value = arr->arr[index];
+			result.escapes = !arr->young;
+			result.container = arr;
+			result.index = index;
 			return result;
 		} else if (gc_obj->type == GC_Obj_Type::String) {
 			GC_Obj_String* str = (GC_Obj_String*) gc_obj;
@@ -864,9 +1875,18 @@ Eval_Result Interpreter::eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance
 				error("Out of bounds", node);
 			}
 
+			char c = str->str[index];
+			scratch.release();
+
 			Eval_Result result;
 			result.ref = nullptr; // strings are immutable
-			result.value = create_string(std::string(1, str->str[index])); // this is so slow...
+			if (use_scratch(node)) {
+				GC_Obj_String* obj = alloc_scratch_string();
+				obj->str.assign(1, c);
+				result.value = Value::from_gc_obj(obj);
+			} else {
+				result.value = create_string(std::string(1, c)); // this is so slow...
+			}
 			return result;
 		}
 
@@ -875,10 +1895,27 @@ Eval_Result Interpreter::eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance
 	}
 	case AST_Node_Type::Class_Decl: {
 		AST_Class_Decl* sub = (AST_Class_Decl*) node;
-		
+
+		if (in_parallel) {
+			error("Classes can't be declared inside parallel_for", node);
+		}
+
+		// already declared when the program ran in another context, only the fields
+		// are evaluated again
+		auto existing = class_decls.find(sub->name);
+		if (existing != class_decls.end() && existing->second.node == sub) {
+			Scope& fields = get_class_fields(sub->name);
+			for (const auto& member : sub->members) {
+				if (member->type != AST_Node_Type::Func_Decl)
+					eval_node(member.get(), &fields);
+			}
+			return {};
+		}
+
 		Class_Decl decl;
 		decl.name = sub->name;
 		decl.parent = sub->parent;
+		decl.node = sub;
 
 		for (const auto& member : sub->members) {
 			eval_node(member.get(), &decl.scope);
@@ -888,62 +1925,60 @@ Eval_Result Interpreter::eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance
 			error("Redefinition of class \"" + decl.name + "\"", node);
 		}
 
-		class_decls[decl.name] = decl;
+		Class_Decl& stored = class_decls[decl.name];
+		stored = decl;
+		for (auto& it : stored.scope.definitions)
+			it.second.scope = &stored.scope;
 		return {};
 	}
-	case AST_Node_Type::New: {
-		AST_New* sub = (AST_New*) node;
+	case AST_Node_Type::Struct_Decl: {
+		AST_Struct_Decl* sub = (AST_Struct_Decl*) node;
 
-		if (class_decls.find(sub->name) == class_decls.end()) {
-			error("Class not found: " + sub->name, node);
+		if (in_parallel) {
+			error("Structs can't be declared inside parallel_for", node);
 		}
 
-		const Class_Decl& class_decl = class_decls[sub->name];
-
-		// TODO: this_obj???
-		GC_Obj_Instance* instance = new GC_Obj_Instance(Scope(&global_scope, nullptr));
-		heap.add_obj(instance);
-
-		instance->class_name = sub->name;
-		instance->scope.definitions = class_decl.scope.definitions;
+		Definition* existing = program_scope.find_def(sub->name);
+		if (existing != nullptr) {
+			// already declared when the program ran in another context
+			if (existing->value.type == Value_Type::Struct_Type && struct_decls[existing->value.as.i].node == sub)
+				return {};
 
-		std::string cur = class_decl.parent;
-		while (!cur.empty()) {
-			if (class_decls.find(cur) == class_decls.end()) {
-				error("Class not found: " + cur, node);
-			}
+			error("Conflicting struct name: " + sub->name, node);
+		}
 
-			for (const auto& it : class_decls[cur].scope.definitions) {
-				const std::string& def_name = it.first;
-				const Definition& def = it.second;
+		if (sub->fields.size() > MAX_STRUCT_FIELDS) {
+			error("Structs can have at most " + std::to_string(MAX_STRUCT_FIELDS) + " fields", node);
+		}
 
-				if (instance->scope.find_def(def_name, false) != nullptr) {
-					// TODO: proper error handling, cant overload a var with a func etc.
-					//error("duplicate variable name: " + def_name);
-					continue;
-				}
+		Struct_Decl decl;
+		decl.name = sub->name;
+		decl.node = sub;
 
-				instance->scope.set_def(def_name, def.value, def.flags);
+		for (size_t i = 0; i < sub->fields.size(); i++) {
+			AST_Var_Decl* field = (AST_Var_Decl*) sub->fields[i].get();
+			if (std::find(decl.fields.begin(), decl.fields.end(), field->name) != decl.fields.end()) {
+				error("Duplicate field name: " + field->name, field);
 			}
 
-			cur = class_decls[cur].parent;
+			decl.fields.push_back(field->name);
+			if (field->init != nullptr)
+				decl.defaults[i] = expect_value(eval_node(field->init.get(), scope).value, Value_Type::Num, field).as.num;
 		}
 
-		Definition* constructor = instance->scope.find_def("init", false);
-		if (constructor != nullptr) {
-			// evaluate constructor args
-			std::vector<Value> arg_evals;
-			for (auto& arg : sub->args) {
-				arg_evals.push_back(eval_node(arg.get(), scope, nullptr).value);
-			}
+		Value val;
+		val.type = Value_Type::Struct_Type;
+		val.as.i = (int32_t) struct_decls.size();
 
-			// call constructor
-			call_function(constructor->value, arg_evals, instance);
-		}
+		struct_decls.push_back(decl);
+		program_scope.set_def(sub->name, val, DEF_FUNC);
+		return {};
+	}
+	case AST_Node_Type::New: {
+		AST_New* sub = (AST_New*) node;
 
-		if (constructor == nullptr && !sub->args.empty()) {
-			error("Default constructor takes no args", node);
-		}
+		GC_Obj_Instance* instance = create_instance(sub->name, node);
+		construct_instance(instance, sub->args, scope, node);
 
 		return {Value::from_gc_obj(instance)};
 	}
@@ -979,8 +2014,14 @@ Eval_Result Interpreter::eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance
 }
 
 void Interpreter::error(const std::string& msg, const AST_Node* node) const {
+	if (node != nullptr)
+		error_at(msg, &node->src_info);
+	else
+		error_at(msg, bc_vm != nullptr ? bc_vm->get_src_info() : nullptr);
+}
+
+void Interpreter::error_at(const std::string& msg, const Source_Info* src_info) const {
 	if (error_callback != nullptr) {
-		const Source_Info* src_info = node != nullptr ? &node->src_info : nullptr;
 		error_callback(msg, src_info);
 	} else {
 		std::cout << "Interpreter error: " << msg << "\n";
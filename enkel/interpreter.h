@@ -7,10 +7,16 @@
 #include "gc.h"
 #include "source_info.h"
 #include "extern_func.h"
+#include "thread_pool.h"
+#include "log_sink.h"
 
 #include <functional>
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <initializer_list>
 #include <unordered_map>
+#include <string>
 
 enum class Control_Flow {
 	Nothing,
@@ -23,46 +29,255 @@ struct Eval_Result {
 	Value value{};
 	Control_Flow cf = Control_Flow::Nothing;
 	Value* ref = nullptr;
+	int field = -1; // if set, ref is a struct and only this field is assigned
+	bool escapes = false; // ref outlives the frame, young objects stored through it get promoted
+	// array or instance ref points into, and the item index for arrays. stores
+	// inside parallel_for check it
+	GC_Obj* container = nullptr;
+	int index = -1;
 };
 
 class Interpreter;
+class BC_VM;
+struct BC_Program;
 
 struct Class_Decl {
 	std::string name;
 	std::string parent;
 	Scope scope;
+	// the declaration, to tell redeclarations from other contexts apart. BC_VM uses
+	// the program and class index, loaded programs have no AST
+	const AST_Class_Decl* node = nullptr;
+	const BC_Program* program = nullptr;
+	uint32_t index = 0;
 
 	Class_Decl() : scope(nullptr, nullptr) {}
 };
 
+struct Struct_Decl {
+	std::string name;
+	std::vector<std::string> fields;
+	float defaults[MAX_STRUCT_FIELDS] = {};
+	// like in Class_Decl
+	const AST_Struct_Decl* node = nullptr;
+	const BC_Program* program = nullptr;
+	uint32_t index = 0;
+};
+
+// Per-instance script state: the global variables and the heap.
+// All contexts of an interpreter share its parsed program, builtins,
+// global functions and class methods, so a context only pays for its
+// own variables, class fields and objects.
+struct Context {
+	Context(Scope* program_scope) : global_scope(program_scope, nullptr) {
+		global_scope.persistent = true;
+	}
+	Context(const Context&) = delete;
+	Context& operator=(const Context&) = delete;
+
+	Scope global_scope;
+	GC_Heap heap;
+	// fields of classes that an earlier context declared, evaluated again here so
+	// instances in this context don't share objects with another context's heap
+	std::unordered_map<std::string, Scope> class_fields;
+	// pinned literal strings of the program BC_VM last ran here, tagged with that run
+	std::vector<Value> bc_str_consts;
+	uint32_t bc_str_consts_run = 0;
+};
+
+// A script function resolved once, for hosts that call it repeatedly.
+// Arity is checked when the handle is prepared and the callee scope is
+// allocated up front and reused by every call. The object a method handle
+// is bound to is pinned, so it survives GC for as long as the handle lives.
+// Calls run in the context that was current when the handle was prepared.
+// A handle must not outlive its interpreter.
+class Func_Handle {
+public:
+	Func_Handle() = default;
+	Func_Handle(Func_Handle&& other) noexcept { *this = std::move(other); }
+	Func_Handle& operator=(Func_Handle&& other) noexcept;
+	~Func_Handle() { release(); }
+
+	bool is_valid() const { return interp != nullptr; }
+	int get_num_args() const { return num_args; }
+
+	Value call(std::initializer_list<Value> args = {}) { return call(args.begin(), args.size()); }
+	Value call(const Value* args, size_t count);
+
+private:
+	friend class Interpreter;
+
+	void release();
+
+	Interpreter* interp = nullptr;
+	Context* ctx = nullptr;
+	Value func{};
+	GC_Obj_Instance* obj = nullptr;
+	int num_args = 0;
+	std::unique_ptr<Scope> scope;
+	std::vector<Definition*> arg_defs;
+	bool in_use = false; // recursive calls fall back to call_function
+};
+
+// An interpreter is a self-contained isolate: it owns its contexts and
+// external funcs, and builtins only reach it through the data_ptr passed to
+// their callback. Separate interpreters can run on separate threads at the
+// same time, as long as each one is only used by one thread at a time.
+// The AST is never modified during evaluation, so one parsed program can be
+// shared by any number of interpreters, but it has to outlive all of them.
 class Interpreter {
 public:
 	using Error_Callback_Func = std::function<void(const std::string& msg, const Source_Info* info)>;
 
 	Interpreter();
+	Interpreter(const Interpreter&) = delete;
+	Interpreter& operator=(const Interpreter&) = delete;
 
 	Eval_Result eval(AST_Node* node);
+	// hot reload: takes the functions and class methods of a newly parsed program
+	// (or part of one) while keeping all globals, instances and heap objects.
+	// new globals and classes are declared, any other top-level statement is skipped.
+	// instances in the current context get the new methods. the old program has to stay
+	// alive, since values may still refer to its functions, and Func_Handles have
+	// to be prepared again
+	void reload(AST_Node* program);
 	void add_external_func(const Extern_Func& callback);
 
+	// contexts
+	// evaluate the same program in each new context to run another instance of it.
+	// every context runs the class member initializers into its own heap, but the
+	// methods come from the first context that declares the class.
+	// only one context is current at a time, don't switch while evaluating
+	std::unique_ptr<Context> create_context();
+	void set_context(Context* _ctx) { ctx = _ctx != nullptr ? _ctx : &default_context; }
+	Context* get_context() { return ctx; }
+
 	// accessors
-	GC_Heap& get_heap() { return heap; }
-	Scope& get_global_scope() { return global_scope; }
+	GC_Heap& get_heap() { return ctx->heap; }
+	Scope& get_global_scope() { return ctx->global_scope; }
 	void set_error_callback(Error_Callback_Func _func) { error_callback = _func; }
+	// host data for external funcs, e.g. the framework that owns this interpreter
+	void set_user_data(void* _user_data) { user_data = _user_data; }
+	void* get_user_data() const { return user_data; }
+	// print() and log() queue their output here instead of writing to stdout themselves.
+	// the sink has to outlive the interpreter
+	void set_log_sink(Log_Sink* _log_sink) { log_sink = _log_sink; }
+	Log_Sink* get_log_sink() const { return log_sink; }
+	// threads used by parallel_for/parallel_map besides the calling one, -1 for one per
+	// extra hardware thread. don't call it from inside a parallel section
+	void set_num_workers(int _num_workers) { num_workers = _num_workers; thread_pool.reset(); }
 
-	std::string get_string(const Value& val) const;
+	// numbers are as short as possible while still reading back the same, or have precision decimals
+	std::string get_string(const Value& val, int precision = -1) const;
 	Value call_function(Value func_ref, const std::vector<Value>& args, GC_Obj_Instance* obj = nullptr, AST_Node* node = nullptr);
+	// calls func_ref count times, with columns[j][i] as argument j of call i, and stores
+	// the return value of call i in results[i]. the callee scope is only set up once
+	void call_function_batch(Value func_ref, const std::vector<const Value*>& columns, size_t count, Value* results, GC_Obj_Instance* obj = nullptr);
+	// resolves a function (or a method, if obj is given) for repeated calls.
+	// returns an invalid handle if nothing called name exists
+	Func_Handle prepare_call(const std::string& name, int num_args, GC_Obj_Instance* obj = nullptr);
+	Func_Handle prepare_call(Value func_ref, int num_args, GC_Obj_Instance* obj = nullptr);
 	Value create_string(const std::string& str);
+	Value create_string(std::string&& str);
+	const Extern_Func& get_extern_func(const Value& func_ref) const { return external_funcs[func_ref.as.i]; }
+	bool find_extern_func(const std::string& name, Value& out);
+	// for compiling to bytecode, externs are bound by index
+	const std::vector<Extern_Func>& get_extern_funcs() const { return external_funcs; }
 	const Value& expect_value(const Value& val, Value_Type expected_type, const AST_Node* node) const;
+	// the optional precision argument of print(), log() and to_string(), -1 if not given
+	int get_precision_arg(const std::vector<Value>& args, size_t index) const;
+
+	// snapshots (snapshot.cpp)
+	// saves the program, global functions, class table, and the current context's
+	// globals and heap. builtins are saved by name and rebound on load.
+	// source_files is stored as is, for hosts that name files by Source_Info::file_index
+	bool save_snapshot(const std::string& path, const AST_Node* program, const std::vector<std::string>& source_files = {}) const;
+	// restores an image into a fresh interpreter that has the same external funcs registered,
+	// without lexing, parsing or evaluating anything. returns the program, which has to
+	// outlive the interpreter, or nullptr if the file is missing or not a valid image
+	std::unique_ptr<AST_Node> load_snapshot(const std::string& path, std::vector<std::string>* source_files = nullptr);
 
 	// temporary??
 	AST_Node* extern_func_node = nullptr; // set when calling extern func to pass info
 private:
+	friend class Func_Handle;
+	friend class BC_VM;
+
+	// pops the scratch temporaries allocated during its lifetime, see mark_temporaries
+	class Scratch_Scope {
+	public:
+		Scratch_Scope(Interpreter& _interp, bool _active = true) :
+			interp(_interp), active(_active && !_interp.in_parallel),
+			num_strings(active ? _interp.num_scratch_strings : 0), num_arrays(active ? _interp.num_scratch_arrays : 0) {}
+		~Scratch_Scope() { release(); }
+		Scratch_Scope(const Scratch_Scope&) = delete;
+		Scratch_Scope& operator=(const Scratch_Scope&) = delete;
+
+		void release() {
+			if (!active)
+				return;
+			interp.num_scratch_strings = num_strings;
+			interp.num_scratch_arrays = num_arrays;
+			active = false;
+		}
+
+	private:
+		Interpreter& interp;
+		bool active;
+		size_t num_strings, num_arrays;
+	};
+
 	Eval_Result eval_node(AST_Node* node, Scope* scope, GC_Obj_Instance* selected_obj = nullptr);
+	// without a node, errors inside the bytecode VM get the line it's at
 	void error(const std::string& msg = "", const AST_Node* node = nullptr) const;
+	void error_at(const std::string& msg, const Source_Info* src_info) const;
+	void add_to_heap(GC_Obj* obj);
+	void promote(const Value& val);
+	void append_interp_value(std::string& out, const Value& val, int precision = -1) const;
+	GC_Obj_Instance* create_instance(const std::string& class_name, const AST_Node* node);
+	Scope& get_class_fields(const std::string& class_name);
+	const Value& get_class_field(const std::string& class_name, const std::string& name, const Value& declared);
+	void construct_instance(GC_Obj_Instance* instance, const std::vector<std::unique_ptr<AST_Node>>& args, Scope* scope, const AST_Node* node);
+	void store(const Eval_Result& target, const Value& val, const AST_Node* node);
+	Value apply_bin_op(Bin_Op op, const Value& lval, const Value& rval, const AST_Node* node);
+	GC_Obj_Instance* acquire_from_pool(GC_Obj_Pool* pool, const AST_Node* node);
+	void release_to_pool(GC_Obj_Pool* pool, const Value& val, const AST_Node* node);
+	Value construct_struct(const Value& struct_type, const std::vector<Value>& args, const AST_Node* node);
+	size_t interp_value_length(const Value& val, int precision = -1) const;
+	bool use_scratch(const AST_Node* node) const { return !in_parallel && (node->temp || node == borrowed_arg); }
+	GC_Obj_String* alloc_scratch_string();
+	GC_Obj_Array* alloc_scratch_array();
+	void run_parallel(const Value& arr_val, const Value& func, GC_Obj_Array* results);
+	// whether the worker on this thread may modify container (at index, for arrays)
+	bool can_store_in_parallel(const GC_Obj* container, int index) const;
+	void write_log(Log_Level level, const std::string& msg);
 
 	Error_Callback_Func error_callback = nullptr;
-	Scope global_scope;
+	void* user_data = nullptr;
+	Log_Sink* log_sink = nullptr;
+	Scope builtin_scope; // external funcs
+	Scope program_scope; // global functions, parent is builtin_scope
 	std::vector<Extern_Func> external_funcs;
 	std::unordered_map<std::string, Class_Decl> class_decls;
-	GC_Heap heap;
+	std::vector<Struct_Decl> struct_decls; // indexed by struct id
+	Context default_context;
+	Context* ctx = &default_context;
+	BC_VM* bc_vm = nullptr; // runs BC_Func_Refs, see BC_VM
+	uint32_t num_bc_runs = 0; // tags the literal strings a context holds
+
+	// temporaries that never reach the heap. the objects are reused, only the first
+	// num_scratch_* are in use
+	std::vector<std::unique_ptr<GC_Obj_String>> scratch_strings;
+	std::vector<std::unique_ptr<GC_Obj_Array>> scratch_arrays;
+	size_t num_scratch_strings = 0;
+	size_t num_scratch_arrays = 0;
+	std::string scratch_buf; // swapped with scratch strings, so buffers get reused too
+	const AST_Node* borrowed_arg = nullptr; // arg being evaluated for an EXTERN_BORROWS_ARGS call
+
+	// parallel_for/parallel_map
+	std::unique_ptr<Thread_Pool> thread_pool; // created on first use
+	int num_workers = -1;
+	std::mutex parallel_heap_mutex;
+	bool in_parallel = false;
+	uint32_t parallel_section = 0; // counts parallel_for calls, tags the objects they create
 };
\ No newline at end of file
@@ -63,6 +63,8 @@ static Token consume_identifier(const std::string& input, int& pos) {
 		type = Token_Type::Keyword_Import;
 	else if (str == "const")
 		type = Token_Type::Keyword_Const;
+	else if (str == "struct")
+		type = Token_Type::Keyword_Struct;
 
 	if (str == "true") {
 		type = Token_Type::Boolean_Literal;
@@ -0,0 +1,211 @@
+#include "log_sink.h"
+
+#include <chrono>
+#include <algorithm>
+#include <string.h>
+
+// the writer wakes up on its own this often, writers don't signal unless the buffer fills up
+static const auto WRITER_INTERVAL = std::chrono::milliseconds(10);
+static const size_t MAX_BATCH = 64 * 1024;
+
+static int64_t now_ms() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Log_Sink::Log_Sink(const std::string& path, size_t _capacity) {
+	capacity = 2;
+	while (capacity < _capacity)
+		capacity *= 2;
+
+	slots = std::make_unique<Slot[]>(capacity);
+	for (size_t i = 0; i < capacity; i++) {
+		slots[i].seq.store(i, std::memory_order_relaxed);
+	}
+
+	if (path.empty()) {
+		file = stdout;
+	} else {
+		file = fopen(path.c_str(), "w");
+		owns_file = file != nullptr;
+	}
+
+	if (file != nullptr)
+		writer = std::thread(&Log_Sink::writer_main, this);
+}
+
+Log_Sink::~Log_Sink() {
+	if (writer.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake_cv.notify_one();
+		writer.join();
+	}
+
+	if (owns_file)
+		fclose(file);
+}
+
+bool Log_Sink::take_rate_token() {
+	int limit = rate_limit.load(std::memory_order_relaxed);
+	if (limit <= 0)
+		return true;
+
+	// fixed one second windows, racing writers may let a few extra through at the edges
+	int64_t now = now_ms();
+	int64_t start = rate_window_start.load(std::memory_order_relaxed);
+	if (now - start >= 1000 && rate_window_start.compare_exchange_strong(start, now, std::memory_order_relaxed))
+		rate_window_count.store(0, std::memory_order_relaxed);
+
+	return rate_window_count.fetch_add(1, std::memory_order_relaxed) < limit;
+}
+
+bool Log_Sink::write(Log_Level level, const char* msg, size_t length) {
+	if (file == nullptr || level < min_level.load(std::memory_order_relaxed))
+		return false;
+
+	if (level != Log_Level::Error && !take_rate_token()) {
+		num_dropped_rate.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	size_t total = length + 1;
+	size_t num_slots = (total + SLOT_DATA - 1) / SLOT_DATA;
+	if (num_slots > capacity) {
+		num_dropped_full.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	// claim num_slots consecutive positions. the writer frees slots in order, so if the
+	// last one is free for this lap, all of them are
+	size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+	for (;;) {
+		size_t last = pos + num_slots - 1;
+		size_t seq = slots[last & (capacity - 1)].seq.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t) seq - (intptr_t) last;
+
+		if (diff == 0) {
+			if (enqueue_pos.compare_exchange_weak(pos, pos + num_slots, std::memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			// not read yet, the buffer is full
+			num_dropped_full.fetch_add(1, std::memory_order_relaxed);
+			wake_cv.notify_one();
+			return false;
+		} else {
+			pos = enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+
+	size_t offset = 0;
+	for (size_t i = 0; i < num_slots; i++) {
+		Slot& slot = slots[(pos + i) & (capacity - 1)];
+		size_t chunk = std::min(SLOT_DATA, total - offset);
+		size_t from_msg = offset < length ? std::min(chunk, length - offset) : 0;
+
+		memcpy(slot.data, msg + offset, from_msg);
+		if (from_msg < chunk)
+			slot.data[from_msg] = '\n';
+		slot.length = (uint32_t) chunk;
+		offset += chunk;
+
+		slot.seq.store(pos + i + 1, std::memory_order_release);
+	}
+
+	num_queued.fetch_add(1, std::memory_order_relaxed);
+
+	// past half full, don't wait for the writer's next round
+	if (pos + num_slots - written_pos.load(std::memory_order_relaxed) > capacity / 2)
+		wake_cv.notify_one();
+
+	return true;
+}
+
+size_t Log_Sink::drain(std::string& batch) {
+	size_t count = 0;
+	while (batch.size() < MAX_BATCH) {
+		Slot& slot = slots[dequeue_pos & (capacity - 1)];
+		if (slot.seq.load(std::memory_order_acquire) != dequeue_pos + 1)
+			break; // empty, or claimed but not written yet
+
+		batch.append(slot.data, slot.length);
+		slot.seq.store(dequeue_pos + capacity, std::memory_order_release);
+		dequeue_pos++;
+		count++;
+	}
+	return count;
+}
+
+void Log_Sink::writer_main() {
+	std::string batch;
+	batch.reserve(MAX_BATCH + SLOT_DATA);
+	uint64_t reported_full = 0, reported_rate = 0;
+
+	for (;;) {
+		drain(batch);
+
+		// let the reader know, after the messages that were written
+		uint64_t dropped_full = num_dropped_full.load(std::memory_order_relaxed);
+		uint64_t dropped_rate = num_dropped_rate.load(std::memory_order_relaxed);
+		if (batch.empty() && (dropped_full != reported_full || dropped_rate != reported_rate)) {
+			batch += "log: dropped " + std::to_string(dropped_full - reported_full) + " messages (buffer full), "
+				+ std::to_string(dropped_rate - reported_rate) + " (rate limit)\n";
+			reported_full = dropped_full;
+			reported_rate = dropped_rate;
+		}
+
+		if (!batch.empty()) {
+			fwrite(batch.data(), 1, batch.size(), file);
+			fflush(file);
+			batch.clear();
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				written_pos.store(dequeue_pos, std::memory_order_relaxed);
+			}
+			written_cv.notify_all();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+		if (stopping)
+			break;
+		wake_cv.wait_for(lock, WRITER_INTERVAL);
+	}
+}
+
+void Log_Sink::flush() {
+	if (!writer.joinable())
+		return;
+
+	size_t target = enqueue_pos.load(std::memory_order_relaxed);
+	wake_cv.notify_one();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	written_cv.wait(lock, [&] { return written_pos.load(std::memory_order_relaxed) >= target; });
+}
+
+Log_Stats Log_Sink::get_stats() const {
+	Log_Stats stats;
+	stats.queued = num_queued.load(std::memory_order_relaxed);
+	stats.dropped_full = num_dropped_full.load(std::memory_order_relaxed);
+	stats.dropped_rate_limit = num_dropped_rate.load(std::memory_order_relaxed);
+	return stats;
+}
+
+static const char* level_names[] = {"debug", "info", "warn", "error"};
+
+const char* Log_Sink::get_level_name(Log_Level level) {
+	return level_names[(int) level];
+}
+
+bool Log_Sink::parse_level(const std::string& name, Log_Level& level) {
+	for (int i = 0; i < 4; i++) {
+		if (name == level_names[i]) {
+			level = (Log_Level) i;
+			return true;
+		}
+	}
+	return false;
+}
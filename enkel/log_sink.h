@@ -0,0 +1,92 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <stdio.h>
+#include <stdint.h>
+
+enum class Log_Level {
+	Debug,
+	Info,
+	Warn,
+	Error,
+};
+
+struct Log_Stats {
+	uint64_t queued = 0;
+	uint64_t dropped_full = 0; // the buffer had no room
+	uint64_t dropped_rate_limit = 0;
+};
+
+// Asynchronous log output, for print() and log().
+// Writers only copy the message into a ring of fixed-size slots, a background
+// thread writes whatever is queued to the file in batches. Any number of threads
+// can write at once without locking: a writer claims the slots for its message
+// with one compare-exchange, so a message is never interleaved with another.
+// Messages that don't fit are dropped and counted, writers never wait.
+class Log_Sink {
+public:
+	// writes to path, or to stdout if path is empty.
+	// capacity is in slots of SLOT_DATA bytes and gets rounded up to a power of two
+	explicit Log_Sink(const std::string& path = "", size_t capacity = 4096);
+	~Log_Sink(); // writes everything that's still queued
+	Log_Sink(const Log_Sink&) = delete;
+	Log_Sink& operator=(const Log_Sink&) = delete;
+
+	bool is_open() const { return file != nullptr; }
+	// messages below level are ignored, not counted as dropped
+	void set_min_level(Log_Level level) { min_level.store(level, std::memory_order_relaxed); }
+	// at most this many messages per second, errors excepted. 0 means no limit
+	void set_rate_limit(int per_second) { rate_limit.store(per_second, std::memory_order_relaxed); }
+
+	// queues msg plus a newline. returns false if it was filtered or dropped
+	bool write(Log_Level level, const char* msg, size_t length);
+	bool write(Log_Level level, const std::string& msg) { return write(level, msg.data(), msg.size()); }
+	// blocks until everything queued so far is written
+	void flush();
+	Log_Stats get_stats() const;
+
+	static const char* get_level_name(Log_Level level);
+	static bool parse_level(const std::string& name, Log_Level& level);
+
+	static constexpr size_t SLOT_DATA = 116;
+
+private:
+	struct Slot {
+		std::atomic<size_t> seq; // position + 1 once written, position + capacity once read
+		uint32_t length;
+		char data[SLOT_DATA];
+	};
+
+	bool take_rate_token();
+	size_t drain(std::string& batch);
+	void writer_main();
+
+	FILE* file = nullptr;
+	bool owns_file = false;
+
+	std::unique_ptr<Slot[]> slots;
+	size_t capacity;
+	alignas(64) std::atomic<size_t> enqueue_pos{0};
+	alignas(64) size_t dequeue_pos = 0; // writer thread only
+	std::atomic<size_t> written_pos{0};
+
+	std::atomic<Log_Level> min_level{Log_Level::Debug};
+	std::atomic<int> rate_limit{0};
+	std::atomic<int64_t> rate_window_start{0}; // ms
+	std::atomic<int> rate_window_count{0};
+
+	std::atomic<uint64_t> num_queued{0};
+	std::atomic<uint64_t> num_dropped_full{0};
+	std::atomic<uint64_t> num_dropped_rate{0};
+
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable wake_cv;
+	std::condition_variable written_cv;
+	bool stopping = false;
+};
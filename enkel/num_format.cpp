@@ -0,0 +1,21 @@
+#include "num_format.h"
+
+#include <charconv>
+#include <math.h>
+
+size_t format_num(char* buf, float num, int precision) {
+	std::to_chars_result result;
+	if (precision < 0) {
+		// plain digits unless the number is very large or very small, 100000 rather than "1e+05"
+		float magnitude = fabsf(num);
+		bool fixed = magnitude == 0 || (magnitude >= 1e-5f && magnitude < 1e15f);
+		result = std::to_chars(buf, buf + NUM_FORMAT_MAX, num, fixed ? std::chars_format::fixed : std::chars_format::scientific);
+	} else {
+		if (precision > NUM_FORMAT_MAX_PRECISION)
+			precision = NUM_FORMAT_MAX_PRECISION;
+		// at most 39 integer digits for a float, so this always fits
+		result = std::to_chars(buf, buf + NUM_FORMAT_MAX, num, std::chars_format::fixed, precision);
+	}
+
+	return result.ptr - buf;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+
+// Number to text, independent of locale and the same on every platform.
+
+const size_t NUM_FORMAT_MAX = 64; // buffer size format_num needs
+const int NUM_FORMAT_MAX_PRECISION = 20;
+
+// writes num into buf and returns the length, without a terminator.
+// precision < 0 gives the shortest text that reads back as the same float ("3", "0.1", "100000"),
+// in scientific notation below 1e-5 and from 1e15 on ("1e+20"). otherwise that many decimals
+// ("3.00" for 2). scripts get an error for more than NUM_FORMAT_MAX_PRECISION, here it's clamped
+size_t format_num(char* buf, float num, int precision = -1);
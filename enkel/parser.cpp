@@ -1,7 +1,11 @@
 #include "parser.h"
+#include "lexer.h"
+#include "ast_util.h"
+#include "num_format.h"
 
 #include <assert.h>
 #include <iostream>
+#include <algorithm>
 
 std::unique_ptr<AST_Node> Parser::parse() {
     std::unique_ptr<AST_Block> block = std::make_unique<AST_Block>(peek().src_info, true);
@@ -10,6 +14,10 @@ std::unique_ptr<AST_Node> Parser::parse() {
         block->statements.push_back(parse_statement());
     }
 
+    if (failed)
+        return nullptr;
+
+    mark_temporaries(block.get());
     return block;
 }
 
@@ -17,7 +25,7 @@ std::unique_ptr<AST_Node> Parser::parse_block() {
     const Source_Info& src_info = eat(Token_Type::Open_Curly).src_info;
     std::unique_ptr<AST_Block> block = std::make_unique<AST_Block>(src_info);
 
-    while (peek().type != Token_Type::Closed_Curly) {
+    while (!at_end(Token_Type::Closed_Curly)) {
         block->statements.push_back(parse_statement());
     }
     eat(Token_Type::Closed_Curly);
@@ -42,6 +50,10 @@ std::unique_ptr<AST_Node> Parser::parse_statement() {
         return parse_class_decl();
     }
 
+    if (peek().type == Token_Type::Keyword_Struct) {
+        return parse_struct_decl();
+    }
+
     // if statement
     if (peek().type == Token_Type::Keyword_If) {
         Source_Info src_info = eat(Token_Type::Keyword_If).src_info;
@@ -193,7 +205,7 @@ std::unique_ptr<AST_Node> Parser::parse_postfix() {
                 while (true) {
                     func_call->args.push_back(parse_expression());
 
-                    if (peek().type == Token_Type::Closed_Parenthesis)
+                    if (at_end(Token_Type::Closed_Parenthesis))
                         break;
 
                     eat(Token_Type::Comma);
@@ -243,7 +255,7 @@ std::unique_ptr<AST_Node> Parser::parse_primary() {
     // string literal
     if (peek().type == Token_Type::String_Literal) {
         const Token& token = eat(Token_Type::String_Literal);
-        return std::make_unique<AST_String_Literal>(token.src_info, token.str);
+        return parse_string_literal(token);
     }
 
     // number or bool literal
@@ -268,7 +280,7 @@ std::unique_ptr<AST_Node> Parser::parse_primary() {
             while (true) {
                 items.push_back(parse_expression());
 
-                if (peek().type == Token_Type::Closed_Bracket)
+                if (at_end(Token_Type::Closed_Bracket))
                     break;
 
                 eat(Token_Type::Comma); // TODO: allow ending comma?
@@ -300,7 +312,7 @@ std::unique_ptr<AST_Node> Parser::parse_primary() {
             while (true) {
                 node->args.push_back(parse_expression());
 
-                if (peek().type == Token_Type::Closed_Parenthesis)
+                if (at_end(Token_Type::Closed_Parenthesis))
                     break;
 
                 eat(Token_Type::Comma);
@@ -332,7 +344,7 @@ std::unique_ptr<AST_Node> Parser::parse_var_decl() {
         auto first_var = std::make_unique<AST_Var_Decl>(src_info, name, std::move(init), is_const);
         multi_decl->decls.push_back(std::move(first_var));
         
-        while (peek().type != Token_Type::Semicolon) {
+        while (!at_end(Token_Type::Semicolon)) {
             eat(Token_Type::Comma);
 
             auto ident_token = eat(Token_Type::Identifier);
@@ -372,7 +384,7 @@ std::unique_ptr<AST_Node> Parser::parse_func_decl(bool is_global) {
             def.name = arg_token.str;
             func_decl->args.push_back(def);
 
-            if (peek().type == Token_Type::Closed_Parenthesis)
+            if (at_end(Token_Type::Closed_Parenthesis))
                 break;
 
             eat(Token_Type::Comma);
@@ -397,7 +409,7 @@ std::unique_ptr<AST_Node> Parser::parse_class_decl() {
 
     auto class_decl = std::make_unique<AST_Class_Decl>(src_info, name, parent);
 
-    while (peek().type != Token_Type::Closed_Curly) {
+    while (!at_end(Token_Type::Closed_Curly)) {
         const Token& next = peek();
 
         switch (next.type) {
@@ -419,7 +431,118 @@ std::unique_ptr<AST_Node> Parser::parse_class_decl() {
 
 const Token eof_token = {Token_Type::End_Of_File};
 
+std::unique_ptr<AST_Node> Parser::parse_struct_decl() {
+    const Source_Info& src_info = eat(Token_Type::Keyword_Struct).src_info;
+    std::string name = eat(Token_Type::Identifier).str;
+
+    eat(Token_Type::Open_Curly);
+
+    auto struct_decl = std::make_unique<AST_Struct_Decl>(src_info, name);
+
+    while (!at_end(Token_Type::Closed_Curly)) {
+        if (peek().type != Token_Type::Keyword_Var) {
+            error("Structs can only contain fields");
+        }
+
+        auto decl = parse_var_decl();
+        if (decl->type == AST_Node_Type::Multi_Var_Decl) {
+            for (auto& field : ((AST_Multi_Var_Decl*) decl.get())->decls)
+                struct_decl->fields.push_back(std::move(field));
+        } else {
+            struct_decl->fields.push_back(std::move(decl));
+        }
+    }
+
+    eat(Token_Type::Closed_Curly);
+
+    return struct_decl;
+}
+
+// "score: {x}" becomes a String_Interp, {{ and }} are literal braces
+std::unique_ptr<AST_Node> Parser::parse_string_literal(const Token& token) {
+    const std::string& str = token.str;
+    if (str.find_first_of("{}") == std::string::npos) {
+        return std::make_unique<AST_String_Literal>(token.src_info, str);
+    }
+
+    auto node = std::make_unique<AST_String_Interp>(token.src_info);
+    std::string part;
+
+    for (size_t i = 0; i < str.size(); i++) {
+        char ch = str[i];
+
+        if ((ch == '{' || ch == '}') && i + 1 < str.size() && str[i + 1] == ch) {
+            part += ch;
+            i++;
+            continue;
+        }
+
+        if (ch == '}') {
+            error("Unmatched '}' in string, use '}}' for a brace");
+            return nullptr;
+        }
+
+        if (ch != '{') {
+            part += ch;
+            continue;
+        }
+
+        size_t end = str.find('}', i + 1);
+        if (end == std::string::npos) {
+            error("Unterminated '{' in string, use '{{' for a brace");
+            return nullptr;
+        }
+
+        // {expr:2}, nothing else in an expression can contain a ':'
+        std::string expr_str = str.substr(i + 1, end - i - 1);
+        int precision = -1;
+        size_t colon = expr_str.rfind(':');
+        if (colon != std::string::npos) {
+            std::string digits = expr_str.substr(colon + 1);
+            if (digits.empty() || digits.size() > 2 || digits.find_first_not_of("0123456789") != std::string::npos) {
+                error("Expected the number of decimals after ':' in string");
+                return nullptr;
+            }
+
+            precision = std::stoi(digits);
+            if (precision > NUM_FORMAT_MAX_PRECISION) {
+                error("At most " + std::to_string(NUM_FORMAT_MAX_PRECISION) + " decimals in string");
+                return nullptr;
+            }
+            expr_str.resize(colon);
+        }
+
+        std::vector<Token> expr_tokens = Lexer::lex(expr_str);
+        for (auto& expr_token : expr_tokens)
+            expr_token.src_info = token.src_info;
+
+        Parser expr_parser(expr_tokens);
+        expr_parser.set_error_callback(error_callback);
+        node->exprs.push_back(expr_parser.parse_expression());
+        node->precisions.push_back(precision);
+
+        if (expr_parser.failed) {
+            failed = true;
+            return nullptr;
+        }
+        if (expr_parser.peek().type != Token_Type::End_Of_File) {
+            error("Expected '}' after expression in string");
+            return nullptr;
+        }
+
+        node->parts.push_back(std::move(part));
+        part.clear();
+        i = end;
+    }
+
+    node->parts.push_back(std::move(part));
+    return node;
+}
+
 const Token& Parser::peek(int offset) {
+    if (failed)
+        return eof_token;
+
     if (pos + offset < 0) {
         error("Peeking out of bounds??");
     }
@@ -431,6 +554,9 @@ const Token& Parser::peek(int offset) {
 }
 
 const Token& Parser::eat(Token_Type expected) {
+    if (failed)
+        return eof_token;
+
     const Token& token = tokens[pos++];
     if (expected != Token_Type::Any && token.type != expected) {
         error("Unexpected token type " + std::to_string(static_cast<int>(token.type)));
@@ -439,10 +565,15 @@ const Token& Parser::eat(Token_Type expected) {
     return token;
 }
 
-void Parser::error(const std::string& msg) const {
+void Parser::error(const std::string& msg) {
+    if (failed)
+        return;
+
     if (error_callback != nullptr) {
-        const auto& token = tokens[pos];
+        // eat() is past the end when the file ends too early
+        const auto& token = tokens[std::min((size_t) pos, tokens.size() - 1)];
 
+        failed = true;
         error_callback(msg, &token.src_info);
     } else {
         std::cout << "Parser error: " << msg << "\n";
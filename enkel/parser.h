@@ -26,16 +26,23 @@ public:
 	std::unique_ptr<AST_Node> parse_var_decl();
 	std::unique_ptr<AST_Node> parse_func_decl(bool is_global);
 	std::unique_ptr<AST_Node> parse_class_decl();
+	std::unique_ptr<AST_Node> parse_struct_decl();
+	std::unique_ptr<AST_Node> parse_string_literal(const Token& token);
 
+	// the callback may return, e.g. to keep running the old program after a reload.
+	// parsing stops at the first error then, and parse() returns nullptr
 	void set_error_callback(Error_Callback_Func _func) { error_callback = _func; }
 
 private:
 	const Token& peek(int offset = 0);
 	const Token& eat(Token_Type expected = Token_Type::Any);
+	// at the token that closes a list, or stopped by an error
+	bool at_end(Token_Type closing) { return failed || peek().type == closing; }
 
-	void error(const std::string& msg = "") const;
+	void error(const std::string& msg = "");
 
 	int pos = 0;
 	const std::vector<Token>& tokens;
 	Error_Callback_Func error_callback;
+	bool failed = false; // past the first error, every token is the end of file
 };
\ No newline at end of file
@@ -1,8 +1,9 @@
 #include "scope.h"
 
 Definition* Scope::find_def(const std::string& name, bool recursive) {
-    if (definitions.find(name) != definitions.end()) {
-        return &definitions[name];
+    auto it = definitions.find(name);
+    if (it != definitions.end()) {
+        return &it->second;
     }
 
     if (recursive && parent != nullptr) {
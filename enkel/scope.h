@@ -18,6 +18,12 @@ struct Scope {
 	Scope* parent = nullptr;
 	// used for methods in classes
 	GC_Obj_Instance* this_obj = nullptr;
+	// definitions can be read but not assigned, e.g. globals inside parallel_for
+	bool read_only = false;
+	// globals and instance fields, values stored here can outlive the frame (see GC_Heap::begin_frame)
+	bool persistent = false;
+	// instance the definitions belong to, if any
+	GC_Obj_Instance* owner = nullptr;
 	// TODO: make sure this doesn't invalidate any pointers to defs when resized
 	// should be impossible, i think?
 	// How it could occur:
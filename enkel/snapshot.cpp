@@ -0,0 +1,950 @@
+#include "interpreter.h"
+#include "image_io.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <unordered_map>
+
+// Image layout, everything little endian:
+//   header
+//   source file names
+//   AST nodes, in pre-order. children are stored as node indices
+//   struct table
+//   heap objects: first every object's type and fixed data, then their contents
+//   global functions, class table, globals
+// Values refer to heap objects and function declarations by index, and to
+// external funcs by name. Loading maps the file and fixes indices up into
+// pointers once every node and object exists.
+
+static const char SNAPSHOT_MAGIC[4] = {'E', 'N', 'K', 'S'};
+static const uint32_t SNAPSHOT_VERSION = 5;
+static const uint32_t NO_INDEX = (uint32_t) -1;
+
+namespace {
+
+struct Save_State {
+	Image_Writer out;
+	std::vector<const AST_Node*> nodes;
+	std::unordered_map<const AST_Node*, uint32_t> node_indices;
+	std::unordered_map<const GC_Obj*, uint32_t> obj_indices;
+	bool ok = true;
+};
+
+struct Load_State {
+	Image_Reader in;
+	std::vector<std::unique_ptr<AST_Node>> nodes;
+	std::vector<std::unique_ptr<GC_Obj>> objects;
+
+	// a child slot waiting for the node with the given index
+	struct Node_Fixup {
+		std::unique_ptr<AST_Node>* slot;
+		uint32_t index;
+	};
+	std::vector<Node_Fixup> node_fixups;
+
+	// a value waiting for the function declaration with the given index
+	struct Func_Fixup {
+		Value* value;
+		uint32_t index;
+	};
+	std::vector<Func_Fixup> func_fixups;
+
+	std::string missing_extern;
+	uint32_t num_structs = 0;
+};
+
+struct Saved_Def {
+	std::string name;
+	Value value;
+	int flags;
+};
+
+}
+
+//
+// AST
+//
+
+static void collect_nodes(const AST_Node* node, Save_State& s);
+
+static void collect_child(const std::unique_ptr<AST_Node>& child, Save_State& s) {
+	if (child != nullptr)
+		collect_nodes(child.get(), s);
+}
+
+static void collect_children(const std::vector<std::unique_ptr<AST_Node>>& children, Save_State& s) {
+	for (const auto& child : children)
+		collect_nodes(child.get(), s);
+}
+
+static void collect_nodes(const AST_Node* node, Save_State& s) {
+	s.node_indices[node] = (uint32_t) s.nodes.size();
+	s.nodes.push_back(node);
+
+	switch (node->type) {
+	case AST_Node_Type::Unary_Op: collect_child(((const AST_Unary_Op*) node)->expr, s); break;
+	case AST_Node_Type::Bin_Op: {
+		const AST_Bin_Op* sub = (const AST_Bin_Op*) node;
+		collect_child(sub->left, s);
+		collect_child(sub->right, s);
+		break;
+	}
+	case AST_Node_Type::Block: collect_children(((const AST_Block*) node)->statements, s); break;
+	case AST_Node_Type::Var_Decl: collect_child(((const AST_Var_Decl*) node)->init, s); break;
+	case AST_Node_Type::Multi_Var_Decl: collect_children(((const AST_Multi_Var_Decl*) node)->decls, s); break;
+	case AST_Node_Type::Func_Decl: collect_child(((const AST_Func_Decl*) node)->body, s); break;
+	case AST_Node_Type::Return: collect_child(((const AST_Return*) node)->expr, s); break;
+	case AST_Node_Type::Func_Call: {
+		const AST_Func_Call* sub = (const AST_Func_Call*) node;
+		collect_child(sub->expr, s);
+		collect_children(sub->args, s);
+		break;
+	}
+	case AST_Node_Type::If: {
+		const AST_If* sub = (const AST_If*) node;
+		collect_child(sub->condition, s);
+		collect_child(sub->if_body, s);
+		collect_child(sub->else_body, s);
+		break;
+	}
+	case AST_Node_Type::While: {
+		const AST_While* sub = (const AST_While*) node;
+		collect_child(sub->condition, s);
+		collect_child(sub->body, s);
+		break;
+	}
+	case AST_Node_Type::For: {
+		const AST_For* sub = (const AST_For*) node;
+		collect_child(sub->expr, s);
+		collect_child(sub->body, s);
+		break;
+	}
+	case AST_Node_Type::Array_Init: collect_children(((const AST_Array_Init*) node)->items, s); break;
+	case AST_Node_Type::Subscript: {
+		const AST_Subscript* sub = (const AST_Subscript*) node;
+		collect_child(sub->expr, s);
+		collect_child(sub->subscript, s);
+		break;
+	}
+	case AST_Node_Type::Class_Decl: collect_children(((const AST_Class_Decl*) node)->members, s); break;
+	case AST_Node_Type::New: collect_children(((const AST_New*) node)->args, s); break;
+	case AST_Node_Type::String_Interp: collect_children(((const AST_String_Interp*) node)->exprs, s); break;
+	case AST_Node_Type::Struct_Decl: collect_children(((const AST_Struct_Decl*) node)->fields, s); break;
+	default:
+		break;
+	}
+}
+
+static void write_child(const std::unique_ptr<AST_Node>& child, Save_State& s) {
+	s.out.u32(child != nullptr ? s.node_indices[child.get()] : NO_INDEX);
+}
+
+static void write_children(const std::vector<std::unique_ptr<AST_Node>>& children, Save_State& s) {
+	s.out.u32((uint32_t) children.size());
+	for (const auto& child : children)
+		write_child(child, s);
+}
+
+static void write_value(const Interpreter& interp, const Value& val, Save_State& s);
+
+static void write_node(const Interpreter& interp, const AST_Node* node, Save_State& s) {
+	Image_Writer& out = s.out;
+	out.u8((uint8_t) node->type);
+	out.u32((uint32_t) node->src_info.line);
+	out.u16((uint16_t) node->src_info.file_index);
+
+	switch (node->type) {
+	case AST_Node_Type::Literal:
+		write_value(interp, ((const AST_Literal*) node)->val, s);
+		break;
+	case AST_Node_Type::String_Literal:
+		out.str(((const AST_String_Literal*) node)->str);
+		break;
+	case AST_Node_Type::Unary_Op: {
+		const AST_Unary_Op* sub = (const AST_Unary_Op*) node;
+		write_child(sub->expr, s);
+		out.u8((uint8_t) sub->op);
+		break;
+	}
+	case AST_Node_Type::Bin_Op: {
+		const AST_Bin_Op* sub = (const AST_Bin_Op*) node;
+		write_child(sub->left, s);
+		write_child(sub->right, s);
+		out.u8((uint8_t) sub->op);
+		break;
+	}
+	case AST_Node_Type::Block: {
+		const AST_Block* sub = (const AST_Block*) node;
+		write_children(sub->statements, s);
+		out.u8(sub->is_global_scope);
+		break;
+	}
+	case AST_Node_Type::Var_Decl: {
+		const AST_Var_Decl* sub = (const AST_Var_Decl*) node;
+		out.str(sub->name);
+		write_child(sub->init, s);
+		out.u8(sub->is_const);
+		break;
+	}
+	case AST_Node_Type::Multi_Var_Decl:
+		write_children(((const AST_Multi_Var_Decl*) node)->decls, s);
+		break;
+	case AST_Node_Type::Var:
+		out.str(((const AST_Var*) node)->name);
+		break;
+	case AST_Node_Type::Func_Decl: {
+		const AST_Func_Decl* sub = (const AST_Func_Decl*) node;
+		out.str(sub->name);
+		write_child(sub->body, s);
+		out.u8(sub->is_global);
+		out.u32((uint32_t) sub->args.size());
+		for (const auto& arg : sub->args) {
+			out.str(arg.name);
+			out.u32((uint32_t) arg.flags);
+		}
+		break;
+	}
+	case AST_Node_Type::Return:
+		write_child(((const AST_Return*) node)->expr, s);
+		break;
+	case AST_Node_Type::Func_Call: {
+		const AST_Func_Call* sub = (const AST_Func_Call*) node;
+		write_child(sub->expr, s);
+		write_children(sub->args, s);
+		break;
+	}
+	case AST_Node_Type::If: {
+		const AST_If* sub = (const AST_If*) node;
+		write_child(sub->condition, s);
+		write_child(sub->if_body, s);
+		write_child(sub->else_body, s);
+		break;
+	}
+	case AST_Node_Type::While: {
+		const AST_While* sub = (const AST_While*) node;
+		write_child(sub->condition, s);
+		write_child(sub->body, s);
+		break;
+	}
+	case AST_Node_Type::For: {
+		const AST_For* sub = (const AST_For*) node;
+		out.str(sub->var_name);
+		write_child(sub->expr, s);
+		write_child(sub->body, s);
+		break;
+	}
+	case AST_Node_Type::Array_Init:
+		write_children(((const AST_Array_Init*) node)->items, s);
+		break;
+	case AST_Node_Type::Subscript: {
+		const AST_Subscript* sub = (const AST_Subscript*) node;
+		write_child(sub->expr, s);
+		write_child(sub->subscript, s);
+		break;
+	}
+	case AST_Node_Type::Class_Decl: {
+		const AST_Class_Decl* sub = (const AST_Class_Decl*) node;
+		out.str(sub->name);
+		out.str(sub->parent);
+		write_children(sub->members, s);
+		break;
+	}
+	case AST_Node_Type::New: {
+		const AST_New* sub = (const AST_New*) node;
+		out.str(sub->name);
+		write_children(sub->args, s);
+		break;
+	}
+	case AST_Node_Type::Import:
+		out.str(((const AST_Import*) node)->path);
+		break;
+	case AST_Node_Type::String_Interp: {
+		const AST_String_Interp* sub = (const AST_String_Interp*) node;
+		out.u32((uint32_t) sub->parts.size());
+		for (const auto& part : sub->parts)
+			out.str(part);
+		write_children(sub->exprs, s);
+		for (int precision : sub->precisions)
+			out.u8((uint8_t) (precision + 1));
+		break;
+	}
+	case AST_Node_Type::Struct_Decl: {
+		const AST_Struct_Decl* sub = (const AST_Struct_Decl*) node;
+		out.str(sub->name);
+		write_children(sub->fields, s);
+		break;
+	}
+	case AST_Node_Type::Break:
+	case AST_Node_Type::Continue:
+	case AST_Node_Type::This:
+	case AST_Node_Type::Null:
+		break;
+	default:
+		s.ok = false;
+	}
+
+	out.u8(node->temp);
+}
+
+static void read_child(std::unique_ptr<AST_Node>& slot, Load_State& s) {
+	uint32_t index = s.in.u32();
+	if (index != NO_INDEX)
+		s.node_fixups.push_back({&slot, index});
+}
+
+static void read_children(std::vector<std::unique_ptr<AST_Node>>& children, Load_State& s) {
+	uint32_t count = s.in.u32();
+	if (!s.in.has((size_t) count * 4))
+		return;
+
+	children.resize(count);
+	for (auto& child : children)
+		read_child(child, s);
+}
+
+static Value read_value(Interpreter& interp, Load_State& s, Value* fixup_target);
+
+static AST_Node* read_node(Interpreter& interp, Load_State& s) {
+	Image_Reader& in = s.in;
+	AST_Node_Type type = (AST_Node_Type) in.u8();
+	Source_Info src_info;
+	src_info.line = (int) in.u32();
+	src_info.file_index = (short) in.u16();
+
+	switch (type) {
+	case AST_Node_Type::Literal: {
+		AST_Literal* node = new AST_Literal(src_info, {});
+		node->val = read_value(interp, s, &node->val);
+		return node;
+	}
+	case AST_Node_Type::String_Literal:
+		return new AST_String_Literal(src_info, in.str());
+	case AST_Node_Type::Unary_Op: {
+		AST_Unary_Op* node = new AST_Unary_Op(src_info, nullptr, Unary_Op::Positive);
+		read_child(node->expr, s);
+		node->op = (Unary_Op) in.u8();
+		return node;
+	}
+	case AST_Node_Type::Bin_Op: {
+		AST_Bin_Op* node = new AST_Bin_Op(src_info, nullptr, nullptr, Bin_Op::Not_A_Bin_Op);
+		read_child(node->left, s);
+		read_child(node->right, s);
+		node->op = (Bin_Op) in.u8();
+		return node;
+	}
+	case AST_Node_Type::Block: {
+		AST_Block* node = new AST_Block(src_info);
+		read_children(node->statements, s);
+		node->is_global_scope = in.u8();
+		return node;
+	}
+	case AST_Node_Type::Var_Decl: {
+		AST_Var_Decl* node = new AST_Var_Decl(src_info, in.str(), nullptr, false);
+		read_child(node->init, s);
+		node->is_const = in.u8();
+		return node;
+	}
+	case AST_Node_Type::Multi_Var_Decl: {
+		AST_Multi_Var_Decl* node = new AST_Multi_Var_Decl(src_info);
+		read_children(node->decls, s);
+		return node;
+	}
+	case AST_Node_Type::Var:
+		return new AST_Var(src_info, in.str());
+	case AST_Node_Type::Func_Decl: {
+		AST_Func_Decl* node = new AST_Func_Decl(src_info, in.str(), nullptr, false);
+		read_child(node->body, s);
+		node->is_global = in.u8();
+		uint32_t num_args = in.u32();
+		for (uint32_t i = 0; i < num_args && in.ok; i++) {
+			Definition arg;
+			arg.name = in.str();
+			arg.flags = (int) in.u32();
+			node->args.push_back(arg);
+		}
+		return node;
+	}
+	case AST_Node_Type::Return: {
+		AST_Return* node = new AST_Return(src_info, nullptr);
+		read_child(node->expr, s);
+		return node;
+	}
+	case AST_Node_Type::Func_Call: {
+		AST_Func_Call* node = new AST_Func_Call(src_info, nullptr);
+		read_child(node->expr, s);
+		read_children(node->args, s);
+		return node;
+	}
+	case AST_Node_Type::If: {
+		AST_If* node = new AST_If(src_info, nullptr, nullptr, nullptr);
+		read_child(node->condition, s);
+		read_child(node->if_body, s);
+		read_child(node->else_body, s);
+		return node;
+	}
+	case AST_Node_Type::While: {
+		AST_While* node = new AST_While(src_info, nullptr, nullptr);
+		read_child(node->condition, s);
+		read_child(node->body, s);
+		return node;
+	}
+	case AST_Node_Type::For: {
+		AST_For* node = new AST_For(src_info, in.str(), nullptr, nullptr);
+		read_child(node->expr, s);
+		read_child(node->body, s);
+		return node;
+	}
+	case AST_Node_Type::Array_Init: {
+		AST_Array_Init* node = new AST_Array_Init(src_info);
+		read_children(node->items, s);
+		return node;
+	}
+	case AST_Node_Type::Subscript: {
+		AST_Subscript* node = new AST_Subscript(src_info, nullptr, nullptr);
+		read_child(node->expr, s);
+		read_child(node->subscript, s);
+		return node;
+	}
+	case AST_Node_Type::Class_Decl: {
+		std::string name = in.str();
+		AST_Class_Decl* node = new AST_Class_Decl(src_info, name, in.str());
+		read_children(node->members, s);
+		return node;
+	}
+	case AST_Node_Type::New: {
+		AST_New* node = new AST_New(src_info, in.str());
+		read_children(node->args, s);
+		return node;
+	}
+	case AST_Node_Type::Import:
+		return new AST_Import(src_info, in.str());
+	case AST_Node_Type::String_Interp: {
+		AST_String_Interp* node = new AST_String_Interp(src_info);
+		uint32_t num_parts = in.u32();
+		for (uint32_t i = 0; i < num_parts && in.ok; i++)
+			node->parts.push_back(in.str());
+		read_children(node->exprs, s);
+		for (size_t i = 0; i < node->exprs.size() && in.ok; i++)
+			node->precisions.push_back((int) in.u8() - 1);
+		if (node->parts.size() != node->exprs.size() + 1 || node->precisions.size() != node->exprs.size())
+			in.ok = false;
+		return node;
+	}
+	case AST_Node_Type::Struct_Decl: {
+		AST_Struct_Decl* node = new AST_Struct_Decl(src_info, in.str());
+		read_children(node->fields, s);
+		return node;
+	}
+	case AST_Node_Type::Break:
+	case AST_Node_Type::Continue:
+	case AST_Node_Type::This:
+	case AST_Node_Type::Null:
+		return new AST_Implied(src_info, type);
+	default:
+		in.ok = false;
+		return nullptr;
+	}
+}
+
+// hands every node but the root to the parent slot that refers to it
+static bool apply_node_fixups(Load_State& s) {
+	std::vector<bool> claimed(s.nodes.size(), false);
+	for (const auto& fixup : s.node_fixups) {
+		if (fixup.index == 0 || fixup.index >= s.nodes.size() || claimed[fixup.index])
+			return false;
+		claimed[fixup.index] = true;
+	}
+
+	for (const auto& fixup : s.node_fixups)
+		*fixup.slot = std::move(s.nodes[fixup.index]);
+
+	return true;
+}
+
+//
+// values and objects
+//
+
+static void write_value(const Interpreter& interp, const Value& val, Save_State& s) {
+	Image_Writer& out = s.out;
+	out.u8((uint8_t) val.type);
+
+	switch (val.type) {
+	case Value_Type::Null:
+		break;
+	case Value_Type::Num:
+		out.f32(val.as.num);
+		break;
+	case Value_Type::Bool:
+		out.u8(val.as._bool);
+		break;
+	case Value_Type::BC_Func_Ref:
+		out.u32((uint32_t) val.as.i);
+		break;
+	case Value_Type::GC_Obj: {
+		auto it = s.obj_indices.find((const GC_Obj*) val.as.ptr);
+		if (it == s.obj_indices.end()) {
+			s.ok = false;
+			break;
+		}
+		out.u32(it->second);
+		break;
+	}
+	case Value_Type::Func_Ref: {
+		// functions are only ever declared by nodes of the program
+		auto it = s.node_indices.find((const AST_Node*) val.as.ptr);
+		if (it == s.node_indices.end()) {
+			s.ok = false;
+			break;
+		}
+		out.u32(it->second);
+		break;
+	}
+	case Value_Type::Extern_Func:
+		out.str(interp.get_extern_func(val).name);
+		break;
+	case Value_Type::Struct:
+		out.u32(val.struct_id);
+		for (int i = 0; i < MAX_STRUCT_FIELDS; i++)
+			out.f32(val.as.fields[i]);
+		break;
+	case Value_Type::Struct_Type:
+		out.u32((uint32_t) val.as.i);
+		break;
+	}
+}
+
+// values referring to function declarations are filled in by apply_func_fixups,
+// so they have to be read straight into their final place
+static Value read_value(Interpreter& interp, Load_State& s, Value* fixup_target) {
+	Image_Reader& in = s.in;
+	Value val{};
+	val.type = (Value_Type) in.u8();
+
+	switch (val.type) {
+	case Value_Type::Null:
+		break;
+	case Value_Type::Num:
+		val.as.num = in.f32();
+		break;
+	case Value_Type::Bool:
+		val.as._bool = in.u8();
+		break;
+	case Value_Type::BC_Func_Ref:
+		val.as.i = (int32_t) in.u32();
+		break;
+	case Value_Type::GC_Obj: {
+		uint32_t index = in.u32();
+		if (index >= s.objects.size()) {
+			in.ok = false;
+			break;
+		}
+		val.as.ptr = s.objects[index].get();
+		break;
+	}
+	case Value_Type::Func_Ref:
+		s.func_fixups.push_back({fixup_target, in.u32()});
+		break;
+	case Value_Type::Extern_Func: {
+		std::string name = in.str();
+		if (!interp.find_extern_func(name, val)) {
+			s.missing_extern = name;
+			in.ok = false;
+		}
+		break;
+	}
+	case Value_Type::Struct:
+		val.struct_id = in.u32();
+		for (int i = 0; i < MAX_STRUCT_FIELDS; i++)
+			val.as.fields[i] = in.f32();
+		if (val.struct_id >= s.num_structs)
+			in.ok = false;
+		break;
+	case Value_Type::Struct_Type:
+		val.as.i = (int32_t) in.u32();
+		if ((uint32_t) val.as.i >= s.num_structs)
+			in.ok = false;
+		break;
+	default:
+		in.ok = false;
+	}
+
+	return val;
+}
+
+// must run while s.nodes still owns every node
+static bool apply_func_fixups(Load_State& s) {
+	for (const auto& fixup : s.func_fixups) {
+		if (fixup.index >= s.nodes.size() || s.nodes[fixup.index]->type != AST_Node_Type::Func_Decl)
+			return false;
+
+		fixup.value->type = Value_Type::Func_Ref;
+		fixup.value->as.ptr = s.nodes[fixup.index].get();
+	}
+	return true;
+}
+
+static void write_defs(const Interpreter& interp, const std::unordered_map<std::string, Definition>& defs, Save_State& s) {
+	s.out.u32((uint32_t) defs.size());
+	for (const auto& it : defs) {
+		s.out.str(it.first);
+		s.out.u32((uint32_t) it.second.flags);
+		write_value(interp, it.second.value, s);
+	}
+}
+
+// definition values are stable once the list is sized, so function refs can be fixed up in place
+static void read_defs(Interpreter& interp, std::vector<Saved_Def>& defs, Load_State& s) {
+	uint32_t count = s.in.u32();
+	if (!s.in.has(count))
+		return;
+
+	defs.resize(count);
+	for (auto& def : defs) {
+		def.name = s.in.str();
+		def.flags = (int) s.in.u32();
+		def.value = read_value(interp, s, &def.value);
+	}
+}
+
+//
+// interpreter
+//
+
+bool Interpreter::save_snapshot(const std::string& path, const AST_Node* program, const std::vector<std::string>& source_files) const {
+	// young objects aren't part of the heap yet
+	if (ctx->heap.in_frame())
+		return false;
+
+	Save_State s;
+
+	collect_nodes(program, s);
+
+	const auto& objects = ctx->heap.get_objects();
+	for (size_t i = 0; i < objects.size(); i++)
+		s.obj_indices[objects[i].get()] = (uint32_t) i;
+
+	Image_Writer& out = s.out;
+	out.data.insert(out.data.end(), SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + 4);
+	out.u32(SNAPSHOT_VERSION);
+
+	out.u32((uint32_t) source_files.size());
+	for (const auto& file : source_files)
+		out.str(file);
+
+	out.u32((uint32_t) s.nodes.size());
+	for (const AST_Node* node : s.nodes)
+		write_node(*this, node, s);
+
+	out.u32((uint32_t) struct_decls.size());
+	for (const auto& decl : struct_decls) {
+		out.str(decl.name);
+		out.u32((uint32_t) decl.fields.size());
+		for (size_t i = 0; i < decl.fields.size(); i++) {
+			out.str(decl.fields[i]);
+			out.f32(decl.defaults[i]);
+		}
+		auto node_it = s.node_indices.find(decl.node);
+		out.u32(node_it != s.node_indices.end() ? node_it->second : NO_INDEX);
+	}
+
+	out.u32((uint32_t) objects.size());
+	for (const auto& obj : objects) {
+		out.u8((uint8_t) obj->type);
+		if (obj->type == GC_Obj_Type::String)
+			out.str(((const GC_Obj_String*) obj.get())->str);
+		else if (obj->type == GC_Obj_Type::Instance)
+			out.str(((const GC_Obj_Instance*) obj.get())->class_name);
+		else if (obj->type == GC_Obj_Type::Pool)
+			out.str(((const GC_Obj_Pool*) obj.get())->class_name);
+	}
+
+	for (const auto& obj : objects) {
+		switch (obj->type) {
+		case GC_Obj_Type::String:
+			break;
+		case GC_Obj_Type::Array: {
+			const GC_Obj_Array* arr = (const GC_Obj_Array*) obj.get();
+			out.u32((uint32_t) arr->arr.size());
+			for (const Value& item : arr->arr)
+				write_value(*this, item, s);
+			break;
+		}
+		case GC_Obj_Type::Table:
+			write_defs(*this, ((const GC_Obj_Table*) obj.get())->definitions, s);
+			break;
+		case GC_Obj_Type::Instance:
+			write_defs(*this, ((const GC_Obj_Instance*) obj.get())->scope.definitions, s);
+			break;
+		case GC_Obj_Type::Pool: {
+			const GC_Obj_Pool* pool = (const GC_Obj_Pool*) obj.get();
+			write_defs(*this, pool->defaults, s);
+			out.u32((uint32_t) pool->instances.size());
+			for (const GC_Obj_Instance* instance : pool->instances)
+				out.u32(s.obj_indices.at(instance));
+			out.u32((uint32_t) pool->free_list.size());
+			for (const GC_Obj_Instance* instance : pool->free_list)
+				out.u32(s.obj_indices.at(instance));
+			break;
+		}
+		}
+	}
+
+	write_defs(*this, program_scope.definitions, s);
+
+	out.u32((uint32_t) class_decls.size());
+	for (const auto& it : class_decls) {
+		const Class_Decl& decl = it.second;
+		out.str(decl.name);
+		out.str(decl.parent);
+		auto node_it = s.node_indices.find(decl.node);
+		out.u32(node_it != s.node_indices.end() ? node_it->second : NO_INDEX);
+
+		// field values as the saved context has them
+		auto fields_it = ctx->class_fields.find(decl.name);
+		if (fields_it == ctx->class_fields.end()) {
+			write_defs(*this, decl.scope.definitions, s);
+		} else {
+			std::unordered_map<std::string, Definition> defs = decl.scope.definitions;
+			for (const auto& field : fields_it->second.definitions)
+				defs[field.first].value = field.second.value;
+			write_defs(*this, defs, s);
+		}
+	}
+
+	write_defs(*this, ctx->global_scope.definitions, s);
+
+	if (!s.ok)
+		return false;
+
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file)
+		return false;
+
+	bool written = fwrite(out.data.data(), out.data.size(), 1, file) == 1;
+	fclose(file);
+	return written;
+}
+
+std::unique_ptr<AST_Node> Interpreter::load_snapshot(const std::string& path, std::vector<std::string>* source_files) {
+	if (!program_scope.definitions.empty() || !class_decls.empty() || !struct_decls.empty() || !ctx->global_scope.definitions.empty()) {
+		error("Snapshots can only be loaded into a fresh interpreter");
+		return nullptr;
+	}
+
+	Mapped_File file(path);
+	if (file.data == nullptr || file.size < 8 || memcmp(file.data, SNAPSHOT_MAGIC, 4) != 0)
+		return nullptr;
+
+	Load_State s;
+	Image_Reader& in = s.in;
+	in.pos = file.data + 4;
+	in.end = file.data + file.size;
+
+	if (in.u32() != SNAPSHOT_VERSION)
+		return nullptr;
+
+	std::vector<std::string> files(in.u32());
+	for (auto& name : files) {
+		if (!in.ok)
+			return nullptr;
+		name = in.str();
+	}
+
+	uint32_t num_nodes = in.u32();
+	if (num_nodes == 0)
+		return nullptr;
+	for (uint32_t i = 0; i < num_nodes && in.ok; i++) {
+		AST_Node* node = read_node(*this, s);
+		bool temp = in.u8() != 0;
+		if (node != nullptr) {
+			node->temp = temp;
+			s.nodes.emplace_back(node);
+		}
+	}
+
+	std::vector<Struct_Decl> structs(in.u32());
+	std::vector<uint32_t> struct_nodes;
+	for (auto& decl : structs) {
+		decl.name = in.str();
+		uint32_t num_fields = in.u32();
+		if (!in.ok || num_fields > MAX_STRUCT_FIELDS)
+			return nullptr;
+		for (uint32_t i = 0; i < num_fields; i++) {
+			decl.fields.push_back(in.str());
+			decl.defaults[i] = in.f32();
+		}
+		struct_nodes.push_back(in.u32());
+	}
+	s.num_structs = (uint32_t) structs.size();
+
+	// create every object first so values can point at them
+	uint32_t num_objects = in.u32();
+	for (uint32_t i = 0; i < num_objects && in.ok; i++) {
+		GC_Obj_Type type = (GC_Obj_Type) in.u8();
+		switch (type) {
+		case GC_Obj_Type::String:
+			s.objects.emplace_back(new GC_Obj_String(in.str()));
+			break;
+		case GC_Obj_Type::Array:
+			s.objects.emplace_back(new GC_Obj_Array());
+			break;
+		case GC_Obj_Type::Table:
+			s.objects.emplace_back(new GC_Obj_Table());
+			break;
+		case GC_Obj_Type::Instance: {
+			GC_Obj_Instance* instance = new GC_Obj_Instance(Scope(&ctx->global_scope, nullptr));
+			instance->class_name = in.str();
+			s.objects.emplace_back(instance);
+			break;
+		}
+		case GC_Obj_Type::Pool: {
+			GC_Obj_Pool* pool = new GC_Obj_Pool();
+			pool->class_name = in.str();
+			s.objects.emplace_back(pool);
+			break;
+		}
+		default:
+			in.ok = false;
+		}
+	}
+
+	// pooled instances by object index, checked before anything is committed
+	auto read_instances = [&](std::vector<GC_Obj_Instance*>& list) {
+		uint32_t count = in.u32();
+		if (!in.has(count))
+			return;
+		for (uint32_t j = 0; j < count; j++) {
+			uint32_t index = in.u32();
+			if (index >= s.objects.size() || s.objects[index]->type != GC_Obj_Type::Instance) {
+				in.ok = false;
+				return;
+			}
+			list.push_back((GC_Obj_Instance*) s.objects[index].get());
+		}
+	};
+
+	std::vector<std::vector<Saved_Def>> obj_defs(s.objects.size());
+	for (size_t i = 0; i < s.objects.size() && in.ok; i++) {
+		GC_Obj* obj = s.objects[i].get();
+		if (obj->type == GC_Obj_Type::Array) {
+			GC_Obj_Array* arr = (GC_Obj_Array*) obj;
+			uint32_t count = in.u32();
+			if (!in.has(count))
+				break;
+			arr->arr.resize(count);
+			for (auto& item : arr->arr)
+				item = read_value(*this, s, &item);
+		} else if (obj->type != GC_Obj_Type::String) {
+			read_defs(*this, obj_defs[i], s);
+		}
+
+		if (obj->type == GC_Obj_Type::Pool) {
+			GC_Obj_Pool* pool = (GC_Obj_Pool*) obj;
+			read_instances(pool->instances);
+			read_instances(pool->free_list);
+		}
+	}
+
+	std::vector<Saved_Def> program_defs;
+	read_defs(*this, program_defs, s);
+
+	struct Saved_Class {
+		std::string name, parent;
+		uint32_t node_index;
+		std::vector<Saved_Def> defs;
+	};
+	std::vector<Saved_Class> classes(in.u32());
+	for (auto& decl : classes) {
+		if (!in.ok)
+			return nullptr;
+		decl.name = in.str();
+		decl.parent = in.str();
+		decl.node_index = in.u32();
+		read_defs(*this, decl.defs, s);
+	}
+
+	std::vector<Saved_Def> global_defs;
+	read_defs(*this, global_defs, s);
+
+	if (!s.missing_extern.empty()) {
+		error("Snapshot needs missing external func: " + s.missing_extern);
+		return nullptr;
+	}
+
+	if (!in.ok || s.nodes.size() != num_nodes || !apply_func_fixups(s))
+		return nullptr;
+
+	// resolve class nodes while every node is still in s.nodes
+	std::vector<const AST_Class_Decl*> class_nodes;
+	for (const auto& decl : classes) {
+		const AST_Node* node = nullptr;
+		if (decl.node_index != NO_INDEX) {
+			if (decl.node_index >= s.nodes.size() || s.nodes[decl.node_index]->type != AST_Node_Type::Class_Decl)
+				return nullptr;
+			node = s.nodes[decl.node_index].get();
+		}
+		class_nodes.push_back((const AST_Class_Decl*) node);
+	}
+
+	for (size_t i = 0; i < structs.size(); i++) {
+		if (struct_nodes[i] == NO_INDEX)
+			continue;
+		if (struct_nodes[i] >= s.nodes.size() || s.nodes[struct_nodes[i]]->type != AST_Node_Type::Struct_Decl)
+			return nullptr;
+		structs[i].node = (const AST_Struct_Decl*) s.nodes[struct_nodes[i]].get();
+	}
+
+	if (!apply_node_fixups(s))
+		return nullptr;
+
+	// everything checks out, commit it all to the interpreter
+	auto set_defs = [](Scope& scope, const std::vector<Saved_Def>& defs) {
+		for (const auto& def : defs)
+			scope.set_def(def.name, def.value, def.flags);
+	};
+
+	for (size_t i = 0; i < s.objects.size(); i++) {
+		GC_Obj* obj = s.objects[i].get();
+		if (obj->type == GC_Obj_Type::Instance) {
+			set_defs(((GC_Obj_Instance*) obj)->scope, obj_defs[i]);
+		} else if (obj->type == GC_Obj_Type::Table || obj->type == GC_Obj_Type::Pool) {
+			auto& definitions = obj->type == GC_Obj_Type::Table ? ((GC_Obj_Table*) obj)->definitions : ((GC_Obj_Pool*) obj)->defaults;
+			for (const auto& def : obj_defs[i]) {
+				Definition& d = definitions[def.name];
+				d.name = def.name;
+				d.value = def.value;
+				d.flags = def.flags;
+			}
+		}
+
+		if (obj->type == GC_Obj_Type::Pool) {
+			GC_Obj_Pool* pool = (GC_Obj_Pool*) obj;
+			for (GC_Obj_Instance* instance : pool->instances)
+				instance->pool = pool;
+			for (GC_Obj_Instance* instance : pool->free_list)
+				instance->released = true;
+		}
+	}
+
+	struct_decls = std::move(structs);
+	set_defs(program_scope, program_defs);
+
+	for (size_t i = 0; i < classes.size(); i++) {
+		Class_Decl& decl = class_decls[classes[i].name];
+		decl.name = classes[i].name;
+		decl.parent = classes[i].parent;
+		decl.node = class_nodes[i];
+		set_defs(decl.scope, classes[i].defs);
+	}
+
+	set_defs(ctx->global_scope, global_defs);
+
+	for (auto& obj : s.objects)
+		ctx->heap.add_obj(obj.release());
+
+	if (source_files != nullptr)
+		*source_files = std::move(files);
+
+	return std::move(s.nodes[0]);
+}
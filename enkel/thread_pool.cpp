@@ -0,0 +1,133 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+Thread_Pool::Thread_Pool(int num_workers) {
+	if (num_workers < 0) {
+		int hw_threads = (int) std::thread::hardware_concurrency();
+		num_workers = hw_threads > 1 ? hw_threads - 1 : 0;
+	}
+
+	for (int i = 0; i < num_workers + 1; i++) {
+		queues.push_back(std::make_unique<Queue>());
+	}
+
+	for (int i = 0; i < num_workers; i++) {
+		workers.emplace_back(&Thread_Pool::worker_main, this, i + 1);
+	}
+}
+
+Thread_Pool::~Thread_Pool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake_cv.notify_all();
+
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+void Thread_Pool::parallel_for(size_t count, size_t chunk_size, const Range_Func& func) {
+	if (count == 0)
+		return;
+
+	chunk_size = std::max(chunk_size, (size_t) 1);
+	remaining = count;
+
+	// deal the chunks out round robin, stealing evens out the rest
+	size_t queue_index = 0;
+	for (size_t begin = 0; begin < count; begin += chunk_size) {
+		Queue& queue = *queues[queue_index];
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.ranges.push_back({begin, std::min(begin + chunk_size, count)});
+		}
+		queue_index = (queue_index + 1) % queues.size();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = &func;
+		job_id++;
+	}
+	wake_cv.notify_all();
+
+	run_ranges(0, func);
+
+	// wait for stolen ranges, and for every worker to let go of func
+	std::unique_lock<std::mutex> lock(mutex);
+	done_cv.wait(lock, [this] { return remaining == 0 && active_workers == 0; });
+	job = nullptr;
+}
+
+void Thread_Pool::worker_main(int index) {
+	uint64_t seen_job_id = 0;
+
+	while (true) {
+		const Range_Func* func;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake_cv.wait(lock, [&] { return stopping || job_id != seen_job_id; });
+
+			if (stopping)
+				return;
+
+			seen_job_id = job_id;
+			if (job == nullptr)
+				continue; // woke up after the job was already done
+
+			func = job;
+			active_workers++;
+		}
+
+		run_ranges(index, *func);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			active_workers--;
+		}
+		done_cv.notify_all();
+	}
+}
+
+bool Thread_Pool::take_range(int index, Range& range) {
+	// newest work from our own queue first
+	{
+		Queue& own = *queues[index];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.ranges.empty()) {
+			range = own.ranges.back();
+			own.ranges.pop_back();
+			return true;
+		}
+	}
+
+	// then steal the oldest work from someone else
+	for (size_t i = 1; i < queues.size(); i++) {
+		Queue& victim = *queues[(index + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.ranges.empty()) {
+			range = victim.ranges.front();
+			victim.ranges.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void Thread_Pool::run_ranges(int index, const Range_Func& func) {
+	Range range;
+	while (take_range(index, range)) {
+		func(index, range.begin, range.end);
+
+		size_t done = range.end - range.begin;
+		if (remaining.fetch_sub(done) == done) {
+			// lock so the wakeup can't slip in between the caller's check and wait
+			std::lock_guard<std::mutex> lock(mutex);
+			done_cv.notify_all();
+		}
+	}
+}
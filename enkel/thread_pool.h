@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+
+// Work-stealing pool for data-parallel loops.
+// Every participant owns a queue of index ranges. It takes work from the back
+// of its own queue and steals from the front of the others when it runs dry.
+// The calling thread takes part as well, so a pool with 0 workers still works.
+class Thread_Pool {
+public:
+	// participant is the index of the thread running the range, 0 is the caller.
+	// a participant runs one range at a time
+	using Range_Func = std::function<void(int participant, size_t begin, size_t end)>;
+
+	// num_workers < 0 means one worker per extra hardware thread
+	Thread_Pool(int num_workers = -1);
+	~Thread_Pool();
+
+	Thread_Pool(const Thread_Pool&) = delete;
+	Thread_Pool& operator=(const Thread_Pool&) = delete;
+
+	// calls func over [0, count) in chunks of chunk_size, returns when all are done
+	void parallel_for(size_t count, size_t chunk_size, const Range_Func& func);
+
+	int get_num_threads() const { return (int) queues.size(); }
+
+private:
+	struct Range {
+		size_t begin, end;
+	};
+
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Range> ranges;
+	};
+
+	void worker_main(int index);
+	bool take_range(int index, Range& range);
+	void run_ranges(int index, const Range_Func& func);
+
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<Queue>> queues; // queues[0] belongs to the calling thread
+
+	std::mutex mutex;
+	std::condition_variable wake_cv;
+	std::condition_variable done_cv;
+	const Range_Func* job = nullptr;
+	uint64_t job_id = 0;
+	int active_workers = 0;
+	bool stopping = false;
+	std::atomic<size_t> remaining{0};
+};
@@ -40,6 +40,7 @@ enum class Token_Type {
     Keyword_Or,
     Keyword_Import,
     Keyword_Const,
+    Keyword_Struct,
     Plus,
     Minus,
     Multiply,
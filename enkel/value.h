@@ -10,17 +10,24 @@ enum class Value_Type {
 	BC_Func_Ref,
 	Func_Ref,
 	Extern_Func,
+	Struct,			// fields are stored inline, struct_id says which struct
+	Struct_Type,	// calling it constructs a struct, as.i is the struct id
 };
 
 struct GC_Obj;
 
+// structs only hold numbers, and few enough to fit in a Value
+const int MAX_STRUCT_FIELDS = 4;
+
 struct Value {
 	Value_Type type = Value_Type::Null;
+	uint32_t struct_id = 0;
 	union {
 		int32_t i = 0;
 		float num;
 		bool _bool;
 		void* ptr;
+		float fields[MAX_STRUCT_FIELDS];
 	} as;
 
 	static constexpr Value from_num(float num) {
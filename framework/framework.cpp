@@ -5,6 +5,11 @@
 #include <enkel/parser.h>
 #include <enkel/interpreter.h>
 #include <enkel/ast_util.h>
+#include <enkel/bc_compiler.h>
+#include <enkel/bc_util.h>
+#include <enkel/bc_file.h>
+#include <enkel/bc_verifier.h>
+#include <enkel/bc_link.h>
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
@@ -15,14 +20,11 @@
 #include <chrono>
 #include <filesystem>
 
-Framework fw{};
-Graphics gfx{};
-
-static char* read_file(const std::string& path, uint64_t& size) {
+static char* read_file(const Framework& fw, const std::string& path, uint64_t& size) {
 	size = 0;
 	FILE* file = fopen(path.c_str(), "rb");
 	if (!file) {
-		framework_error("Failed to open file: " + path);
+		framework_error(fw, "Failed to open file: " + path);
 	}
 
 	fseek(file, 0, SEEK_END);
@@ -40,93 +42,105 @@ static char* read_file(const std::string& path, uint64_t& size) {
 	return buf;
 }
 
-static void register_funcs() {
-	auto expect_type = [] (Interpreter& interp, const Value& val, Value_Type type) -> const Value& {
-		return interp.expect_value(val, Value_Type::Num, interp.extern_func_node);
-	};
+static const Value& expect_type(Interpreter& interp, const Value& val, Value_Type type) {
+	return interp.expect_value(val, type, interp.extern_func_node);
+}
 
+// natives find their framework through the interpreter's user data,
+// so nothing here depends on process-wide state
+static void register_funcs(Framework& fw) {
 	// --- window ---
-	fw.interp.add_external_func({"set_size", 2, [&](const std::vector<Value>& args, void* data_ptr) -> Value {
+	fw.interp.add_external_func({"set_size", 2, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
+		Framework& fw = *(Framework*) interp.get_user_data();
 		int width = expect_type(interp, args[0], Value_Type::Num).as.num;
 		int height = expect_type(interp, args[1], Value_Type::Num).as.num;
 
 		fw.width = width;
 		fw.height = height;
 
-		fw.interp.get_global_scope().set_def("width", Value::from_num(width));
-		fw.interp.get_global_scope().set_def("height", Value::from_num(height));
+		interp.get_global_scope().set_def("width", Value::from_num(width));
+		interp.get_global_scope().set_def("height", Value::from_num(height));
 
 		SDL_SetWindowSize(fw.window, width, height);
 		return {};
 	}});
 
-	fw.interp.add_external_func({"set_title", 1, [&](const std::vector<Value>& args, void* data_ptr) -> Value {
-		fw.title = fw.interp.get_string(args[0]);
+	fw.interp.add_external_func({"set_title", 1, [](const std::vector<Value>& args, void* data_ptr) -> Value {
+		Interpreter& interp = *(Interpreter*) data_ptr;
+		Framework& fw = *(Framework*) interp.get_user_data();
+		fw.title = interp.get_string(args[0]);
 		SDL_SetWindowTitle(fw.window, fw.title.c_str());
 		return {};
-	}});
+	}, EXTERN_BORROWS_ARGS});
 
-	fw.interp.add_external_func({"set_resizable", 1, [&](const std::vector<Value>& args, void* data_ptr) -> Value {
+	fw.interp.add_external_func({"set_resizable", 1, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
+		Framework& fw = *(Framework*) interp.get_user_data();
 		bool resizable = expect_type(interp, args[0], Value_Type::Bool).as._bool;
 		SDL_SetWindowResizable(fw.window, (SDL_bool) resizable);
 		return {};
 	}});
 
 	// --- graphics ---
-	fw.interp.add_external_func({"clear", 0, [&](const std::vector<Value>& args, void* data_ptr) -> Value {
-		gfx.clear();
+	fw.interp.add_external_func({"clear", 0, [](const std::vector<Value>& args, void* data_ptr) -> Value {
+		Interpreter& interp = *(Interpreter*) data_ptr;
+		Framework& fw = *(Framework*) interp.get_user_data();
+		fw.gfx.clear();
 		return {};
 	}});
 
-	fw.interp.add_external_func({"set_color", 1, [&](const std::vector<Value>& args, void* data_ptr) -> Value {
+	fw.interp.add_external_func({"set_color", 1, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
+		Framework& fw = *(Framework*) interp.get_user_data();
 
 		uint32_t i = 0;
 		if (args[0].type == Value_Type::GC_Obj) {
 			// TODO: make sure its a string
-			const std::string& str = fw.interp.get_string(args[0]);
+			const std::string& str = interp.get_string(args[0]);
 
 			if (str[0] != '#')
-				framework_error("Expected starting # in hex color string", &interp.extern_func_node->src_info);
+				framework_error(fw, "Expected starting # in hex color string", &interp.extern_func_node->src_info);
 
 			char* end;
 			i = strtol(str.c_str() + 1, &end, 16);
 
 			if (*end != 0)
-				framework_error("Failed to parse hex color string", &interp.extern_func_node->src_info);
+				framework_error(fw, "Failed to parse hex color string", &interp.extern_func_node->src_info);
 		} else if (args[0].type == Value_Type::Num) {
 			i = (uint32_t) args[0].as.num;
 		}
 
-		gfx.set_color(i);
+		fw.gfx.set_color(i);
 		return {};
 	}});
 
-	fw.interp.add_external_func({"fill_rect", 4, [&](const std::vector<Value>& args, void* data_ptr) -> Value {
+	fw.interp.add_external_func({"fill_rect", 4, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
+		Framework& fw = *(Framework*) interp.get_user_data();
 
 		float x = expect_type(interp, args[0], Value_Type::Num).as.num;
 		float y = expect_type(interp, args[1], Value_Type::Num).as.num;
 		float w = expect_type(interp, args[2], Value_Type::Num).as.num;
 		float h = expect_type(interp, args[3], Value_Type::Num).as.num;
 
-		gfx.fill_rect(x, y, w, h);
+		fw.gfx.fill_rect(x, y, w, h);
 		return {};
 	}});
 
-	fw.interp.add_external_func({"load_image", 1, [&](const std::vector<Value>& args, void* data_ptr) -> Value {
+	fw.interp.add_external_func({"load_image", 1, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
+		Framework& fw = *(Framework*) interp.get_user_data();
 
 		const std::string& path = interp.get_string(args[0]);
 		int id = fw.images.size();
-		fw.images.push_back(Image(path));
+		fw.images.push_back(Image(fw, path));
 		return {Value::from_num(id)};
-	}});
+	}, EXTERN_BORROWS_ARGS});
 	
-	fw.interp.add_external_func({"draw_image", 3, [&](const std::vector<Value>& args, void* data_ptr) -> Value {
+	fw.interp.add_external_func({"draw_image", 3, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
+		Framework& fw = *(Framework*) interp.get_user_data();
 
 		int id = (int) expect_type(interp, args[0], Value_Type::Num).as.num;
 		float x = expect_type(interp, args[1], Value_Type::Num).as.num;
@@ -136,25 +150,27 @@ static void register_funcs() {
 		float w = args.size() >= 4 ? expect_type(interp, args[3], Value_Type::Num).as.num : img.get_width();
 		float h = args.size() >= 5 ? expect_type(interp, args[4], Value_Type::Num).as.num : img.get_height();
 
-		gfx.draw_img(img, x, y, w, h);
+		fw.gfx.draw_img(img, x, y, w, h);
 		return {};
 	}});
 
 	// --- input ---
-	fw.interp.add_external_func({"key_pressed", 1, [&](const std::vector<Value>& args, void* data_ptr) -> Value {
+	fw.interp.add_external_func({"key_pressed", 1, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
+		Framework& fw = *(Framework*) interp.get_user_data();
 
 		SDL_Keycode code = SDL_GetKeyFromName(interp.get_string(args[0]).c_str());
 
 		if (code == SDLK_UNKNOWN) {
-			framework_error("unknown key");
+			framework_error(fw, "unknown key");
 		}
 
-		return {Value::from_bool(is_key_down(code))};
-	}});
+		return {Value::from_bool(is_key_down(fw, code))};
+	}, EXTERN_BORROWS_ARGS});
 
-	fw.interp.add_external_func({"mouse_pressed", 1, [&](const std::vector<Value>& args, void* data_ptr) -> Value {
+	fw.interp.add_external_func({"mouse_pressed", 1, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
+		Framework& fw = *(Framework*) interp.get_user_data();
 
 		const auto& button = interp.get_string(args[0]);
 
@@ -166,46 +182,50 @@ static void register_funcs() {
 		} else if (button == "middle") {
 			result = fw.mouse_middle;
 		} else {
-			framework_error("Unknown mouse button");
+			framework_error(fw, "Unknown mouse button");
 		}
 
 		return {Value::from_bool(result)};
-	}});
+	}, EXTERN_BORROWS_ARGS});
 
 	// --- utils ---
-	fw.interp.add_external_func({"rand", 0, [&](const std::vector<Value>& args, void* data_ptr) -> Value {
+	fw.interp.add_external_func({"rand", 0, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		return {Value::from_num(rand() / (RAND_MAX + 1.0f))};
 	}});
 
-	fw.interp.add_external_func({"set_framerate", 1, [&](const std::vector<Value>& args, void* data_ptr) -> Value {
+	fw.interp.add_external_func({"set_framerate", 1, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
+		Framework& fw = *(Framework*) interp.get_user_data();
 
 		float fps = expect_type(interp, args[0], Value_Type::Num).as.num;
 		fw.framerate = fps;
 		return {};
 	}});
 
-	fw.interp.add_external_func({"exit", 0, [&](const std::vector<Value>& args, void* data_ptr) -> Value {
+	fw.interp.add_external_func({"exit", 0, [](const std::vector<Value>& args, void* data_ptr) -> Value {
+		Interpreter& interp = *(Interpreter*) data_ptr;
+		Framework& fw = *(Framework*) interp.get_user_data();
 		fw.running = false;
 		return {};
 	}});
 
-	fw.interp.add_external_func({"read_file", 1, [&](const std::vector<Value>& args, void* data_ptr) -> Value {
+	fw.interp.add_external_func({"read_file", 1, [](const std::vector<Value>& args, void* data_ptr) -> Value {
 		Interpreter& interp = *(Interpreter*) data_ptr;
+		Framework& fw = *(Framework*) interp.get_user_data();
 
 		const auto& path = interp.get_string(args[0]);
 
 		uint64_t size;
-		char* buf = read_file(path, size);
+		char* buf = read_file(fw, path, size);
 
 		Value str_val = interp.create_string(buf); // TODO: avoid unnecessary strlen
 		free(buf);
 
 		return {str_val};
-	}});
+	}, EXTERN_BORROWS_ARGS});
 }
 
-void framework_error(const std::string& msg, const Source_Info* info) {
+static std::string format_error(const Framework& fw, const std::string& msg, const Source_Info* info) {
 	std::string final_msg;
 
 	if (info != nullptr) {
@@ -217,6 +237,15 @@ void framework_error(const std::string& msg, const Source_Info* info) {
 	}
 
 	final_msg += msg;
+	return final_msg;
+}
+
+void framework_error(const Framework& fw, const std::string& msg, const Source_Info* info) {
+	std::string final_msg = format_error(fw, msg, info);
+
+	// whatever the script printed before the error comes first
+	if (fw.log != nullptr)
+		fw.log->flush();
 
 	std::cout << final_msg << std::endl;
 	SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Error!", final_msg.c_str(), fw.window);
@@ -224,33 +253,35 @@ void framework_error(const std::string& msg, const Source_Info* info) {
 	exit(1);
 }
 
-bool is_key_down(SDL_Keycode keycode) {
-	if (fw.keyboard_state.find(keycode) == fw.keyboard_state.end())
+bool is_key_down(const Framework& fw, SDL_Keycode keycode) {
+	auto it = fw.keyboard_state.find(keycode);
+	if (it == fw.keyboard_state.end())
 		return false;
 
-	return fw.keyboard_state[keycode];
+	return it->second;
 }
 
-static void init_sdl() {
+static void init_sdl(Framework& fw) {
 	if (SDL_Init(SDL_INIT_VIDEO)) {
-		framework_error("failed to initialize SDL2");
+		framework_error(fw, "failed to initialize SDL2");
 	}
 
 	if (!(IMG_Init(IMG_INIT_PNG) & IMG_INIT_PNG)) {
-		framework_error("failed to initialize SDL2 image");
+		framework_error(fw, "failed to initialize SDL2 image");
 	}
 
 	fw.window = SDL_CreateWindow(fw.title.c_str(),
 		SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
 		fw.width, fw.height, SDL_WINDOW_HIDDEN);
 	if (!fw.window) {
-		framework_error("failed to create SDL2 window");
+		framework_error(fw, "failed to create SDL2 window");
 	}
 
-	gfx.init();
+	fw.renderer = SDL_CreateRenderer(fw.window, -1, SDL_RENDERER_ACCELERATED);
+	fw.gfx.init(fw.renderer);
 }
 
-static bool is_imported(const std::string& script_path) {
+static bool is_imported(const Framework& fw, const std::string& script_path) {
 	for (const auto& path : fw.script_paths) {
 		if (script_path == path)
 			return true;
@@ -258,19 +289,21 @@ static bool is_imported(const std::string& script_path) {
 	return false;
 }
 
-static std::vector<Token> load_tokens(const std::string& script_path) {
+// file_index is given when reloading a file that was already loaded
+static std::vector<Token> load_tokens(Framework& fw, const std::string& script_path, int file_index = -1) {
 	uint64_t siz;
-	char* buf = read_file(script_path, siz);
+	char* buf = read_file(fw, script_path, siz);
 
 	if (siz == 0)
 		return {};
 
-	int file_index = fw.script_paths.size();
-
 	std::vector<Token> tokens = Lexer::lex(buf);
 	free(buf);
 
-	fw.script_paths.push_back(script_path);
+	if (file_index < 0) {
+		file_index = fw.script_paths.size();
+		fw.script_paths.push_back(script_path);
+	}
 
 	for (auto& token : tokens)
 		token.src_info.file_index = file_index;
@@ -283,10 +316,10 @@ static std::vector<Token> load_tokens(const std::string& script_path) {
 			std::string import_path = tokens[i + 1].str;
 			tokens.erase(tokens.begin() + i, tokens.begin() + i + 3);
 
-			if (!is_imported(import_path)) {
+			if (!is_imported(fw, import_path)) {
 				auto absolute_path = std::filesystem::absolute(script_path).parent_path() / import_path;
 
-				std::vector<Token> imported_tokens = load_tokens(absolute_path.string());
+				std::vector<Token> imported_tokens = load_tokens(fw, absolute_path.string());
 				if (imported_tokens.size() == 0)
 					continue;
 				tokens.insert(tokens.begin() + i, imported_tokens.begin(), imported_tokens.end());
@@ -297,20 +330,134 @@ static std::vector<Token> load_tokens(const std::string& script_path) {
 	return tokens;
 }
 
-static void init(const std::string& script_path) {
-	init_sdl();
-	std::vector<Token> tokens = load_tokens(script_path);
+static void prepare_callbacks(Framework& fw) {
+	fw.init_func = fw.interp.prepare_call("init", 0);
+	fw.update_func = fw.interp.prepare_call("update", 0);
+	fw.draw_func = fw.interp.prepare_call("draw", 0);
+}
 
-	Parser parser(tokens);
-	parser.set_error_callback(framework_error);
-	auto root = parser.parse();
+// remembers modification times for scripts that don't have one yet
+static void update_script_times(Framework& fw) {
+	for (size_t i = fw.script_times.size(); i < fw.script_paths.size(); i++) {
+		std::error_code ec;
+		fw.script_times.push_back(std::filesystem::last_write_time(fw.script_paths[i], ec));
+	}
+}
+
+// re-parses only the scripts that changed on disk, globals and objects are kept.
+// a script that doesn't parse is reported and the old program keeps running, it's
+// tried again until it's fixed
+static void reload_changed_scripts(Framework& fw) {
+	bool reloaded = false;
+
+	// new imports get appended to script_paths while looping, they're loaded already
+	size_t num_scripts = fw.script_paths.size();
+	fw.failed_script_times.resize(num_scripts);
+	for (size_t i = 0; i < num_scripts; i++) {
+		std::error_code ec;
+		auto time = std::filesystem::last_write_time(fw.script_paths[i], ec);
+		if (ec || time == fw.script_times[i])
+			continue;
+
+		size_t num_paths = fw.script_paths.size();
+		std::vector<Token> tokens = load_tokens(fw, fw.script_paths[i], (int) i);
+		if (tokens.empty())
+			continue; // probably caught while being saved
+
+		std::string parse_error;
+		Parser parser(tokens);
+		parser.set_error_callback([&](const std::string& msg, const Source_Info* info) {
+			parse_error = format_error(fw, msg, info);
+		});
+		std::unique_ptr<AST_Node> program = parser.parse();
+		if (program == nullptr) {
+			// once per save, not on every check
+			if (time != fw.failed_script_times[i]) {
+				fw.failed_script_times[i] = time;
+				std::cout << "Failed to reload " << fw.script_paths[i] << ":\n" << parse_error << std::endl;
+			}
+
+			// new imports get loaded again with the fixed script
+			fw.script_paths.resize(num_paths);
+			continue;
+		}
+
+		fw.script_times[i] = time;
+		fw.interp.reload(program.get());
+		fw.reloaded_programs.push_back(std::move(program));
+		reloaded = true;
+
+		std::cout << "Reloaded " << fw.script_paths[i] << std::endl;
+	}
+
+	if (reloaded) {
+		update_script_times(fw);
+		prepare_callbacks(fw);
+	}
+}
 
-	//print_ast(root.get());
+static void run_bc_program(Framework& fw, const Framework_Options& options) {
+	fw.vm = std::make_unique<BC_VM>(fw.interp);
+	if (options.bc_profile)
+		fw.vm->set_profile(&fw.bc_profile);
+	fw.vm->run(&fw.bc_program);
+}
 
-	fw.interp.set_error_callback(framework_error);
-	register_funcs();
+static void init(Framework& fw, const Framework_Options& options) {
+	auto on_error = [&fw](const std::string& msg, const Source_Info* info) {
+		framework_error(fw, msg, info);
+	};
+
+	init_sdl(fw);
+
+	fw.log = std::make_unique<Log_Sink>(options.log_path);
+	if (!fw.log->is_open())
+		framework_error(fw, "Failed to open log file: " + options.log_path);
+
+	fw.interp.set_error_callback(on_error);
+	fw.interp.set_log_sink(fw.log.get());
+	fw.interp.set_user_data(&fw);
+	register_funcs(fw);
+
+	if (!options.load_snapshot_path.empty()) {
+		fw.program = fw.interp.load_snapshot(options.load_snapshot_path, &fw.script_paths);
+		if (fw.program == nullptr)
+			framework_error(fw, "Failed to load snapshot: " + options.load_snapshot_path);
+	} else if (!options.load_bytecode_path.empty()) {
+		if (!load_bc_program(options.load_bytecode_path, fw.bc_program, &fw.script_paths))
+			framework_error(fw, "Failed to load bytecode: " + options.load_bytecode_path);
+
+		// externs are bound by name, the file may not have come from the compiler
+		std::string link_error, verify_error;
+		if (!link_bc_program(fw.bc_program, fw.interp.get_extern_funcs(), link_error))
+			framework_error(fw, "Failed to link " + options.load_bytecode_path + ": " + link_error);
+		if (!verify_bc_program(fw.bc_program, fw.interp.get_extern_funcs(), verify_error))
+			framework_error(fw, "Invalid bytecode in " + options.load_bytecode_path + ": " + verify_error);
+
+		run_bc_program(fw, options);
+	} else {
+		std::vector<Token> tokens = load_tokens(fw, options.script_path);
+
+		Parser parser(tokens);
+		parser.set_error_callback(on_error);
+		fw.program = parser.parse();
+
+		//print_ast(fw.program.get());
+
+		if (options.bytecode) {
+			BC_Compiler compiler(fw.interp.get_extern_funcs());
+			compiler.set_error_callback(on_error);
+			fw.bc_program = compiler.compile(fw.program.get());
+			run_bc_program(fw, options);
+		} else {
+			fw.interp.eval(fw.program.get());
+		}
 
-	fw.interp.eval(root.get());
+		if (!options.save_snapshot_path.empty() &&
+			!fw.interp.save_snapshot(options.save_snapshot_path, fw.program.get(), fw.script_paths)) {
+			framework_error(fw, "Failed to save snapshot: " + options.save_snapshot_path);
+		}
+	}
 
 	fw.interp.get_global_scope().set_def("width", Value::from_num(fw.width));
 	fw.interp.get_global_scope().set_def("height", Value::from_num(fw.height));
@@ -334,32 +481,61 @@ static void init(const std::string& script_path) {
 	fw.interp.get_global_scope().set_def("MAGENTA", Value::from_num(0xFF00FF), DEF_CONST);
 	fw.interp.get_global_scope().set_def("CYAN", Value::from_num(0x00FFFF), DEF_CONST);
 
-	auto try_get_func = [] (const std::string& name) -> Value {
-		Definition* def = fw.interp.get_global_scope().find_def(name);
-		if (def == nullptr)
-			return {};
-		return def->value;
-	};
+	prepare_callbacks(fw);
 
-	fw.init_func = try_get_func("init");
-	fw.update_func = try_get_func("update");
-	fw.draw_func = try_get_func("draw");
+	if (options.hot_reload)
+		update_script_times(fw);
 
-	if (fw.init_func.type != Value_Type::Null)
-		fw.interp.call_function(fw.init_func, {});
+	if (fw.init_func.is_valid())
+		fw.init_func.call();
 
 	SDL_ShowWindow(fw.window);
 }
 
-void run_framework(const std::string& script_path) {
+// compile only, nothing runs and no window is opened
+static void save_bytecode(Framework& fw, const Framework_Options& options) {
+	auto on_error = [&fw](const std::string& msg, const Source_Info* info) {
+		framework_error(fw, msg, info);
+	};
+
+	// the compiler binds externs by name, they have to exist
+	fw.interp.set_error_callback(on_error);
+	fw.interp.set_user_data(&fw);
+	register_funcs(fw);
+
+	std::vector<Token> tokens = load_tokens(fw, options.script_path);
+
+	Parser parser(tokens);
+	parser.set_error_callback(on_error);
+	fw.program = parser.parse();
+
+	BC_Compiler compiler(fw.interp.get_extern_funcs());
+	compiler.set_error_callback(on_error);
+	fw.bc_program = compiler.compile(fw.program.get());
+
+	if (!save_bc_program(options.save_bytecode_path, fw.bc_program, fw.script_paths))
+		framework_error(fw, "Failed to save bytecode: " + options.save_bytecode_path);
+
+	std::cout << "Saved " << options.save_bytecode_path << std::endl;
+}
+
+void run_framework(const Framework_Options& options) {
 	using namespace std::chrono;
 
 	srand(time(0));
 
-	init(script_path);
+	Framework fw{};
+
+	if (!options.save_bytecode_path.empty()) {
+		save_bytecode(fw, options);
+		return;
+	}
+
+	init(fw, options);
 
 	int prev_ticks = SDL_GetTicks();
 	int frame_count = 0;
+	int prev_reload_check = SDL_GetTicks();
 
 	auto prev_frame_time = high_resolution_clock::now();
 
@@ -399,6 +575,11 @@ void run_framework(const std::string& script_path) {
 			}
 		}
 
+		if (options.hot_reload && SDL_GetTicks() - prev_reload_check >= 250) {
+			reload_changed_scripts(fw);
+			prev_reload_check = SDL_GetTicks();
+		}
+
 		auto now = high_resolution_clock::now();
 		auto nanos_since_last = duration_cast<nanoseconds>(now - prev_frame_time).count();
 		double seconds_since_last = nanos_since_last / 1000000000.0;
@@ -408,13 +589,19 @@ void run_framework(const std::string& script_path) {
 
 			fw.interp.get_global_scope().set_def("delta_time", Value::from_num(seconds_since_last));
 
-			if (fw.update_func.type != Value_Type::Null)
-				fw.interp.call_function(fw.update_func, {});
+			if (options.frame_heap)
+				fw.interp.get_heap().begin_frame();
 
-			if (fw.draw_func.type != Value_Type::Null)
-				fw.interp.call_function(fw.draw_func, {});
+			if (fw.update_func.is_valid())
+				fw.update_func.call();
 
-			gfx.swap_buffers();
+			if (fw.draw_func.is_valid())
+				fw.draw_func.call();
+
+			if (options.frame_heap)
+				fw.interp.get_heap().end_frame();
+
+			fw.gfx.swap_buffers();
 
 			const int FRAMES = 100;
 			if (frame_count++ >= FRAMES) {
@@ -431,5 +618,8 @@ void run_framework(const std::string& script_path) {
 		SDL_Delay(1);
 	}
 
+	if (options.bc_profile)
+		print_bc_profile(fw.bc_profile);
+
 	SDL_Quit();
 }
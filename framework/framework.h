@@ -1,16 +1,21 @@
 #pragma once
 
 #include "image.h"
+#include "graphics.h"
 
 #include <enkel/interpreter.h>
 #include <enkel/value.h>
+#include <enkel/log_sink.h>
+#include <enkel/bc_vm.h>
 
 #define GL_GLEXT_PROTOTYPES
 #include <SDL2/SDL.h>
 #include <string>
 #include <stdint.h>
 #include <vector>
+#include <memory>
 #include <unordered_map>
+#include <filesystem>
 
 struct Framework {
 	SDL_Window* window;
@@ -22,21 +27,41 @@ struct Framework {
 	std::string title = "enkel framework";
 	bool running = true;
 
+	Graphics gfx;
+	std::unique_ptr<AST_Node> program; // must outlive interp, which points into it
+	std::vector<std::unique_ptr<AST_Node>> reloaded_programs; // same, for every hot reload
+	std::unique_ptr<Log_Sink> log; // must outlive interp too
 	Interpreter interp;
-	Value init_func;
-	Value update_func;
-	Value draw_func;
+	BC_Program bc_program; // with --bytecode or --load-bytecode, must outlive vm
+	std::unique_ptr<BC_VM> vm;
+	BC_Profile bc_profile;
+	Func_Handle init_func;
+	Func_Handle update_func;
+	Func_Handle draw_func;
 
 	std::vector<Image> images;
 	std::unordered_map<int32_t, bool> keyboard_state;
 	std::vector<std::string> script_paths;
+	std::vector<std::filesystem::file_time_type> script_times; // only kept with hot reload
+	std::vector<std::filesystem::file_time_type> failed_script_times; // of reloads that didn't parse
 	bool mouse_left = false;
 	bool mouse_right = false;
 	bool mouse_middle = false;
 };
 
-extern Framework fw;
+struct Framework_Options {
+	std::string script_path;
+	std::string save_snapshot_path; // write an image once the scripts' top level has run
+	std::string load_snapshot_path; // start from an image instead of the scripts
+	bool hot_reload = false; // re-load scripts when they change on disk
+	std::string log_path; // print() and log() output, stdout if empty
+	bool bytecode = false; // compile the scripts and run them on BC_VM instead of the interpreter
+	bool bc_profile = false; // with bytecode, print the most common opcode sequences on exit
+	std::string save_bytecode_path; // compile the scripts to this file and exit, see bc_file.h
+	std::string load_bytecode_path; // run compiled scripts instead of the scripts, see bc_file.h
+	bool frame_heap = true; // free what update() and draw() allocate at the end of each frame, see GC_Heap::begin_frame
+};
 
-void run_framework(const std::string& script_path);
-void framework_error(const std::string& msg = "", const Source_Info* info = nullptr);
-bool is_key_down(SDL_Keycode keycode);
+void run_framework(const Framework_Options& options);
+void framework_error(const Framework& fw, const std::string& msg = "", const Source_Info* info = nullptr);
+bool is_key_down(const Framework& fw, SDL_Keycode keycode);
@@ -2,19 +2,21 @@
 
 #include "image.h"
 
+#include <SDL2/SDL.h>
 #include <stdint.h>
 
 class Graphics {
 public:
 	Graphics() {}
 
-	void init();
+	void init(SDL_Renderer* _renderer);
 	void set_color(uint32_t color);
 	void clear() const;
 	void swap_buffers();
 	void fill_rect(float x, float y, float w, float h);
 	void draw_img(const Image& img, float x, float y, float w, float h);
 private:
+	SDL_Renderer* renderer = nullptr;
 	uint32_t color = 0;
 };
 
@@ -3,10 +3,10 @@
 
 #include <SDL2/SDL_image.h>
 
-Image::Image(const std::string& path) {
+Image::Image(const Framework& fw, const std::string& path) {
 	SDL_Surface* surf = IMG_Load(path.c_str());
 	if (surf == NULL) {
-		framework_error("failed to load image: " + path);
+		framework_error(fw, "failed to load image: " + path);
 	}
 
 	width = surf->w;
@@ -14,7 +14,7 @@ Image::Image(const std::string& path) {
 
 	tex = SDL_CreateTextureFromSurface(fw.renderer, surf);
 	if (tex == NULL) {
-		framework_error("failed to convert surface to texture: " + path);
+		framework_error(fw, "failed to convert surface to texture: " + path);
 	}
 
 	SDL_FreeSurface(surf);
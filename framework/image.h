@@ -3,10 +3,12 @@
 #include <SDL2/SDL.h>
 #include <string>
 
+struct Framework;
+
 class Image {
 public:
 	Image() {}
-	Image(const std::string& path);
+	Image(const Framework& fw, const std::string& path);
 
 	SDL_Texture* get_texture() const { return tex; }
 	const int get_width() const { return width; }
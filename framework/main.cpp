@@ -11,19 +11,6 @@
 #include <iostream>
 
 void testo() {
-	// TODO: lookup extern funcs using string/string_id
-	// so it wont break if extern_funcs order changes
-	// we could even do a link stage before runtime
-
-	// TODO: store runtime data in struct common to both Interpreter and BC_VM
-	// things like heap data, strings, etc..
-	// and pass that to extern funcs instead
-	std::vector<Extern_Func> extern_funcs;
-	extern_funcs.push_back({"print", 1, [](const std::vector<Value>& args, void* data_ptr) -> Value {
-		std::cout << "[BC] print():  " << args[0].as.num << "\n";
-		return {};
-	}});
-
 	//auto tokens = Lexer::lex("var x = 5; while (x <= 69) { x += 1; } ");
 	auto tokens = Lexer::lex("func test(x, y) { return x - y; } if (1 < 100) print(test(2, 1));");
 	Parser parser(tokens);
@@ -31,7 +18,8 @@ void testo() {
 
 	print_ast(ast.get());
 
-	BC_Compiler compiler(extern_funcs);
+	Interpreter interp;
+	BC_Compiler compiler(interp.get_extern_funcs());
 	auto program = compiler.compile(ast.get());
 
 	std::cout << std::endl;
@@ -40,35 +28,79 @@ void testo() {
 
 	std::cout << std::endl;
 
-	//BC_Program program;
-	//program.code = {
-	//	BC_CALL_U8, 0,
-	//	BC_EXIT,
-
-	//	BC_ALLOC_FRAME_U8, 3,
-	//	BC_PUSH_U8, 5,
-	//	BC_PUSH_U8, 8,
-	//	BC_ADD,
-	//	BC_RET,
-	//};
-	//program.func_table = {
-	//	{3},
-	//};
-
-	BC_VM vm;
-	vm.run(&program, extern_funcs);
+	BC_VM vm(interp);
+	vm.run(&program);
 
 	exit(0);
 }
 
+static void usage_error() {
+	SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Error",
+		"Usage: framework <script> [--save-snapshot <file>] [--hot-reload] [--no-frame-heap] [--log-file <file>]\n"
+		"       framework <script> --bytecode [--bc-profile] [--no-frame-heap] [--log-file <file>]\n"
+		"       framework <script> --save-bytecode <file>\n"
+		"       framework --load-snapshot <file> [--hot-reload] [--no-frame-heap] [--log-file <file>]\n"
+		"       framework --load-bytecode <file> [--bc-profile] [--no-frame-heap] [--log-file <file>]", NULL);
+	exit(1);
+}
+
 int main(int argc, char* argv[]) {
-	testo();
-	
-	if (argc <= 1) {
-		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Error", "Please call this executable with a path to the starting script", NULL);
-		return 1;
+	Framework_Options options;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+
+		if (arg == "--bc-test") {
+			testo();
+		} else if (arg == "--bytecode") {
+			options.bytecode = true;
+		} else if (arg == "--bc-profile") {
+			options.bc_profile = true;
+		} else if (arg == "--hot-reload") {
+			options.hot_reload = true;
+		} else if (arg == "--no-frame-heap") {
+			options.frame_heap = false;
+		} else if (arg == "--save-snapshot" || arg == "--load-snapshot" || arg == "--log-file" ||
+			arg == "--save-bytecode" || arg == "--load-bytecode") {
+			if (i + 1 >= argc)
+				usage_error();
+
+			if (arg == "--save-snapshot")
+				options.save_snapshot_path = argv[++i];
+			else if (arg == "--load-snapshot")
+				options.load_snapshot_path = argv[++i];
+			else if (arg == "--save-bytecode")
+				options.save_bytecode_path = argv[++i];
+			else if (arg == "--load-bytecode")
+				options.load_bytecode_path = argv[++i];
+			else
+				options.log_path = argv[++i];
+		} else if (options.script_path.empty() && arg[0] != '-') {
+			options.script_path = arg;
+		} else {
+			usage_error();
+		}
 	}
 
-	run_framework(argv[1]);
+	// one of a script, a snapshot or compiled scripts
+	int num_inputs = !options.script_path.empty() + !options.load_snapshot_path.empty() + !options.load_bytecode_path.empty();
+	if (num_inputs != 1)
+		usage_error();
+	// compiling doesn't run anything
+	if (!options.save_bytecode_path.empty() && (options.script_path.empty() || options.hot_reload ||
+		options.bc_profile || !options.save_snapshot_path.empty() || !options.log_path.empty()))
+		usage_error();
+	if (!options.save_bytecode_path.empty())
+		options.bytecode = true;
+	if (!options.load_bytecode_path.empty())
+		options.bytecode = true;
+
+	// the VM runs the scripts' own functions, there's no AST to reload or save
+	if (options.bytecode && (options.hot_reload || !options.save_snapshot_path.empty() || !options.load_snapshot_path.empty()))
+		usage_error();
+	if (options.bc_profile && !options.bytecode)
+		usage_error();
+
+	run_framework(options);
 	return 0;
 }
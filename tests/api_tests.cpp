@@ -0,0 +1,323 @@
+#include <enkel/lexer.h>
+#include <enkel/parser.h>
+#include <enkel/interpreter.h>
+#include <enkel/bc_compiler.h>
+#include <enkel/bc_vm.h>
+#include <enkel/log_sink.h>
+
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <filesystem>
+#include <algorithm>
+#include <stdio.h>
+
+// tests for the parts of the library that only a host reaches, scripts are in run_tests.sh
+
+static int num_failed = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::cout << "FAIL: " << __func__ << ": " #cond " (line " << __LINE__ << ")\n"; \
+			num_failed++; \
+		} \
+	} while (0)
+
+static void on_error(const std::string& msg, const Source_Info* info) {
+	std::cout << "ERROR: " << msg << " line " << (info != nullptr ? info->line : -1) << std::endl;
+	exit(1);
+}
+
+static std::unique_ptr<AST_Node> parse(const char* source) {
+	auto tokens = Lexer::lex(source);
+	Parser parser(tokens);
+	parser.set_error_callback(on_error);
+	return parser.parse();
+}
+
+// runs a program on the interpreter or on BC_VM, for tests that cover both
+struct Engine {
+	Engine(bool _bytecode) : bytecode(_bytecode) {
+		interp.set_error_callback(on_error);
+	}
+
+	void run(AST_Node* ast) {
+		if (!bytecode) {
+			interp.eval(ast);
+			return;
+		}
+
+		if (vm == nullptr) {
+			BC_Compiler compiler(interp.get_extern_funcs());
+			compiler.set_error_callback(on_error);
+			program = compiler.compile(ast);
+			vm = std::make_unique<BC_VM>(interp);
+		}
+		vm->run(&program);
+	}
+
+	// a global's field, as text
+	std::string get_field(const char* global, const char* field) {
+		Definition* def = interp.get_global_scope().find_def(global);
+		if (def == nullptr || def->value.type != Value_Type::GC_Obj)
+			return "<no " + std::string(global) + ">";
+
+		GC_Obj_Instance* instance = (GC_Obj_Instance*) def->value.as.ptr;
+		Definition* field_def = instance->scope.find_def(field, false);
+		return field_def != nullptr ? interp.get_string(field_def->value) : "<no field>";
+	}
+
+	bool bytecode;
+	Interpreter interp;
+	BC_Program program;
+	std::unique_ptr<BC_VM> vm;
+};
+
+// a second context runs the same program with its own globals and class fields,
+// and destroying it leaves nothing behind in the default context
+static void test_contexts(bool bytecode) {
+	auto ast = parse(
+		"class A { var items = []; func add(v) { items.push(v); } }\n"
+		"var a = new A();\n"
+		"func addstr(x) { a.add(\"str\" + x); }\n");
+
+	Engine engine(bytecode);
+	Interpreter& interp = engine.interp;
+	engine.run(ast.get());
+
+	std::unique_ptr<Context> ctx = interp.create_context();
+	interp.set_context(ctx.get());
+	CHECK(interp.get_context() == ctx.get());
+	engine.run(ast.get());
+
+	Func_Handle addstr = interp.prepare_call("addstr", 1);
+	CHECK(addstr.is_valid());
+	addstr.call({Value::from_num(7)});
+	CHECK(engine.get_field("a", "items") == "[str7]");
+
+	interp.set_context(nullptr);
+	CHECK(engine.get_field("a", "items") == "[]");
+
+	addstr = Func_Handle();
+	ctx.reset();
+
+	interp.get_heap().garbage_collect({&interp.get_global_scope()});
+	CHECK(engine.get_field("a", "items") == "[]");
+	interp.prepare_call("addstr", 1).call({Value::from_num(1)});
+	CHECK(engine.get_field("a", "items") == "[str1]");
+}
+
+// a method called in a batch sees the object it's called on
+static void test_method_batch(bool bytecode) {
+	auto ast = parse(
+		"class A { var k = 10; func f(x) { return x + k; } }\n"
+		"var a = new A();\n");
+
+	Engine engine(bytecode);
+	Interpreter& interp = engine.interp;
+	engine.run(ast.get());
+
+	GC_Obj_Instance* a = (GC_Obj_Instance*) interp.get_global_scope().find_def("a")->value.as.ptr;
+	Definition* f = a->scope.find_def("f");
+	CHECK(f != nullptr);
+
+	Value args[] = {Value::from_num(1), Value::from_num(2), Value::from_num(3)};
+	Value results[3];
+	interp.call_function_batch(f->value, {args}, 3, results, a);
+	CHECK(interp.get_string(results[0]) == "11");
+	CHECK(interp.get_string(results[1]) == "12");
+	CHECK(interp.get_string(results[2]) == "13");
+}
+
+// a host whose error callback returns, like the framework's hot reload, gets
+// nullptr and one error instead of a half parsed program
+static void test_parse_error_recovery() {
+	const char* sources[] = {
+		"var x = ;",
+		"func f(a, { }",
+		"class A { var x = 1; print(x); }",
+		"struct S { var x = 1",
+		"var a = [1, 2",
+		"print(f(1, 2);",
+		"var s = \"{1 +}\";",
+		"var s = \"{x:}\";",
+		"if (true) { var y = new A(1,",
+	};
+
+	for (const char* source : sources) {
+		auto tokens = Lexer::lex(source);
+		Parser parser(tokens);
+		int num_errors = 0;
+		parser.set_error_callback([&](const std::string& msg, const Source_Info* info) {
+			num_errors++;
+		});
+
+		CHECK(parser.parse() == nullptr);
+		CHECK(num_errors == 1);
+	}
+}
+
+static std::string log_path() {
+	return (std::filesystem::temp_directory_path() / "enkel_api_tests.log").string();
+}
+
+// the lines of the log, without the writer's own notes about dropped messages
+static std::vector<std::string> read_log() {
+	std::vector<std::string> lines;
+	std::ifstream in(log_path());
+	std::string line;
+	while (std::getline(in, line)) {
+		if (line.rfind("log: dropped", 0) != 0)
+			lines.push_back(line);
+	}
+	return lines;
+}
+
+// "<thread> <index> " and filler up to a length that varies, some messages take
+// several slots
+static std::string log_message(int thread, int index) {
+	std::string msg = std::to_string(thread) + " " + std::to_string(index) + " ";
+	size_t length = 10 + (thread * 31 + index * 17) % (Log_Sink::SLOT_DATA * 3);
+	msg.append(length, (char) ('a' + thread));
+	return msg;
+}
+
+static bool is_log_message(const std::string& line, int& thread, int& index) {
+	if (sscanf(line.c_str(), "%d %d ", &thread, &index) != 2 || thread < 0 || thread >= 26)
+		return false;
+	return line == log_message(thread, index);
+}
+
+// messages written from several threads at once come out whole and in the order
+// each thread wrote them
+static void test_log_threads() {
+	const int NUM_THREADS = 4, NUM_MESSAGES = 500;
+	{
+		Log_Sink log(log_path(), NUM_THREADS * NUM_MESSAGES * 4);
+		std::vector<std::thread> threads;
+		for (int t = 0; t < NUM_THREADS; t++) {
+			threads.emplace_back([&log, t] {
+				for (int i = 0; i < NUM_MESSAGES; i++)
+					log.write(Log_Level::Info, log_message(t, i));
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+
+		Log_Stats stats = log.get_stats();
+		CHECK(stats.queued == NUM_THREADS * NUM_MESSAGES);
+		CHECK(stats.dropped_full == 0);
+	}
+
+	std::vector<int> next_index(NUM_THREADS, 0);
+	int num_lines = 0;
+	for (const std::string& line : read_log()) {
+		int thread, index;
+		CHECK(is_log_message(line, thread, index) && thread < NUM_THREADS);
+		if (thread < NUM_THREADS) {
+			CHECK(index == next_index[thread]);
+			next_index[thread] = index + 1;
+		}
+		num_lines++;
+	}
+	CHECK(num_lines == NUM_THREADS * NUM_MESSAGES);
+}
+
+// once flush() returns, everything the thread wrote before is in the file, also
+// for messages that wrap around the end of a small ring
+static void test_log_flush() {
+	const int NUM_THREADS = 3, NUM_MESSAGES = 40;
+	Log_Sink log(log_path(), 8);
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < NUM_THREADS; t++) {
+		threads.emplace_back([&log, t] {
+			for (int i = 0; i < NUM_MESSAGES; i++) {
+				std::string msg = log_message(t, i);
+				// the ring has room for a few messages, wait for it to drain
+				while (!log.write(Log_Level::Info, msg))
+					log.flush();
+				log.flush();
+
+				std::vector<std::string> lines = read_log();
+				CHECK(std::find(lines.begin(), lines.end(), msg) != lines.end());
+			}
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+
+	int num_lines = 0;
+	for (const std::string& line : read_log()) {
+		int thread, index;
+		CHECK(is_log_message(line, thread, index));
+		num_lines++;
+	}
+	CHECK(num_lines == NUM_THREADS * NUM_MESSAGES);
+}
+
+// every message is either queued or counted as dropped, and the queued ones are
+// the ones in the file
+static void test_log_stats() {
+	const int NUM_THREADS = 4, NUM_MESSAGES = 2000;
+	uint64_t queued;
+	{
+		Log_Sink log(log_path(), 4);
+		std::vector<std::thread> threads;
+		for (int t = 0; t < NUM_THREADS; t++) {
+			threads.emplace_back([&log, t] {
+				for (int i = 0; i < NUM_MESSAGES; i++)
+					log.write(Log_Level::Info, log_message(t, i));
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+
+		// longer than the whole ring
+		CHECK(!log.write(Log_Level::Info, std::string(Log_Sink::SLOT_DATA * 4, 'x')));
+
+		Log_Stats stats = log.get_stats();
+		CHECK(stats.queued + stats.dropped_full == NUM_THREADS * NUM_MESSAGES + 1);
+		CHECK(stats.dropped_full >= 1);
+		CHECK(stats.dropped_rate_limit == 0);
+		queued = stats.queued;
+	}
+	CHECK(read_log().size() == queued);
+
+	{
+		Log_Sink log(log_path());
+		log.set_rate_limit(10);
+		for (int i = 0; i < 100; i++)
+			log.write(Log_Level::Info, "limited");
+		// errors always get through
+		CHECK(log.write(Log_Level::Error, "error"));
+
+		Log_Stats stats = log.get_stats();
+		CHECK(stats.queued == 11);
+		CHECK(stats.dropped_rate_limit == 90);
+		CHECK(stats.dropped_full == 0);
+	}
+
+	std::filesystem::remove(log_path());
+}
+
+int main() {
+	test_parse_error_recovery();
+	test_log_threads();
+	test_log_flush();
+	test_log_stats();
+
+	for (bool bytecode : {false, true}) {
+		test_contexts(bytecode);
+		test_method_batch(bytecode);
+	}
+
+	if (num_failed > 0) {
+		std::cout << num_failed << " api checks failed\n";
+		return 1;
+	}
+	std::cout << "api tests passed\n";
+	return 0;
+}
@@ -0,0 +1,55 @@
+#!/bin/sh
+# times every script in bench/ on the interpreter and on BC_VM with parts of the
+# compiler turned off, best of RUNS runs in ms. each column adds one thing:
+#
+#   interp     the tree-walking interpreter
+#   stack      BC_VM with only the op stack: no register ops, superinstructions or optimizer
+#   register   + register ops for arithmetic on locals
+#   super      + superinstructions
+#   optimized  + the peephole optimizer, what BC_Compiler does by default
+#
+# with run_script_switch built (make run_script_switch), a second table compares
+# BC_VM's switch and threaded dispatch on the default compiler output
+#
+# RUNS=5 ./bench.sh [scripts...]
+
+cd "$(dirname "$0")"
+
+RUNS=${RUNS:-5}
+
+if [ $# -eq 0 ]; then
+	set -- bench/arr.en bench/fib.en bench/local.en bench/loop.en bench/method.en
+fi
+
+# best time of RUNS runs of the runner in $1 with the rest of the args
+best_ms() {
+	run=$1
+	shift
+	i=0
+	while [ $i -lt "$RUNS" ]; do
+		$run --time "$@" 2>&1 > /dev/null | tail -1
+		i=$((i + 1))
+	done | awk 'NR == 1 || $1 < best { best = $1 } END { printf "%10.1f", best }'
+}
+
+printf "%-12s%10s%10s%10s%10s%10s\n" "" interp stack register super optimized
+for script in "$@"; do
+	printf "%-12s" "$(basename "$script" .en)"
+	best_ms ./run_script "$script"
+	best_ms ./run_script --bytecode --no-optimize --no-register-ops --no-superinstructions "$script"
+	best_ms ./run_script --bytecode --no-optimize --no-superinstructions "$script"
+	best_ms ./run_script --bytecode --no-optimize "$script"
+	best_ms ./run_script --bytecode "$script"
+	echo
+done
+
+[ -x ./run_script_switch ] || exit 0
+
+echo
+printf "%-12s%10s%10s\n" "" switch threaded
+for script in "$@"; do
+	printf "%-12s" "$(basename "$script" .en)"
+	best_ms ./run_script_switch --bytecode "$script"
+	best_ms ./run_script --bytecode "$script"
+	echo
+done
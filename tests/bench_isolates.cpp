@@ -0,0 +1,76 @@
+#include <enkel/lexer.h>
+#include <enkel/parser.h>
+#include <enkel/interpreter.h>
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+// throughput of independent interpreters on 1, 2, 4.. threads and max_threads.
+// every run gets a new Interpreter, all of them share the parsed program
+
+static void on_error(const std::string& msg, const Source_Info* info) {
+	std::cerr << "ERROR: " << msg << " line " << (info != nullptr ? info->line : -1) << std::endl;
+	exit(1);
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::cerr << "Usage: bench_isolates <script> [max_threads] [runs_per_thread]\n";
+		return 2;
+	}
+
+	int max_threads = argc >= 3 ? atoi(argv[2]) : (int) std::thread::hardware_concurrency();
+	int runs_per_thread = argc >= 4 ? atoi(argv[3]) : 20;
+	if (max_threads < 1)
+		max_threads = 1;
+
+	std::ifstream file(argv[1]);
+	if (!file) {
+		std::cerr << "Can't open " << argv[1] << "\n";
+		return 2;
+	}
+	std::stringstream source;
+	source << file.rdbuf();
+
+	auto tokens = Lexer::lex(source.str());
+	Parser parser(tokens);
+	parser.set_error_callback(on_error);
+	auto ast = parser.parse();
+
+	std::vector<int> thread_counts;
+	for (int n = 1; n < max_threads; n *= 2)
+		thread_counts.push_back(n);
+	thread_counts.push_back(max_threads);
+
+	double single_rate = 0;
+	for (int num_threads : thread_counts) {
+		auto start = std::chrono::steady_clock::now();
+
+		std::vector<std::thread> threads;
+		for (int t = 0; t < num_threads; t++) {
+			threads.emplace_back([&]() {
+				for (int i = 0; i < runs_per_thread; i++) {
+					Interpreter interp;
+					interp.set_error_callback(on_error);
+					interp.eval(ast.get());
+				}
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		double rate = num_threads * runs_per_thread / seconds;
+		if (num_threads == 1)
+			single_rate = rate;
+
+		std::cout << num_threads << " threads: " << (int) rate << " scripts/s, "
+			<< std::fixed << std::setprecision(2) << rate / single_rate << "x of 1 thread\n";
+	}
+
+	return 0;
+}
@@ -0,0 +1,227 @@
+#include <enkel/lexer.h>
+#include <enkel/parser.h>
+#include <enkel/interpreter.h>
+#include <enkel/bc_compiler.h>
+#include <enkel/bc_vm.h>
+#include <enkel/bc_file.h>
+#include <enkel/bc_link.h>
+#include <enkel/bc_verifier.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// runs a script on the interpreter or on BC_VM. errors go to stdout so the
+// conformance tests compare them like any other output
+
+struct Options {
+	std::string script_path;
+	bool bytecode = false;
+	bool optimize = true;
+	bool register_ops = true;
+	bool superinstructions = true;
+	std::string save_load_path;
+	std::string load_path; // runs a saved program instead of a script
+	std::string snapshot_path;
+	std::string load_snapshot_path; // calls host_cb on a snapshot instead of running a script
+	bool time = false;
+};
+
+static void usage() {
+	std::cerr << "Usage: run_script [--bytecode] [--no-optimize] [--no-register-ops] [--no-superinstructions]\n";
+	std::cerr << "                  [--save-load <file>] [--snapshot <file>] [--workers <n>] [--time] <script>\n";
+	std::cerr << "       run_script --load <file>\n";
+	std::cerr << "       run_script --load-snapshot <file>\n";
+	exit(2);
+}
+
+static void on_error(const std::string& msg, const Source_Info* info) {
+	std::cout << "ERROR: " << msg << " line " << (info != nullptr ? info->line : -1) << std::endl;
+	exit(1);
+}
+
+static void on_parse_error(const std::string& msg, const Source_Info* info) {
+	std::cout << "PARSE ERROR: " << msg << " line " << (info != nullptr ? info->line : -1) << std::endl;
+	exit(1);
+}
+
+// externs a host would add
+static void add_host_funcs(Interpreter& interp, bool reversed) {
+	Extern_Func a = {"host_a", 0, [](const std::vector<Value>& args, void* data_ptr) -> Value {
+		return Value::from_num(1);
+	}};
+	Extern_Func b = {"host_b", 1, [](const std::vector<Value>& args, void* data_ptr) -> Value {
+		return Value::from_num(args[0].as.num * 2);
+	}};
+
+	interp.add_external_func(reversed ? b : a);
+	interp.add_external_func(reversed ? a : b);
+}
+
+static int num_workers = -1;
+
+static void init_interp(Interpreter& interp, bool reversed_host_funcs) {
+	interp.set_error_callback(on_error);
+	interp.set_num_workers(num_workers);
+	add_host_funcs(interp, reversed_host_funcs);
+}
+
+// calls back into the script after it ran, like the framework does with update()
+static void call_host_cb(Interpreter& interp) {
+	Func_Handle handle = interp.prepare_call("host_cb", 1);
+	if (!handle.is_valid())
+		return;
+
+	for (int i = 0; i < 3; i++)
+		std::cout << interp.get_string(handle.call({Value::from_num(i)})) << "\n";
+}
+
+static void check(bool ok, const char* what, const std::string& error) {
+	if (!ok) {
+		std::cout << what << " FAILED: " << error << std::endl;
+		exit(1);
+	}
+}
+
+// loaded programs are linked against the host funcs in the opposite order, so extern
+// calls have to be bound by name
+static void run_loaded(const std::string& path) {
+	Interpreter interp;
+	init_interp(interp, true);
+
+	BC_Program program;
+	std::string error;
+	check(load_bc_program(path, program), "LOAD", path);
+	check(link_bc_program(program, interp.get_extern_funcs(), error), "LINK", error);
+	check(verify_bc_program(program, interp.get_extern_funcs(), error), "VERIFY", error);
+
+	BC_VM vm(interp);
+	vm.run(&program);
+	call_host_cb(interp);
+}
+
+// restored with the host funcs in the opposite order too, they're bound by name
+static void run_loaded_snapshot(const std::string& path) {
+	std::unique_ptr<AST_Node> program; // outlives interp
+	Interpreter interp;
+	init_interp(interp, true);
+
+	program = interp.load_snapshot(path);
+	check(program != nullptr, "LOAD SNAPSHOT", path);
+	call_host_cb(interp);
+}
+
+// runs the script, then host_cb on a fresh interpreter restored from a snapshot
+static void run_snapshot(AST_Node* ast, const std::string& path) {
+	{
+		Interpreter interp;
+		init_interp(interp, false);
+		interp.eval(ast);
+		check(interp.save_snapshot(path, ast), "SAVE SNAPSHOT", path);
+	}
+
+	run_loaded_snapshot(path);
+}
+
+static void run_bytecode(AST_Node* ast, const Options& options) {
+	Interpreter interp;
+	init_interp(interp, false);
+
+	BC_Compiler compiler(interp.get_extern_funcs());
+	compiler.set_error_callback(on_error);
+	compiler.set_optimize(options.optimize);
+	compiler.set_register_ops(options.register_ops);
+	compiler.set_superinstructions(options.superinstructions);
+	BC_Program program = compiler.compile(ast);
+
+	std::string error;
+	check(verify_bc_program(program, interp.get_extern_funcs(), error), "VERIFY", error);
+
+	if (options.save_load_path.empty()) {
+		BC_VM vm(interp);
+		vm.run(&program);
+		call_host_cb(interp);
+		return;
+	}
+
+	check(save_bc_program(options.save_load_path, program), "SAVE", options.save_load_path);
+	run_loaded(options.save_load_path);
+}
+
+int main(int argc, char* argv[]) {
+	Options options;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+
+		if (arg == "--bytecode") {
+			options.bytecode = true;
+		} else if (arg == "--no-optimize") {
+			options.optimize = false;
+		} else if (arg == "--no-register-ops") {
+			options.register_ops = false;
+		} else if (arg == "--no-superinstructions") {
+			options.superinstructions = false;
+		} else if (arg == "--save-load" && i + 1 < argc) {
+			options.save_load_path = argv[++i];
+		} else if (arg == "--load" && i + 1 < argc) {
+			options.load_path = argv[++i];
+		} else if (arg == "--snapshot" && i + 1 < argc) {
+			options.snapshot_path = argv[++i];
+		} else if (arg == "--load-snapshot" && i + 1 < argc) {
+			options.load_snapshot_path = argv[++i];
+		} else if (arg == "--workers" && i + 1 < argc) {
+			num_workers = atoi(argv[++i]);
+		} else if (arg == "--time") {
+			options.time = true;
+		} else if (arg[0] != '-' && options.script_path.empty()) {
+			options.script_path = arg;
+		} else {
+			usage();
+		}
+	}
+
+	if (!options.load_path.empty()) {
+		run_loaded(options.load_path);
+		return 0;
+	}
+	if (!options.load_snapshot_path.empty()) {
+		run_loaded_snapshot(options.load_snapshot_path);
+		return 0;
+	}
+	if (options.script_path.empty())
+		usage();
+
+	std::ifstream file(options.script_path);
+	if (!file) {
+		std::cerr << "Can't open " << options.script_path << "\n";
+		return 2;
+	}
+	std::stringstream source;
+	source << file.rdbuf();
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	auto tokens = Lexer::lex(source.str());
+	Parser parser(tokens);
+	parser.set_error_callback(on_parse_error);
+	auto ast = parser.parse();
+
+	if (options.bytecode || !options.save_load_path.empty()) {
+		run_bytecode(ast.get(), options);
+	} else if (!options.snapshot_path.empty()) {
+		run_snapshot(ast.get(), options.snapshot_path);
+	} else {
+		Interpreter interp;
+		init_interp(interp, false);
+		interp.eval(ast.get());
+		call_host_cb(interp);
+	}
+
+	if (options.time) {
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cerr << ms << " ms\n";
+	}
+	return 0;
+}
@@ -0,0 +1,78 @@
+#!/bin/sh
+# runs every script in scripts/ on the interpreter and on BC_VM, with the optimizer,
+# register ops and superinstructions on and off, through save/load and through a
+# snapshot of the interpreter, and compares the output with <name>.out. <name>.bc.out overrides it for the bytecode modes where
+# the two engines knowingly differ (mostly error messages). programs/ holds saved
+# programs with hand-broken code, that the verifier or BC_VM have to reject. they're
+# tied to BC_FILE_VERSION
+#
+# ./run_tests.sh              all scripts
+# RUNNER=./run_script_switch ./run_tests.sh   the same with BC_VM's switch dispatch
+# ./run_tests.sh --update     rewrites the .out files from the interpreter
+
+cd "$(dirname "$0")"
+
+# parallel_for and parallel_map get real threads even on a single core
+RUN="${RUNNER:-./run_script} --workers 3"
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+if [ "$1" = "--update" ]; then
+	for script in scripts/*.en; do
+		$RUN "$script" > "${script%.en}.out"
+	done
+	exit 0
+fi
+
+passed=0
+failed=0
+
+check() {
+	name=$1
+	expected=$2
+	shift 2
+
+	"$@" > "$TMP/out" 2>&1
+	if cmp -s "$expected" "$TMP/out"; then
+		passed=$((passed + 1))
+	else
+		failed=$((failed + 1))
+		echo "FAIL: $name ($*)"
+		diff "$expected" "$TMP/out" | head -10
+	fi
+}
+
+for script in scripts/*.en; do
+	out="${script%.en}.out"
+	bc_out="${script%.en}.bc.out"
+	[ -f "$bc_out" ] || bc_out=$out
+
+	check "$script" "$out" $RUN "$script"
+	# the optimizer, register ops and superinstructions must not change what a program does
+	for flags in "" "--no-optimize" "--no-superinstructions" "--no-optimize --no-superinstructions" \
+		"--no-register-ops" "--no-optimize --no-register-ops --no-superinstructions"; do
+		check "$script" "$bc_out" $RUN --bytecode $flags "$script"
+	done
+	check "$script" "$bc_out" $RUN --save-load "$TMP/program.enb" "$script"
+	check "$script" "$out" $RUN --snapshot "$TMP/image.snap" "$script"
+done
+
+# damaged snapshots are rejected, not half restored
+$RUN --snapshot "$TMP/image.snap" scripts/basics.en > /dev/null
+size=$(wc -c < "$TMP/image.snap")
+for length in 0 8 $((size / 2)) $((size - 1)); do
+	head -c "$length" "$TMP/image.snap" > "$TMP/damaged.snap"
+	echo "LOAD SNAPSHOT FAILED: $TMP/damaged.snap" > "$TMP/expected"
+	check "snapshot cut to $length bytes" "$TMP/expected" $RUN --load-snapshot "$TMP/damaged.snap"
+done
+# the version follows the 4 byte magic
+cp "$TMP/image.snap" "$TMP/damaged.snap"
+printf '\377' | dd of="$TMP/damaged.snap" bs=1 seek=4 conv=notrunc 2> /dev/null
+check "snapshot of another version" "$TMP/expected" $RUN --load-snapshot "$TMP/damaged.snap"
+
+for program in programs/*.enb; do
+	check "$program" "${program%.enb}.out" $RUN --load "$program"
+done
+
+echo "$passed passed, $failed failed"
+[ "$failed" -eq 0 ]